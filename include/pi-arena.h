@@ -0,0 +1,140 @@
+/*
+ * $Id$
+ *
+ * pi-arena.h:  bump allocation of many small blocks freed together
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-arena.h
+ *  @brief Arena allocation interface
+ *
+ * An arena hands out memory from large chunks, and gives all of it back
+ * at once with pi_arena_reset() or pi_arena_free(). It suits unpacking
+ * every record of a database, where each record would otherwise need a
+ * malloc() per string and a free_*() call:
+ *
+ * @code
+ *	pi_arena_t *arena = pi_arena_new(0);
+ *	Address_t addr;
+ *
+ *	for (each record) {
+ *		unpack_Address_arena(&addr, buf, address_v1, arena);
+ *		// ... use addr, don't call free_Address() ...
+ *	}
+ *	pi_arena_reset(arena);	// all the records are gone
+ *	// ...
+ *	pi_arena_free(arena);
+ * @endcode
+ *
+ * Wherever a pi_arena_t pointer is taken, NULL means plain malloc(): the
+ * memory is then freed one block at a time, as usual.
+ */
+
+#ifndef _PILOT_ARENA_H_
+#define _PILOT_ARENA_H_
+
+#include <stddef.h>
+
+#include "pi-args.h"
+#include "pi-buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+	/** @brief Arena, see pi_arena_new() */
+	typedef struct pi_arena pi_arena_t;
+
+	/** @brief Create an arena
+	 *
+	 * Dispose of it with pi_arena_free()
+	 *
+	 * @param chunk_size Bytes to get from malloc() at a time, or 0 for a default
+	 * @return A new arena, or NULL if out of memory
+	 */
+	extern pi_arena_t *pi_arena_new
+		PI_ARGS((size_t chunk_size));
+
+	/** @brief Allocate a block in an arena
+	 *
+	 * The block is aligned for any type, and lasts until the arena is
+	 * reset or freed.
+	 *
+	 * @param arena The arena, or NULL for malloc()
+	 * @param size Number of bytes
+	 * @return The block, or NULL if out of memory
+	 */
+	extern void *pi_arena_alloc
+		PI_ARGS((pi_arena_t *arena, size_t size));
+
+	/** @brief Copy a block of memory into an arena
+	 *
+	 * @param arena The arena, or NULL for malloc()
+	 * @param data Bytes to copy
+	 * @param size Number of bytes
+	 * @return The copy, or NULL if out of memory
+	 */
+	extern void *pi_arena_memdup
+		PI_ARGS((pi_arena_t *arena, const void *data, size_t size));
+
+	/** @brief Copy a string into an arena
+	 *
+	 * Copies up to the null or @a maxlen bytes, whichever comes first,
+	 * and null-terminates the copy.
+	 *
+	 * @param arena The arena, or NULL for malloc()
+	 * @param s String to copy
+	 * @param maxlen Most bytes to read from @a s
+	 * @return The copy, or NULL if out of memory
+	 */
+	extern char *pi_arena_strndup
+		PI_ARGS((pi_arena_t *arena, const char *s, size_t maxlen));
+
+	/** @brief Copy a string out of a packed record, and step over it
+	 *
+	 * Doesn't read past the end of the record: a string it cuts short
+	 * is still null-terminated.
+	 *
+	 * @param arena The arena, or NULL for malloc()
+	 * @param buf The record
+	 * @param p Where the string starts in @a buf; on return, past its
+	 *	null
+	 * @return The copy, or NULL if out of memory
+	 */
+	extern char *pi_arena_unpack_string
+		PI_ARGS((pi_arena_t *arena, const pi_buffer_t *buf,
+			unsigned char **p));
+
+	/** @brief Give back everything allocated in an arena
+	 *
+	 * The chunks are kept for the next allocations.
+	 *
+	 * @param arena The arena, may be NULL
+	 */
+	extern void pi_arena_reset
+		PI_ARGS((pi_arena_t *arena));
+
+	/** @brief Dispose of an arena and everything allocated in it
+	 *
+	 * @param arena The arena, may be NULL
+	 */
+	extern void pi_arena_free
+		PI_ARGS((pi_arena_t *arena));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
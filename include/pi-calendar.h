@@ -29,6 +29,7 @@
 #include <stdint.h>
 
 #include <pi-appinfo.h>
+#include <pi-arena.h>
 #include <pi-buffer.h>
 #include "pi-location.h"
 #include "pi-blob.h"
@@ -113,6 +114,12 @@ extern "C" {
 	  PI_ARGS((CalendarEvent_t *event));
 	extern int unpack_CalendarEvent
 	    PI_ARGS((CalendarEvent_t *event, const pi_buffer_t *record, calendarType type));
+	/* Like unpack_CalendarEvent(), but the strings, exceptions, blobs
+	   and timezone are allocated in the arena, and freed with it
+	   instead of with free_CalendarEvent() */
+	extern int unpack_CalendarEvent_arena
+	    PI_ARGS((CalendarEvent_t *event, const pi_buffer_t *record,
+		     calendarType type, pi_arena_t *arena));
 	extern int pack_CalendarEvent
 	    PI_ARGS((const CalendarEvent_t *event, pi_buffer_t *record, calendarType type));
 	extern int unpack_CalendarAppInfo
@@ -45,6 +45,7 @@
 
 #include <pi-args.h>
 #include <pi-appinfo.h>
+#include <pi-arena.h>
 #include <pi-buffer.h>
 #include <pi-blob.h>
 #include <time.h>
@@ -167,6 +168,10 @@ extern void free_Contact
     PI_ARGS((struct Contact *));
 extern int unpack_Contact
     PI_ARGS((struct Contact *, pi_buffer_t *, contactsType));
+/* Like unpack_Contact(), but the strings and blobs are allocated in the
+   arena, and freed with it instead of with free_Contact() */
+extern int unpack_Contact_arena
+    PI_ARGS((struct Contact *, pi_buffer_t *, contactsType, pi_arena_t *));
 extern int pack_Contact
     PI_ARGS((struct Contact *, pi_buffer_t *, contactsType));
 extern int unpack_ContactAppInfo
@@ -23,6 +23,7 @@
 
 #include <time.h>
 #include "pi-appinfo.h"
+#include "pi-arena.h"
 #include "pi-buffer.h"
 
 #ifdef __cplusplus
@@ -98,6 +99,12 @@ extern "C" {
 	  PI_ARGS((struct Appointment *));
 	extern int unpack_Appointment
 	    PI_ARGS((struct Appointment *, const pi_buffer_t *record, datebookType type));
+	/* Like unpack_Appointment(), but the strings and exceptions are
+	   allocated in the arena, and freed with it instead of with
+	   free_Appointment() */
+	extern int unpack_Appointment_arena
+	    PI_ARGS((struct Appointment *, const pi_buffer_t *record,
+		     datebookType type, pi_arena_t *arena));
 	extern int pack_Appointment
 	    PI_ARGS((const struct Appointment *, pi_buffer_t *record, datebookType type));
 	extern int unpack_AppointmentAppInfo
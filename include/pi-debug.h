@@ -25,6 +25,8 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
+
 #include "pi-args.h"
 
 #define PI_DBG_NONE 0x000
@@ -54,6 +56,11 @@ extern void pi_debug_set_level  PI_ARGS((int level));
 
 extern void pi_debug_set_file PI_ARGS((const char *path));
 
+/* Send the log messages issued by the calling thread to `file'
+   instead of the log file (NULL reverts to the log file). Used to
+   keep one log per session when serving several devices at once. */
+extern void pi_debug_set_thread_file PI_ARGS((FILE *file));
+
 extern void pi_log PI_ARGS((int type, int level, PI_CONST char *format, ...));
 
 extern void pi_dumpline
@@ -628,13 +628,30 @@ enum palmOSErrors {
 
 #ifndef SWIG	/* no need to clutter the bindings with this */
 
-/** @brief Internal DLP argument structure */
+/** @brief Internal DLP argument structure
+ *
+ * Request arguments own their data. Response arguments are views into the
+ * receive buffer of the response they belong to: @a data points inside
+ * the buffer and must not be freed nor used after dlp_response_free().
+ */
 struct dlpArg {
 	int 	id_;		/**< Argument ID (start at #PI_DLP_ARG_FIRST_ID) */
 	size_t	len;		/**< Argument length */
 	char *data;			/**< Argument data */
 };
 
+/** @brief Internal reference-counted DLP receive buffer
+ *
+ * Each socket keeps one of these around so that reading a response does
+ * not allocate anything once the buffer has grown to the usual packet
+ * size. Every response decoded from the buffer holds a reference on it.
+ */
+struct dlpRxBuffer {
+	int refcount;				/**< Number of references (socket + live responses) */
+	pi_buffer_t *buf;			/**< Raw response packet */
+	struct dlpResponse *spare;	/**< Released response kept for reuse, or NULL */
+};
+
 /** @brief Internal DLP command request structure */
 struct dlpRequest {
 	enum dlpFunctions cmd;	/**< Command ID */
@@ -648,6 +665,9 @@ struct dlpResponse {
 	enum dlpErrors err;		/**< DLP error (see #dlpErrors enum) */
 	int argc;				/**< Number of response arguments */
 	struct dlpArg **argv;	/**< Response arguments */
+	struct dlpArg *args;	/**< Storage for the response arguments pointed to by @a argv */
+	int args_allocated;		/**< Number of entries allocated in @a args and @a argv */
+	struct dlpRxBuffer *rxbuf;	/**< Receive buffer the arguments point into */
 };
 
 #endif	/* !SWIG */
@@ -673,6 +693,9 @@ struct dlpResponse {
 		int sd));
 	extern void dlp_response_free PI_ARGS((struct dlpResponse *req));
 
+	extern struct dlpRxBuffer *dlp_rxbuf_new PI_ARGS((void));
+	extern void dlp_rxbuf_release PI_ARGS((struct dlpRxBuffer *rxbuf));
+
 	extern int dlp_exec PI_ARGS((int sd, struct dlpRequest *req,
 		struct dlpResponse **res));
 
@@ -1895,6 +1918,210 @@ struct dlpResponse {
 		PI_ARGS((int sd, FileRef fileref, int *size));
 /*@}*/
 
+/** @name Pipelined reads */
+/*@{*/
+	/** @brief Pipelined read engine (opaque, see dlp_PipelineNew()) */
+	typedef struct dlpPipeline dlpPipeline;
+
+	/** @brief Result of a request submitted to a pipeline */
+	struct dlpPipelineCompletion {
+		enum dlpFunctions cmd;	/**< Command that was sent */
+		int result;		/**< Number of data bytes read, or a negative error code (see pi-error.h) */
+		void *context;		/**< Value passed when submitting the request */
+		int index;		/**< Record or resource index */
+		pi_buffer_t *buffer;	/**< Buffer passed when submitting the request, filled with the data */
+		recordid_t recuid;	/**< Record unique ID (record reads) */
+		int attr;		/**< Record attributes (record reads) */
+		int category;		/**< Record category (record reads) */
+		unsigned long type;	/**< Resource type (resource reads) */
+		int resID;		/**< Resource ID (resource reads) */
+		struct DBSizeInfo size;	/**< Database size (database lookups) */
+	};
+
+	/** @brief Create a pipelined read engine for a socket
+	 *
+	 * A pipeline keeps up to @a depth read requests in flight instead of
+	 * waiting for each response before sending the next request. This
+	 * removes one network round trip per record on NetSync connections.
+	 * Responses are matched to requests using the NET transaction ID.
+	 *
+	 * The first request is always sent alone to check that the device
+	 * echoes transaction IDs. If it doesn't, or if the device later
+	 * loses track of queued requests, the pipeline re-sends what was
+	 * in flight and falls back to a depth of 1 for the rest of the
+	 * connection. Connections that don't use NET (serial, PADP) always
+	 * run at depth 1.
+	 *
+	 * While a pipeline has requests in flight, don't issue other DLP
+	 * calls on the socket.
+	 *
+	 * @param sd Socket number
+	 * @param depth Maximum number of requests in flight
+	 * @return A new pipeline, or NULL if out of memory
+	 */
+	extern dlpPipeline *dlp_PipelineNew
+		PI_ARGS((int sd, int depth));
+
+	/** @brief Free a pipeline
+	 *
+	 * Responses to requests still in flight are read and discarded.
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 */
+	extern void dlp_PipelineFree
+		PI_ARGS((dlpPipeline *pipeline));
+
+	/** @brief Return the number of requests a pipeline currently keeps in flight
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @return Effective depth (1 until the device has been checked, or after a fallback)
+	 */
+	extern int dlp_PipelineDepth
+		PI_ARGS((dlpPipeline *pipeline));
+
+	/** @brief Queue a dlp_ReadRecordByIndex() request
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @param dbhandle Open database handle, obtained from dlp_OpenDB()
+	 * @param recindex Record index (zero based)
+	 * @param retbuf If not NULL, a buffer allocated using pi_buffer_new(). Filled with the record contents when the request completes
+	 * @param context Value returned in the completion
+	 * @return A negative value if the request could not be sent (see pi-error.h)
+	 */
+	extern PI_ERR dlp_PipelineReadRecordByIndex
+		PI_ARGS((dlpPipeline *pipeline, int dbhandle, int recindex,
+			pi_buffer_t *retbuf, void *context));
+
+	/** @brief Queue a dlp_ReadResourceByIndex() request
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @param dbhandle Open database handle, obtained from dlp_OpenDB()
+	 * @param resindex Resource index (zero based)
+	 * @param retbuf If not NULL, a buffer allocated using pi_buffer_new(). Filled with the resource contents when the request completes
+	 * @param context Value returned in the completion
+	 * @return A negative value if the request could not be sent (see pi-error.h)
+	 */
+	extern PI_ERR dlp_PipelineReadResourceByIndex
+		PI_ARGS((dlpPipeline *pipeline, int dbhandle, int resindex,
+			pi_buffer_t *retbuf, void *context));
+
+	/** @brief Queue a dlp_VFSFileRead() request
+	 *
+	 * File reads are followed by raw data packets, so a file read is
+	 * never in flight together with other requests. Queueing them still
+	 * lets the caller overlap local processing with the transfer.
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @param fileref File reference obtained from dlp_VFSFileOpen()
+	 * @param retbuf Buffer allocated using pi_buffer_new(). Filled with the data read when the request completes
+	 * @param len Number of bytes to read
+	 * @param context Value returned in the completion
+	 * @return A negative value if the request could not be sent (see pi-error.h)
+	 */
+	extern PI_ERR dlp_PipelineVFSFileRead
+		PI_ARGS((dlpPipeline *pipeline, FileRef fileref,
+			pi_buffer_t *retbuf, size_t len, void *context));
+
+	/** @brief Queue a dlp_FindDBByName() request for the size of a database
+	 *
+	 * Supported on Palm OS 3.0 (DLP 1.2) and later. The size is in the
+	 * @a size member of the completion.
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @param cardno Card number (should be 0)
+	 * @param dbname Database name
+	 * @param context Value returned in the completion
+	 * @return A negative value if the request could not be sent (see pi-error.h)
+	 */
+	extern PI_ERR dlp_PipelineFindDBByName
+		PI_ARGS((dlpPipeline *pipeline, int cardno, PI_CONST char *dbname,
+			void *context));
+
+	/** @brief Wait for the oldest queued request to complete
+	 *
+	 * Completions are returned in submission order. More queued
+	 * requests are sent as slots free up.
+	 *
+	 * @param pipeline Pipeline created with dlp_PipelineNew()
+	 * @param completion On return, the outcome of the request
+	 * @return 1 if @a completion was filled, 0 if no request is pending
+	 */
+	extern int dlp_PipelineComplete
+		PI_ARGS((dlpPipeline *pipeline,
+			struct dlpPipelineCompletion *completion));
+
+	/** @brief Callback invoked by dlp_ReadRecordsBatch() and dlp_ReadResourcesBatch()
+	 *
+	 * @param sd Socket number
+	 * @param entry The record or resource that was read. Its data is in @a entry->buffer
+	 * @param userdata Value passed to the batch function
+	 * @return 0 to continue, a negative value to stop the batch
+	 */
+	typedef int (*dlp_batch_callback)
+		PI_ARGS((int sd, struct dlpPipelineCompletion *entry, void *userdata));
+
+	/** @brief Read a range of records, keeping the next ones in flight
+	 *
+	 * Reads records @a first to @a first + @a count - 1 using a pipeline
+	 * (see dlp_PipelineNew()) of the given depth, and calls @a callback
+	 * for each of them in order. While the callback processes a record,
+	 * the following ones are already on their way.
+	 *
+	 * @param sd Socket number
+	 * @param dbhandle Open database handle, obtained from dlp_OpenDB()
+	 * @param first Index of the first record to read
+	 * @param count Number of records to read
+	 * @param depth Maximum number of requests in flight
+	 * @param buffer Buffer allocated using pi_buffer_new(), receives each record in turn
+	 * @param callback Function called for each record
+	 * @param userdata Passed to @a callback
+	 * @return Number of records read, or a negative error code (the value returned by @a callback if it stopped the batch)
+	 */
+	extern PI_ERR dlp_ReadRecordsBatch
+		PI_ARGS((int sd, int dbhandle, int first, int count, int depth,
+			pi_buffer_t *buffer, dlp_batch_callback callback,
+			void *userdata));
+
+	/** @brief Read a range of resources, keeping the next ones in flight
+	 *
+	 * Same as dlp_ReadRecordsBatch(), for resource databases.
+	 *
+	 * @param sd Socket number
+	 * @param dbhandle Open database handle, obtained from dlp_OpenDB()
+	 * @param first Index of the first resource to read
+	 * @param count Number of resources to read
+	 * @param depth Maximum number of requests in flight
+	 * @param buffer Buffer allocated using pi_buffer_new(), receives each resource in turn
+	 * @param callback Function called for each resource
+	 * @param userdata Passed to @a callback
+	 * @return Number of resources read, or a negative error code (the value returned by @a callback if it stopped the batch)
+	 */
+	extern PI_ERR dlp_ReadResourcesBatch
+		PI_ARGS((int sd, int dbhandle, int first, int count, int depth,
+			pi_buffer_t *buffer, dlp_batch_callback callback,
+			void *userdata));
+
+	/** @brief Read the whole database list
+	 *
+	 * Reads the list with ::dlpDBListMultiple, so that a device with
+	 * hundreds of databases answers in a few round trips, and stops as
+	 * soon as the device says there are no more. If @a sizes is not
+	 * NULL, the size of each database is looked up too, keeping
+	 * several lookups in flight (see dlp_PipelineNew()); devices older
+	 * than Palm OS 3.0 can't tell, and get zeroed sizes.
+	 *
+	 * @param sd Socket number
+	 * @param cardno Card number (should be 0)
+	 * @param flags Flags (see #dlpDBList enum), ::dlpDBListMultiple is implied
+	 * @param dblist Buffer allocated using pi_buffer_new(), filled with one DBInfo structure per database
+	 * @param sizes NULL, or a buffer allocated using pi_buffer_new(), filled with the matching DBSizeInfo structures
+	 * @return Number of databases, or a negative error code
+	 */
+	extern PI_ERR dlp_ReadDBCatalog
+		PI_ARGS((int sd, int cardno, int flags, pi_buffer_t *dblist,
+			pi_buffer_t *sizes));
+/*@}*/
+
 #ifdef __cplusplus
 }
 #endif
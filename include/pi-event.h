@@ -0,0 +1,199 @@
+/*
+ * $Id$
+ *
+ * pi-event.h: Waiting on descriptors and timers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-event.h
+ *  @brief Event loop: many sockets and timers in one thread
+ *
+ * An event loop watches any number of descriptors and calls a handler
+ * when one of them becomes readable or writable. It uses epoll where
+ * available and poll() elsewhere, so descriptor numbers are not limited
+ * by FD_SETSIZE. Timeouts are timers kept in a timer wheel: adding,
+ * cancelling and expiring a timer take constant time, however many
+ * sessions the loop is watching.
+ *
+ * Socket descriptors returned by pi_socket() and pi_accept() can be
+ * watched directly. Serial and USB devices read ahead: bytes they
+ * already took from the descriptor don't make it readable again, so
+ * handlers should read whole packets (pi_read(), DLP calls) rather
+ * than single bytes.
+ *
+ * A loop is not thread-safe: add, remove and run it from one thread.
+ *
+ * pi_event_wait() waits on a single descriptor without a loop; the
+ * devices of libpisock use it for their own timeouts.
+ */
+
+#ifndef _PILOT_EVENT_H_
+#define _PILOT_EVENT_H_
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @name Events
+ *  PI_EVENT_ERROR is reported whether it was asked for or not.
+ */
+/*@{*/
+#define PI_EVENT_READ	0x01	/**< Data can be read, or end of file */
+#define PI_EVENT_WRITE	0x02	/**< Data can be written */
+#define PI_EVENT_ERROR	0x04	/**< Error or hang-up on the descriptor */
+/*@}*/
+
+typedef struct pi_event_loop pi_event_loop_t;
+typedef struct pi_event_timer pi_event_timer_t;
+
+/** @brief Called when a watched descriptor is ready
+ *
+ * @param loop Event loop
+ * @param fd Descriptor
+ * @param events PI_EVENT_* flags that are ready
+ * @param userdata Value given to pi_event_add()
+ */
+typedef void (*pi_event_handler)
+    PI_ARGS((pi_event_loop_t *loop, int fd, int events, void *userdata));
+
+/** @brief Called when a timer expires
+ *
+ * The timer is freed once the handler returns; the handler may add new
+ * timers, but must not cancel the one it was called for.
+ *
+ * @param loop Event loop
+ * @param timer Timer that expired
+ * @param userdata Value given to pi_event_timer_add()
+ */
+typedef void (*pi_event_timer_handler)
+    PI_ARGS((pi_event_loop_t *loop, pi_event_timer_t *timer,
+	void *userdata));
+
+/** @brief Wait until one descriptor is ready
+ *
+ * @param fd Descriptor
+ * @param events PI_EVENT_READ and/or PI_EVENT_WRITE
+ * @param timeout Timeout in milliseconds, 0 waits forever
+ * @return Events ready (on error or hang-up, PI_EVENT_ERROR together
+ *	   with @a events, so that the next read or write reports it), 0
+ *	   on timeout, -1 (errno set) if the wait failed or was interrupted
+ */
+extern int pi_event_wait PI_ARGS((int fd, int events, int timeout));
+
+/** @brief Create an event loop
+ *
+ * @return The new loop, or NULL (errno set) on failure
+ */
+extern pi_event_loop_t *pi_event_loop_new PI_ARGS((void));
+
+/** @brief Free an event loop and its pending timers
+ *
+ * The descriptors it was watching are left open.
+ *
+ * @param loop Event loop
+ */
+extern void pi_event_loop_free PI_ARGS((pi_event_loop_t *loop));
+
+/** @brief Watch a descriptor
+ *
+ * @param loop Event loop
+ * @param fd Descriptor, not already watched by @a loop
+ * @param events PI_EVENT_READ and/or PI_EVENT_WRITE
+ * @param handler Function called when the descriptor is ready
+ * @param userdata Passed to @a handler
+ * @return 0 on success, negative error code on failure
+ */
+extern int pi_event_add
+    PI_ARGS((pi_event_loop_t *loop, int fd, int events,
+	pi_event_handler handler, void *userdata));
+
+/** @brief Change the events a watched descriptor is waited for
+ *
+ * @param loop Event loop
+ * @param fd Watched descriptor
+ * @param events PI_EVENT_READ and/or PI_EVENT_WRITE
+ * @return 0 on success, negative error code on failure
+ */
+extern int pi_event_modify
+    PI_ARGS((pi_event_loop_t *loop, int fd, int events));
+
+/** @brief Stop watching a descriptor
+ *
+ * Must be called before the descriptor is closed. Can be called from
+ * any handler.
+ *
+ * @param loop Event loop
+ * @param fd Watched descriptor
+ * @return 0 on success, negative error code if @a fd is not watched
+ */
+extern int pi_event_remove PI_ARGS((pi_event_loop_t *loop, int fd));
+
+/** @brief Start a one-shot timer
+ *
+ * Timers have a resolution of PI_EVENT_TICK milliseconds.
+ *
+ * @param loop Event loop
+ * @param timeout Milliseconds until the timer expires
+ * @param handler Function called when it does
+ * @param userdata Passed to @a handler
+ * @return The timer, or NULL (errno set) on failure
+ */
+extern pi_event_timer_t *pi_event_timer_add
+    PI_ARGS((pi_event_loop_t *loop, int timeout,
+	pi_event_timer_handler handler, void *userdata));
+
+/** @brief Cancel and free a timer that has not expired yet
+ *
+ * @param loop Event loop
+ * @param timer Timer
+ */
+extern void pi_event_timer_cancel
+    PI_ARGS((pi_event_loop_t *loop, pi_event_timer_t *timer));
+
+/** @brief Wait for events once and call their handlers
+ *
+ * @param loop Event loop
+ * @param timeout Longest wait in milliseconds: 0 waits until a
+ *		  descriptor is ready or a timer expires, a negative value
+ *		  only handles what is ready already
+ * @return Number of handlers called, or negative error code
+ */
+extern int pi_event_loop_run_once
+    PI_ARGS((pi_event_loop_t *loop, int timeout));
+
+/** @brief Handle events until pi_event_loop_stop() is called, or until
+ *	   nothing is watched and no timer is pending
+ *
+ * @param loop Event loop
+ * @return 0, or negative error code if waiting failed
+ */
+extern int pi_event_loop_run PI_ARGS((pi_event_loop_t *loop));
+
+/** @brief Make pi_event_loop_run() return, typically from a handler
+ *
+ * @param loop Event loop
+ */
+extern void pi_event_loop_stop PI_ARGS((pi_event_loop_t *loop));
+
+/** Resolution of timers, in milliseconds */
+#define PI_EVENT_TICK	10
+
+#ifdef __cplusplus
+}
+#endif
+#endif
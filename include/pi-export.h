@@ -0,0 +1,172 @@
+/*
+ * $Id$
+ *
+ * pi-export.h: Converting database records to files on a worker pool
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-export.h
+ *  @brief Export pool: decode and write pictures in parallel, in order
+ *
+ * The picture tools (pilot-read-palmpix, pilot-read-veo,
+ * pilot-read-screenshot) read the records of one picture at a time, from
+ * a handheld or a pi_file_t, on the thread that owns the connection or
+ * file. They copy them into a pi_export_records_t and queue the picture
+ * on an export pool. Workers decode the picture and encode it to PPM or
+ * PNG while the next one is read. Completion callbacks run on the
+ * queueing thread, in the order the pictures were queued. Messages and
+ * errors therefore come out in the same order as they would with a
+ * single job.
+ *
+ * A pool of one job, or a library built without threads, runs each
+ * picture as soon as it is queued.
+ *
+ * The pool bounds the number of pictures in flight, not memory: a
+ * pi_export_records_t holds a heap copy of every record of the database
+ * it was filled from, even one read from a mapped pi_file_t, until it is
+ * freed. A tool converting a database therefore holds all of it, plus
+ * the decoded pictures in flight.
+ */
+
+#ifndef _PILOT_EXPORT_H_
+#define _PILOT_EXPORT_H_
+
+#include <stddef.h>
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pi_file;
+
+typedef struct pi_export pi_export_t;
+typedef struct pi_export_records pi_export_records_t;
+
+/** @brief Decode and write one picture, on a worker thread
+ *
+ * @param job Value given to pi_export_queue()
+ * @return 0 on success, negative error code on failure
+ */
+typedef int (*pi_export_work) PI_ARGS((void *job));
+
+/** @brief Called on the queueing thread once a picture is written, in
+ *	   queue order; typically reports errors and frees the job
+ *
+ * @param job Value given to pi_export_queue()
+ * @param result Value the work function returned
+ */
+typedef void (*pi_export_done) PI_ARGS((void *job, int result));
+
+/** @brief Create an export pool
+ *
+ * @param jobs Number of pictures converted at the same time
+ * @return The new pool, or NULL (errno set) on failure
+ */
+extern pi_export_t *pi_export_new PI_ARGS((int jobs));
+
+/** @brief Queue a picture
+ *
+ * Runs the completion callbacks of the pictures finished so far. Waits
+ * while twice as many pictures as there are jobs are in flight, so at
+ * most that many pictures are being decoded and encoded at once.
+ *
+ * @param pool Export pool
+ * @param work Work function
+ * @param done Completion callback, or NULL
+ * @param job Passed to both
+ * @return 0 on success, negative error code on failure
+ */
+extern int pi_export_queue
+    PI_ARGS((pi_export_t *pool, pi_export_work work, pi_export_done done,
+	void *job));
+
+/** @brief Wait for every queued picture, run the remaining completion
+ *	   callbacks and free the pool
+ *
+ * @param pool Export pool
+ * @return Number of pictures whose work function failed
+ */
+extern int pi_export_finish PI_ARGS((pi_export_t *pool));
+
+/** @brief Create an empty set of records
+ *
+ * @return The new set, or NULL (errno set) on failure
+ */
+extern pi_export_records_t *pi_export_records_new PI_ARGS((void));
+
+/** @brief Free a set of records and their data
+ *
+ * @param records Set of records
+ */
+extern void pi_export_records_free PI_ARGS((pi_export_records_t *records));
+
+/** @brief Append a copy of a record
+ *
+ * @param records Set of records
+ * @param data Record data
+ * @param size Record size
+ * @return Index of the record, or negative error code
+ */
+extern int pi_export_records_add
+    PI_ARGS((pi_export_records_t *records, const void *data, size_t size));
+
+/** @brief Append a copy of every record of a database file
+ *
+ * The records are copied even if the file is mapped, so the set stays
+ * valid after pi_file_close().
+ *
+ * @param records Set of records
+ * @param pf Record database opened with pi_file_open()
+ * @return Number of records appended, or negative error code
+ */
+extern int pi_export_records_from_file
+    PI_ARGS((pi_export_records_t *records, struct pi_file *pf));
+
+/** @brief Append a copy of every record of a database open on a handheld
+ *
+ * @param records Set of records
+ * @param sd Socket descriptor
+ * @param db Database handle from dlp_OpenDB()
+ * @return Number of records appended, or negative error code
+ */
+extern int pi_export_records_from_dlp
+    PI_ARGS((pi_export_records_t *records, int sd, int db));
+
+/** @brief Number of records in a set
+ *
+ * @param records Set of records
+ * @return Number of records
+ */
+extern int pi_export_records_count PI_ARGS((pi_export_records_t *records));
+
+/** @brief Look up a record
+ *
+ * @param records Set of records
+ * @param index Index of the record
+ * @param data Set to the record data, valid until the set is freed
+ * @param size Set to the record size
+ * @return 0 on success, negative error code if there is no such record
+ */
+extern int pi_export_records_get
+    PI_ARGS((pi_export_records_t *records, int index, void **data,
+	size_t *size));
+
+#ifdef __cplusplus
+}
+#endif
+#endif
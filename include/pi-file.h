@@ -73,14 +73,23 @@ typedef struct pi_file {
 	int	num_entries_allocated;	/**< Number of entries allocated in the entries memory block */
 	int	rbuf_size;		/**< Size of the internal read buffer */
 	FILE 	*f;			/**< Actual on-disk file */
-	pi_buffer_t *tmpbuf;		/**< Temporary buffer for databases opened with pi_file_create() */
+	pi_buffer_t *tmpbuf;		/**< Data of files opened with pi_file_create_buffered(), NULL otherwise */
+	long	data_offset;		/**< For files opened with pi_file_create(), where the record data being written starts */
+	long	data_size;		/**< For files opened with pi_file_create(), bytes of record data written so far */
+	int	reserved_entries;	/**< For files opened with pi_file_create(), entries the header was sized for */
 	char 	*file_name;		/**< Access path */
+	char	*tmp_name;		/**< For files being written, the temporary file in the same directory that pi_file_close() renames to file_name */
 	void 	*app_info;		/**< Pointer to the appInfo block or NULL */
 	void	*sort_info;		/**< Pointer to the sortInfo block or NULL */
 	void	*rbuf;			/**< Read buffer, used internally */
+	void	*map;			/**< Memory mapping of the whole file, or NULL if it is read with stdio */
+	size_t	map_size;		/**< Size of the memory mapping */
 	unsigned long unique_id_seed;	/**< Database file's unique ID seed as read from an existing file */
 	struct 	DBInfo info;		/**< Database information and attributes */
 	struct 	pi_file_entry *entries;	/**< Array of records / resources */
+	int	*index;			/**< Open addressing hash table of entry numbers + 1, by record ID or by resource type and ID; NULL until a lookup needs it */
+	int	index_size;		/**< Slots in the hash table, a power of two */
+	int	index_count;		/**< Entries added to the hash table so far */
 } pi_file_t;
 
 /** @brief Transfer progress callback structure
@@ -135,6 +144,12 @@ enum piProgressType {
 	 * Don't dispose of the returned structure directly.
 	 * Use pi_file_close() instead.
 	 *
+	 * Where the system supports it, the file is mapped in memory rather
+	 * than read: opening it only parses the headers, and the records,
+	 * resources and info blocks you read point into the mapping. Files
+	 * that can't be mapped are read with stdio. Don't truncate a file
+	 * while it is open.
+	 *
 	 * @param name The access path to the database to open on the local machine
 	 * @return An initialized pi_file_t structure or NULL.
 	 */
@@ -143,24 +158,60 @@ enum piProgressType {
 
 	/** @brief Create a new database file
 	 *
-	 * A new database file is created on the local machine.
+	 * A new database file is created on the local machine. Record and
+	 * resource data goes to a temporary file in the same directory as
+	 * it is appended, so memory use doesn't depend on the size of the
+	 * database. pi_file_close() writes the header and entry table and
+	 * renames the temporary file to @a name, so a file already there
+	 * is only replaced once the new one is complete.
 	 *
 	 * @param name Access path of the new file to create
 	 * @param INPUT	Characteristics of the database to create
-	 * @return A new pi_file_t structure. Use pi_file_close() to write data and close file.
+	 * @return A new pi_file_t structure, or NULL if the file can't be created. Use pi_file_close() to write the header and close file.
 	 */
 	extern pi_file_t *pi_file_create
 	    PI_ARGS((const char *name, const struct DBInfo *INPUT));
 
+	/** @brief Create a new database file, keeping its data in memory
+	 *
+	 * Like pi_file_create(), except that nothing touches the disk
+	 * before pi_file_close(), which writes the whole file at once.
+	 * This lets an application retrieve databases in one thread while
+	 * other threads write the ones already retrieved, at the cost of
+	 * holding each database in memory until it is closed. A database
+	 * with more than a megabyte of record data isn't held: from then
+	 * on its data goes to the temporary file as with pi_file_create().
+	 *
+	 * @param name Access path of the new file to create
+	 * @param INPUT	Characteristics of the database to create
+	 * @return A new pi_file_t structure, or NULL. Use pi_file_close() to write the file.
+	 */
+	extern pi_file_t *pi_file_create_buffered
+	    PI_ARGS((const char *name, const struct DBInfo *INPUT));
+
 	/** @brief Closes a local file
 	 *
 	 * If the file had been opened with pi_file_create, all
-	 * modifications are written to disk before the file is closed
+	 * modifications are written to disk before the file is closed.
+	 * If writing failed, or a pi_file_retrieve() into the file did,
+	 * nothing is written and the file at its access path, if any, is
+	 * left alone.
 	 *
 	 * @param pf	The pi_file_t structure is being disposed of by this function
 	 * @return An error code (see file pi-error.h)
 	 */
 	extern int pi_file_close PI_ARGS((pi_file_t *pf));
+
+	/** @brief Closes a file without writing it
+	 *
+	 * For a file opened with pi_file_create() or
+	 * pi_file_create_buffered(), nothing is written and the file at
+	 * its access path, if any, is left alone. Other files are just
+	 * closed.
+	 *
+	 * @param pf	The pi_file_t structure is being disposed of by this function
+	 */
+	extern void pi_file_discard PI_ARGS((pi_file_t *pf));
 /*@}*/
 
 /** @name Reading from open files */
@@ -200,7 +251,8 @@ enum piProgressType {
 	/** @brief Read a resource by index
 	 *
 	 * If it exists, the returned data points directly into the file
-	 * structures. Don't dispose or modify it.
+	 * structures. Don't dispose or modify it. It stays valid until the
+	 * next read, or until pi_file_close() if the file is mapped.
 	 *
 	 * @param pf An open file
 	 * @param resindex The resource index
@@ -253,7 +305,8 @@ enum piProgressType {
 	/** @brief Read a record by index
 	 *
 	 * If it exists, the returned data points directly into the file
-	 * structures. Don't dispose or modify it.
+	 * structures. Don't dispose or modify it. It stays valid until the
+	 * next read, or until pi_file_close() if the file is mapped.
 	 *
 	 * @param pf An open file
 	 * @param recindex Record index
@@ -271,7 +324,8 @@ enum piProgressType {
 	/** @brief Read a record by unique ID
 	 *
 	 * If it exists, the returned data points directly into the file
-	 * structures. Don't dispose or modify it.
+	 * structures. Don't dispose or modify it. It stays valid until the
+	 * next read, or until pi_file_close() if the file is mapped.
 	 *
 	 * @param pf An open file
 	 * @param recuid The record unique ID
@@ -290,6 +344,14 @@ enum piProgressType {
 	extern void pi_file_get_entries
 	    PI_ARGS((pi_file_t *pf, int *entries));
 #endif
+
+	/** @brief Returns how much record data a file holds in memory
+	 *
+	 * @param pf	An open file
+	 * @return Bytes of record data of a file created with pi_file_create_buffered() that is still held in memory, 0 for other files and for one whose data went to its temporary file
+	 */
+	extern size_t pi_file_get_buffered_size
+	    PI_ARGS((const pi_file_t *pf));
 /*@}*/
 
 /** @name Modifying files open for write */
@@ -364,6 +426,9 @@ enum piProgressType {
 	 *
 	 * You must first create the local file using pi_file_create()
 	 *
+	 * If the retrieve fails, pi_file_close() discards @a pf instead of
+	 * writing it.
+	 *
 	 * @param pf A file open for write
 	 * @param socket Socket to the connected handheld
 	 * @param cardno Card number the file resides on (usually 0)
@@ -374,6 +439,35 @@ enum piProgressType {
 	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
 			progress_func report_progress));
 
+	/** @brief Retrieve a file from the handheld, reading only what
+	 *  changed since an earlier copy
+	 *
+	 * The handheld is asked for the unique IDs of the records and for
+	 * the records whose dirty flag is set. Only those, and the records
+	 * @a previous doesn't have, cross the wire; the others are copied
+	 * from @a previous, and the records that are gone from the handheld
+	 * are left out.
+	 *
+	 * The dirty flags only tell what changed if nobody reset them since
+	 * @a previous was retrieved, which is only assumed as long as the
+	 * database's backup date on the handheld is the one @a previous
+	 * has. Otherwise, and for resource databases, databases in ROM and
+	 * devices older than Palm OS 3, this is pi_file_retrieve().
+	 *
+	 * @a pf may be created with the same name as @a previous: the
+	 * records are taken from @a previous before @a pf is closed.
+	 *
+	 * @param pf A file open for write
+	 * @param previous The earlier copy, open with pi_file_open(), or NULL
+	 * @param socket Socket to the connected handheld
+	 * @param cardno Card number the file resides on (usually 0)
+	 * @param report_progress Progress function callback or NULL (see #pi_progress_t structure)
+	 * @return Negative code on error
+	 */
+	extern int pi_file_retrieve_incremental
+	    PI_ARGS((pi_file_t *pf, pi_file_t *previous, int socket,
+			int cardno, progress_func report_progress));
+
 	/** @brief Install a new file on the handheld
 	 *
 	 * You must first open the local file with pi_file_open()
@@ -408,6 +502,42 @@ enum piProgressType {
 	extern int pi_file_merge
 	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
 			progress_func report_progress));
+
+	/** @brief Install a file on the handheld, sending only what changed
+	 *
+	 * If the handheld has a database of that name, type, creator,
+	 * version and flags, it is updated in place. Records (by unique ID)
+	 * and resources (by type and ID) that are not in the file are
+	 * deleted, and those that are new or differ are written. The
+	 * appInfo block is written if it differs. Otherwise, and for files
+	 * with records that have no unique ID, this is pi_file_install().
+	 *
+	 * To compare, the database is read back from the handheld and
+	 * digested. If @a manifest is given, the digests of what was
+	 * installed are saved there, and the next install uses them instead
+	 * as long as it is to the same handheld, by user ID and name, and
+	 * the database's creation date and modification number on the
+	 * handheld are unchanged. Then only the changes cross the wire. A
+	 * handheld that was never synced has no user to tell it by, and
+	 * gets no manifest.
+	 *
+	 * Records added to an existing database end up after the others,
+	 * whatever their position in the file. If the install fails
+	 * while updating a database in place, the database is left as it
+	 * is rather than deleted.
+	 *
+	 * You must first open the local file with pi_file_open()
+	 *
+	 * @param pf An open file
+	 * @param socket Socket to the connected handheld
+	 * @param cardno Card number to install to (usually 0)
+	 * @param manifest Manifest file for this database and handheld, or NULL
+	 * @param report_progress Progress function callback or NULL (see #pi_progress_t structure)
+	 * @return Negative code on error
+	 */
+	extern int pi_file_install_diff
+	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
+			const char *manifest, progress_func report_progress));
 /*@}*/
 
 /** @name Time utilities */
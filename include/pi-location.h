@@ -25,6 +25,7 @@
 #include <stdint.h>
 
 #include <pi-appinfo.h>
+#include <pi-arena.h>
 #include <pi-buffer.h>
 
 #ifdef __cplusplus
@@ -95,6 +96,9 @@ extern "C" {
 	PI_ARGS((Timezone_t *tz, const pi_buffer_t *buf));
 	extern int unpack_Timezone_p
 	PI_ARGS((Timezone_t *tz, const unsigned char *data, const size_t position));
+	extern int unpack_Timezone_arena
+	PI_ARGS((Timezone_t *tz, const unsigned char *data, const size_t position,
+		pi_arena_t *arena));
 	extern int unpack_Location
 	PI_ARGS((Location_t *tz, const pi_buffer_t *buf));
 
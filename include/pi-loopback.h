@@ -0,0 +1,54 @@
+/*
+ * $Id$
+ *
+ * pi-loopback.h: In-memory connections between sockets of one process
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-loopback.h
+ *  @brief Loopback device: connect two sockets of the same process
+ *
+ * Ports named "loop:<name>" never leave the process. A socket bound to
+ * "loop:<name>" listens under that name; sockets of the same process
+ * that connect to "loop:<name>" are accepted by it, and the two ends
+ * then exchange bytes through a pair of in-memory ring buffers. Both
+ * the serial (PADP/CMP) and NetSync stacks run on top of it, so that a
+ * desktop application and a simulated device can talk to each other at
+ * memory speed, for tests and benchmarks.
+ *
+ * Like TCP listeners, a loopback listener accepts any number of
+ * connections through pi_accept_session(). The device needs thread
+ * support: without it, "loop:" ports are not recognized.
+ */
+
+#ifndef _PILOT_LOOPBACK_H_
+#define _PILOT_LOOPBACK_H_
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PI_LOOPBACK_DEV	1
+
+	extern pi_device_t *pi_loopback_device
+	    PI_ARGS((int type));
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -34,6 +34,17 @@ extern "C" {
 	extern void set_float PI_ARGS((void *, double));
 	extern int compareTm PI_ARGS((struct tm * a, struct tm * b));
 
+	/* Dates of the proleptic Gregorian calendar as days since 1970-01-01,
+	   with the month counted from 1 */
+	extern long pi_days_from_civil PI_ARGS((long year, int mon, int mday));
+	extern void pi_civil_from_days
+	    PI_ARGS((long days, long *year, int *mon, int *mday));
+
+	/* Normalize a struct tm and set tm_wday and tm_yday, like mktime()
+	   but without looking at the timezone unless PI_TM_LOCAL is given */
+#define PI_TM_LOCAL	1
+	extern struct tm *pi_normalize_tm PI_ARGS((struct tm * t, int flags));
+
 #ifdef __cplusplus
 }
 #endif
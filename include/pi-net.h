@@ -46,6 +46,8 @@ extern "C" {
 		int split_writes;	/* set to 0 or <> 0 (see net_tx() function) */
 		size_t write_chunksize;	/* set to 0 or a chunk size value (i.e. 4096) (see net_tx() function) */
 		unsigned char txid;
+		unsigned char rx_txid;	/* txid of the last packet received */
+		int pipelining;		/* 0 if the device can't handle pipelined requests (see dlp_PipelineNew()) */
 	} pi_net_data_t;
 
 	extern pi_protocol_t *net_protocol
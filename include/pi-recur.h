@@ -0,0 +1,235 @@
+/*
+ * $Id$
+ *
+ * pi-recur.h: Occurrences of repeating appointments and calendar events
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-recur.h
+ *  @brief Expanding the repeat rules of Datebook and Calendar records
+ *
+ * The repeat rule, end date and exceptions of an appointment or a
+ * calendar event are compiled into a pi_recur_t, which gives the days it
+ * occurs on one after the other, without looking at the days in between.
+ *
+ * A pi_recur_index_t holds the rules of a whole database and finds the
+ * occurrences that fall in a range of time. It only looks at the rules
+ * whose first and last occurrences are around the range, through an
+ * interval tree, so a query costs the logarithm of the number of rules
+ * plus what it finds rather than a scan of the database:
+ *
+ * @code
+ *	pi_recur_index_t *index = pi_recur_index_new();
+ *	pi_recur_t rule;
+ *
+ *	for (each record) {
+ *		unpack_Appointment(&appt, buf, datebook_v1);
+ *		pi_recur_from_appointment(&rule, &appt);
+ *		pi_recur_index_add(index, &rule, record_id);
+ *		free_Appointment(&appt);
+ *	}
+ *	count = pi_recur_index_query(index, from, to, occurrences);
+ * @endcode
+ *
+ * Times are wall clock times, as on the handheld, counted in minutes
+ * since 1970-01-01 00:00 (see pi_recur_minutes()); days are counted from
+ * the same date (see pi_days_from_civil()). No timezone is involved.
+ *
+ * An occurrence is in a range [from, to) if it begins before @a to and
+ * ends after @a from. One that takes no time counts as lasting a minute.
+ * An untimed event takes its whole day.
+ */
+
+#ifndef _PILOT_RECUR_H_
+#define _PILOT_RECUR_H_
+
+#include <limits.h>
+#include <time.h>
+
+#include "pi-args.h"
+#include "pi-buffer.h"
+#include "pi-calendar.h"
+#include "pi-datebook.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Last day of a rule that repeats forever */
+#define PI_RECUR_FOREVER	LONG_MAX
+
+/** @brief A compiled repeat rule
+ *
+ * The fields are set by pi_recur_from_appointment() and
+ * pi_recur_from_calendar(), and shouldn't be changed.
+ */
+typedef struct pi_recur {
+	int	type;		/**< enum repeatTypes, repeatNone if it doesn't repeat */
+	int	frequency;	/**< Every how many days, weeks, months or years */
+	long	first,		/**< Day of the first occurrence, or before it */
+		last;		/**< Last day it may occur, or PI_RECUR_FOREVER */
+	int	start,		/**< Minutes after midnight it begins */
+		duration;	/**< Minutes it lasts */
+	int	weekdays;	/**< repeatWeekly: bit n for day n of the week, 0 being Sunday */
+	long	week0;		/**< repeatWeekly: first day of the first week */
+	int	week,		/**< repeatMonthlyByDay: 0-3 for the 1st-4th, 4 for the last */
+		weekday;	/**< repeatMonthlyByDay: day of the week */
+	int	mday;		/**< repeatMonthlyByDate, repeatYearly: day of the month */
+	long	month0;		/**< Monthly and yearly: year * 12 + month of the first occurrence */
+	int	exceptions;	/**< Number of days it doesn't occur on */
+	long	*exception;	/**< Those days, sorted */
+} pi_recur_t;
+
+/** @brief Going through the occurrences of a rule in a range of time */
+typedef struct pi_recur_iter {
+	const pi_recur_t *rule;
+	long	day,		/* next day to look at */
+		last_day;	/* last day that can be in the range */
+} pi_recur_iter_t;
+
+/** @brief An occurrence found by pi_recur_index_query() */
+typedef struct pi_occurrence {
+	long	begin,		/**< Minutes since 1970-01-01 00:00 */
+		end;
+	int	index;		/**< Which rule: 0 for the first one added, and so on */
+	void	*data;		/**< As given to pi_recur_index_add() */
+} pi_occurrence_t;
+
+typedef struct pi_recur_index pi_recur_index_t;
+
+/** @brief Minutes from 1970-01-01 00:00 to the time in a struct tm
+ *
+ * Seconds are ignored.
+ *
+ * @param t Time
+ * @return Minutes, negative before 1970
+ */
+extern long pi_recur_minutes PI_ARGS((const struct tm *t));
+
+/** @brief The inverse of pi_recur_minutes()
+ *
+ * @param minutes Minutes since 1970-01-01 00:00
+ * @param t Where to store the time, with tm_wday and tm_yday set
+ * @return @a t
+ */
+extern struct tm *pi_recur_tm PI_ARGS((long minutes, struct tm *t));
+
+/** @brief Compile the repeat rule of an appointment
+ *
+ * Dispose of the rule with pi_recur_free().
+ *
+ * @param rule Rule to set up
+ * @param appt Appointment, which isn't referred to afterwards
+ * @return 0, or a negative error code if out of memory
+ */
+extern int pi_recur_from_appointment
+    PI_ARGS((pi_recur_t *rule, const struct Appointment *appt));
+
+/** @brief Compile the repeat rule of a calendar event
+ *
+ * The times are taken as they are, even if the event has a timezone.
+ * Dispose of the rule with pi_recur_free().
+ *
+ * @param rule Rule to set up
+ * @param event Calendar event, which isn't referred to afterwards
+ * @return 0, or a negative error code if out of memory
+ */
+extern int pi_recur_from_calendar
+    PI_ARGS((pi_recur_t *rule, const struct CalendarEvent *event));
+
+/** @brief Dispose of what a compiled rule holds
+ *
+ * @param rule Rule
+ */
+extern void pi_recur_free PI_ARGS((pi_recur_t *rule));
+
+/** @brief Find the first day a rule occurs on, from a given day
+ *
+ * @param rule Rule
+ * @param day Day to look from
+ * @param next Where to store the day of the occurrence
+ * @return 1 if there is one, 0 if the rule doesn't occur on or after @a day
+ */
+extern int pi_recur_next
+    PI_ARGS((const pi_recur_t *rule, long day, long *next));
+
+/** @brief Start going through the occurrences of a rule in [from, to)
+ *
+ * @param iter Iterator
+ * @param rule Rule, which must last as long as the iterator
+ * @param from Start of the range, in minutes
+ * @param to End of the range, in minutes
+ */
+extern void pi_recur_iter_init
+    PI_ARGS((pi_recur_iter_t *iter, const pi_recur_t *rule, long from,
+	     long to));
+
+/** @brief Get the next occurrence in the range
+ *
+ * @param iter Iterator
+ * @param begin Where to store when the occurrence begins, in minutes
+ * @param end Where to store when it ends
+ * @return 1 if there was one, 0 once there are no more
+ */
+extern int pi_recur_iter_next
+    PI_ARGS((pi_recur_iter_t *iter, long *begin, long *end));
+
+/** @brief Create an empty index
+ *
+ * @return The index, or NULL if out of memory
+ */
+extern pi_recur_index_t *pi_recur_index_new PI_ARGS((void));
+
+/** @brief Dispose of an index and the rules in it
+ *
+ * @param index Index, may be NULL
+ */
+extern void pi_recur_index_free PI_ARGS((pi_recur_index_t *index));
+
+/** @brief Add a rule to an index
+ *
+ * The index takes the rule over: don't call pi_recur_free() on it
+ * afterwards, whether this succeeds or not.
+ *
+ * @param index Index
+ * @param rule Rule compiled by pi_recur_from_appointment() or
+ *	pi_recur_from_calendar()
+ * @param data Handed back with each occurrence of the rule
+ * @return The number the rule was given (see pi_occurrence_t), or a
+ *	negative error code if out of memory
+ */
+extern int pi_recur_index_add
+    PI_ARGS((pi_recur_index_t *index, pi_recur_t *rule, void *data));
+
+/** @brief Find the occurrences in a range of time
+ *
+ * @param index Index
+ * @param from Start of the range, in minutes
+ * @param to End of the range, in minutes
+ * @param occurrences Buffer that gets the pi_occurrence_t's, replacing
+ *	its contents, in order of begin time and then of rule
+ * @return The number of occurrences, or a negative error code if out of
+ *	memory
+ */
+extern int pi_recur_index_query
+    PI_ARGS((pi_recur_index_t *index, long from, long to,
+	     pi_buffer_t *occurrences));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* _PILOT_RECUR_H_ */
@@ -30,6 +30,9 @@ extern "C" {
 
 #define PI_SERIAL_DEV     1
 
+/** Size of the read-ahead ring of serial devices */
+#define PI_SERIAL_RING_SIZE	4096
+
 	struct pi_serial_impl {
 		int (*open) PI_ARGS((pi_socket_t *ps,
 			struct pi_sockaddr *addr, size_t addrlen));
@@ -46,8 +49,12 @@ extern "C" {
 	struct pi_serial_data {
 		struct pi_serial_impl impl;
 
-		unsigned char buf[256];
+		/* Read-ahead ring: each read() takes as much as the kernel
+		   has, and the small framing reads of SLP are served from
+		   here. buf_size bytes are waiting, starting at buf_start. */
+		unsigned char buf[PI_SERIAL_RING_SIZE];
 		size_t buf_size;
+		size_t buf_start;
 		
 		/* IO options */		
 #ifndef OS2
@@ -70,6 +77,7 @@ extern "C" {
 		/* Statistics */
 		int rx_bytes;
 		int rx_errors;
+		int rx_syscalls;	/**< select() and read() calls to receive */
 
 		int tx_bytes;
 		int tx_errors;
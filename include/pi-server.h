@@ -0,0 +1,143 @@
+/*
+ * $Id$
+ *
+ * pi-server.h: serving several devices from a single process
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-server.h
+ *  @brief Multi-session server: one listener per port, a pool of workers
+ *
+ * A server owns a listening socket for each port it is given and a
+ * fixed pool of worker threads. Every connection accepted on any of the
+ * ports becomes a session: a worker runs the job function on the
+ * connected socket, then closes it. Sessions on different sockets run
+ * concurrently; ports that can only carry one connection at a time
+ * (serial, USB) are listened to again once their session is over.
+ *
+ * The server installs no signal handler. Each session can log to its
+ * own file (see pi_server_set_log_dir()).
+ *
+ * The server requires thread support: when libpisock was built without
+ * it, pi_server_new() fails.
+ */
+
+#ifndef _PILOT_SERVER_H_
+#define _PILOT_SERVER_H_
+
+#include "pi-args.h"
+#include "pi-socket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pi_server pi_server_t;
+
+/** @brief Job run by a worker for each accepted connection
+ *
+ * @param sd Connected socket. The server closes it once the job returns.
+ * @param session Session number, unique within the server
+ * @param userdata Value passed to pi_server_new()
+ * @return A negative value if the session failed
+ */
+typedef int (*pi_server_job) PI_ARGS((int sd, int session, void *userdata));
+
+/** @brief Create a server
+ *
+ * @param workers Number of sessions that can run at the same time
+ * @param job Function to run for each session
+ * @param userdata Passed to @a job
+ * @return The new server, or NULL (errno set) on failure
+ */
+extern pi_server_t *pi_server_new
+    PI_ARGS((int workers, pi_server_job job, void *userdata));
+
+/** @brief Log each session to its own file
+ *
+ * Debug output of the worker running a session, as well as the start
+ * and end of the session, go to @a dir/session-N.log. Must be called
+ * before adding ports.
+ *
+ * @param server Server
+ * @param dir Existing directory, or NULL to log to the debug log file
+ * @return 0 on success, negative on error
+ */
+extern int pi_server_set_log_dir
+    PI_ARGS((pi_server_t *server, PI_CONST char *dir));
+
+/** @brief Start listening on a port
+ *
+ * Binds a new listening socket to @a port (any port name accepted by
+ * pi_bind()) and starts accepting connections on it.
+ *
+ * @param server Server
+ * @param port Port name
+ * @return 0 on success, negative error code if the port could not be bound
+ */
+extern int pi_server_add_port
+    PI_ARGS((pi_server_t *server, PI_CONST char *port));
+
+/** @brief Get the local address of the port added last
+ *
+ * After adding a port such as "net:any:0", on which the system chooses
+ * the TCP port, this gives the address that was bound, "any:40213" say.
+ *
+ * @param server Server
+ * @param addr Where to store the address (a struct pi_sockaddr)
+ * @param namelen Size of @a addr, set to the size of the address stored
+ * @return 0 on success, negative error code if no port is listening
+ */
+extern int pi_server_getsockname
+    PI_ARGS((pi_server_t *server, struct sockaddr *addr, size_t *namelen));
+
+/** @brief Wait for sessions to finish
+ *
+ * @param server Server
+ * @param sessions Return once this many sessions have finished since the
+ *		   server was created; 0 to wait until pi_server_stop()
+ * @return Number of sessions finished so far
+ */
+extern int pi_server_wait PI_ARGS((pi_server_t *server, int sessions));
+
+/** @brief Session counters
+ *
+ * @param server Server
+ * @param completed Where to store the number of sessions whose job succeeded
+ * @param failed Where to store the number of sessions whose job failed
+ */
+extern void pi_server_stats
+    PI_ARGS((pi_server_t *server, int *completed, int *failed));
+
+/** @brief Stop accepting connections
+ *
+ * Closes the listening sockets and waits for the sessions already
+ * accepted to finish. Can be called from any thread but the workers.
+ *
+ * @param server Server
+ */
+extern void pi_server_stop PI_ARGS((pi_server_t *server));
+
+/** @brief Stop the server if needed, then free it
+ *
+ * @param server Server
+ */
+extern void pi_server_free PI_ARGS((pi_server_t *server));
+
+#ifdef __cplusplus
+}
+#endif
+#endif
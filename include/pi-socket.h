@@ -139,7 +139,10 @@ enum PiOptCMP {
 enum PiOptNet {
 	PI_NET_TYPE,
 	PI_NET_SPLIT_WRITES,		/**< if set, write separately the NET header and data */
-	PI_NET_WRITE_CHUNKSIZE		/**< size of data chunks if PI_NET_SPLIT_WRITES is set. 0 for no chunking of data */
+	PI_NET_WRITE_CHUNKSIZE,		/**< size of data chunks if PI_NET_SPLIT_WRITES is set. 0 for no chunking of data */
+	PI_NET_TXID,			/**< transaction ID used for the next packet sent (int) */
+	PI_NET_RX_TXID,			/**< transaction ID of the last packet received (int, read only) */
+	PI_NET_PIPELINING		/**< set to 0 once the device was found unable to queue several requests (int) */
 };
 
 /** @brief Socket level options (use pi_getsockopt() and pi_setsockopt()) */
@@ -149,6 +152,7 @@ enum PiOptSock {
 };
 
 struct	pi_protocol;			/* forward declaration */
+struct	dlpRxBuffer;			/* forward declaration (see pi-dlp.h) */
 
 /** @brief Definition of a socket */
 typedef struct pi_socket {
@@ -180,6 +184,12 @@ typedef struct pi_socket {
 
 	int last_error;			/**< error code returned by the last dlp_* command */
 	int palmos_error;		/**< Palm OS error code returned by the last transaction with the handheld */
+
+	struct dlpRxBuffer *dlp_rxbuf;	/**< Receive buffer reused across DLP responses (allocated on first use) */
+
+	struct pi_protocol *layers[2][PI_LEVEL_SOCK];	/**< Protocol at each level of the protocol queue ([0]) and of the command queue ([1]), resolved when the queues are built */
+
+	struct pi_watchdog *watchdog;	/**< Keepalive state set up by pi_watchdog(), NULL if the socket isn't watched */
 } pi_socket_t;
 
 /** @brief Internal sockets chained list */
@@ -329,7 +339,8 @@ typedef struct pi_socket_list
 	 * Call this function after creating a new socket with pi_socket()
 	 * to bind the socket to a specific port. Recognized port prefixes
 	 * are: "serial:", "usb:" and "net:". On Unix platforms, you need to
-	 * indicate the /dev entry to bind serial: and usb: to.
+	 * indicate the /dev entry to bind serial: and usb: to. "loop:<name>"
+	 * listens for sockets of the same process (see pi-loopback.h).
 	 *
 	 * @param pi_sd Socket descriptor
 	 * @param port Port string as described above
@@ -370,6 +381,26 @@ typedef struct pi_socket_list
 	    PI_ARGS((int pi_sd, struct sockaddr * remote_addr, size_t *namelen,
 		     int timeout));
 
+	/** @brief Wait for a handheld, keeping the listener open
+	 *
+	 * On ports that can serve several devices at once ("net:" and
+	 * "loop:"), the connection is accepted into a new socket and @a pi_sd
+	 * keeps listening. Other ports can only serve one device: the listening
+	 * socket itself becomes the connection, exactly as with
+	 * pi_accept_to(), and the caller must bind a new listener once the
+	 * session is over. Compare the result to @a pi_sd to know which
+	 * case applies.
+	 *
+	 * @param pi_sd Listening socket descriptor
+	 * @param remote_addr Unused. Pass NULL.
+	 * @param namelen Unused. Pass NULL.
+	 * @param timeout Number of seconds to wait. Pass 0 to wait forever.
+	 * @return Socket descriptor of the connection, or negative error code
+	 */
+	extern PI_ERR pi_accept_session
+	    PI_ARGS((int pi_sd, struct sockaddr * remote_addr, size_t *namelen,
+		     int timeout));
+
 	/** @brief Close a socket
 	 *
 	 * This function closes a socket and disposes of all the internal
@@ -560,14 +591,22 @@ typedef struct pi_socket_list
 	 */
 	extern PI_ERR pi_tickle PI_ARGS((int pi_sd));
 
-	/** @brief Set a watchdog that will call pi_tickle() at regular intervals
+	/** @brief Set a watchdog that will call pi_tickle() when the link is idle
+	 *
+	 * Each watched socket has its own interval. Whenever nothing has
+	 * been sent or received on a connected socket for @a interval
+	 * seconds, pi_tickle() is called to keep the connection alive. A
+	 * socket is never tickled while another thread is sending or
+	 * receiving on it, so the watchdog is safe to use in multi-threaded
+	 * servers. Calling pi_watchdog() again changes the interval.
 	 *
-	 * The watchdog uses the unix SIGALRM to fire an alarm at regular
-	 * intervals. If the socket is still connected when the alarm fires,
-	 * pi_tickle() is called to keep the connection alive.
+	 * With thread support, a single thread of the library watches all
+	 * the sockets. Without it, the watchdog falls back to SIGALRM,
+	 * and the last interval set applies to all the sockets.
 	 *
 	 * @param pi_sd Socket descriptor
-	 * @param interval Time interval in seconds between alarms
+	 * @param interval Idle time in seconds before a tickle, 0 to stop
+	 *		   watching the socket
 	 * @return 0, or #PI_ERR_SOCK_INVALID if the socket wasn't found
 	 */
 	extern int pi_watchdog PI_ARGS((int pi_sd, int interval));
@@ -88,6 +88,12 @@ extern "C" {
 #define PI_FLUSH_INPUT       0x01       /* for flush() 			*/
 #define	PI_FLUSH_OUTPUT      0x02       /* for flush() 			*/
 
+/* Protocol at a level of the queue in use (see pi_socket_t layers); the
+   per-packet code uses it and prot->next instead of pi_protocol() and
+   pi_protocol_next(), which look the socket up first */
+#define PI_SOCK_LAYER(ps, level) \
+	((ps)->layers[(ps)->command ? 1 : 0][(level)])
+
 	typedef struct pi_protocol {
 		int level;
 		struct pi_protocol *(*dup)
@@ -111,9 +117,12 @@ extern "C" {
 				int option_name, const void *option_value,
 					size_t *option_len));
 		void *data;
+		struct pi_protocol *next;	/* layer below, set when the queue is built */
 	} pi_protocol_t;
 
 	typedef struct pi_device {
+		struct pi_device *(*dup)	/* NULL if a listener can't accept several connections */
+			PI_ARGS((struct pi_device *dev));
 		void (*free)
 			PI_ARGS((struct pi_device *dev));
 		struct pi_protocol *(*protocol)
@@ -135,7 +144,7 @@ extern "C" {
 	} pi_device_t;
 	
 	/* internal functions */
-	extern pi_socket_list_t *pi_socket_recognize PI_ARGS((pi_socket_t *));
+	extern int pi_socket_recognize PI_ARGS((pi_socket_t *));
 	extern pi_socket_t *find_pi_socket PI_ARGS((int sd));
 	extern int crc16 PI_ARGS((unsigned char *ptr, int count));
 	extern char *printlong PI_ARGS((unsigned long val));
@@ -0,0 +1,154 @@
+/*
+ * $Id$
+ *
+ * pi-store.h: Deduplicating backup store
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-store.h
+ *  @brief Backup store: databases kept as records addressed by content
+ *
+ * A store is a directory that holds records, resources and appInfo and
+ * sortInfo blocks, each in a file named after the MD5 digest of its
+ * data, under @c objects/. A record that is the same in several backups,
+ * from the same handheld or from others, is only stored once.
+ *
+ * A backed up database is described by a manifest: a small text file
+ * with the database header and, for each record or resource, its
+ * attributes and digest. A snapshot is a directory of manifests; where
+ * manifests live is up to the application (pilot-xfer puts them where
+ * it would otherwise write the .pdb and .prc files). A manifest can be
+ * turned back into a database file at any time.
+ *
+ * Objects are written under a temporary name and renamed into place,
+ * so several processes can back up into the same store at once.
+ * Objects are never removed, even once no manifest refers to them.
+ */
+
+#ifndef _PILOT_STORE_H_
+#define _PILOT_STORE_H_
+
+#include "pi-args.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pi_store pi_store_t;
+
+/** @brief What went into a store since it was opened */
+struct pi_store_stats {
+	unsigned long objects;		/**< Records, resources and blocks stored */
+	unsigned long new_objects;	/**< Those the store didn't have yet */
+	unsigned long bytes;		/**< Bytes of data stored */
+	unsigned long new_bytes;	/**< Bytes actually written */
+};
+
+/** @brief Open a store, creating its directory if needed
+ *
+ * @param dir Store directory
+ * @return The store, or NULL (errno set) on failure
+ */
+extern pi_store_t *pi_store_open PI_ARGS((const char *dir));
+
+/** @brief Close a store
+ *
+ * @param store Store
+ */
+extern void pi_store_close PI_ARGS((pi_store_t *store));
+
+/** @brief Back up a database from the handheld into a store
+ *
+ * Like pi_file_retrieve(), except that the records go into the store
+ * and the database is described by a manifest.
+ *
+ * @param store Store
+ * @param socket Socket to the connected handheld
+ * @param cardno Card number the database resides on (usually 0)
+ * @param info Database to back up, as returned by dlp_ReadDBList(); the
+ *	  manifest keeps this header
+ * @param manifest Manifest file to write
+ * @param report_progress Progress function callback or NULL (see #pi_progress_t structure)
+ * @return Negative code on error, in which case no manifest is written
+ */
+extern int pi_store_retrieve
+    PI_ARGS((pi_store_t *store, int socket, int cardno,
+	const struct DBInfo *info, const char *manifest,
+	progress_func report_progress));
+
+/** @brief Put a database file into a store
+ *
+ * @param store Store
+ * @param pf File open with pi_file_open()
+ * @param manifest Manifest file to write
+ * @return Negative code on error
+ */
+extern int pi_store_add
+    PI_ARGS((pi_store_t *store, pi_file_t *pf, const char *manifest));
+
+/** @brief Write the database a manifest describes to a file
+ *
+ * @param store Store
+ * @param manifest Manifest file
+ * @param path Database file to create
+ * @return Negative code on error
+ */
+extern int pi_store_materialize
+    PI_ARGS((pi_store_t *store, const char *manifest, const char *path));
+
+/** @brief Open the database a manifest describes
+ *
+ * The database is written to an unnamed temporary file, which goes
+ * away when the file is closed.
+ *
+ * @param store Store
+ * @param manifest Manifest file
+ * @return The open file, or NULL on error
+ */
+extern pi_file_t *pi_store_open_file
+    PI_ARGS((pi_store_t *store, const char *manifest));
+
+/** @brief Read the database header a manifest keeps
+ *
+ * Only the manifest is read, not the objects, so this is much cheaper
+ * than pi_store_open_file() when the header and sizes are all that's
+ * needed.
+ *
+ * @param manifest Manifest file
+ * @param info On return, the database header
+ * @param size On return, if not NULL, the number and sizes of the
+ *	  records or resources and of the blocks; totalBytes is the size
+ *	  of the database file pi_store_materialize() would write
+ * @return Negative code on error
+ */
+extern int pi_store_get_info
+    PI_ARGS((const char *manifest, struct DBInfo *info,
+	struct DBSizeInfo *size));
+
+/** @brief Get what went into a store since it was opened
+ *
+ * @param store Store
+ * @param stats On return, the counters
+ */
+extern void pi_store_get_stats
+    PI_ARGS((pi_store_t *store, struct pi_store_stats *stats));
+
+#ifdef __cplusplus
+}
+#endif
+#endif
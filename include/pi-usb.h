@@ -36,6 +36,9 @@ extern "C" {
 
 #define PI_USB_DEV     1
 
+/** Size of the read-ahead ring of USB devices */
+#define PI_USB_RING_SIZE	4096
+
 	struct pi_usb_data;
 
 	typedef struct pi_usb_impl {
@@ -72,8 +75,9 @@ extern "C" {
 		struct pi_usb_impl impl;	/**< structure containing ptr to the actual implementations for the current platform */
 		struct pi_usb_dev dev;		/**< device structure */
 
-		unsigned char buf[256];		/**< temp. buffer to hold incoming data when peeking at init time */
-		size_t buf_size;
+		unsigned char buf[PI_USB_RING_SIZE];	/**< read-ahead ring (Linux), or data kept by a peek */
+		size_t buf_size;		/**< bytes waiting in buf */
+		size_t buf_start;		/**< offset of the first of them */
 
 		/* IO options */
 		void *ref;			/**< Used by the platform implementation to keep a ptr to additional private data */
@@ -85,6 +89,10 @@ extern "C" {
 		int establishhighrate;		/**< Boolean: try to establish rate higher than the device publishes */
 
 		int timeout;
+
+		/* Statistics */
+		int rx_bytes;
+		int rx_syscalls;		/**< select() and read() calls to receive */
 	} pi_usb_data_t;
 
 	extern pi_device_t *pi_usb_device PI_ARGS((int type));
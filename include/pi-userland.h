@@ -24,6 +24,7 @@
 
 #include <popt.h>
 #include "pi-appinfo.h"
+#include "pi-file.h"
 
 /*
  * This file defines general stuff for conduits -- common option processing,
@@ -167,6 +168,56 @@ extern int plu_getromversion(int sd, plu_romversion_t *d);
  */
 int plu_protect_files(char *name, const char *extension, const size_t namelength);
 
+/*
+ * Function:    plu_protect_name
+ *
+ * Summary:     Protects filenames and paths which include 'illegal'
+ *              characters, such as '/' and '=' in them.
+ *
+ * Parameters:  d           <-- destination, three times as long as s
+ *              s           --> database name
+ *
+ * Returns:     Nothing
+ */
+extern void plu_protect_name(char *d, const char *s);
+
+
+/***********************************************************************
+ *
+ * Backing up databases, as pilot-xfer and pilot-sync-server do.
+ *
+ ***********************************************************************/
+
+/* Bytes plu_backup_name() needs on top of the directory name */
+#define PLU_BACKUP_NAME_EXTRA	(3 * 32 + 8)
+
+/*
+ * Store in @p name the path of the backup of a database in @p dirname:
+ * the protected database name, with .prc, .pqa or .pdb appended. @p name
+ * must hold strlen(dirname) + PLU_BACKUP_NAME_EXTRA bytes.
+ */
+extern void plu_backup_name(char *name, const char *dirname,
+	const struct DBInfo *info);
+
+/*
+ * Retrieve a database into a buffered file for @p name, clearing the
+ * open and read-only flags of @p info first. With @p incremental, only
+ * the records that changed since the backup already at @p name are read
+ * again. Returns 0 and sets @p pf, to be handed to plu_backup_write(),
+ * or a negative error code: then nothing is written and the earlier
+ * backup, if any, is left as it was.
+ */
+extern int plu_backup_retrieve(int sd, const char *name, struct DBInfo *info,
+	int incremental, pi_file_t **pf);
+
+/*
+ * Write a retrieved database to disk, flush it and give it the dates of
+ * the database. Returns the size of the file, or -1 if it couldn't be
+ * written, in which case the earlier backup is still there as it was.
+ */
+extern long plu_backup_write(pi_file_t *pf, const char *name,
+	const struct DBInfo *info);
+
 /*
  * We need to be able to refer to the table of common options.
  */
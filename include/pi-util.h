@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include "pi-args.h"
+#include "pi-buffer.h"
 
 /* pi_mktag Turn a sequence of characters into a long (er.. 32 bit quantity)
             like those used on the PalmOS device to identify creators and
@@ -79,6 +80,49 @@ extern "C" {
 		PI_ARGS((const char *charset, const char *ptext, int bytes,
 		     char **text));
 
+	/** @brief Convert strings to the Palm charset into one buffer
+	 *
+	 * Converts a batch of null-terminated strings, like the fields of
+	 * a record, with one converter, and appends the results to @a arena
+	 * instead of allocating each. The converters are kept open by each
+	 * thread, for all the convert_* functions.
+	 *
+	 * @param charset Desktop charset of @a texts
+	 * @param count Number of strings
+	 * @param texts Strings to convert, NULL ones are left NULL
+	 * @param ptexts On return, the converted strings, which point in @a arena
+	 * @param arena Buffer allocated using pi_buffer_new(), the strings are appended to it
+	 * @param pi_charset Palm charset, or NULL for PILOT_CHARSET or CP1252
+	 * @return 0 on success, -1 on failure
+	 */
+	extern int convert_ToPilotChar_Strings
+		PI_ARGS((const char *charset, int count, char * const *texts,
+		     char **ptexts, pi_buffer_t *arena,
+		     const char *pi_charset));
+
+	/** @brief Convert strings from the Palm charset into one buffer
+	 *
+	 * @param charset Desktop charset to convert to
+	 * @param count Number of strings
+	 * @param ptexts Strings to convert, NULL ones are left NULL
+	 * @param texts On return, the converted strings, which point in @a arena
+	 * @param arena Buffer allocated using pi_buffer_new(), the strings are appended to it
+	 * @param pi_charset Palm charset, or NULL for PILOT_CHARSET or CP1252
+	 * @return 0 on success, -1 on failure
+	 */
+	extern int convert_FromPilotChar_Strings
+		PI_ARGS((const char *charset, int count, char * const *ptexts,
+		     char **texts, pi_buffer_t *arena,
+		     const char *pi_charset));
+
+	/** @brief Read a clock that doesn't jump with the time of day
+	 *
+	 * Falls back on the time of day where there is no monotonic clock.
+	 *
+	 * @return Milliseconds since an arbitrary point
+	 */
+	extern long pi_clock_ms PI_ARGS((void));
+
 	/** @brief Convert a milliseconds timeout value to an absolute timespec
 	 *
 	 * @param timeout Timeout value from now, in milliseconds
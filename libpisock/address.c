@@ -27,6 +27,7 @@
 
 #include "pi-macros.h"
 #include "pi-address.h"
+#include "pi-arena.h"
 
 #define hi(x) (((x) >> 4) & 0x0f)
 #define lo(x) ((x) & 0x0f)
@@ -70,6 +71,27 @@ free_Address(Address_t *addr)
  ***********************************************************************/
 int
 unpack_Address(Address_t *addr, const pi_buffer_t *buf, addressType type)
+{
+	return unpack_Address_arena(addr, buf, type, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    unpack_Address_arena
+ *
+ * Summary:     Fill in the address structure based on the raw record 
+ *		data, allocating the strings in an arena
+ *
+ * Parameters:  Address_t*, pi_buffer_t *buf, record type, pi_arena_t*
+ *		(NULL to allocate them with malloc)
+ *
+ * Returns:     -1 on error, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Address_arena(Address_t *addr, const pi_buffer_t *buf,
+	addressType type, pi_arena_t *arena)
 {
 	unsigned long	contents,
 			v;
@@ -105,9 +127,12 @@ unpack_Address(Address_t *addr, const pi_buffer_t *buf, addressType type)
 
 	for (v = 0; v < 19; v++) {
 		if (contents & (1 << v)) {
-			if ((buf->used - ofs) < 1)
+			if (ofs >= buf->used)
 				return 0;
-			addr->entry[v] = strdup((char *) (buf->data + ofs));
+			addr->entry[v] = pi_arena_strndup(arena,
+				(char *) (buf->data + ofs), buf->used - ofs);
+			if (addr->entry[v] == NULL)
+				return -1;
                   	ofs += strlen(addr->entry[v]) + 1;
 		} else {
 			addr->entry[v] = 0;
@@ -37,6 +37,7 @@
 #endif
 
 #include "pi-macros.h"
+#include "pi-arena.h"
 #include "pi-blob.h"
 
 /***********************************************************************
@@ -112,6 +113,25 @@ dup_Blob(const Blob_t *blob)
  ***********************************************************************/
 int
 unpack_Blob_p(Blob_t *blob, const unsigned char *data, const size_t position) {
+	return unpack_Blob_arena(blob, data, position, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_Blob_arena
+ *
+ * Summary:     Unpack a blob starting at position in data, allocating
+ *		its data in an arena
+ *
+ * Parameters:  Blob_t*, unsigned char*, size_t, pi_arena_t* (NULL to
+ *		allocate it with malloc)
+ *
+ * Returns:     the number of bytes read or -1 on error
+ *
+ ***********************************************************************/
+int
+unpack_Blob_arena(Blob_t *blob, const unsigned char *data,
+	const size_t position, pi_arena_t *arena) {
 	size_t localPosition = position;
   
 	memcpy(blob->type, (char *)data+localPosition, 4);
@@ -119,14 +139,14 @@ unpack_Blob_p(Blob_t *blob, const unsigned char *data, const size_t position) {
 	//printf("blob->type = %c %c %c %c\n", blob->type[0], blob->type[1], blob->type[2], blob->type[3]);
 	blob->length = get_short(data+localPosition);
 	localPosition += 2;
+	blob->data = NULL;
 	if(blob->length > 0) {
 		//printf("blob->length = %d\n", blob->length);
-		blob->data = (uint8_t *)malloc(blob->length);
+		blob->data = (uint8_t *)pi_arena_memdup(arena,
+			data+localPosition, blob->length);
 		if(NULL == blob->data) {
 			printf("Malloc failed!\n");
 			return -1;
-		} else {
-			memcpy(blob->data, data+localPosition, blob->length);
 		}
 		localPosition += blob->length;
 	}
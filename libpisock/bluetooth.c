@@ -240,6 +240,7 @@ pi_bluetooth_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -297,6 +298,7 @@ pi_bluetooth_protocol (pi_device_t *dev)
 	if (prot != NULL) {
 		prot->level 		= PI_LEVEL_DEV;
 		prot->dup 		= pi_bluetooth_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= pi_bluetooth_protocol_free;
 		prot->read 		= pi_bluetooth_read;
 		prot->write 		= pi_bluetooth_write;
@@ -443,6 +445,7 @@ pi_bluetooth_device (int type)
 		return NULL;
 	}
 
+	dev->dup        = NULL;
 	dev->free       = pi_bluetooth_device_free;
 	dev->protocol   = pi_bluetooth_protocol;	
 	dev->bind       = pi_bluetooth_bind;
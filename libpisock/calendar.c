@@ -38,6 +38,7 @@
 #endif
 
 #include "pi-macros.h"
+#include "pi-arena.h"
 #include "pi-calendar.h"
 
 #define alarmFlag 	64
@@ -260,6 +261,27 @@ free_CalendarEvent(CalendarEvent_t *a)
  ***********************************************************************/
 int
 unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType type)
+{
+	return unpack_CalendarEvent_arena(a, buf, type, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_CalendarEvent_arena
+ *
+ * Summary:     Fill in the calendar event structure based on the raw 
+ *		record data, allocating the strings, exceptions, blobs
+ *		and timezone in an arena
+ *
+ * Parameters:  CalendarEvent_t*, pi_buffer_t * of buffer, calendarType,
+ *		pi_arena_t* (NULL to allocate them with malloc)
+ *
+ * Returns:     -1 on fail, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_CalendarEvent_arena(CalendarEvent_t *a, const pi_buffer_t *buf,
+	calendarType type, pi_arena_t *arena)
 {
 	int 	iflags,
 		j,
@@ -301,8 +323,8 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 		a->event = 0;
 	}
 
-	mktime(&a->begin);
-	mktime(&a->end);
+	pi_normalize_tm(&a->begin, 0);
+	pi_normalize_tm(&a->end, 0);
 
 	iflags = get_byte(buf->data + 6);
 
@@ -341,7 +363,7 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 			a->repeatEnd.tm_hour 	= 0;
 			a->repeatEnd.tm_sec 	= 0;
 			a->repeatEnd.tm_isdst 	= -1;
-			mktime(&a->repeatEnd);
+			pi_normalize_tm(&a->repeatEnd, 0);
 			a->repeatForever = 0;
 		}
 		a->repeatFrequency = get_byte(p2);
@@ -375,7 +397,10 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 	if (iflags & exceptFlag) {
 		a->exceptions = get_short(p2);
 		p2 += 2;
-		a->exception = malloc(sizeof(struct tm) * a->exceptions);
+		a->exception = pi_arena_alloc(arena,
+			sizeof(struct tm) * a->exceptions);
+		if (a->exception == NULL)
+			return -1;
 
 		for (j = 0; j < a->exceptions; j++, p2 += 2) {
 			d = (unsigned short int) get_short(p2);
@@ -386,7 +411,7 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 			a->exception[j].tm_min 		= 0;
 			a->exception[j].tm_sec 		= 0;
 			a->exception[j].tm_isdst 	= -1;
-			mktime(&a->exception[j]);
+			pi_normalize_tm(&a->exception[j], 0);
 		}
 
 	} else {
@@ -394,25 +419,24 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 		a->exception 	= 0;
 	}
 
-	if (iflags & descFlag) {
-		a->description = strdup((char *)p2);
-		p2 += strlen((char *)p2) + 1;
-	} else
-		a->description = 0;
+	a->description = 0;
+	a->note = 0;
+	a->location = 0;
 
-	if (iflags & noteFlag) {
-		a->note = strdup((char *)p2);
-		p2 += strlen((char *)p2) + 1;
-	} else {
-		a->note = 0;
-	}
+	if ((iflags & descFlag)
+	    && (a->description = pi_arena_unpack_string(arena, buf,
+			&p2)) == NULL)
+		return -1;
 
-	if (iflags & locFlag) {
-		a->location = strdup((char *)p2);
-		p2 += strlen((char *)p2) + 1;
-	} else {
-		a->location = 0;
-	}
+	if ((iflags & noteFlag)
+	    && (a->note = pi_arena_unpack_string(arena, buf,
+			&p2)) == NULL)
+		return -1;
+
+	if ((iflags & locFlag)
+	    && (a->location = pi_arena_unpack_string(arena, buf,
+			&p2)) == NULL)
+		return -1;
 
 	/* initialize the blobs to NULL */
 	for (i=0; i<MAX_BLOBS; ++i) {
@@ -431,8 +455,12 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 				return -1;
 			}
 
-			a->blob[blob_count] = (Blob_t *)malloc(sizeof(Blob_t));
-			result = unpack_Blob_p(a->blob[blob_count], p2, 0);
+			a->blob[blob_count] = (Blob_t *)pi_arena_alloc(arena,
+				sizeof(Blob_t));
+			if (a->blob[blob_count] == NULL)
+				return -1;
+			result = unpack_Blob_arena(a->blob[blob_count], p2, 0,
+				arena);
 			if(-1 == result) {
 				return -1;
 			} else {
@@ -445,11 +473,17 @@ unpack_CalendarEvent(CalendarEvent_t *a, const pi_buffer_t *buf, calendarType ty
 				int result;
 				if(NULL != a->tz) {
 					printf("Warning: Found more than one timezone blob! Freeing the previous one and starting again\n");
-					free_Timezone(a->tz);
-					free(a->tz);
+					if (arena == NULL) {
+						free_Timezone(a->tz);
+						free(a->tz);
+					}
 				}
-				a->tz = (Timezone_t *)malloc(sizeof(Timezone_t));
-				result = unpack_Timezone_p(a->tz, a->blob[blob_count]->data, 0);
+				a->tz = (Timezone_t *)pi_arena_alloc(arena,
+					sizeof(Timezone_t));
+				if (a->tz == NULL)
+					return -1;
+				result = unpack_Timezone_arena(a->tz,
+					a->blob[blob_count]->data, 0, arena);
 				if(-1 == result) {
 					printf("Error unpacking timezone blob\n");
 					return -1;
@@ -72,6 +72,7 @@ cmp_protocol_dup (pi_protocol_t *prot)
 	if ( (new_prot != NULL) && (new_data != NULL) ) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -144,6 +145,7 @@ cmp_protocol (void)
 	if (prot != NULL && data != NULL) {
 		prot->level 		= PI_LEVEL_CMP;
 		prot->dup 		= cmp_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= cmp_protocol_free;
 		prot->read 		= cmp_rx;
 		prot->write 		= cmp_tx;
@@ -190,7 +192,7 @@ cmp_rx_handshake(pi_socket_t *ps, int establishrate,
 	pi_buffer_t *buf;
 	int bytes;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -253,9 +255,10 @@ cmp_tx_handshake(pi_socket_t *ps)
 {
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
+	pi_buffer_t *buf;
 	int result;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -264,7 +267,17 @@ cmp_tx_handshake(pi_socket_t *ps)
 	if ((result = cmp_wakeup(ps, 38400)) < 0)	/* Assume box can't go over 38400 */
 		return result;
 
-	if ((result = cmp_rx(ps, NULL, 0, 0)) < 0)
+	/* Read the answer */
+	buf = pi_buffer_new (PI_CMP_HEADER_LEN);
+	if (buf == NULL) {
+		errno = ENOMEM;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+	}
+
+	result = cmp_rx(ps, buf, PI_CMP_HEADER_LEN, 0);
+
+	pi_buffer_free (buf);
+	if (result < 0)
 		return result;							/* failed to read, errno already set */
 
 	switch (data->type) {
@@ -304,12 +317,12 @@ cmp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	struct 	pi_cmp_data *data;
 	unsigned char cmp_buf[PI_CMP_HEADER_LEN];
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_cmp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -354,12 +367,12 @@ cmp_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	LOG((PI_DBG_CMP, PI_DBG_LVL_DEBUG, "CMP RX len=%d flags=0x%02x\n",
 		len, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_cmp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -394,11 +407,11 @@ cmp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -422,7 +435,7 @@ cmp_init(pi_socket_t *ps, int baudrate)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_cmp_data *)prot->data;
@@ -453,7 +466,7 @@ cmp_abort(pi_socket_t *ps, int reason)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 	
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -483,7 +496,7 @@ cmp_wakeup(pi_socket_t *ps, int maxbaud)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 	
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -517,7 +530,7 @@ cmp_getsockopt(pi_socket_t *ps, int level, int option_name,
 
 	(void) level;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_cmp_data *)prot->data;
@@ -584,7 +597,7 @@ cmp_setsockopt(pi_socket_t *ps, int level, int option_name,
 
 	(void) level;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_padp_data *)prot->data;
@@ -27,6 +27,8 @@
 #include <string.h>
 
 #include "pi-macros.h"
+#include "pi-error.h"
+#include "pi-arena.h"
 #include "pi-blob.h"
 #include "pi-contact.h"
  
@@ -74,11 +76,32 @@ void free_Contact(struct Contact *c)
  *
  * Parameters: None
  *
- * Returns:    -1 on error, 
- *             The length of the data used from the buffer on success
+ * Returns:    Negative on error (see unpack_Contact_arena()),
+ *             the length of the data used from the buffer on success
  *
  ***********************************************************************/
 int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
+{
+   return unpack_Contact_arena(c, buf, type, NULL);
+}
+
+
+/***********************************************************************
+ *
+ * Function:   unpack_Contact_arena
+ *
+ * Summary:    Fill in the contact structure based on the raw record
+ *             data, allocating the strings and blobs in an arena
+ *
+ * Parameters: pi_arena_t* (NULL to allocate them with malloc)
+ *
+ * Returns:    -1 on a bad record, PI_ERR_GENERIC_MEMORY if out of
+ *             memory, the length of the data used from the buffer on
+ *             success
+ *
+ ***********************************************************************/
+int unpack_Contact_arena(struct Contact *c, pi_buffer_t *buf,
+   contactsType type, pi_arena_t *arena)
 {
    unsigned long contents1;
    unsigned long contents2;
@@ -133,8 +156,10 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
       if (contents1 & (1 << i)) {
          if (len < 1)
             return 0;
-         c->entry[field_num] = strdup((char *) Pbuf);
-         Pbuf += strlen((char *) Pbuf) + 1;
+         c->entry[field_num] = pi_arena_strndup(arena, (char *) Pbuf, len);
+         if (c->entry[field_num] == NULL)
+            return PI_ERR_GENERIC_MEMORY;
+         Pbuf += strlen(c->entry[field_num]) + 1;
          len -= strlen(c->entry[field_num]) + 1;
       } else {
          c->entry[field_num] = 0;
@@ -144,8 +169,10 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
       if (contents2 & (1 << i)) {
          if (len < 1)
             return 0;
-         c->entry[field_num] = strdup((char *) Pbuf);
-         Pbuf += strlen((char *) Pbuf) + 1;
+         c->entry[field_num] = pi_arena_strndup(arena, (char *) Pbuf, len);
+         if (c->entry[field_num] == NULL)
+            return PI_ERR_GENERIC_MEMORY;
+         Pbuf += strlen(c->entry[field_num]) + 1;
          len -= strlen(c->entry[field_num]) + 1;
       } else {
          c->entry[field_num] = 0;
@@ -203,16 +230,20 @@ int unpack_Contact(struct Contact *c, pi_buffer_t *buf, contactsType type)
          /* Too many blobs were found. */
          return (Pbuf - record);
       }
-      c->blob[blob_count] = malloc(sizeof(Blob_t));
+      c->blob[blob_count] = pi_arena_alloc(arena, sizeof(Blob_t));
+      if (c->blob[blob_count] == NULL)
+         return PI_ERR_GENERIC_MEMORY;
       strncpy(c->blob[blob_count]->type, (char *)Pbuf, 4);
       c->blob[blob_count]->length = get_short(Pbuf+4);
-      c->blob[blob_count]->data = malloc(c->blob[blob_count]->length);
-      if (c->blob[blob_count]->data) {
-         memcpy(c->blob[blob_count]->data, Pbuf+6, c->blob[blob_count]->length);
-      }
+      c->blob[blob_count]->data = pi_arena_memdup(arena, Pbuf+6,
+         c->blob[blob_count]->length);
+      if (c->blob[blob_count]->data == NULL)
+         return PI_ERR_GENERIC_MEMORY;
       if (! strncmp(c->blob[blob_count]->type, BLOB_TYPE_PICTURE_ID, 4)) {
          if (!(c->picture)) {
-            c->picture = malloc(sizeof(struct ContactPicture));
+            c->picture = pi_arena_alloc(arena, sizeof(struct ContactPicture));
+            if (c->picture == NULL)
+               return PI_ERR_GENERIC_MEMORY;
          }
          c->picture->dirty = get_short(c->blob[blob_count]->data);
          c->picture->length = c->blob[blob_count]->length - 2;
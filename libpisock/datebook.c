@@ -36,6 +36,7 @@
 #endif
 
 #include "pi-macros.h"
+#include "pi-arena.h"
 #include "pi-datebook.h"
 
 #define alarmFlag 	64
@@ -100,6 +101,27 @@ free_Appointment(Appointment_t *a)
  ***********************************************************************/
 int
 unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
+{
+	return unpack_Appointment_arena(a, buf, type, NULL);
+}
+
+/***********************************************************************
+ *
+ * Function:    unpack_Appointment_arena
+ *
+ * Summary:     Fill in the appointment structure based on the raw 
+ *		record data, allocating the strings and exceptions in an
+ *		arena
+ *
+ * Parameters:  Appointment_t*, pi_buffer_t * of buffer, datebook type,
+ *		pi_arena_t* (NULL to allocate them with malloc)
+ *
+ * Returns:     -1 on error, 0 on success
+ *
+ ***********************************************************************/
+int
+unpack_Appointment_arena(Appointment_t *a, const pi_buffer_t *buf,
+	datebookType type, pi_arena_t *arena)
 {
 	int 	iflags,
 		j,
@@ -154,8 +176,8 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 		a->event = 0;
 	}
 
-	mktime(&a->begin);
-	mktime(&a->end);
+	pi_normalize_tm(&a->begin, 0);
+	pi_normalize_tm(&a->end, 0);
 
 	iflags = get_byte(buf->data + 6);
 
@@ -194,7 +216,7 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 			a->repeatEnd.tm_hour 	= 0;
 			a->repeatEnd.tm_sec 	= 0;
 			a->repeatEnd.tm_isdst 	= -1;
-			mktime(&a->repeatEnd);
+			pi_normalize_tm(&a->repeatEnd, 0);
 			a->repeatForever = 0;
 		}
 		a->repeatFrequency = get_byte(p2);
@@ -228,7 +250,10 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 	if (iflags & exceptFlag) {
 		a->exceptions = get_short(p2);
 		p2 += 2;
-		a->exception = malloc(sizeof(struct tm) * a->exceptions);
+		a->exception = pi_arena_alloc(arena,
+			sizeof(struct tm) * a->exceptions);
+		if (a->exception == NULL)
+			return -1;
 
 		for (j = 0; j < a->exceptions; j++, p2 += 2) {
 			d = (unsigned short int) get_short(p2);
@@ -239,7 +264,7 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 			a->exception[j].tm_min 		= 0;
 			a->exception[j].tm_sec 		= 0;
 			a->exception[j].tm_isdst 	= -1;
-			mktime(&a->exception[j]);
+			pi_normalize_tm(&a->exception[j], 0);
 		}
 
 	} else {
@@ -247,18 +272,18 @@ unpack_Appointment(Appointment_t *a, const pi_buffer_t *buf, datebookType type)
 		a->exception 	= 0;
 	}
 
-	if (iflags & descFlag) {
-		a->description = strdup((char *)p2);
-		p2 += strlen((char *)p2) + 1;
-	} else
-		a->description = 0;
+	a->description = 0;
+	a->note = 0;
 
-	if (iflags & noteFlag) {
-		a->note = strdup((char *)p2);
-		p2 += strlen((char *)p2) + 1;
-	} else {
-		a->note = 0;
-	}
+	if ((iflags & descFlag)
+	    && (a->description = pi_arena_unpack_string(arena, buf,
+			&p2)) == NULL)
+		return -1;
+
+	if ((iflags & noteFlag)
+	    && (a->note = pi_arena_unpack_string(arena, buf,
+			&p2)) == NULL)
+		return -1;
 	return 0;
 }
 
@@ -20,6 +20,10 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -33,6 +37,19 @@ static int debug_level = PI_DBG_LVL_NONE;
 static FILE *debug_file = NULL;
 static PI_MUTEX_DEFINE(logfile_mutex);
 
+#if HAVE_PTHREAD
+static pthread_key_t thread_file_key;
+static pthread_once_t thread_file_once = PTHREAD_ONCE_INIT;
+
+static void
+thread_file_key_init (void)
+{
+	pthread_key_create (&thread_file_key, NULL);
+}
+#else
+static FILE *thread_file = NULL;
+#endif
+
 /***********************************************************************
  *
  * Function:    pi_debug_get_types
@@ -133,6 +150,29 @@ pi_debug_set_file (const char *path)
 }
 
 
+/***********************************************************************
+ *
+ * Function:    pi_debug_set_thread_file
+ *
+ * Summary:     redirects the calling thread's log messages
+ *
+ * Parameters:  FILE* to log to, or NULL for the log file
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_debug_set_thread_file (FILE *file)
+{
+#if HAVE_PTHREAD
+	pthread_once (&thread_file_once, thread_file_key_init);
+	pthread_setspecific (thread_file_key, file);
+#else
+	thread_file = file;
+#endif
+}
+
+
 /***********************************************************************
  *
  * Function:    pi_log
@@ -148,6 +188,7 @@ void
 pi_log (int type, int level, const char *format, ...)
 {
 	va_list ap;
+	FILE *file;
 
 	if (!(debug_types & type) && type != PI_DBG_ALL)
 		return;
@@ -161,13 +202,22 @@ pi_log (int type, int level, const char *format, ...)
 		debug_file = stderr;
 
 #if HAVE_PTHREAD
-	fprintf(debug_file, "[thread 0x%08lx] ", pi_thread_id());
+	pthread_once (&thread_file_once, thread_file_key_init);
+	file = (FILE *) pthread_getspecific (thread_file_key);
+#else
+	file = thread_file;
+#endif
+	if (file == NULL)
+		file = debug_file;
+
+#if HAVE_PTHREAD
+	fprintf(file, "[thread 0x%08lx] ", pi_thread_id());
 #endif
 	va_start(ap, format);
-	vfprintf(debug_file, format, ap);
+	vfprintf(file, format, ap);
 	va_end(ap);
 
-	fflush(debug_file);
+	fflush(file);
 
 	pi_mutex_unlock(&logfile_mutex);
 }
@@ -545,16 +545,22 @@ struct dlpResponse
 		res->err = dlpErrNoError;
 		res->argc = argc;
 		res->argv = NULL;
+		res->args = NULL;
+		res->args_allocated = argc;
+		res->rxbuf = NULL;
 
 		if (argc) {
 			res->argv = (struct dlpArg **) malloc (sizeof (struct dlpArg *) * argc);
-			if (res->argv == NULL) {
+			res->args = (struct dlpArg *) malloc (sizeof (struct dlpArg) * argc);
+			if (res->argv == NULL || res->args == NULL) {
+				free(res->argv);
+				free(res->args);
 				free(res);
 				return NULL;
 			}
 			/* zero-out argv so that in case of error during
-			   response read, dlp_response_free() won't try to
-			   free uninitialized ptrs */
+			   response read, callers won't look at
+			   uninitialized ptrs */
 			memset(res->argv, 0, sizeof (struct dlpArg *) * argc);
 		}
 	}
@@ -563,6 +569,64 @@ struct dlpResponse
 }
 
 
+/***************************************************************************
+ *
+ * Function:	dlp_rxbuf_new
+ *
+ * Summary:	creates a new reference-counted receive buffer
+ *
+ * Parameters:	None
+ *
+ * Returns:     dlpRxBuffer* with a reference count of 1, or NULL if
+ *		failure
+ *
+ ***************************************************************************/
+struct dlpRxBuffer
+*dlp_rxbuf_new (void)
+{
+	struct dlpRxBuffer *rxbuf;
+
+	rxbuf = (struct dlpRxBuffer *) malloc (sizeof (struct dlpRxBuffer));
+	if (rxbuf == NULL)
+		return NULL;
+
+	rxbuf->buf = pi_buffer_new (DLP_BUF_SIZE);
+	if (rxbuf->buf == NULL) {
+		free (rxbuf);
+		return NULL;
+	}
+	rxbuf->refcount = 1;
+	rxbuf->spare = NULL;
+
+	return rxbuf;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_rxbuf_release
+ *
+ * Summary:	drops a reference to a receive buffer, freeing it (and the
+ *		spare response it caches) when the last reference goes away
+ *
+ * Parameters:	dlpRxBuffer*
+ *
+ * Returns:     void
+ *
+ ***************************************************************************/
+void
+dlp_rxbuf_release (struct dlpRxBuffer *rxbuf)
+{
+	if (rxbuf == NULL || --rxbuf->refcount > 0)
+		return;
+
+	if (rxbuf->spare != NULL)
+		dlp_response_free (rxbuf->spare);
+	pi_buffer_free (rxbuf->buf);
+	free (rxbuf);
+}
+
+
 /***************************************************************************
  *
  * Function:	dlp_response_read
@@ -573,27 +637,50 @@ struct dlpResponse
  *
  * Returns:     first dlpArg response length or -1 on error
  *
+ * Note:	The response arguments point directly into the socket's
+ *		receive buffer; nothing is copied. The buffer is shared
+ *		with the response until dlp_response_free() is called, and
+ *		reused for the next response once released, so the common
+ *		read/free cycle doesn't allocate.
+ *
  ***************************************************************************/
 ssize_t
 dlp_response_read (struct dlpResponse **res, int sd)
 {
 	struct dlpResponse *response;
-	unsigned char *buf;
+	struct dlpRxBuffer *rxbuf;
+	unsigned char *buf, *end;
 	short argid;
-	int i;
+	int i, argc;
 	ssize_t bytes;
-	size_t len;
-	pi_buffer_t *dlp_buf;
+	size_t len, hdr;
+	pi_socket_t *ps;
 
-	dlp_buf = pi_buffer_new (DLP_BUF_SIZE);
-	if (dlp_buf == NULL)
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	/* nothing to free if we fail before there is a response */
+	*res = NULL;
 
-	bytes = pi_read (sd, dlp_buf, dlp_buf->allocated);      /* buffer will grow as needed */
-	if (bytes < 0) {
-		pi_buffer_free (dlp_buf);
-		return bytes;
+	if (!(ps = find_pi_socket(sd))) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	rxbuf = ps->dlp_rxbuf;
+	if (rxbuf != NULL && rxbuf->refcount > 1) {
+		/* a previous response still points into this buffer:
+		   hand it over to that response and start a new one */
+		dlp_rxbuf_release (rxbuf);
+		rxbuf = NULL;
+	}
+	if (rxbuf == NULL) {
+		rxbuf = ps->dlp_rxbuf = dlp_rxbuf_new ();
+		if (rxbuf == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
 	}
+	rxbuf->buf->used = 0;
+
+	bytes = pi_read (sd, rxbuf->buf, rxbuf->buf->allocated);      /* buffer will grow as needed */
+	if (bytes < 0)
+		return bytes;
 	if (bytes < 4) {
 		/* packet is probably incomplete */
 #ifdef DEBUG
@@ -601,28 +688,43 @@ dlp_response_read (struct dlpResponse **res, int sd)
 				"dlp_response_read: response too short (%d bytes)\n",
 				bytes));
 		if (bytes)
-			pi_dumpdata(dlp_buf->data, (size_t)dlp_buf->used);
+			pi_dumpdata(rxbuf->buf->data, (size_t)rxbuf->buf->used);
 #endif
 		return pi_set_error(sd, PI_ERR_DLP_COMMAND);
 	}
 
-	response = dlp_response_new((enum dlpFunctions)(dlp_buf->data[0] & 0x7f), dlp_buf->data[1]);
+	argc = rxbuf->buf->data[1];
+	response = rxbuf->spare;
+	if (response != NULL) {
+		rxbuf->spare = NULL;
+		if (response->args_allocated < argc) {
+			dlp_response_free (response);
+			response = NULL;
+		}
+	}
+	if (response == NULL)
+		response = dlp_response_new((enum dlpFunctions)0, argc);
 	*res = response;
 
 	/* note that in case an error occurs, we do not deallocate the response
 	   since callers already do it under all circumstances */
-	if (response == NULL) {
-		pi_buffer_free(dlp_buf);
+	if (response == NULL)
 		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
-	}
 
-	response->err = (enum dlpErrors) get_short (&dlp_buf->data[2]);
+	response->cmd = (enum dlpFunctions)(rxbuf->buf->data[0] & 0x7f);
+	response->err = (enum dlpErrors) get_short (&rxbuf->buf->data[2]);
+	response->argc = argc;
+	response->rxbuf = rxbuf;
+	rxbuf->refcount++;
+	if (argc)
+		memset(response->argv, 0, sizeof (struct dlpArg *) * argc);
 	pi_set_palmos_error(sd, (int)response->err);
 
-	/* FIXME: add bounds checking to make sure we don't access past
-	 * the end of the buffer in case the data is corrupt */
-	buf = dlp_buf->data + 4;
-	for (i = 0; i < response->argc; i++) {
+	buf = rxbuf->buf->data + 4;
+	end = rxbuf->buf->data + rxbuf->buf->used;
+	for (i = 0; i < argc; i++) {
+		if (end - buf < 2)
+			goto truncated;
 		argid = get_byte (buf) & 0x3f;
 		if (get_byte(buf) & PI_DLP_ARG_FLAG_LONG) {
 			if (pi_version(sd) < 0x0104) {
@@ -634,48 +736,57 @@ dlp_response_read (struct dlpResponse **res, int sd)
 				   contents. We need to report that the data is too large
 				   to be transferred.
 				*/
-				pi_buffer_free(dlp_buf);
 				return pi_set_error(sd, PI_ERR_DLP_DATASIZE);
 			}
+			hdr = 6;
+			if (end - buf < (ssize_t)hdr)
+				goto truncated;
 			len = get_long(&buf[2]);
-			buf += 6;
 		} else if (get_byte(buf) & PI_DLP_ARG_FLAG_SHORT) {
+			hdr = 4;
+			if (end - buf < (ssize_t)hdr)
+				goto truncated;
 			len = get_short(&buf[2]);
-			buf += 4;
 		} else {
+			hdr = 2;
 			argid = get_byte(buf);
 			len = get_byte(&buf[1]);
-			buf += 2;
-		}
-
-		response->argv[i] = dlp_arg_new (argid, len);
-		if (response->argv[i] == NULL) {
-			pi_buffer_free (dlp_buf);
-			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
 		}
-		memcpy (response->argv[i]->data, buf, len);
+		buf += hdr;
+		if ((size_t)(end - buf) < len)
+			goto truncated;
+
+		response->args[i].id_ = argid;
+		response->args[i].len = len;
+		response->args[i].data = (char *)buf;
+		response->argv[i] = &response->args[i];
 		buf += len;
 	}
 
-	pi_buffer_free(dlp_buf);
+	return argc ? response->argv[0]->len : 0;
 
-	return response->argc ? response->argv[0]->len : 0;
+truncated:
+	LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
+			"dlp_response_read: argument %d overruns the %d bytes response\n",
+			i, (int)bytes));
+	response->argc = i;
+	return pi_set_error(sd, PI_ERR_DLP_COMMAND);
 }
 
 
 /***************************************************************************
  *
- * Function:	dlp_request_write
+ * Function:	dlp_request_encode
  *
- * Summary:	writes dlp request
+ * Summary:	serializes a dlp request into a newly allocated packet
  *
- * Parameters:	dlpRequest**, sd
+ * Parameters:	dlpRequest*, length of the packet (out)
  *
- * Returns:     response length or -1 on error
+ * Returns:     malloc()ed packet or NULL if out of memory
  *
  ***************************************************************************/
-ssize_t
-dlp_request_write (struct dlpRequest *req, int sd)
+static unsigned char *
+dlp_request_encode (struct dlpRequest *req, size_t *length)
 {
 	unsigned char *exec_buf, *buf;
 	int i;
@@ -684,7 +795,7 @@ dlp_request_write (struct dlpRequest *req, int sd)
 	len = dlp_arg_len(req->argc, req->argv) + 2;
 	exec_buf = (unsigned char *) malloc (sizeof (unsigned char) * len);
 	if (exec_buf == NULL)
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+		return NULL;
 
 	set_byte(&exec_buf[PI_DLP_OFFSET_CMD], req->cmd);
 	set_byte(&exec_buf[PI_DLP_OFFSET_ARGC], req->argc);
@@ -719,17 +830,64 @@ dlp_request_write (struct dlpRequest *req, int sd)
 		}
 	}
 
-	pi_flush(sd, PI_FLUSH_INPUT);
+	*length = len;
+	return exec_buf;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_request_send
+ *
+ * Summary:	writes an encoded dlp request
+ *
+ * Parameters:	sd, dlpRequest*, flush flag (non-zero to discard pending
+ *		input first)
+ *
+ * Returns:     request length or negative on error
+ *
+ ***************************************************************************/
+static ssize_t
+dlp_request_send (int sd, struct dlpRequest *req, int flush)
+{
+	unsigned char *exec_buf;
+	size_t len;
+	ssize_t result;
+
+	exec_buf = dlp_request_encode (req, &len);
+	if (exec_buf == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	if (flush)
+		pi_flush(sd, PI_FLUSH_INPUT);
 
-	if ((i = pi_write(sd, exec_buf, len)) < (ssize_t)len) {
+	if ((result = pi_write(sd, exec_buf, len)) < (ssize_t)len) {
 		errno = -EIO;
-		if (i >= 0 && i < (ssize_t)len)
-			i = -1;
+		if (result >= 0 && result < (ssize_t)len)
+			result = -1;
 	}
 
 	free (exec_buf);
 
-	return i;
+	return result;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_request_write
+ *
+ * Summary:	writes dlp request
+ *
+ * Parameters:	dlpRequest**, sd
+ *
+ * Returns:     response length or -1 on error
+ *
+ ***************************************************************************/
+ssize_t
+dlp_request_write (struct dlpRequest *req, int sd)
+{
+	return dlp_request_send (sd, req, 1);
 }
 
 
@@ -778,23 +936,79 @@ dlp_request_free (struct dlpRequest *req)
 void
 dlp_response_free (struct dlpResponse *res)
 {
-	int i;
+	struct dlpRxBuffer *rxbuf;
 
 	if (res == NULL)
 		return;
 
-	if (res->argv != NULL) {
-		for (i = 0; i < res->argc; i++) {
-			if (res->argv[i] != NULL)
-				dlp_arg_free (res->argv[i]);
+	rxbuf = res->rxbuf;
+	if (rxbuf != NULL) {
+		/* arguments are views into the receive buffer, nothing to
+		   free there. Keep the response shell around for the next
+		   read and drop our reference to the buffer */
+		res->rxbuf = NULL;
+		if (rxbuf->spare == NULL) {
+			rxbuf->spare = res;
+			res = NULL;
 		}
-		free (res->argv);
+		dlp_rxbuf_release (rxbuf);
+		if (res == NULL)
+			return;
 	}
 
+	free (res->argv);
+	free (res->args);
 	free (res);
 }
 
 
+/***************************************************************************
+ *
+ * Function:	dlp_response_check
+ *
+ * Summary:	checks that a response matches the request it answers and
+ *		carries no error
+ *
+ * Parameters:	sd, requested command, dlpResponse*, response length
+ *
+ * Returns:     the number of response bytes, or negative on error
+ *
+ ***************************************************************************/
+static int
+dlp_response_check(int sd, enum dlpFunctions cmd, struct dlpResponse *res,
+	int bytes)
+{
+	/* Check to make sure the response is for this command */
+	if (res->cmd != cmd) {
+		/* The Palm m130 and Tungsten T return the wrong code for VFSVolumeInfo */
+		/* Tungsten T5 (and maybe Treo 650) return dlpFuncEndOfSync for dlpFuncWriteResource */
+		/* In some cases, the Tapwave Zodiac returns dlpFuncReadRecord instead of dlpFuncReadRecordEx */
+		if ((cmd != dlpFuncVFSVolumeInfo || res->cmd != dlpFuncVFSVolumeSize)
+			&& cmd != dlpFuncWriteResource			/* T5 */
+			&& cmd != dlpFuncReadRecord			/* Zodiac */
+			&& cmd != dlpFuncReadRecordEx)			/* Zodiac */
+		{
+			errno = -ENOMSG;
+
+			LOG((PI_DBG_DLP, PI_DBG_LVL_DEBUG,
+					"dlp_exec: result CMD 0x%02x doesn't match requested cmd 0x%02x\n",
+					(unsigned)(res->cmd), (unsigned)cmd));
+
+			return pi_set_error(sd, PI_ERR_DLP_COMMAND);
+		}
+	}
+
+	/* Check to make sure there was no error  */
+	if (res->err != dlpErrNoError) {
+		errno = -ENOMSG;
+		pi_set_palmos_error(sd, (int)(res->err));
+		return pi_set_error(sd, PI_ERR_DLP_PALMOS);
+	}
+
+	return bytes;
+}
+
+
 /***************************************************************************
  *
  * Function:	dlp_exec
@@ -828,34 +1042,7 @@ dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
 		return bytes;
 	}
 
-	/* Check to make sure the response is for this command */
-	if ((*res)->cmd != req->cmd) {
-		/* The Palm m130 and Tungsten T return the wrong code for VFSVolumeInfo */
-		/* Tungsten T5 (and maybe Treo 650) return dlpFuncEndOfSync for dlpFuncWriteResource */
-		/* In some cases, the Tapwave Zodiac returns dlpFuncReadRecord instead of dlpFuncReadRecordEx */
-		if ((req->cmd != dlpFuncVFSVolumeInfo || (*res)->cmd != dlpFuncVFSVolumeSize)
-			&& req->cmd != dlpFuncWriteResource			/* T5 */
-			&& req->cmd != dlpFuncReadRecord			/* Zodiac */
-			&& req->cmd != dlpFuncReadRecordEx)			/* Zodiac */
-		{
-			errno = -ENOMSG;
-
-			LOG((PI_DBG_DLP, PI_DBG_LVL_DEBUG,
-					"dlp_exec: result CMD 0x%02x doesn't match requested cmd 0x%02x\n",
-					(unsigned)((*res)->cmd), (unsigned)req->cmd));
-
-			return pi_set_error(sd, PI_ERR_DLP_COMMAND);
-		}
-	}
-
-	/* Check to make sure there was no error  */
-	if ((*res)->err != dlpErrNoError) {
-		errno = -ENOMSG;
-		pi_set_palmos_error(sd, (int)((*res)->err));
-		return pi_set_error(sd, PI_ERR_DLP_PALMOS);
-	}
-
-	return bytes;
+	return dlp_response_check (sd, req->cmd, *res, bytes);
 }
 
 /* These conversion functions are strictly for use within the DLP layer.
@@ -4835,6 +5022,831 @@ dlp_ExpSlotMediaType(int sd, int slotNum, unsigned long *mediaType)
 	return result;
 }
 
+
+/***************************************************************************
+ *
+ * Pipelined reads
+ *
+ * A pipeline keeps a FIFO of read requests. Up to `depth' of them are
+ * written before the first response is read back; responses come back in
+ * order and carry the NET transaction ID of the request they answer.
+ *
+ ***************************************************************************/
+
+#define PIPE_QUEUED	0	/* waiting to be sent */
+#define PIPE_SENT	1	/* in flight */
+#define PIPE_RECEIVED	2	/* response read, not delivered yet */
+
+struct dlpPipelineSlot {
+	int state;
+	int txid;
+	int dbhandle;
+	int large;
+	size_t len;			/* VFSFileRead length */
+	struct dlpRequest *req;
+	struct dlpResponse *res;
+	int result;			/* response length or error once received */
+	struct dlpPipelineCompletion completion;
+};
+
+struct dlpPipeline {
+	int sd;
+	int depth;			/* maximum number of requests in flight */
+	int net;			/* NET framing: responses can be matched by txid */
+	int verified;			/* device was seen echoing our txid */
+	int next_txid;
+	int in_flight;
+	int error;			/* fatal link error, reported by all pending requests */
+
+	int head, count, allocated;	/* circular FIFO of requests */
+	struct dlpPipelineSlot *slots;
+
+	int stale;			/* responses to requests re-sent after a fallback */
+	int *stale_txids;
+};
+
+#define PIPE_SLOT(pl, i) (&(pl)->slots[((pl)->head + (i)) % (pl)->allocated])
+
+static void
+pipeline_set_txid (struct dlpPipeline *pl, int txid)
+{
+	size_t size = sizeof(int);
+
+	pi_setsockopt(pl->sd, PI_LEVEL_NET, PI_NET_TXID, &txid, &size);
+}
+
+static int
+pipeline_depth (struct dlpPipeline *pl)
+{
+	return pl->verified ? pl->depth : 1;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	pipeline_fallback
+ *
+ * Summary:	the device lost track of the queued requests: remember the
+ *		txids of the responses that may still show up, put every
+ *		request in flight back in the queue and stop pipelining
+ *
+ * Parameters:	dlpPipeline*
+ *
+ * Returns:     void
+ *
+ ***************************************************************************/
+static void
+pipeline_fallback (struct dlpPipeline *pl)
+{
+	int i, off = 0;
+	size_t size = sizeof(int);
+	struct dlpPipelineSlot *slot;
+
+	LOG((PI_DBG_DLP, PI_DBG_LVL_WARN,
+		"DLP sd=%d pipeline: device can't queue requests, "
+		"falling back to depth 1\n", pl->sd));
+
+	pl->stale = 0;
+	for (i = 0; i < pl->count; i++) {
+		slot = PIPE_SLOT(pl, i);
+		if (slot->state == PIPE_SENT) {
+			pl->stale_txids[pl->stale++] = slot->txid;
+			slot->state = PIPE_QUEUED;
+		}
+	}
+	pl->in_flight = 0;
+	pl->depth = 1;
+	pi_setsockopt(pl->sd, PI_LEVEL_NET, PI_NET_PIPELINING, &off, &size);
+}
+
+
+/***************************************************************************
+ *
+ * Function:	pipeline_pump
+ *
+ * Summary:	sends queued requests until the pipeline is full
+ *
+ * Parameters:	dlpPipeline*
+ *
+ * Returns:     0 or a negative error code
+ *
+ ***************************************************************************/
+static int
+pipeline_pump (struct dlpPipeline *pl)
+{
+	int i, freeze_txid;
+	ssize_t result;
+	size_t opt_size = sizeof(int);
+	struct dlpPipelineSlot *slot;
+
+	if (pl->error < 0)
+		return pl->error;
+
+	for (i = 0; i < pl->count; i++) {
+		slot = PIPE_SLOT(pl, i);
+		if (slot->state == PIPE_SENT && slot->req->cmd == dlpFuncVFSFileRead)
+			break;		/* raw data follows: nothing else goes out */
+		if (slot->state != PIPE_QUEUED)
+			continue;
+		if (pl->in_flight >= pipeline_depth(pl))
+			break;
+		if (slot->req->cmd == dlpFuncVFSFileRead) {
+			if (pl->in_flight > 0)
+				break;
+			freeze_txid = 1;
+			pi_setsockopt(pl->sd, PI_LEVEL_PADP, PI_PADP_FREEZE_TXID,
+				&freeze_txid, &opt_size);
+		}
+
+		if (pl->net) {
+			slot->txid = pl->next_txid;
+			pipeline_set_txid(pl, slot->txid);
+			if (++pl->next_txid >= 0xff)
+				pl->next_txid = 1;
+		}
+
+		/* input is only flushed when we don't expect any answer */
+		result = dlp_request_send(pl->sd, slot->req, pl->in_flight == 0);
+		if (result < 0) {
+			pl->error = (int)result;
+			return pl->error;
+		}
+		slot->state = PIPE_SENT;
+		pl->in_flight++;
+	}
+
+	return 0;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	pipeline_receive
+ *
+ * Summary:	reads the response to the oldest request in flight
+ *
+ * Parameters:	dlpPipeline*
+ *
+ * Returns:     void (the outcome is stored in the slot)
+ *
+ ***************************************************************************/
+static void
+pipeline_receive (struct dlpPipeline *pl)
+{
+	int i, rx_txid, freeze_txid, result = 0;
+	ssize_t bytes;
+	size_t size, len, total;
+	struct dlpPipelineSlot *slot = NULL;
+	struct dlpResponse *res = NULL;
+
+	for (i = 0; i < pl->count; i++) {
+		slot = PIPE_SLOT(pl, i);
+		if (slot->state == PIPE_SENT)
+			break;
+	}
+	if (i == pl->count)
+		return;
+
+	for (;;) {
+		bytes = dlp_response_read(&res, pl->sd);
+		if (bytes < 0) {
+			dlp_response_free(res);
+			res = NULL;
+			if (pl->in_flight > 1) {
+				/* the device probably dropped what we queued */
+				pipeline_fallback(pl);
+				if ((result = pipeline_pump(pl)) < 0)
+					break;
+				continue;
+			}
+			result = (int)bytes;
+			break;
+		}
+
+		if (pl->net) {
+			size = sizeof(int);
+			pi_getsockopt(pl->sd, PI_LEVEL_NET, PI_NET_RX_TXID, &rx_txid, &size);
+			if (!pl->verified) {
+				/* first exchange, only one request in flight */
+				if (rx_txid == slot->txid) {
+					pl->verified = 1;
+				} else {
+					LOG((PI_DBG_DLP, PI_DBG_LVL_INFO,
+						"DLP sd=%d pipeline: device doesn't echo txid\n",
+						pl->sd));
+					pl->depth = 1;
+					pl->net = 0;
+				}
+			} else if (rx_txid != slot->txid) {
+				for (i = 0; i < pl->stale; i++)
+					if (pl->stale_txids[i] == rx_txid)
+						break;
+				dlp_response_free(res);
+				res = NULL;
+				if (i < pl->stale) {
+					/* late answer to a request we re-sent */
+					pl->stale_txids[i] = pl->stale_txids[--pl->stale];
+					continue;
+				}
+				if (pl->in_flight > 1) {
+					pipeline_fallback(pl);
+					if ((result = pipeline_pump(pl)) < 0)
+						break;
+					continue;
+				}
+				LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
+					"DLP sd=%d pipeline: got txid 0x%02x, expected 0x%02x\n",
+					pl->sd, rx_txid, slot->txid));
+				result = pi_set_error(pl->sd, PI_ERR_DLP_COMMAND);
+				break;
+			}
+		}
+
+		result = dlp_response_check(pl->sd, slot->req->cmd, res, (int)bytes);
+		break;
+	}
+
+	if (slot->req->cmd == dlpFuncVFSFileRead) {
+		if (result >= 0 && slot->completion.buffer != NULL) {
+			pi_buffer_clear(slot->completion.buffer);
+			len = slot->len;
+			total = 0;
+			do {
+				bytes = pi_read(pl->sd, slot->completion.buffer, len);
+				if (bytes > 0) {
+					len -= bytes;
+					total += bytes;
+				}
+			} while (bytes > 0 && len > 0);
+			result = (bytes >= 0) ? (int)total : (int)bytes;
+		}
+		freeze_txid = 0;
+		size = sizeof(int);
+		pi_setsockopt(pl->sd, PI_LEVEL_PADP, PI_PADP_FREEZE_TXID,
+			&freeze_txid, &size);
+	}
+
+	slot->res = res;
+	slot->result = result;
+	slot->state = PIPE_RECEIVED;
+	if (pl->in_flight > 0)
+		pl->in_flight--;
+
+	/* pick up the txid sequence where a plain dlp_exec() expects it */
+	if (pl->in_flight == 0 && pl->net)
+		pipeline_set_txid(pl, pl->next_txid);
+}
+
+
+/***************************************************************************
+ *
+ * Function:	pipeline_submit
+ *
+ * Summary:	appends a request to the pipeline and sends what can be sent
+ *
+ * Parameters:	dlpPipeline*, dlpRequest* (owned by the pipeline from now
+ *		on), index, buffer, context
+ *
+ * Returns:     new slot or NULL if out of memory
+ *
+ ***************************************************************************/
+static struct dlpPipelineSlot *
+pipeline_submit (struct dlpPipeline *pl, struct dlpRequest *req, int index,
+	pi_buffer_t *buffer, void *context)
+{
+	int i;
+	struct dlpPipelineSlot *slot, *slots;
+
+	if (pl->count == pl->allocated) {
+		slots = (struct dlpPipelineSlot *) malloc
+			(sizeof (struct dlpPipelineSlot) * pl->allocated * 2);
+		if (slots == NULL) {
+			dlp_request_free(req);
+			return NULL;
+		}
+		for (i = 0; i < pl->count; i++)
+			slots[i] = *PIPE_SLOT(pl, i);
+		free(pl->slots);
+		pl->slots = slots;
+		pl->head = 0;
+		pl->allocated *= 2;
+	}
+
+	slot = PIPE_SLOT(pl, pl->count);
+	pl->count++;
+
+	memset(slot, 0, sizeof (struct dlpPipelineSlot));
+	slot->state = PIPE_QUEUED;
+	slot->req = req;
+	slot->completion.cmd = req->cmd;
+	slot->completion.index = index;
+	slot->completion.buffer = buffer;
+	slot->completion.context = context;
+
+	return slot;
+}
+
+dlpPipeline *
+dlp_PipelineNew(int sd, int depth)
+{
+	struct dlpPipeline *pl;
+	int pipelining = 1;
+	size_t size = sizeof(int);
+
+	TraceX(dlp_PipelineNew, "depth=%d", depth);
+
+	pl = (struct dlpPipeline *) calloc (1, sizeof (struct dlpPipeline));
+	if (pl == NULL)
+		return NULL;
+
+	if (depth < 1)
+		depth = 1;
+
+	pl->sd = sd;
+	pl->allocated = depth < 8 ? 16 : depth * 2;
+	pl->slots = (struct dlpPipelineSlot *) malloc
+		(sizeof (struct dlpPipelineSlot) * pl->allocated);
+	pl->stale_txids = (int *) malloc (sizeof (int) * depth);
+	if (pl->slots == NULL || pl->stale_txids == NULL) {
+		free(pl->slots);
+		free(pl->stale_txids);
+		free(pl);
+		return NULL;
+	}
+
+	if (pi_protocol(sd, PI_LEVEL_NET) != NULL) {
+		pl->net = 1;
+		pi_getsockopt(sd, PI_LEVEL_NET, PI_NET_PIPELINING, &pipelining, &size);
+		size = sizeof(int);
+		pi_getsockopt(sd, PI_LEVEL_NET, PI_NET_TXID, &pl->next_txid, &size);
+	}
+	pl->depth = (pl->net && pipelining) ? depth : 1;
+
+	return pl;
+}
+
+void
+dlp_PipelineFree(dlpPipeline *pl)
+{
+	struct dlpPipelineSlot *slot;
+
+	if (pl == NULL)
+		return;
+
+	while (pl->in_flight > 0 && pl->error == 0)
+		pipeline_receive(pl);
+
+	while (pl->count > 0) {
+		slot = PIPE_SLOT(pl, 0);
+		dlp_request_free(slot->req);
+		dlp_response_free(slot->res);
+		pl->head = (pl->head + 1) % pl->allocated;
+		pl->count--;
+	}
+
+	free(pl->slots);
+	free(pl->stale_txids);
+	free(pl);
+}
+
+int
+dlp_PipelineDepth(dlpPipeline *pl)
+{
+	return pipeline_depth(pl);
+}
+
+int
+dlp_PipelineReadRecordByIndex(dlpPipeline *pl, int dbhandle, int recindex,
+	pi_buffer_t *buffer, void *context)
+{
+	int sd = pl->sd;
+	struct dlpRequest *req;
+	struct dlpPipelineSlot *slot;
+
+	TraceX(dlp_PipelineReadRecordByIndex, "recindex=%d", recindex);
+	pi_reset_errors(sd);
+
+	if (pi_version(sd) >= 0x0104) {
+		req = dlp_request_new_with_argid(dlpFuncReadRecordEx, 0x21, 1, 12);
+		if (req == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
+		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0x00);
+		set_short(DLP_REQUEST_DATA(req, 0, 2), recindex);
+		set_long(DLP_REQUEST_DATA(req, 0, 4), 0);
+		set_long(DLP_REQUEST_DATA(req, 0, 8), pi_maxrecsize(sd));
+	} else {
+		req = dlp_request_new_with_argid(dlpFuncReadRecord, 0x21, 1, 8);
+		if (req == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
+		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0x00);
+		set_short(DLP_REQUEST_DATA(req, 0, 2), recindex);
+		set_short(DLP_REQUEST_DATA(req, 0, 4), 0);
+		set_short(DLP_REQUEST_DATA(req, 0, 6), buffer ?
+			pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE : 0);
+	}
+
+	slot = pipeline_submit(pl, req, recindex, buffer, context);
+	if (slot == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	slot->dbhandle = dbhandle;
+	slot->large = (req->cmd == dlpFuncReadRecordEx);
+
+	return pipeline_pump(pl);
+}
+
+int
+dlp_PipelineReadResourceByIndex(dlpPipeline *pl, int dbhandle, int resindex,
+	pi_buffer_t *buffer, void *context)
+{
+	int sd = pl->sd;
+	struct dlpRequest *req;
+	struct dlpPipelineSlot *slot;
+
+	TraceX(dlp_PipelineReadResourceByIndex, "resindex=%d", resindex);
+	pi_reset_errors(sd);
+
+	if (pi_version(sd) >= 0x0104) {
+		req = dlp_request_new (dlpFuncReadResourceEx, 1, 12);
+		if (req == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
+		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0);
+		set_short(DLP_REQUEST_DATA(req, 0, 2), resindex);
+		set_long(DLP_REQUEST_DATA(req, 0, 4), 0);
+		set_long(DLP_REQUEST_DATA(req, 0, 8), pi_maxrecsize(sd));
+	} else {
+		req = dlp_request_new (dlpFuncReadResource, 1, 8);
+		if (req == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
+		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0);
+		set_short(DLP_REQUEST_DATA(req, 0, 2), resindex);
+		set_long(DLP_REQUEST_DATA(req, 0, 4),
+			pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE);
+	}
+
+	slot = pipeline_submit(pl, req, resindex, buffer, context);
+	if (slot == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	slot->dbhandle = dbhandle;
+	slot->large = (req->cmd == dlpFuncReadResourceEx);
+
+	return pipeline_pump(pl);
+}
+
+int
+dlp_PipelineVFSFileRead(dlpPipeline *pl, FileRef fileRef, pi_buffer_t *buffer,
+	size_t len, void *context)
+{
+	int sd = pl->sd;
+	struct dlpRequest *req;
+	struct dlpPipelineSlot *slot;
+
+	RequireDLPVersion(sd,1,2);
+	TraceX(dlp_PipelineVFSFileRead, "fileRef=%ld len=%ld", (long)fileRef, (long)len);
+	pi_reset_errors(sd);
+
+	req = dlp_request_new (dlpFuncVFSFileRead, 1, 8);
+	if (req == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	set_long (DLP_REQUEST_DATA (req, 0, 0), fileRef);
+	set_long (DLP_REQUEST_DATA (req, 0, 4), len);
+
+	slot = pipeline_submit(pl, req, 0, buffer, context);
+	if (slot == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	slot->len = len;
+
+	return pipeline_pump(pl);
+}
+
+int
+dlp_PipelineFindDBByName(dlpPipeline *pl, int cardno, PI_CONST char *name,
+	void *context)
+{
+	int sd = pl->sd;
+	struct dlpRequest *req;
+
+	TraceX(dlp_PipelineFindDBByName, "cardno=%d name='%s'", cardno, name);
+	pi_reset_errors(sd);
+
+	if (pi_version(sd) < 0x0102)
+		return pi_set_error(sd, PI_ERR_DLP_UNSUPPORTED);
+
+	req = dlp_request_new(dlpFuncFindDB, 1, 2 + (strlen(name) + 1));
+	if (req == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	set_byte(DLP_REQUEST_DATA(req, 0, 0), dlpFindDBOptFlagGetSize);
+	set_byte(DLP_REQUEST_DATA(req, 0, 1), cardno);
+	strcpy(DLP_REQUEST_DATA(req, 0, 2), name);
+
+	if (pipeline_submit(pl, req, 0, NULL, context) == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	return pipeline_pump(pl);
+}
+
+int
+dlp_PipelineComplete(dlpPipeline *pl, struct dlpPipelineCompletion *c)
+{
+	int sd = pl->sd, data_len, hdr, maxBufferSize;
+	struct dlpPipelineSlot *slot;
+	struct dlpResponse *res;
+
+	if (pl->count == 0)
+		return 0;
+
+	slot = PIPE_SLOT(pl, 0);
+	if (slot->state == PIPE_QUEUED)
+		pipeline_pump(pl);
+	if (slot->state == PIPE_SENT)
+		pipeline_receive(pl);
+	if (slot->state == PIPE_QUEUED)
+		slot->result = pl->error;	/* could not be sent */
+
+	res = slot->res;
+	maxBufferSize = pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE;
+	*c = slot->completion;
+	c->result = slot->result;
+
+	switch (slot->req->cmd) {
+		case dlpFuncReadRecord:
+		case dlpFuncReadRecordEx:
+			if (slot->result <= 0)
+				break;
+			hdr = slot->large ? 14 : 10;
+			data_len = res->argv[0]->len - hdr;
+			c->recuid = get_long(DLP_RESPONSE_DATA(res, 0, 0));
+			c->attr = get_byte(DLP_RESPONSE_DATA(res, 0, hdr - 2));
+			c->category = get_byte(DLP_RESPONSE_DATA(res, 0, hdr - 1));
+			c->result = data_len;
+			if (c->buffer == NULL)
+				break;
+			if (data_len == maxBufferSize && !slot->large) {
+				/* near-maximum record: let dlp_ReadRecordByIndex()
+				   fetch it in two steps once the link is quiet */
+				while (pl->in_flight > 0)
+					pipeline_receive(pl);
+				c->result = dlp_ReadRecordByIndex(sd, slot->dbhandle,
+					c->index, c->buffer, &c->recuid, &c->attr,
+					&c->category);
+				if (pl->net) {
+					size_t size = sizeof(int);
+					pi_getsockopt(sd, PI_LEVEL_NET, PI_NET_TXID,
+						&pl->next_txid, &size);
+				}
+				break;
+			}
+			pi_buffer_clear(c->buffer);
+			pi_buffer_append(c->buffer, DLP_RESPONSE_DATA(res, 0, hdr),
+				(size_t)data_len);
+			break;
+
+		case dlpFuncReadResource:
+		case dlpFuncReadResourceEx:
+			if (slot->result <= 0)
+				break;
+			hdr = slot->large ? 12 : 10;
+			data_len = res->argv[0]->len - hdr;
+			c->type = get_long(DLP_RESPONSE_DATA(res, 0, 0));
+			c->resID = get_short(DLP_RESPONSE_DATA(res, 0, 4));
+			c->result = data_len;
+			if (c->buffer == NULL)
+				break;
+			if (data_len == maxBufferSize && !slot->large) {
+				while (pl->in_flight > 0)
+					pipeline_receive(pl);
+				c->result = dlp_ReadResourceByIndex(sd, slot->dbhandle,
+					(unsigned int)c->index, c->buffer, &c->type,
+					&c->resID);
+				if (pl->net) {
+					size_t size = sizeof(int);
+					pi_getsockopt(sd, PI_LEVEL_NET, PI_NET_TXID,
+						&pl->next_txid, &size);
+				}
+				break;
+			}
+			pi_buffer_clear(c->buffer);
+			pi_buffer_append(c->buffer, DLP_RESPONSE_DATA(res, 0, hdr),
+				(size_t)data_len);
+			break;
+
+		case dlpFuncFindDB:
+			if (slot->result > 0)
+				dlp_decode_finddb_response(res, NULL, NULL, NULL,
+					NULL, &c->size);
+			break;
+
+		default:
+			break;
+	}
+
+	dlp_request_free(slot->req);
+	dlp_response_free(slot->res);
+	pl->head = (pl->head + 1) % pl->allocated;
+	pl->count--;
+
+	pipeline_pump(pl);
+
+	return 1;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_read_batch
+ *
+ * Summary:	common code for dlp_ReadRecordsBatch() and
+ *		dlp_ReadResourcesBatch()
+ *
+ * Parameters:	sd, dbhandle, resources flag, first index, count, depth,
+ *		buffer, callback, userdata
+ *
+ * Returns:     number of entries read or negative on error
+ *
+ ***************************************************************************/
+static int
+dlp_read_batch(int sd, int dbhandle, int resources, int first, int count,
+	int depth, pi_buffer_t *buffer, dlp_batch_callback callback,
+	void *userdata)
+{
+	int submitted = 0, completed = 0, result = 0, err, palmoserr;
+	dlpPipeline *pl;
+	struct dlpPipelineCompletion entry;
+
+	pl = dlp_PipelineNew(sd, depth);
+	if (pl == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	while (completed < count) {
+		/* keep the pipeline full, but don't queue the whole range */
+		while (submitted < count && submitted - completed < depth) {
+			if (resources)
+				result = dlp_PipelineReadResourceByIndex(pl, dbhandle,
+					first + submitted, buffer, NULL);
+			else
+				result = dlp_PipelineReadRecordByIndex(pl, dbhandle,
+					first + submitted, buffer, NULL);
+			if (result < 0)
+				break;
+			submitted++;
+		}
+		if (result < 0 || dlp_PipelineComplete(pl, &entry) == 0)
+			break;
+
+		if (entry.result < 0) {
+			result = entry.result;
+			break;
+		}
+		completed++;
+		if (callback != NULL &&
+				(result = callback(sd, &entry, userdata)) < 0)
+			break;
+	}
+
+	/* draining what's still in flight must not clobber the error */
+	err = pi_error(sd);
+	palmoserr = pi_palmos_error(sd);
+	dlp_PipelineFree(pl);
+	pi_set_error(sd, err);
+	pi_set_palmos_error(sd, palmoserr);
+
+	return result < 0 ? result : completed;
+}
+
+int
+dlp_ReadRecordsBatch(int sd, int dbhandle, int first, int count, int depth,
+	pi_buffer_t *buffer, dlp_batch_callback callback, void *userdata)
+{
+	TraceX(dlp_ReadRecordsBatch, "first=%d count=%d depth=%d", first, count, depth);
+	pi_reset_errors(sd);
+
+	return dlp_read_batch(sd, dbhandle, 0, first, count, depth, buffer,
+		callback, userdata);
+}
+
+int
+dlp_ReadResourcesBatch(int sd, int dbhandle, int first, int count, int depth,
+	pi_buffer_t *buffer, dlp_batch_callback callback, void *userdata)
+{
+	TraceX(dlp_ReadResourcesBatch, "first=%d count=%d depth=%d", first, count, depth);
+	pi_reset_errors(sd);
+
+	return dlp_read_batch(sd, dbhandle, 1, first, count, depth, buffer,
+		callback, userdata);
+}
+
+int
+dlp_ReadDBCatalog(int sd, int cardno, int flags, pi_buffer_t *dblist,
+	pi_buffer_t *sizes)
+{
+	int result, i, count, submitted, completed, err, palmoserr;
+	struct DBInfo *info;
+	struct DBSizeInfo *size;
+	struct dlpPipelineCompletion entry;
+	dlpPipeline *pl;
+	pi_buffer_t *buf;
+
+	TraceX(dlp_ReadDBCatalog, "cardno=%d flags=0x%04x", cardno, flags);
+	pi_reset_errors(sd);
+
+	buf = pi_buffer_new(DLP_BUF_SIZE);
+	if (buf == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	pi_buffer_clear(dblist);
+	for (i = 0;;) {
+		result = dlp_ReadDBList(sd, cardno, flags | dlpDBListMultiple,
+			i, buf);
+		if (result == PI_ERR_DLP_PALMOS
+		    && pi_palmos_error(sd) == dlpErrNotFound)
+			break;
+		if (result < 0)
+			goto done;
+		/* a reply with no database in it ends the list too: what
+		   came so far is the catalog, none at all an empty one */
+		if (buf->used == 0)
+			break;
+		if (pi_buffer_append_buffer(dblist, buf) == NULL) {
+			result = pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+			goto done;
+		}
+
+		/* the device tells when this was the last batch, which
+		   saves asking for one more */
+		info = (struct DBInfo *)(buf->data + buf->used
+			- sizeof(struct DBInfo));
+		if (!info->more)
+			break;
+		i = info->index + 1;
+	}
+	pi_reset_errors(sd);
+
+	count = (int)(dblist->used / sizeof(struct DBInfo));
+	result = count;
+	if (sizes == NULL)
+		goto done;
+
+	pi_buffer_clear(sizes);
+	if (pi_buffer_expect(sizes, count * sizeof(struct DBSizeInfo)) == NULL) {
+		result = pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+		goto done;
+	}
+	memset(sizes->data, 0, count * sizeof(struct DBSizeInfo));
+	sizes->used = count * sizeof(struct DBSizeInfo);
+	if (pi_version(sd) < 0x0102 || count == 0)
+		goto done;
+
+	pl = dlp_PipelineNew(sd, 8);
+	if (pl == NULL) {
+		result = pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+		goto done;
+	}
+	info = (struct DBInfo *)dblist->data;
+	size = (struct DBSizeInfo *)sizes->data;
+	for (submitted = completed = 0; completed < count; completed++) {
+		while (submitted < count && submitted - completed < 8) {
+			if ((result = dlp_PipelineFindDBByName(pl, cardno,
+					info[submitted].name, NULL)) < 0)
+				break;
+			submitted++;
+		}
+		if (result < 0 || dlp_PipelineComplete(pl, &entry) == 0)
+			break;
+		if (entry.result >= 0)
+			size[completed] = entry.size;
+		else if (entry.result != PI_ERR_DLP_PALMOS) {
+			/* a database that went away keeps a zeroed size,
+			   a broken link ends the catalog */
+			result = entry.result;
+			break;
+		}
+	}
+
+	err = pi_error(sd);
+	palmoserr = pi_palmos_error(sd);
+	dlp_PipelineFree(pl);
+	if (result < 0) {
+		pi_set_error(sd, err);
+		pi_set_palmos_error(sd, palmoserr);
+	} else {
+		pi_reset_errors(sd);
+		result = count;
+	}
+
+done:
+	pi_buffer_free(buf);
+	return result;
+}
+
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* ex: set tabstop=4 expandtab: */
 /* Local Variables: */
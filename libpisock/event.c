@@ -0,0 +1,728 @@
+/*
+ * $Id$
+ *
+ * event.c: Waiting on descriptors and timers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define PI_EVENT_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include "pi-debug.h"
+#include "pi-error.h"
+#include "pi-event.h"
+#include "pi-util.h"
+
+/* Timers are kept in a hashed timer wheel: a timer expiring at tick t
+   sits in slot t % PI_EVENT_SLOTS. Each tick only looks at one slot;
+   timers more than a turn of the wheel away stay in their slot until
+   the wheel comes round to their tick. */
+#define PI_EVENT_SLOTS		512
+
+/* Descriptors handled per epoll_wait() call */
+#define PI_EVENT_BATCH		64
+
+struct pi_event_timer {
+	long	expires;		/* tick */
+	pi_event_timer_handler handler;
+	void	*userdata;
+	struct pi_event_timer *next,
+		**pprev;
+};
+
+struct pi_event_watch {
+	int	events;			/* 0 if the descriptor isn't watched */
+	pi_event_handler handler;
+	void	*userdata;
+};
+
+struct pi_event_loop {
+#ifdef PI_EVENT_EPOLL
+	int	epfd;
+#else
+	struct pollfd *pfds;
+	int	pfds_size;
+#endif
+	struct pi_event_watch *watches;	/* indexed by descriptor */
+	int	watches_size,
+		watched,
+		timers,
+		stopped;
+
+	long	base,			/* clock when the loop was created */
+		tick;			/* last tick whose timers have run */
+	struct pi_event_timer *slots[PI_EVENT_SLOTS],
+		*expired;		/* timers being run */
+};
+
+
+/***********************************************************************
+ *
+ * Function:    event_now
+ *
+ * Summary:     current tick of a loop
+ *
+ * Parameters:  pi_event_loop_t*
+ *
+ * Returns:     Ticks since the loop was created
+ *
+ ***********************************************************************/
+static long
+event_now(pi_event_loop_t *loop)
+{
+	return (pi_clock_ms() - loop->base) / PI_EVENT_TICK;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    event_link
+ *
+ * Summary:     put a timer at the head of a list
+ *
+ * Parameters:  list head, timer
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+event_link(struct pi_event_timer **head, struct pi_event_timer *timer)
+{
+	timer->next = *head;
+	if (timer->next != NULL)
+		timer->next->pprev = &timer->next;
+	timer->pprev = head;
+	*head = timer;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    event_unlink
+ *
+ * Summary:     take a timer out of the list it is in
+ *
+ * Parameters:  timer
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+event_unlink(struct pi_event_timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    event_ready
+ *
+ * Summary:     translate poll() events to PI_EVENT_* flags
+ *
+ * Parameters:  revents, PI_EVENT_* flags waited for
+ *
+ * Returns:     PI_EVENT_* flags
+ *
+ ***********************************************************************/
+static int
+event_ready(int revents, int events)
+{
+	int	ready = 0;
+
+	if (revents & POLLIN)
+		ready |= PI_EVENT_READ;
+	if (revents & POLLOUT)
+		ready |= PI_EVENT_WRITE;
+	if (revents & (POLLERR | POLLHUP | POLLNVAL))
+		ready |= PI_EVENT_ERROR | events;
+
+	return ready;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_wait
+ *
+ * Summary:     wait until one descriptor is ready
+ *
+ * Parameters:  descriptor, PI_EVENT_* flags, timeout in milliseconds
+ *		(0 waits forever)
+ *
+ * Returns:     PI_EVENT_* flags ready, 0 on timeout, -1 on error
+ *
+ ***********************************************************************/
+int
+pi_event_wait(int fd, int events, int timeout)
+{
+	struct pollfd pfd;
+	int	result;
+
+	pfd.fd		= fd;
+	pfd.events	= ((events & PI_EVENT_READ) ? POLLIN : 0)
+			| ((events & PI_EVENT_WRITE) ? POLLOUT : 0);
+	pfd.revents	= 0;
+
+	result = poll(&pfd, 1, timeout == 0 ? -1 : timeout);
+	if (result <= 0)
+		return result;
+
+	if (pfd.revents & POLLNVAL) {
+		errno = EBADF;
+		return -1;
+	}
+	return event_ready(pfd.revents, events);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_loop_new
+ *
+ * Summary:     create an event loop
+ *
+ * Parameters:  None
+ *
+ * Returns:     pi_event_loop_t*, or NULL on failure
+ *
+ ***********************************************************************/
+pi_event_loop_t *
+pi_event_loop_new(void)
+{
+	pi_event_loop_t *loop;
+
+	loop = (pi_event_loop_t *)calloc(1, sizeof(pi_event_loop_t));
+	if (loop == NULL)
+		return NULL;
+
+#ifdef PI_EVENT_EPOLL
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		free(loop);
+		return NULL;
+	}
+#endif
+	loop->base = pi_clock_ms();
+
+	return loop;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_loop_free
+ *
+ * Summary:     free an event loop and its pending timers
+ *
+ * Parameters:  pi_event_loop_t*
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_event_loop_free(pi_event_loop_t *loop)
+{
+	struct pi_event_timer *timer;
+	int	i;
+
+	if (loop == NULL)
+		return;
+
+	for (i = 0; i < PI_EVENT_SLOTS; i++)
+		while ((timer = loop->slots[i]) != NULL) {
+			event_unlink(timer);
+			free(timer);
+		}
+
+#ifdef PI_EVENT_EPOLL
+	close(loop->epfd);
+#else
+	free(loop->pfds);
+#endif
+	free(loop->watches);
+	free(loop);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_add
+ *
+ * Summary:     watch a descriptor
+ *
+ * Parameters:  pi_event_loop_t*, descriptor, PI_EVENT_* flags, handler,
+ *		user data
+ *
+ * Returns:     0 on success, negative error code otherwise
+ *
+ ***********************************************************************/
+int
+pi_event_add(pi_event_loop_t *loop, int fd, int events,
+	pi_event_handler handler, void *userdata)
+{
+	struct pi_event_watch *watches;
+	int	size;
+
+	if (fd < 0 || handler == NULL || (events & ~PI_EVENT_ERROR) == 0) {
+		errno = EINVAL;
+		return PI_ERR_GENERIC_ARGUMENT;
+	}
+	if (fd < loop->watches_size && loop->watches[fd].events != 0) {
+		errno = EEXIST;
+		return PI_ERR_GENERIC_ARGUMENT;
+	}
+
+	if (fd >= loop->watches_size) {
+		size = loop->watches_size ? loop->watches_size : 64;
+		while (size <= fd)
+			size *= 2;
+		watches = (struct pi_event_watch *)realloc(loop->watches,
+			size * sizeof(struct pi_event_watch));
+		if (watches == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		memset(watches + loop->watches_size, 0,
+			(size - loop->watches_size)
+				* sizeof(struct pi_event_watch));
+		loop->watches = watches;
+		loop->watches_size = size;
+	}
+
+#ifdef PI_EVENT_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events	= ((events & PI_EVENT_READ) ? EPOLLIN : 0)
+				| ((events & PI_EVENT_WRITE) ? EPOLLOUT : 0);
+		ev.data.fd	= fd;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			return PI_ERR_GENERIC_SYSTEM;
+	}
+#endif
+
+	loop->watches[fd].events	= events & ~PI_EVENT_ERROR;
+	loop->watches[fd].handler	= handler;
+	loop->watches[fd].userdata	= userdata;
+	loop->watched++;
+
+	LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+		"EVENT watching fd %d for 0x%x\n", fd, events));
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_modify
+ *
+ * Summary:     change the events a watched descriptor is waited for
+ *
+ * Parameters:  pi_event_loop_t*, descriptor, PI_EVENT_* flags
+ *
+ * Returns:     0 on success, negative error code otherwise
+ *
+ ***********************************************************************/
+int
+pi_event_modify(pi_event_loop_t *loop, int fd, int events)
+{
+	if (fd < 0 || fd >= loop->watches_size
+	    || loop->watches[fd].events == 0
+	    || (events & ~PI_EVENT_ERROR) == 0) {
+		errno = EINVAL;
+		return PI_ERR_GENERIC_ARGUMENT;
+	}
+
+#ifdef PI_EVENT_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events	= ((events & PI_EVENT_READ) ? EPOLLIN : 0)
+				| ((events & PI_EVENT_WRITE) ? EPOLLOUT : 0);
+		ev.data.fd	= fd;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+			return PI_ERR_GENERIC_SYSTEM;
+	}
+#endif
+
+	loop->watches[fd].events = events & ~PI_EVENT_ERROR;
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_remove
+ *
+ * Summary:     stop watching a descriptor
+ *
+ * Parameters:  pi_event_loop_t*, descriptor
+ *
+ * Returns:     0 on success, negative error code otherwise
+ *
+ ***********************************************************************/
+int
+pi_event_remove(pi_event_loop_t *loop, int fd)
+{
+	if (fd < 0 || fd >= loop->watches_size
+	    || loop->watches[fd].events == 0) {
+		errno = EINVAL;
+		return PI_ERR_GENERIC_ARGUMENT;
+	}
+
+#ifdef PI_EVENT_EPOLL
+	{
+		struct epoll_event ev;	/* kernels before 2.6.9 want one */
+
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+	}
+#endif
+
+	loop->watches[fd].events = 0;
+	loop->watched--;
+
+	LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+		"EVENT no longer watching fd %d\n", fd));
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_timer_add
+ *
+ * Summary:     start a one-shot timer
+ *
+ * Parameters:  pi_event_loop_t*, timeout in milliseconds, handler,
+ *		user data
+ *
+ * Returns:     pi_event_timer_t*, or NULL on failure
+ *
+ ***********************************************************************/
+pi_event_timer_t *
+pi_event_timer_add(pi_event_loop_t *loop, int timeout,
+	pi_event_timer_handler handler, void *userdata)
+{
+	pi_event_timer_t *timer;
+	long	ticks;
+
+	if (handler == NULL || timeout < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	timer = (pi_event_timer_t *)malloc(sizeof(pi_event_timer_t));
+	if (timer == NULL)
+		return NULL;
+
+	/* never expire early: round up, and count the tick in progress
+	   as already gone */
+	ticks = (timeout + PI_EVENT_TICK - 1) / PI_EVENT_TICK;
+	timer->expires	= event_now(loop) + ticks + 1;
+	timer->handler	= handler;
+	timer->userdata	= userdata;
+	event_link(&loop->slots[timer->expires % PI_EVENT_SLOTS], timer);
+	loop->timers++;
+
+	return timer;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_timer_cancel
+ *
+ * Summary:     cancel and free a timer
+ *
+ * Parameters:  pi_event_loop_t*, pi_event_timer_t*
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_event_timer_cancel(pi_event_loop_t *loop, pi_event_timer_t *timer)
+{
+	if (timer == NULL)
+		return;
+
+	event_unlink(timer);
+	free(timer);
+	loop->timers--;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    event_expire
+ *
+ * Summary:     run the timers that expired since the last call
+ *
+ * Parameters:  pi_event_loop_t*
+ *
+ * Returns:     Number of timers run
+ *
+ ***********************************************************************/
+static int
+event_expire(pi_event_loop_t *loop)
+{
+	struct pi_event_timer *timer,
+		*next;
+	long	now,
+		tick,
+		last;
+	int	count = 0;
+
+	now = event_now(loop);
+	if (now <= loop->tick)
+		return 0;
+
+	/* after a long stall, one turn of the wheel sees every timer */
+	last = now;
+	if (last - loop->tick > PI_EVENT_SLOTS)
+		last = loop->tick + PI_EVENT_SLOTS;
+
+	for (tick = loop->tick + 1; tick <= last; tick++) {
+		/* timers that have come due move to the expired list,
+		   where they can still be cancelled by earlier handlers */
+		for (timer = loop->slots[tick % PI_EVENT_SLOTS];
+		     timer != NULL; timer = next) {
+			next = timer->next;
+			if (timer->expires <= now) {
+				event_unlink(timer);
+				event_link(&loop->expired, timer);
+			}
+		}
+
+		while ((timer = loop->expired) != NULL) {
+			event_unlink(timer);
+			loop->timers--;
+			timer->handler(loop, timer, timer->userdata);
+			free(timer);
+			count++;
+		}
+	}
+	loop->tick = now;
+
+	return count;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    event_timeout
+ *
+ * Summary:     how long a loop may wait before its next timer is due
+ *
+ * Parameters:  pi_event_loop_t*, longest wait in milliseconds (0 for
+ *		no limit)
+ *
+ * Returns:     Milliseconds, -1 for no limit
+ *
+ ***********************************************************************/
+static int
+event_timeout(pi_event_loop_t *loop, int timeout)
+{
+	long	tick,
+		wait;
+
+	if (loop->timers > 0) {
+		/* the first slot holding a timer; timers further than a
+		   turn away only make the loop wake up early */
+		for (tick = loop->tick + 1;
+		     tick <= loop->tick + PI_EVENT_SLOTS; tick++)
+			if (loop->slots[tick % PI_EVENT_SLOTS] != NULL)
+				break;
+
+		wait = tick * PI_EVENT_TICK - (pi_clock_ms() - loop->base);
+		if (wait < 0)
+			wait = 0;
+		if (timeout == 0 || wait < timeout)
+			return (int) wait;
+	}
+
+	return timeout == 0 ? -1 : timeout;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_loop_run_once
+ *
+ * Summary:     wait for events once and call their handlers
+ *
+ * Parameters:  pi_event_loop_t*, longest wait in milliseconds (0 until
+ *		something happens, negative not to wait)
+ *
+ * Returns:     Number of handlers called, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_event_loop_run_once(pi_event_loop_t *loop, int timeout)
+{
+	struct pi_event_watch *watch;
+	int	wait,
+		ready,
+		count = 0,
+		fd,
+		i;
+
+	wait = timeout < 0 ? 0 : event_timeout(loop, timeout);
+
+#ifdef PI_EVENT_EPOLL
+	{
+		struct epoll_event evs[PI_EVENT_BATCH];
+		int	revents;
+
+		ready = epoll_wait(loop->epfd, evs, PI_EVENT_BATCH, wait);
+		if (ready < 0 && errno != EINTR)
+			return PI_ERR_GENERIC_SYSTEM;
+
+		for (i = 0; i < ready; i++) {
+			fd = evs[i].data.fd;
+			watch = &loop->watches[fd];
+			if (watch->events == 0)
+				continue;	/* removed by a handler */
+
+			revents = 0;
+			if (evs[i].events & EPOLLIN)
+				revents |= POLLIN;
+			if (evs[i].events & EPOLLOUT)
+				revents |= POLLOUT;
+			if (evs[i].events & (EPOLLERR | EPOLLHUP))
+				revents |= POLLERR;
+			watch->handler(loop, fd,
+				event_ready(revents, watch->events),
+				watch->userdata);
+			count++;
+		}
+	}
+#else
+	{
+		struct pollfd *pfds;
+		int	n = 0;
+
+		if (loop->watched > loop->pfds_size) {
+			pfds = (struct pollfd *)realloc(loop->pfds,
+				loop->watched * sizeof(struct pollfd));
+			if (pfds == NULL)
+				return PI_ERR_GENERIC_MEMORY;
+			loop->pfds = pfds;
+			loop->pfds_size = loop->watched;
+		}
+		for (fd = 0; fd < loop->watches_size && n < loop->watched; fd++) {
+			watch = &loop->watches[fd];
+			if (watch->events == 0)
+				continue;
+			loop->pfds[n].fd	= fd;
+			loop->pfds[n].events	=
+				((watch->events & PI_EVENT_READ) ? POLLIN : 0)
+				| ((watch->events & PI_EVENT_WRITE) ? POLLOUT : 0);
+			loop->pfds[n].revents	= 0;
+			n++;
+		}
+
+		ready = poll(loop->pfds, n, wait);
+		if (ready < 0 && errno != EINTR)
+			return PI_ERR_GENERIC_SYSTEM;
+
+		for (i = 0; i < n && ready > 0; i++) {
+			if (loop->pfds[i].revents == 0)
+				continue;
+			ready--;
+			fd = loop->pfds[i].fd;
+			watch = &loop->watches[fd];
+			if (watch->events == 0)
+				continue;	/* removed by a handler */
+			watch->handler(loop, fd,
+				event_ready(loop->pfds[i].revents,
+					watch->events),
+				watch->userdata);
+			count++;
+		}
+	}
+#endif
+
+	return count + event_expire(loop);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_loop_run
+ *
+ * Summary:     handle events until the loop is stopped or has nothing
+ *		left to wait for
+ *
+ * Parameters:  pi_event_loop_t*
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_event_loop_run(pi_event_loop_t *loop)
+{
+	int	result;
+
+	loop->stopped = 0;
+	while (!loop->stopped && (loop->watched > 0 || loop->timers > 0))
+		if ((result = pi_event_loop_run_once(loop, 0)) < 0)
+			return result;
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_event_loop_stop
+ *
+ * Summary:     make pi_event_loop_run() return
+ *
+ * Parameters:  pi_event_loop_t*
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_event_loop_stop(pi_event_loop_t *loop)
+{
+	loop->stopped = 1;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
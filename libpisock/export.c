@@ -0,0 +1,551 @@
+/*
+ * $Id$
+ *
+ * export.c: Converting database records to files on a worker pool
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-error.h"
+#include "pi-threadsafe.h"
+#include "pi-export.h"
+
+/* Records read ahead by pi_export_records_from_dlp() */
+#define PI_EXPORT_READ_DEPTH	8
+
+/* Pictures in flight per job: one being converted, one waiting */
+#define PI_EXPORT_BACKLOG	2
+
+enum pi_export_state {
+	PI_EXPORT_QUEUED,
+	PI_EXPORT_RUNNING,
+	PI_EXPORT_FINISHED
+};
+
+struct pi_export_job {
+	pi_export_work work;
+	pi_export_done done;
+	void	*job;
+	int	result;
+	enum pi_export_state state;
+	struct pi_export_job *next;
+};
+
+struct pi_export {
+	int	jobs,			/* 1: run pictures as they're queued */
+		pending,		/* jobs queued, not yet reported */
+		failures,
+		stopping;
+
+	/* in queue order; next_work is the first one no worker took yet */
+	struct pi_export_job *head,
+		*tail,
+		*next_work;
+
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond,	/* a job was queued, or stopping */
+		done_cond;		/* a job finished */
+	pthread_t *threads;
+	int	threads_started;
+#endif
+};
+
+struct pi_export_record {
+	void	*data;
+	size_t	size;
+};
+
+struct pi_export_records {
+	struct pi_export_record *entries;
+	int	count,
+		allocated;
+};
+
+#if HAVE_PTHREAD
+/***********************************************************************
+ *
+ * Function:    pi_export_thread
+ *
+ * Summary:     Worker: run queued jobs in queue order until the pool
+ *		is stopped
+ *
+ * Parameters:  export pool
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+pi_export_thread(void *arg)
+{
+	pi_export_t *pool = (pi_export_t *)arg;
+	struct pi_export_job *job;
+	int	result;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->next_work == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if ((job = pool->next_work) == NULL)
+			break;
+		pool->next_work = job->next;
+		job->state = PI_EXPORT_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		result = job->work(job->job);
+
+		pthread_mutex_lock(&pool->lock);
+		job->result = result;
+		job->state = PI_EXPORT_FINISHED;
+		pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_reap
+ *
+ * Summary:     Run the completion callbacks of the finished jobs at the
+ *		head of the queue. Called and returns with the pool
+ *		locked; the callbacks run unlocked.
+ *
+ * Parameters:  export pool
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_export_reap(pi_export_t *pool)
+{
+	struct pi_export_job *job;
+
+	while ((job = pool->head) != NULL && job->state == PI_EXPORT_FINISHED) {
+		pool->head = job->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		pool->pending--;
+		if (job->result < 0)
+			pool->failures++;
+
+		pthread_mutex_unlock(&pool->lock);
+		if (job->done)
+			job->done(job->job, job->result);
+		free(job);
+		pthread_mutex_lock(&pool->lock);
+	}
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    pi_export_new
+ *
+ * Summary:     Create an export pool and start its worker threads
+ *
+ * Parameters:  number of pictures converted at the same time
+ *
+ * Returns:     the pool, or NULL if out of memory
+ *
+ ***********************************************************************/
+pi_export_t *
+pi_export_new(int jobs)
+{
+	pi_export_t *pool;
+
+	pool = (pi_export_t *) calloc(1, sizeof(pi_export_t));
+	if (pool == NULL)
+		return NULL;
+	pool->jobs = 1;
+
+#if HAVE_PTHREAD
+	if (jobs > 1) {
+		pool->threads = (pthread_t *) malloc(jobs * sizeof(pthread_t));
+		if (pool->threads == NULL) {
+			free(pool);
+			return NULL;
+		}
+		pthread_mutex_init(&pool->lock, NULL);
+		pthread_cond_init(&pool->work_cond, NULL);
+		pthread_cond_init(&pool->done_cond, NULL);
+
+		while (pool->threads_started < jobs
+		       && pthread_create(&pool->threads[pool->threads_started],
+				NULL, pi_export_thread, pool) == 0)
+			pool->threads_started++;
+
+		/* with no worker at all, jobs run as they're queued */
+		if (pool->threads_started > 0) {
+			pool->jobs = pool->threads_started;
+		} else {
+			pthread_cond_destroy(&pool->done_cond);
+			pthread_cond_destroy(&pool->work_cond);
+			pthread_mutex_destroy(&pool->lock);
+		}
+	}
+#endif
+
+	return pool;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_queue
+ *
+ * Summary:     Queue a picture, running the completion callbacks of
+ *		the pictures finished so far, and wait while the pool
+ *		is full
+ *
+ * Parameters:  export pool, work function, completion callback or NULL,
+ *		value passed to both
+ *
+ * Returns:     0, or a negative error code if out of memory
+ *
+ ***********************************************************************/
+int
+pi_export_queue(pi_export_t *pool, pi_export_work work,
+	pi_export_done done, void *data)
+{
+#if HAVE_PTHREAD
+	struct pi_export_job *job;
+
+	if (pool->threads_started > 0) {
+		job = (struct pi_export_job *)
+			calloc(1, sizeof(struct pi_export_job));
+		if (job == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		job->work = work;
+		job->done = done;
+		job->job = data;
+		job->state = PI_EXPORT_QUEUED;
+
+		pthread_mutex_lock(&pool->lock);
+		if (pool->tail)
+			pool->tail->next = job;
+		else
+			pool->head = job;
+		pool->tail = job;
+		if (pool->next_work == NULL)
+			pool->next_work = job;
+		pool->pending++;
+		pthread_cond_signal(&pool->work_cond);
+
+		pi_export_reap(pool);
+		while (pool->pending >= PI_EXPORT_BACKLOG * pool->jobs) {
+			pthread_cond_wait(&pool->done_cond, &pool->lock);
+			pi_export_reap(pool);
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		return 0;
+	}
+#endif
+
+	{
+		int	result = work(data);
+
+		if (result < 0)
+			pool->failures++;
+		if (done)
+			done(data, result);
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_finish
+ *
+ * Summary:     Wait for every queued picture, run the remaining
+ *		completion callbacks and free the pool
+ *
+ * Parameters:  export pool
+ *
+ * Returns:     number of pictures whose work function failed
+ *
+ ***********************************************************************/
+int
+pi_export_finish(pi_export_t *pool)
+{
+	int	failures;
+
+#if HAVE_PTHREAD
+	if (pool->threads_started > 0) {
+		int	i;
+
+		pthread_mutex_lock(&pool->lock);
+		for (;;) {
+			pi_export_reap(pool);
+			if (pool->head == NULL)
+				break;
+			pthread_cond_wait(&pool->done_cond, &pool->lock);
+		}
+		pool->stopping = 1;
+		pthread_cond_broadcast(&pool->work_cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		for (i = 0; i < pool->threads_started; i++)
+			pthread_join(pool->threads[i], NULL);
+
+		pthread_cond_destroy(&pool->done_cond);
+		pthread_cond_destroy(&pool->work_cond);
+		pthread_mutex_destroy(&pool->lock);
+	}
+	free(pool->threads);
+#endif
+
+	failures = pool->failures;
+	free(pool);
+
+	return failures;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_new
+ *
+ * Summary:     Create an empty set of records
+ *
+ * Parameters:  None
+ *
+ * Returns:     the set, or NULL if out of memory
+ *
+ ***********************************************************************/
+pi_export_records_t *
+pi_export_records_new(void)
+{
+	return (pi_export_records_t *)
+		calloc(1, sizeof(pi_export_records_t));
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_free
+ *
+ * Summary:     Free a set of records and the copies of their data
+ *
+ * Parameters:  set of records, or NULL
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_export_records_free(pi_export_records_t *records)
+{
+	int	i;
+
+	if (records == NULL)
+		return;
+	for (i = 0; i < records->count; i++)
+		free(records->entries[i].data);
+	free(records->entries);
+	free(records);
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_add
+ *
+ * Summary:     Append a heap copy of a record
+ *
+ * Parameters:  set of records, record data, record size
+ *
+ * Returns:     index of the record, or a negative error code
+ *
+ ***********************************************************************/
+int
+pi_export_records_add(pi_export_records_t *records, const void *data,
+	size_t size)
+{
+	struct pi_export_record *entry;
+
+	if (records->count == records->allocated) {
+		int	allocated = records->allocated ? 2 * records->allocated : 16;
+
+		entry = (struct pi_export_record *) realloc(records->entries,
+			allocated * sizeof(struct pi_export_record));
+		if (entry == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		records->entries = entry;
+		records->allocated = allocated;
+	}
+
+	entry = &records->entries[records->count];
+	/* never a zero-sized allocation, so an empty record isn't NULL */
+	entry->data = malloc(size ? size : 1);
+	if (entry->data == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	if (size)
+		memcpy(entry->data, data, size);
+	entry->size = size;
+
+	return records->count++;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_from_file
+ *
+ * Summary:     Append a heap copy of every record of a database file,
+ *		whether it is mapped or not
+ *
+ * Parameters:  set of records, record database
+ *
+ * Returns:     number of records appended, or a negative error code
+ *
+ ***********************************************************************/
+int
+pi_export_records_from_file(pi_export_records_t *records, pi_file_t *pf)
+{
+	void	*data;
+	size_t	size;
+	int	entries,
+		i,
+		result;
+
+	pi_file_get_entries(pf, &entries);
+	for (i = 0; i < entries; i++) {
+		result = pi_file_read_record(pf, i, &data, &size, NULL, NULL,
+			NULL);
+		if (result < 0)
+			return result;
+		if ((result = pi_export_records_add(records, data, size)) < 0)
+			return result;
+	}
+
+	return entries;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_entry
+ *
+ * Summary:     Batch read callback for pi_export_records_from_dlp()
+ *
+ * Parameters:  socket, record read, set of records
+ *
+ * Returns:     0 to go on, negative to stop reading
+ *
+ ***********************************************************************/
+static int
+pi_export_records_entry(int sd, struct dlpPipelineCompletion *entry,
+	void *userdata)
+{
+	int	result;
+
+	result = pi_export_records_add((pi_export_records_t *)userdata,
+		entry->buffer->data, entry->buffer->used);
+
+	return result < 0 ? pi_set_error(sd, result) : 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_from_dlp
+ *
+ * Summary:     Append a copy of every record of a database open on the
+ *		handheld, reading a few records ahead
+ *
+ * Parameters:  set of records, socket, database handle
+ *
+ * Returns:     number of records appended, or a negative error code
+ *
+ ***********************************************************************/
+int
+pi_export_records_from_dlp(pi_export_records_t *records, int sd, int db)
+{
+	pi_buffer_t *buffer;
+	int	count,
+		result;
+
+	if ((result = dlp_ReadOpenDBInfo(sd, db, &count)) < 0)
+		return result;
+	if (count == 0)
+		return 0;
+
+	buffer = pi_buffer_new(DLP_BUF_SIZE);
+	if (buffer == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	result = dlp_ReadRecordsBatch(sd, db, 0, count, PI_EXPORT_READ_DEPTH,
+		buffer, pi_export_records_entry, records);
+	pi_buffer_free(buffer);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_count
+ *
+ * Summary:     Number of records in a set
+ *
+ * Parameters:  set of records
+ *
+ * Returns:     number of records
+ *
+ ***********************************************************************/
+int
+pi_export_records_count(pi_export_records_t *records)
+{
+	return records->count;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_export_records_get
+ *
+ * Summary:     Look a record up; the data stays valid until the set is
+ *		freed
+ *
+ * Parameters:  set of records, index, where to store the data and size
+ *
+ * Returns:     0, or PI_ERR_FILE_NOT_FOUND if there is no such record
+ *
+ ***********************************************************************/
+int
+pi_export_records_get(pi_export_records_t *records, int index,
+	void **data, size_t *size)
+{
+	if (index < 0 || index >= records->count)
+		return PI_ERR_FILE_NOT_FOUND;
+
+	*data = records->entries[index].data;
+	if (size)
+		*size = records->entries[index].size;
+
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -43,8 +43,10 @@
 #include "pi-inet.h"
 #include "pi-cmp.h"
 #include "pi-net.h"
+#include "pi-event.h"
 
 /* Declare prototypes */
+static pi_device_t *pi_inet_device_dup (pi_device_t *dev);
 static void pi_inet_device_free (pi_device_t *dev);
 static pi_protocol_t* pi_inet_protocol (pi_device_t *dev);
 static pi_protocol_t* pi_inet_protocol_dup (pi_protocol_t *prot);
@@ -78,6 +80,7 @@ pi_inet_device (int type)
 	}
 
 	if (dev != NULL && data != NULL) {
+		dev->dup 	= pi_inet_device_dup;
 		dev->free 	= pi_inet_device_free;
 		dev->protocol 	= pi_inet_protocol;	
 		dev->bind 	= pi_inet_bind;
@@ -97,6 +100,23 @@ pi_inet_device (int type)
 	return dev;
 }
 
+/* A TCP listener can accept any number of connections: each of them
+   gets its own copy of the device (see pi_accept_session()) */
+static pi_device_t*
+pi_inet_device_dup (pi_device_t *dev)
+{
+	pi_device_t *new_dev;
+
+	ASSERT (dev != NULL);
+
+	new_dev = pi_inet_device (PI_NET_DEV);
+	if (new_dev != NULL)
+		((pi_inet_data_t *)new_dev->data)->timeout =
+			((pi_inet_data_t *)dev->data)->timeout;
+
+	return new_dev;
+}
+
 static void
 pi_inet_device_free (pi_device_t *dev)
 {
@@ -123,6 +143,7 @@ pi_inet_protocol (pi_device_t *dev)
 	if (prot != NULL) {
 		prot->level 		= PI_LEVEL_DEV;
 		prot->dup 		= pi_inet_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= pi_inet_protocol_free;
 		prot->read 		= pi_inet_read;
 		prot->write 		= pi_inet_write;
@@ -147,6 +168,7 @@ pi_inet_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -167,6 +189,59 @@ pi_inet_protocol_free (pi_protocol_t *prot)
 		free(prot);
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_inet_address
+ *
+ * Summary:     Fill in the address named by a device, "host[:port]".
+ *		An empty host or "any" stands for any address, and the
+ *		port defaults to the NetSync one.
+ *
+ * Parameters:  device name, address to fill in
+ *
+ * Returns:     0, or -1 if the host can't be found
+ *
+ ***********************************************************************/
+static int
+pi_inet_address(const char *device, struct sockaddr_in *serv_addr)
+{
+	char	host[256];
+	const char *port;
+	size_t	len;
+
+	memset(serv_addr, 0, sizeof(struct sockaddr_in));
+	serv_addr->sin_family = AF_INET;
+
+	if ((port = strchr(device, ':')) != NULL) {
+		serv_addr->sin_port = htons(atoi(port + 1));
+		len = port - device;
+	} else {
+		serv_addr->sin_port = htons(14238);
+		len = strlen(device);
+	}
+	if (len >= sizeof(host))
+		len = sizeof(host) - 1;
+	memcpy(host, device, len);
+	host[len] = '\0';
+
+	if (len > 1 && strcmp(host, "any")) {
+		serv_addr->sin_addr.s_addr = inet_addr(host);
+		if (serv_addr->sin_addr.s_addr == (in_addr_t)-1) {
+			struct hostent *hostent = gethostbyname(host);
+
+			if (!hostent)
+				return -1;
+
+			memcpy((char *) &serv_addr->sin_addr.s_addr,
+				   hostent->h_addr, (size_t)hostent->h_length);
+		}
+	} else {
+		serv_addr->sin_addr.s_addr = htonl(INADDR_ANY);
+	}
+
+	return 0;
+}
+
 static int
 pi_inet_bind(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
 {
@@ -174,33 +249,15 @@ pi_inet_bind(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
 		sd,
 		err;
 	size_t	optlen;
+	pl_socklen_t len;
 	struct 	pi_sockaddr *paddr = (struct pi_sockaddr *) addr;
 	struct 	sockaddr_in serv_addr;
 	char 	*device = paddr->pi_device, 
-		*port	= NULL;
+		*port;
 
 	/* Figure out the addresses to allow */
-	memset(&serv_addr, 0, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	if (strlen(device) > 1 && strncmp(device, "any", 3)) {
-		serv_addr.sin_addr.s_addr = inet_addr(device);
-		if (serv_addr.sin_addr.s_addr == (in_addr_t)-1) {
-			struct hostent *hostent = gethostbyname(device);
-
-			if (!hostent)
-				return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
-
-			memcpy((char *) &serv_addr.sin_addr.s_addr,
-				   hostent->h_addr, (size_t)hostent->h_length);
-		}
-	} else {
-		serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	}
-	if ((port = strchr(device, ':')) != NULL) {
-		serv_addr.sin_port = htons(atoi(++port));
-	} else {
-		serv_addr.sin_port = htons(14238);
-	}
+	if (pi_inet_address(device, &serv_addr) < 0)
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
 
 	sd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sd < 0) {
@@ -232,6 +289,19 @@ pi_inet_bind(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
 	memcpy(ps->laddr, addr, addrlen);
 	ps->laddrlen 	= addrlen;
 
+	/* with port 0 the system chose one: give the port bound to in the
+	   local address, for pi_getsockname() */
+	len = sizeof(serv_addr);
+	if (getsockname(ps->sd, (struct sockaddr *)&serv_addr, &len) == 0
+	    && addrlen >= sizeof(struct pi_sockaddr)) {
+		paddr = (struct pi_sockaddr *) ps->laddr;
+		if ((port = strchr(paddr->pi_device, ':')) == NULL)
+			port = paddr->pi_device + strlen(paddr->pi_device);
+		snprintf(port, sizeof(paddr->pi_device)
+			- (port - paddr->pi_device), ":%d",
+			ntohs(serv_addr.sin_port));
+	}
+
 	return 0;
 }
 
@@ -246,27 +316,12 @@ pi_inet_connect(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
 	char 	*device = paddr->pi_device;
 	
 	/* Figure out the addresses to allow */
-	memset(&serv_addr, 0, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	if (strlen(device) > 1) {
-		serv_addr.sin_addr.s_addr = inet_addr(device);
-		if (serv_addr.sin_addr.s_addr == (in_addr_t)-1) {
-			struct hostent *hostent = gethostbyname(device);
-		
-			if (!hostent) {
-				LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, 
-					"DEV CONNECT Inet: Unable"
-					" to determine host\n"));
-				return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
-			}
-			
-			memcpy((char *) &serv_addr.sin_addr.s_addr,
-				   hostent->h_addr, (size_t)hostent->h_length);
-		}
-	} else {
-		serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (pi_inet_address(device, &serv_addr) < 0) {
+		LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, 
+			"DEV CONNECT Inet: Unable"
+			" to determine host\n"));
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
 	}
-	serv_addr.sin_port = htons(14238);
 
 	sd = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -449,25 +504,16 @@ pi_inet_write(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 	int 	total,
 		nwrote;
 	pi_inet_data_t *data = (pi_inet_data_t *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
-
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
+	int	ready;
 
 	total = len;
 	while (total > 0) {
-		if (data->timeout == 0) {
-			if (select(ps->sd + 1, 0, &ready, 0, 0) < 0
-				&& errno == EINTR)
-				continue;
-		} else {
-			t.tv_sec 	= data->timeout / 1000;
-			t.tv_usec 	= (data->timeout % 1000) * 1000;
-			if (select(ps->sd + 1, 0, &ready, 0, &t) == 0)
-				return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-		}
-		if (!FD_ISSET(ps->sd, &ready)) {
+		ready = pi_event_wait(ps->sd, PI_EVENT_WRITE, data->timeout);
+		if (ready < 0 && errno == EINTR && data->timeout == 0)
+			continue;
+		if (ready == 0)
+			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+		if (ready < 0) {
 			ps->state = PI_SOCK_CONN_BREAK;
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
@@ -497,8 +543,7 @@ pi_inet_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	int 	r, 
 		fl 	= 0;
 	pi_inet_data_t *data = (pi_inet_data_t *)ps->device->data;
-	fd_set 	ready;
-	struct 	timeval t;
+	int	ready;
 
 	if (pi_buffer_expect (msg, len) == NULL) {
 		errno = ENOMEM;
@@ -508,22 +553,14 @@ pi_inet_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	if (flags == PI_MSG_PEEK)
 		fl = MSG_PEEK;
 	
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
-
 	/* If timeout == 0, wait forever for packet, otherwise wait till
 	   timeout milliseconds */
-	if (data->timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= data->timeout / 1000;
-		t.tv_usec 	= (data->timeout % 1000) * 1000;
-		if (select(ps->sd + 1, &ready, 0, 0, &t) == 0)
-			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-	}
+	ready = pi_event_wait(ps->sd, PI_EVENT_READ, data->timeout);
+	if (ready == 0)
+		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 
 	/* If data is available in time, read it */
-	if (FD_ISSET(ps->sd, &ready)) {
+	if (ready > 0) {
 		r = recv(ps->sd, msg->data + msg->used, len, fl);
 		if (r < 0) {
 			if (errno == EPIPE || errno == EBADF) {
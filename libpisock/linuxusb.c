@@ -27,11 +27,13 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "pi-debug.h"
 #include "pi-source.h"
 #include "pi-usb.h"
 #include "pi-error.h"
+#include "pi-event.h"
 
 #ifdef HAVE_SYS_IOCTL_COMPAT_H
 #include <sys/ioctl_compat.h>
@@ -48,8 +50,13 @@
 
 static int u_open(pi_socket_t *ps, struct pi_sockaddr *addr, size_t addrlen);
 static int u_close(pi_socket_t *ps);
-static int u_write(pi_socket_t *ps, unsigned char *buf, size_t len, int flags);
-static int u_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags);
+static ssize_t u_write(pi_socket_t *ps, const unsigned char *buf, size_t len,
+	int flags);
+static ssize_t u_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len,
+	int flags);
+static int u_read_buf(pi_socket_t *ps, pi_buffer_t *buf, size_t len,
+	int flags);
+static int u_ring_fill(pi_socket_t *ps);
 static int u_poll(pi_socket_t *ps, int timeout);
 static int u_flush(pi_socket_t *ps, int flags);
 
@@ -146,23 +153,16 @@ u_close(pi_socket_t *ps)
 static int
 u_poll(pi_socket_t *ps, int timeout)
 {
-	struct 	timeval t;
-	fd_set 	ready;
+	struct 	pi_usb_data *data = (struct pi_usb_data *)ps->device->data;
 
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
+	/* data already read ahead */
+	if (data->buf_size > 0)
+		return 1;
 
 	/* If timeout == 0, wait forever for packet, otherwise wait till
 	   timeout milliseconds */
-	if (timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= timeout / 1000;
-		t.tv_usec 	= (timeout % 1000) * 1000;
-		select(ps->sd + 1, &ready, 0, 0, &t);
-	}
-
-	if (!FD_ISSET(ps->sd, &ready)) {
+	data->rx_syscalls++;
+	if (pi_event_wait(ps->sd, PI_EVENT_READ, timeout) <= 0) {
 		/* otherwise throw out any current packet and return */
 		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
 			 "DEV POLL linuxusb timeout\n"));
@@ -188,30 +188,21 @@ u_poll(pi_socket_t *ps, int timeout)
  * Returns:     Nothing
  *
  ***********************************************************************/
-static int
-u_write(pi_socket_t *ps, unsigned char *buf, size_t len, int flags)
+static ssize_t
+u_write(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 {
 	int 	total,
 		nwrote;
 	struct 	pi_usb_data *data = (struct pi_usb_data *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
-
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
+	int	ready;
 
 	total = len;
 	while (total > 0) {
-		if (data->timeout == 0)
-			select(ps->sd + 1, 0, &ready, 0, 0);
-		else {
-			t.tv_sec 	= data->timeout / 1000;
-			t.tv_usec 	= (data->timeout % 1000) * 1000;
-			if (select(ps->sd + 1, 0, &ready, 0, &t))
-				return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-		}
+		ready = pi_event_wait(ps->sd, PI_EVENT_WRITE, data->timeout);
+		if (ready == 0)
+			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 
-		if (!FD_ISSET(ps->sd, &ready)) {
+		if (ready < 0) {
 			ps->state = PI_SOCK_CONN_BREAK;
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
@@ -236,23 +227,31 @@ u_write(pi_socket_t *ps, unsigned char *buf, size_t len, int flags)
  *
  * Function:    u_read_buf
  *
- * Summary:     read buffer
+ * Summary:     read from the read-ahead ring
  *
- * Parameters:  pi_socket_t*, char* to buffer, length of buffer
+ * Parameters:  pi_socket_t*, pi_buffer_t* to buffer, length to get, flags
  *
- * Returns:     number of bytes read
+ * Returns:     number of bytes read or negative on error
  *
  ***********************************************************************/
 static int
 u_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags) 
 {
 	struct 	pi_usb_data *data = (struct pi_usb_data *)ps->device->data;
-	size_t rbuf = data->buf_size;
+	size_t	rbuf = data->buf_size,
+		first;
 	
 	if (rbuf > len)
 		rbuf = len;
 
-	if (pi_buffer_append (buf, data->buf, rbuf) == NULL) {
+	/* the bytes may wrap around the end of the ring */
+	first = PI_USB_RING_SIZE - data->buf_start;
+	if (first > rbuf)
+		first = rbuf;
+
+	if (pi_buffer_append (buf, &data->buf[data->buf_start], first) == NULL
+	    || (rbuf > first
+		&& pi_buffer_append (buf, data->buf, rbuf - first) == NULL)) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
@@ -260,7 +259,10 @@ u_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	if (flags != PI_MSG_PEEK) {
 		data->buf_size -= rbuf;
 		if (data->buf_size > 0)
-			memmove(data->buf, &data->buf[rbuf], data->buf_size);
+			data->buf_start = (data->buf_start + rbuf)
+				% PI_USB_RING_SIZE;
+		else
+			data->buf_start = 0;
 	}
 
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
@@ -272,82 +274,91 @@ u_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 
 /***********************************************************************
  *
- * Function:    u_read
+ * Function:    u_ring_fill
  *
- * Summary:     Read incoming data from the socket/file descriptor
+ * Summary:     Wait for data, then read as much as the kernel has into
+ *		the free space of the read-ahead ring, with one call
  *
- * Parameters:  pi_socket_t*, char* to buffer, buffer length, flags
+ * Parameters:  pi_socket_t*
  *
  * Returns:     number of bytes read or negative otherwise
  *
  ***********************************************************************/
 static int
-u_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
+u_ring_fill(pi_socket_t *ps)
 {
-	ssize_t rbuf = 0,
-		bytes;
+	ssize_t bytes;
+	size_t	tail;
+	int	iovcnt = 1;
 	struct 	pi_usb_data *data = (struct pi_usb_data *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
-
-	/* check whether we have at least partial data in store */
-	if (data->buf_size) {
-		rbuf = u_read_buf(ps, buf, len, flags);
-		if (rbuf < 0)
-			return rbuf;
-		len -= rbuf;
-		if (len == 0)
-			return rbuf;
-	}
+	struct	iovec iov[2];
 
 	/* If timeout == 0, wait forever for packet, otherwise wait till
 	   timeout milliseconds */
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
-	if (data->timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= data->timeout / 1000;
-		t.tv_usec 	= (data->timeout % 1000) * 1000;
-		if (select(ps->sd + 1, &ready, 0, 0, &t) == 0) {
-			LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
-				"DEV RX linuxusb timeout\n"));
-			errno = ETIMEDOUT;
-			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-		}
+	data->rx_syscalls++;
+	if (pi_event_wait(ps->sd, PI_EVENT_READ, data->timeout) <= 0) {
+		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
+			"DEV RX linuxusb timeout\n"));
+		errno = ETIMEDOUT;
+		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 	}
 
-	/* If data is available in time, read it */
-	if (FD_ISSET(ps->sd, &ready)) {
-		if (flags == PI_MSG_PEEK && len > 256)
-			len = 256;
+	/* The free space runs from the end of the data to the end of the
+	   ring, then from the start of the ring to the start of the data */
+	tail = (data->buf_start + data->buf_size) % PI_USB_RING_SIZE;
+	iov[0].iov_base = &data->buf[tail];
+	if (tail >= data->buf_start) {
+		iov[0].iov_len	= PI_USB_RING_SIZE - tail;
+		iov[1].iov_base	= data->buf;
+		iov[1].iov_len	= data->buf_start;
+		if (data->buf_start > 0)
+			iovcnt = 2;
+	} else
+		iov[0].iov_len	= data->buf_start - tail;
+
+	data->rx_syscalls++;
+	bytes = readv(ps->sd, iov, iovcnt);
+	if (bytes < 0)
+		return pi_set_error(ps->sd, PI_ERR_SOCK_IO);
+
+	data->buf_size += bytes;
+	data->rx_bytes += bytes;
 
-		if (pi_buffer_expect (buf, len) == NULL) {
-			errno = ENOMEM;
-			return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
-		}
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
+		"DEV RX linuxusb read %d bytes\n", bytes));
 
-		bytes = read(ps->sd, buf->data + buf->used, len);
+	return bytes;
+}
 
-		if (bytes > 0) {
-			if (flags == PI_MSG_PEEK) {
-				memcpy(data->buf + data->buf_size, buf->data + buf->used, bytes);
-				data->buf_size += bytes;
-			}
-			buf->used += bytes;
-			rbuf += bytes;
 
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
-				"DEV RX linuxusb read %d bytes\n", bytes));
-		}
-	} else {
-		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
-			"DEV RX linuxusb timeout\n"));
-		errno = ETIMEDOUT;
-		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+/***********************************************************************
+ *
+ * Function:    u_read
+ *
+ * Summary:     Read incoming data from the socket/file descriptor
+ *
+ * Parameters:  pi_socket_t*, char* to buffer, buffer length, flags
+ *
+ * Returns:     number of bytes read or negative otherwise
+ *
+ ***********************************************************************/
+static ssize_t
+u_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
+{
+	int	bytes;
+	struct 	pi_usb_data *data = (struct pi_usb_data *)ps->device->data;
+
+	/* Only go to the device when the ring can't serve the request:
+	   when it is empty, or when a peek wants more than it holds */
+	if (data->buf_size == 0
+	    || (flags == PI_MSG_PEEK && data->buf_size < len
+		&& data->buf_size < PI_USB_RING_SIZE)) {
+		bytes = u_ring_fill(ps);
+		if (bytes < 0)
+			return bytes;
 	}
 
-	return rbuf;
+	return u_read_buf(ps, buf, len, flags);
 }
 
 /***********************************************************************
@@ -377,6 +388,7 @@ u_flush(pi_socket_t *ps, int flags)
 	if (flags & PI_FLUSH_INPUT) {
 		/* clear internal buffer */
 		data->buf_size = 0;
+		data->buf_start = 0;
 
 		/* flush pending data */
 		if ((fl = fcntl(ps->sd, F_GETFL, 0)) != -1) {
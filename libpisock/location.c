@@ -27,6 +27,7 @@
 #include <errno.h>
 
 #include "pi-macros.h"
+#include "pi-arena.h"
 #include "pi-location.h"
 
 /***********************************************************************
@@ -397,6 +398,17 @@ unpack_Timezone(Timezone_t *tz, const pi_buffer_t *buf) {
  */
 int
 unpack_Timezone_p(Timezone_t *tz, const unsigned char *data, const size_t position) {
+	return unpack_Timezone_arena(tz, data, position, NULL);
+}
+/**
+ * Like unpack_Timezone_p, allocating the name in an arena (NULL to
+ * allocate it with malloc).
+ * 
+ * Returns:     -1 on error, number of bytes read on success
+ */
+int
+unpack_Timezone_arena(Timezone_t *tz, const unsigned char *data,
+	const size_t position, pi_arena_t *arena) {
 	uint8_t byte;
 	size_t localPosition = position;
   
@@ -464,7 +476,10 @@ unpack_Timezone_p(Timezone_t *tz, const unsigned char *data, const size_t positi
 		tz->name = NULL;
 		++localPosition;
 	} else {
-		tz->name = strdup((char *)(data+localPosition));
+		tz->name = pi_arena_strndup(arena, (char *)(data+localPosition),
+			strlen((char *)(data+localPosition)));
+		if (tz->name == NULL)
+			return -1;
 		localPosition += strlen(tz->name) + 1;
 	}
 
@@ -0,0 +1,848 @@
+/*
+ * $Id$
+ *
+ * loopback.c: In-memory connections between sockets of one process
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-loopback.h"
+#include "pi-cmp.h"
+#include "pi-net.h"
+#include "pi-error.h"
+#include "pi-event.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+#define PI_LOOPBACK_RING_SIZE	0x10000
+
+/* One direction of a connection */
+struct pi_loopback_ring {
+	unsigned char data[PI_LOOPBACK_RING_SIZE];
+	size_t	head,			/* next byte to read */
+		used;
+};
+
+/* A connection: ring[0] carries what the connecting end writes,
+   ring[1] what the accepting end writes */
+struct pi_loopback_link {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* data, room or hang up */
+	struct pi_loopback_ring ring[2];
+	int	closed,
+		refs;
+	struct pi_loopback_link *next;	/* pending connections */
+};
+
+/* A name sockets can connect to. The listening socket's descriptor is
+   one end of a socket pair, which receives a byte for each pending
+   connection: accept can then wait on it like on a TCP listener, and
+   shutting it down wakes the accepting threads up. */
+struct pi_loopback_listener {
+	char	name[256];
+	int	notify,			/* other end of the socket pair */
+		refs;
+	struct pi_loopback_link *pending,
+		**tail;
+	struct pi_loopback_listener *next;
+};
+
+typedef struct pi_loopback_data {
+	struct pi_loopback_listener *listener;
+	struct pi_loopback_link *link;
+	int	side;			/* 0: connecting end, 1: accepting end */
+
+	/* Time out */
+	int timeout;
+
+	/* Statistics */
+	int rx_bytes;
+	int tx_bytes;
+} pi_loopback_data_t;
+
+static struct pi_loopback_listener *listeners = NULL;
+static pthread_mutex_t listeners_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Declare prototypes */
+static pi_device_t *pi_loopback_device_dup (pi_device_t *dev);
+static void pi_loopback_device_free (pi_device_t *dev);
+static pi_protocol_t* pi_loopback_protocol (pi_device_t *dev);
+static pi_protocol_t* pi_loopback_protocol_dup (pi_protocol_t *prot);
+static void pi_loopback_protocol_free (pi_protocol_t *prot);
+static int pi_loopback_close(pi_socket_t *ps);
+static int pi_loopback_connect(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen);
+static int pi_loopback_bind(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen);
+static int pi_loopback_listen(pi_socket_t *ps, int backlog);
+static int pi_loopback_accept(pi_socket_t *ps, struct sockaddr *addr, size_t *addrlen);
+static ssize_t pi_loopback_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags);
+static ssize_t pi_loopback_write(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags);
+static int pi_loopback_getsockopt(pi_socket_t *ps, int level, int option_name, void *option_value, size_t *option_len);
+static int pi_loopback_setsockopt(pi_socket_t *ps, int level, int option_name, const void *option_value, size_t *option_len);
+static int pi_loopback_flush(pi_socket_t *ps, int flags);
+
+extern int pi_socket_init(pi_socket_t *ps);
+
+pi_device_t*
+pi_loopback_device (int type)
+{
+	pi_device_t *dev = NULL;
+	pi_loopback_data_t *data = NULL;
+
+	dev = (pi_device_t *)malloc (sizeof (pi_device_t));
+	if (dev != NULL) {
+		data = (pi_loopback_data_t *)calloc (1, sizeof (pi_loopback_data_t));
+		if (data == NULL) {
+			free(dev);
+			dev = NULL;
+		}
+	}
+
+	if (dev != NULL && data != NULL) {
+		dev->dup 	= pi_loopback_device_dup;
+		dev->free 	= pi_loopback_device_free;
+		dev->protocol 	= pi_loopback_protocol;
+		dev->bind 	= pi_loopback_bind;
+		dev->listen 	= pi_loopback_listen;
+		dev->accept 	= pi_loopback_accept;
+		dev->connect 	= pi_loopback_connect;
+		dev->close 	= pi_loopback_close;
+		dev->data 	= data;
+	}
+
+	return dev;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    link_release
+ *
+ * Summary:     Drop a reference to a connection, freeing it with the
+ *		last one
+ *
+ * Parameters:  pi_loopback_link*
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+link_release(struct pi_loopback_link *link)
+{
+	int	refs;
+
+	pthread_mutex_lock(&link->lock);
+	link->closed = 1;
+	refs = --link->refs;
+	pthread_cond_broadcast(&link->cond);
+	pthread_mutex_unlock(&link->lock);
+
+	if (refs == 0) {
+		pthread_cond_destroy(&link->cond);
+		pthread_mutex_destroy(&link->lock);
+		free(link);
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    listener_release
+ *
+ * Summary:     Drop a reference to a listener. With the last one, its
+ *		name becomes free again and the connections it did not
+ *		accept are hung up.
+ *
+ * Parameters:  pi_loopback_listener*
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+listener_release(struct pi_loopback_listener *listener)
+{
+	struct pi_loopback_listener **l;
+	struct pi_loopback_link *link;
+
+	pthread_mutex_lock(&listeners_mutex);
+	if (--listener->refs > 0) {
+		pthread_mutex_unlock(&listeners_mutex);
+		return;
+	}
+	for (l = &listeners; *l != NULL; l = &(*l)->next) {
+		if (*l == listener) {
+			*l = listener->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&listeners_mutex);
+
+	while ((link = listener->pending) != NULL) {
+		listener->pending = link->next;
+		link_release(link);
+	}
+	close(listener->notify);
+	free(listener);
+}
+
+static pi_device_t*
+pi_loopback_device_dup (pi_device_t *dev)
+{
+	pi_device_t *new_dev;
+	pi_loopback_data_t *data,
+		*new_data;
+
+	ASSERT (dev != NULL);
+
+	data = (pi_loopback_data_t *)dev->data;
+	new_dev = pi_loopback_device (PI_LOOPBACK_DEV);
+	if (new_dev != NULL) {
+		new_data = (pi_loopback_data_t *)new_dev->data;
+		new_data->timeout = data->timeout;
+
+		/* the copy accepts on the same listener */
+		if (data->listener != NULL) {
+			pthread_mutex_lock(&listeners_mutex);
+			data->listener->refs++;
+			pthread_mutex_unlock(&listeners_mutex);
+			new_data->listener = data->listener;
+		}
+	}
+
+	return new_dev;
+}
+
+static void
+pi_loopback_device_free (pi_device_t *dev)
+{
+	pi_loopback_data_t *data;
+
+	ASSERT (dev != NULL);
+	if (dev != NULL) {
+		data = (pi_loopback_data_t *)dev->data;
+		if (data != NULL) {
+			if (data->link != NULL)
+				link_release(data->link);
+			if (data->listener != NULL)
+				listener_release(data->listener);
+			free(data);
+		}
+		free(dev);
+	}
+}
+
+static pi_protocol_t*
+pi_loopback_protocol (pi_device_t *dev)
+{
+	pi_protocol_t *prot;
+
+	ASSERT (dev != NULL);
+
+	prot = (pi_protocol_t *)malloc (sizeof (pi_protocol_t));
+
+	if (prot != NULL) {
+		prot->level 		= PI_LEVEL_DEV;
+		prot->dup 		= pi_loopback_protocol_dup;
+		prot->next		= NULL;
+		prot->free 		= pi_loopback_protocol_free;
+		prot->read 		= pi_loopback_read;
+		prot->write 		= pi_loopback_write;
+		prot->flush		= pi_loopback_flush;
+		prot->getsockopt 	= pi_loopback_getsockopt;
+		prot->setsockopt 	= pi_loopback_setsockopt;
+		prot->data = NULL;
+	}
+
+	return prot;
+}
+
+static pi_protocol_t*
+pi_loopback_protocol_dup (pi_protocol_t *prot)
+{
+	pi_protocol_t *new_prot;
+
+	ASSERT (prot != NULL);
+
+	new_prot = (pi_protocol_t *)malloc (sizeof (pi_protocol_t));
+
+	if (new_prot != NULL) {
+		new_prot->level 	= prot->level;
+		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
+		new_prot->free 		= prot->free;
+		new_prot->read 		= prot->read;
+		new_prot->write 	= prot->write;
+		new_prot->flush		= prot->flush;
+		new_prot->getsockopt 	= prot->getsockopt;
+		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->data 		= NULL;
+	}
+
+	return new_prot;
+}
+
+static void
+pi_loopback_protocol_free (pi_protocol_t *prot)
+{
+	ASSERT (prot != NULL);
+	if (prot != NULL)
+		free(prot);
+}
+
+static void
+pi_loopback_set_addr(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
+{
+	ps->raddr 	= malloc(addrlen);
+	memcpy(ps->raddr, addr, addrlen);
+	ps->raddrlen 	= addrlen;
+	ps->laddr 	= malloc(addrlen);
+	memcpy(ps->laddr, addr, addrlen);
+	ps->laddrlen 	= addrlen;
+}
+
+static int
+pi_loopback_bind(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
+{
+	int	fds[2],
+		err;
+	struct 	pi_sockaddr *paddr = (struct pi_sockaddr *) addr;
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_listener *listener;
+
+	listener = (struct pi_loopback_listener *)
+		calloc(1, sizeof(struct pi_loopback_listener));
+	if (listener == NULL) {
+		errno = ENOMEM;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+	}
+	strncpy(listener->name, paddr->pi_device, sizeof(listener->name) - 1);
+	listener->refs = 1;
+	listener->tail = &listener->pending;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		LOG((PI_DBG_DEV, PI_DBG_LVL_ERR,
+			"DEV BIND Loopback: Unable to create socket pair\n"));
+		free(listener);
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+	}
+	listener->notify = fds[1];
+
+	pthread_mutex_lock(&listeners_mutex);
+	for (listener->next = listeners; listener->next != NULL;
+	     listener->next = listener->next->next) {
+		if (strcmp(listener->next->name, listener->name) == 0)
+			break;
+	}
+	if (listener->next != NULL) {
+		pthread_mutex_unlock(&listeners_mutex);
+		LOG((PI_DBG_DEV, PI_DBG_LVL_ERR,
+			"DEV BIND Loopback: %s already bound\n", listener->name));
+		close(fds[0]);
+		close(fds[1]);
+		free(listener);
+		errno = EADDRINUSE;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+	}
+	listener->next = listeners;
+	listeners = listener;
+	pthread_mutex_unlock(&listeners_mutex);
+
+	if ((err = pi_socket_setsd (ps, fds[0])) < 0) {
+		/* the name is free again */
+		close(fds[0]);
+		listener_release(listener);
+		return err;
+	}
+	data->listener = listener;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO,
+		"DEV BIND Loopback Bound to %s\n", listener->name));
+
+	pi_loopback_set_addr(ps, addr, addrlen);
+
+	return 0;
+}
+
+static int
+pi_loopback_connect(pi_socket_t *ps, struct sockaddr *addr, size_t addrlen)
+{
+	int 	err;
+	struct 	pi_sockaddr *paddr = (struct pi_sockaddr *) addr;
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_listener *listener;
+	struct pi_loopback_link *link;
+
+	link = (struct pi_loopback_link *)
+		calloc(1, sizeof(struct pi_loopback_link));
+	if (link == NULL) {
+		errno = ENOMEM;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+	}
+	pthread_mutex_init(&link->lock, NULL);
+	pthread_cond_init(&link->cond, NULL);
+	link->refs = 2;			/* one for each end */
+
+	pthread_mutex_lock(&listeners_mutex);
+	for (listener = listeners; listener != NULL; listener = listener->next)
+		if (strcmp(listener->name, paddr->pi_device) == 0)
+			break;
+	if (listener == NULL) {
+		pthread_mutex_unlock(&listeners_mutex);
+		LOG((PI_DBG_DEV, PI_DBG_LVL_ERR,
+			"DEV CONNECT Loopback: Nothing bound to %s\n",
+			paddr->pi_device));
+		pthread_cond_destroy(&link->cond);
+		pthread_mutex_destroy(&link->lock);
+		free(link);
+		errno = ECONNREFUSED;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+	}
+	*listener->tail = link;
+	listener->tail = &link->next;
+	if (write(listener->notify, "", 1) != 1) {
+		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
+			"DEV CONNECT Loopback: Unable to wake the listener\n"));
+	}
+	pthread_mutex_unlock(&listeners_mutex);
+
+	data->link = link;
+	data->side = 0;
+
+	pi_loopback_set_addr(ps, addr, addrlen);
+
+	switch (ps->cmd) {
+		case PI_CMD_CMP:
+			if ((err = cmp_tx_handshake(ps)) < 0)
+				return err;
+			break;
+		case PI_CMD_NET:
+			if ((err = net_tx_handshake(ps)) < 0)
+				return err;
+			break;
+	}
+	ps->state = PI_SOCK_CONN_INIT;
+	ps->command = 0;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO, "DEV CONNECT Loopback: Connected\n"));
+	return 0;
+}
+
+static int
+pi_loopback_listen(pi_socket_t *ps, int backlog)
+{
+	ps->state = PI_SOCK_LISTEN;
+	return 0;
+}
+
+static int
+pi_loopback_accept(pi_socket_t *ps, struct sockaddr *addr, size_t *addrlen)
+{
+	int	sd,
+		err,
+		split = 0,
+		chunksize = 0;
+	char	c;
+	size_t	len,
+		size;
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_listener *listener = data->listener;
+	struct pi_loopback_link *link;
+	unsigned char cmp_flags;
+
+	if (listener == NULL)
+		return pi_set_error(ps->sd, PI_ERR_SOCK_LISTENER);
+
+	/* wait for a connection: accept_to is in seconds, 0 waits forever */
+	while ((err = pi_event_wait(ps->sd, PI_EVENT_READ,
+			ps->accept_to * 1000)) < 0 && errno == EINTR)
+		;
+	if (err == 0)
+		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+	if (err < 0 || read(ps->sd, &c, 1) != 1) {
+		/* the listening socket was shut down */
+		LOG((PI_DBG_DEV, PI_DBG_LVL_INFO,
+			"DEV ACCEPT Loopback: Listener closed\n"));
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+	}
+
+	/* each byte stands for a connection already queued */
+	pthread_mutex_lock(&listeners_mutex);
+	link = listener->pending;
+	if (link != NULL) {
+		listener->pending = link->next;
+		if (listener->pending == NULL)
+			listener->tail = &listener->pending;
+	}
+	pthread_mutex_unlock(&listeners_mutex);
+	if (link == NULL)
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+
+	link->next	= NULL;
+	data->link	= link;
+	data->side	= 1;
+	data->listener	= NULL;
+	listener_release(listener);
+
+	/* the connection needs no descriptor: trade the listener's for an
+	   idle one */
+	if ((sd = open(NULL_DEVICE, O_RDWR)) < 0)
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
+	if ((err = pi_socket_setsd(ps, sd)) < 0)
+		return err;
+
+	if (addr != NULL && addrlen != NULL && ps->laddr != NULL) {
+		len = *addrlen < ps->laddrlen ? *addrlen : ps->laddrlen;
+		memcpy(addr, ps->laddr, len);
+		*addrlen = len;
+	}
+
+	pi_socket_init(ps);
+
+	switch (ps->cmd) {
+		case PI_CMD_CMP:
+			if ((err = cmp_rx_handshake(ps, 57600, 0)) < 0)
+				return err;
+
+			/* propagate the long packet format flag to both command and non-command stacks */
+			size = sizeof(cmp_flags);
+			pi_getsockopt(ps->sd, PI_LEVEL_CMP, PI_CMP_FLAGS, &cmp_flags, &size);
+			if (cmp_flags & CMP_FL_LONG_PACKET_SUPPORT) {
+				int use_long_format = 1;
+				size = sizeof(int);
+				pi_setsockopt(ps->sd, PI_LEVEL_PADP, PI_PADP_USE_LONG_FORMAT,
+					      &use_long_format, &size);
+				ps->command ^= 1;
+				pi_setsockopt(ps->sd, PI_LEVEL_PADP, PI_PADP_USE_LONG_FORMAT,
+					      &use_long_format, &size);
+				ps->command ^= 1;
+			}
+			break;
+		case PI_CMD_NET:
+			/* nothing to gain from splitting writes in memory */
+			len = sizeof (split);
+			pi_setsockopt(ps->sd, PI_LEVEL_NET, PI_NET_SPLIT_WRITES,
+				&split, &len);
+			len = sizeof (chunksize);
+			pi_setsockopt(ps->sd, PI_LEVEL_NET, PI_NET_WRITE_CHUNKSIZE,
+				&chunksize, &len);
+
+			ps->command ^= 1;
+			len = sizeof (split);
+			pi_setsockopt(ps->sd, PI_LEVEL_NET, PI_NET_SPLIT_WRITES,
+				&split, &len);
+			len = sizeof (chunksize);
+			pi_setsockopt(ps->sd, PI_LEVEL_NET, PI_NET_WRITE_CHUNKSIZE,
+				&chunksize, &len);
+			ps->command ^= 1;
+
+			if ((err = net_rx_handshake(ps)) < 0)
+				return err;
+			break;
+	}
+
+	ps->state 	= PI_SOCK_CONN_ACCEPT;
+	ps->command 	= 0;
+	ps->dlprecord	= 0;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO, "DEV LOOPBACK ACCEPT accepted\n"));
+
+	return ps->sd;
+}
+
+static int
+pi_loopback_close(pi_socket_t *ps)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+
+	/* hang up: the other end reads what is left, then gets an error */
+	if (data->link != NULL) {
+		pthread_mutex_lock(&data->link->lock);
+		data->link->closed = 1;
+		pthread_cond_broadcast(&data->link->cond);
+		pthread_mutex_unlock(&data->link->lock);
+	}
+	if (ps->laddr) {
+		free(ps->laddr);
+		ps->laddr = NULL;
+	}
+	if (ps->raddr) {
+		free(ps->raddr);
+		ps->raddr = NULL;
+	}
+	return 0;
+}
+
+static int
+pi_loopback_flush(pi_socket_t *ps, int flags)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_ring *ring;
+
+	if ((flags & PI_FLUSH_INPUT) && data->link != NULL) {
+		ring = &data->link->ring[data->side ^ 1];
+		pthread_mutex_lock(&data->link->lock);
+		ring->head = 0;
+		ring->used = 0;
+		pthread_cond_broadcast(&data->link->cond);
+		pthread_mutex_unlock(&data->link->lock);
+	}
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    link_wait
+ *
+ * Summary:     Wait for the other end of a connection, with the
+ *		connection locked
+ *
+ * Parameters:  pi_loopback_link*, deadline (NULL to wait forever)
+ *
+ * Returns:     0, or ETIMEDOUT once the deadline has passed
+ *
+ ***********************************************************************/
+static int
+link_wait(struct pi_loopback_link *link, struct timespec *deadline)
+{
+	if (deadline == NULL)
+		return pthread_cond_wait(&link->cond, &link->lock);
+	return pthread_cond_timedwait(&link->cond, &link->lock, deadline);
+}
+
+static struct timespec *
+link_deadline(int timeout, struct timespec *ts)
+{
+	struct timeval now;
+
+	if (timeout == 0)
+		return NULL;
+
+	gettimeofday(&now, NULL);
+	ts->tv_sec	= now.tv_sec + timeout / 1000;
+	ts->tv_nsec	= now.tv_usec * 1000 + (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+static ssize_t
+pi_loopback_write(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_link *link = data->link;
+	struct pi_loopback_ring *ring;
+	struct timespec ts,
+		*deadline;
+	size_t	total = 0,
+		tail,
+		count;
+
+	if (link == NULL) {
+		ps->state = PI_SOCK_CONN_BREAK;
+		return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+	}
+	ring = &link->ring[data->side];
+	deadline = link_deadline(data->timeout, &ts);
+
+	pthread_mutex_lock(&link->lock);
+	while (total < len) {
+		while (ring->used == PI_LOOPBACK_RING_SIZE && !link->closed)
+			if (link_wait(link, deadline) == ETIMEDOUT)
+				break;
+		if (link->closed) {
+			pthread_mutex_unlock(&link->lock);
+			ps->state = PI_SOCK_CONN_BREAK;
+			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+		}
+		if (ring->used == PI_LOOPBACK_RING_SIZE) {
+			pthread_mutex_unlock(&link->lock);
+			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+		}
+
+		/* copy as much as fits, in at most two pieces */
+		count = PI_LOOPBACK_RING_SIZE - ring->used;
+		if (count > len - total)
+			count = len - total;
+		tail = (ring->head + ring->used) % PI_LOOPBACK_RING_SIZE;
+		if (tail + count > PI_LOOPBACK_RING_SIZE) {
+			memcpy(ring->data + tail, msg + total,
+				PI_LOOPBACK_RING_SIZE - tail);
+			memcpy(ring->data, msg + total + PI_LOOPBACK_RING_SIZE - tail,
+				count - (PI_LOOPBACK_RING_SIZE - tail));
+		} else {
+			memcpy(ring->data + tail, msg + total, count);
+		}
+		ring->used += count;
+		total += count;
+		pthread_cond_broadcast(&link->cond);
+	}
+	pthread_mutex_unlock(&link->lock);
+
+	data->tx_bytes += len;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO, "DEV TX Loopback Bytes: %d\n", len));
+
+	return len;
+}
+
+static ssize_t
+pi_loopback_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+	struct pi_loopback_link *link = data->link;
+	struct pi_loopback_ring *ring;
+	struct timespec ts,
+		*deadline;
+	size_t	want,
+		count;
+
+	if (link == NULL) {
+		ps->state = PI_SOCK_CONN_BREAK;
+		return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+	}
+
+	if (pi_buffer_expect (msg, len) == NULL) {
+		errno = ENOMEM;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+	}
+
+	ring = &link->ring[data->side ^ 1];
+	deadline = link_deadline(data->timeout, &ts);
+
+	/* a peek waits for all the bytes asked for, so that the protocol
+	   detection doesn't spin on a partial header */
+	want = 1;
+	if (flags == PI_MSG_PEEK)
+		want = len < PI_LOOPBACK_RING_SIZE ? len : PI_LOOPBACK_RING_SIZE;
+
+	pthread_mutex_lock(&link->lock);
+	while (ring->used < want && !link->closed)
+		if (link_wait(link, deadline) == ETIMEDOUT)
+			break;
+	if (ring->used == 0) {
+		count = link->closed;
+		pthread_mutex_unlock(&link->lock);
+		if (count) {
+			ps->state = PI_SOCK_CONN_BREAK;
+			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+		}
+		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN, "DEV RX Loopback timeout\n"));
+		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+	}
+
+	count = ring->used < len ? ring->used : len;
+	if (ring->head + count > PI_LOOPBACK_RING_SIZE) {
+		memcpy(msg->data + msg->used, ring->data + ring->head,
+			PI_LOOPBACK_RING_SIZE - ring->head);
+		memcpy(msg->data + msg->used + PI_LOOPBACK_RING_SIZE - ring->head,
+			ring->data, count - (PI_LOOPBACK_RING_SIZE - ring->head));
+	} else {
+		memcpy(msg->data + msg->used, ring->data + ring->head, count);
+	}
+	if (flags != PI_MSG_PEEK) {
+		ring->head = (ring->head + count) % PI_LOOPBACK_RING_SIZE;
+		ring->used -= count;
+		pthread_cond_broadcast(&link->cond);
+	}
+	pthread_mutex_unlock(&link->lock);
+
+	data->rx_bytes += count;
+	msg->used += count;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO, "DEV RX Loopback Bytes: %d\n", count));
+
+	return count;
+}
+
+static int
+pi_loopback_getsockopt(pi_socket_t *ps, int level, int option_name,
+		   void *option_value, size_t *option_len)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+
+	switch (option_name) {
+		case PI_DEV_TIMEOUT:
+			if (*option_len != sizeof (data->timeout)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			memcpy (option_value, &data->timeout,
+				sizeof (data->timeout));
+			*option_len = sizeof (data->timeout);
+			break;
+	}
+
+	return 0;
+}
+
+static int
+pi_loopback_setsockopt(pi_socket_t *ps, int level, int option_name,
+		   const void *option_value, size_t *option_len)
+{
+	pi_loopback_data_t *data = (pi_loopback_data_t *)ps->device->data;
+
+	switch (option_name) {
+		case PI_DEV_TIMEOUT:
+			if (*option_len != sizeof (data->timeout)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			memcpy (&data->timeout, option_value,
+				sizeof (data->timeout));
+			break;
+	}
+
+	return 0;
+}
+
+#else /* HAVE_PTHREAD */
+
+/* Both ends of a connection block on each other: without threads there
+   is nobody to run the other end. */
+
+pi_device_t*
+pi_loopback_device (int type)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -77,6 +77,7 @@ static pi_protocol_t
 	if (new_prot != NULL && new_data != NULL) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -89,6 +90,8 @@ static pi_protocol_t
 		new_data->split_writes	= data->split_writes;
 		new_data->write_chunksize	= data->write_chunksize;
 		new_data->txid 		= data->txid;
+		new_data->rx_txid	= data->rx_txid;
+		new_data->pipelining	= data->pipelining;
 		new_prot->data 		= new_data;
 	}
 
@@ -149,6 +152,7 @@ pi_protocol_t
 	if (prot != NULL && data != NULL) {
 		prot->level 		= PI_LEVEL_NET;
 		prot->dup 		= net_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= net_protocol_free;
 		prot->read 		= net_rx;
 		prot->write 		= net_tx;
@@ -160,6 +164,8 @@ pi_protocol_t
 		data->split_writes	= 1;	    /* write packet header and data separately */
 		data->write_chunksize	= 4096;	    /* and push data in 4k chunks. Required for some USB devices */
 		data->txid 		= 0x00;
+		data->rx_txid		= 0x00;
+		data->pipelining	= 1;
 		prot->data 		= data;
 	}
 
@@ -279,11 +285,11 @@ net_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -313,12 +319,12 @@ net_tx(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 	pi_net_data_t *data;
 	unsigned char *buf;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_net_data_t *)prot->data;
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -417,12 +423,12 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	pi_buffer_t *header;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	
 	data = (pi_net_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -546,6 +552,7 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	CHECK(PI_DBG_NET, PI_DBG_LVL_DEBUG, net_dump(header->data, msg->data));
 
 	/* Update the transaction id */
+	data->rx_txid = header->data[PI_NET_OFFSET_TXID];
 	if (ps->state == PI_SOCK_CONN_INIT || ps->command == 1)
 		data->txid = header->data[PI_NET_OFFSET_TXID];
 	else {
@@ -576,7 +583,7 @@ net_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -592,6 +599,25 @@ net_getsockopt(pi_socket_t *ps, int level, int option_name,
 				sizeof (data->type));
 			*option_len = sizeof (data->type);
 			break;
+
+		case PI_NET_TXID:
+		case PI_NET_RX_TXID:
+			if (*option_len != sizeof (int)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			*(int *)option_value = (option_name == PI_NET_TXID) ?
+				data->txid : data->rx_txid;
+			break;
+
+		case PI_NET_PIPELINING:
+			if (*option_len != sizeof (data->pipelining)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			memcpy (option_value, &data->pipelining,
+				sizeof (data->pipelining));
+			break;
 	}
 
 	return 0;
@@ -616,7 +642,7 @@ net_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -658,6 +684,26 @@ net_setsockopt(pi_socket_t *ps, int level, int option_name,
 			memcpy (&data->write_chunksize, option_value,
 				sizeof(data->write_chunksize));
 			break;
+
+		/* used by the pipelined DLP reads to tag each request they
+		 * put in flight, so that responses can be matched
+		 */
+		case PI_NET_TXID:
+			if (*option_len != sizeof (int)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			data->txid = (unsigned char)*(const int *)option_value;
+			break;
+
+		case PI_NET_PIPELINING:
+			if (*option_len != sizeof (data->pipelining)) {
+				errno = EINVAL;
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+			}
+			memcpy (&data->pipelining, option_value,
+				sizeof(data->pipelining));
+			break;
 	}
 
 	return 0;
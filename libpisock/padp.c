@@ -78,6 +78,7 @@ padp_protocol_dup (pi_protocol_t *prot)
 		} else {
 			new_prot->level = prot->level;
 			new_prot->dup 	= prot->dup;
+			new_prot->next	= NULL;
 			new_prot->free 	= prot->free;
 			new_prot->read 	= prot->read;
 			new_prot->write = prot->write;
@@ -145,6 +146,7 @@ pi_protocol_t
 		} else {
 			prot->level	= PI_LEVEL_PADP;
 			prot->dup 	= padp_protocol_dup;
+			prot->next	= NULL;
 			prot->free 	= padp_protocol_free;
 			prot->read 	= padp_rx;
 			prot->write 	= padp_tx;
@@ -195,12 +197,12 @@ padp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	pi_buffer_t *padp_buf;
 	struct padp padp;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_padp_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -421,12 +423,12 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 	LOG((PI_DBG_PADP, PI_DBG_LVL_DEBUG, "PADP RX expect=%d flags=0x%04x\n",
 		expect, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_padp_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -684,11 +686,11 @@ padp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -713,7 +715,7 @@ padp_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_padp_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_padp_data_t *)prot->data;
@@ -771,7 +773,7 @@ padp_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_padp_data_t *data;
 	int was_frozen;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_padp_data_t *)prot->data;
@@ -835,10 +837,11 @@ padp_sendack(struct pi_socket *ps,
 	unsigned char
 		npadp_buf[PI_PADP_HEADER_LEN+2];
 	struct pi_protocol
+		*prot,
 		*next;
 	
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
-	if (next == NULL)
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_PADP);
+	if (prot == NULL || (next = prot->next) == NULL)
  	    return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	type 	= 2;
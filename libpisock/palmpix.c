@@ -63,12 +63,33 @@
 # endif /* HAVE_INTTYPES_H */
 #endif /* HAVE_STDINT_H */
 
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define PIX_SSE2 1
+#endif
+
 #include "pi-macros.h"
 #include "pi-palmpix.h"
 
 #define max(a,b) (( a > b ) ? a : b )
 #define min(a,b) (( a < b ) ? a : b )
 
+/* DecodeRow() reads ahead 32 bits at a time, up to 4 bytes past the
+   last code of a channel */
+#define PIX_PAD 4
+
+/* The 32 bits at P, most significant first */
+#define PIX_WORD(p) \
+	((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 \
+	 | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+
+/* Clamp V, an int between -256 and 511, to 0..255 without a branch:
+   negative values are masked to 0, values above 255 saturated by the
+   sign of 255 - V */
+#define PIX_SIGN(v) ((v) >> (sizeof(int) * 8 - 1))
+#define PIX_CLAMP(v) \
+	((((v) & ~PIX_SIGN(v)) | PIX_SIGN(255 - (v))) & 0xff)
+
 int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb,
         uint8_t *b);
 
@@ -1110,6 +1131,82 @@ uint16_t huffTable[] =
      0x0043,0x0043,0x0043,0x0043,0x005b,0x005b,0x0085,0x00a0
 };
 
+/****************************************************************
+ * Channel kernels: the correction and stretch passes below look at
+ * every sample of a channel and then map it through a 256 entry table
+ ****************************************************************/
+
+/* Smallest sample and sum of the samples */
+static void ChannelStats( const uint8_t *p, int n, uint8_t *minp, uint32_t *sump )
+{
+   int i = 0;
+   uint8_t lo = 255;
+   uint32_t sum = 0;
+#ifdef PIX_SSE2
+   __m128i vmin = _mm_set1_epi8( (char)0xff ),
+	   vsum = _mm_setzero_si128(),
+	   zero = _mm_setzero_si128(),
+	   v;
+   uint8_t lanes[16];
+   int k;
+   
+   for( ; i + 16 <= n; i += 16 )
+     {
+	v = _mm_loadu_si128( (const __m128i *)(p + i) );
+	vmin = _mm_min_epu8( vmin, v );
+	vsum = _mm_add_epi64( vsum, _mm_sad_epu8( v, zero ));
+     }
+   _mm_storeu_si128( (__m128i *)lanes, vmin );
+   for( k=0; k<16; k++ )
+     lo = min( lo, lanes[k] );
+   sum = _mm_cvtsi128_si32( vsum ) + _mm_cvtsi128_si32( _mm_srli_si128( vsum, 8 ));
+#endif
+   for( ; i<n; i++ )
+     {
+	lo = min( lo, p[i] );
+	sum += p[i];
+     }
+   *minp = lo;
+   *sump = sum;
+}
+
+/* Number of samples of each value, counted into four tables so that
+   runs of equal samples don't wait on each other */
+static void ChannelCount( const uint8_t *p, int n, uint32_t *count )
+{
+   uint32_t part[4][256];
+   int i, v;
+   
+   memset( part, 0, sizeof( part ));
+   for( i=0; i + 4 <= n; i += 4 )
+     {
+	part[0][p[i]]++;
+	part[1][p[i + 1]]++;
+	part[2][p[i + 2]]++;
+	part[3][p[i + 3]]++;
+     }
+   for( ; i<n; i++ )
+     part[0][p[i]]++;
+   for( v=0; v<256; v++ )
+     count[v] = part[0][v] + part[1][v] + part[2][v] + part[3][v];
+}
+
+/* Replace every sample by its entry in lut */
+static void ChannelMap( uint8_t *p, int n, const uint8_t *lut )
+{
+   int i;
+   
+   for( i=0; i + 4 <= n; i += 4 )
+     {
+	p[i] = lut[p[i]];
+	p[i + 1] = lut[p[i + 1]];
+	p[i + 2] = lut[p[i + 2]];
+	p[i + 3] = lut[p[i + 3]];
+     }
+   for( ; i<n; i++ )
+     p[i] = lut[p[i]];
+}
+
 /****************************************************************
  * Bias
  * 
@@ -1122,16 +1219,19 @@ static void Bias( double bias, int width, int height, uint8_t *data )
 {
    int i;
    double num, denom, t;
+   uint8_t lut[256];
       
    fprintf( stderr, "Bias factor : %lf\n", bias );
    
-   for( i=0; i<width*height; i++ )
+   for( i=0; i<256; i++ )
      {
-	t = (double)data[i]/256.0;
+	t = (double)i/256.0;
 	num = t;
 	denom = (1.0/bias - 2) * (1.0 - t) + 1;
-	data[i] = num/denom * 256.0;     
+	lut[i] = num/denom * 256.0;     
      }
+
+   ChannelMap( data, width*height, lut );
 }
 
 /***********************************************************************
@@ -1140,9 +1240,10 @@ static void Bias( double bias, int width, int height, uint8_t *data )
 int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b)
 {
 	/* uint8_t *tmpRow; */
-	uint8_t gbMin, gbMax, grMin, grMax, rMin, rMax, bMin, bMax;
+	uint8_t gbMin, grMin, rMin, bMin;
+	uint32_t rSum, grSum, gbSum, bSum;
 	float grInc, gbInc, rInc, bInc, grCur, gbCur, rCur, bCur;
-	float rMean = 0, grMean = 0, gbMean = 0, bMean = 0, maxMean;
+	float rMean, grMean, gbMean, bMean, maxMean;
 	uint16_t	width = picHdr->w/2;
 	uint16_t	height = picHdr->h/2;
 	int i;
@@ -1153,26 +1254,15 @@ int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr,
 	memset( greenB, 0, 256 * sizeof( uint8_t ));
 	memset( blue, 0, 256 * sizeof( uint8_t ));
  
-	gbMin = grMin = rMin = bMin = 255;
-	gbMax = grMax = rMax = bMax = 0;
-		
-	for( i=0; i<width*height; i ++ )
-	{
-		gbMin = min( gbMin, gb[i] );
-		grMin = min( grMin, gr[i] );
-		rMin = min( rMin, r[i] );
-		bMin = min( bMin, b[i] );
-
-	    gbMax = max( gbMax, gb[i] );
-		grMax = max( grMax, gr[i] );
-		rMax = max( rMax, r[i] );
-		bMax = max( bMax, b[i] );
-		
-		rMean += r[i];
-		gbMean += gb[i];
-		grMean += gr[i];
-		bMean += b[i];
-	}	
+	ChannelStats( r, width*height, &rMin, &rSum );
+	ChannelStats( gr, width*height, &grMin, &grSum );
+	ChannelStats( gb, width*height, &gbMin, &gbSum );
+	ChannelStats( b, width*height, &bMin, &bSum );
+	
+	rMean = rSum;
+	gbMean = gbSum;
+	grMean = grSum;
+	bMean = bSum;
 	
 	rMean = rMean / ( width * height );
 	gbMean = gbMean / ( width * height );
@@ -1242,13 +1332,10 @@ int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr,
 		}
 	 }
 
-	for( i=0; i<width*height; i ++ )
-	{
-		gb[i] = greenB[gb[i]];
-		gr[i] = greenR[gr[i]];
-		b[i] = blue[b[i]];
-		r[i] = red[r[i]];
-	}	
+	ChannelMap( gb, width*height, greenB );
+	ChannelMap( gr, width*height, greenR );
+	ChannelMap( b, width*height, blue );
+	ChannelMap( r, width*height, red );
 	
 	return( 1 );
 }
@@ -1274,21 +1361,13 @@ int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint
 	memset( greenB, 0, 256 * sizeof( uint8_t ));
 	memset( blue, 0, 256 * sizeof( uint8_t ));
  
-	memset( rC, 0, 256 * sizeof( uint32_t ));
-	memset( grC, 0, 256 * sizeof( uint32_t ));
-	memset( gbC, 0, 256 * sizeof( uint32_t ));
-	memset( bC, 0, 256 * sizeof( uint32_t ));
- 
 	gbMin = grMin = rMin = bMin = 255;
 	gbMax = grMax = rMax = bMax = 0;
 		
-	for( i=0; i<width*height; i ++ )
-	{
-	    rC[r[i]]++;
-	    grC[gr[i]]++;
-	    gbC[gb[i]]++;
-	    bC[b[i]]++;
-	}	
+	ChannelCount( r, width*height, rC );
+	ChannelCount( gr, width*height, grC );
+	ChannelCount( gb, width*height, gbC );
+	ChannelCount( b, width*height, bC );
 
     rCum = grCum = gbCum = bCum = 0;
     
@@ -1409,13 +1488,10 @@ int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint
 		}
 	 }
 
-	for( i=0; i<width*height; i ++ )
-	{
-		gb[i] = greenB[gb[i]];
-		gr[i] = greenR[gr[i]];
-		b[i] = blue[b[i]];
-		r[i] = red[r[i]];
-	}	
+	ChannelMap( gb, width*height, greenB );
+	ChannelMap( gr, width*height, greenR );
+	ChannelMap( b, width*height, blue );
+	ChannelMap( r, width*height, red );
 	
 	return( 1 );
 }
@@ -1425,138 +1501,211 @@ int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint
  * green component when the green component is centered. This is to compensate
  * for a different intensity on odd and even green rows. All green 
  * interpolations have an equal number of pixels from a red row and blue row.
+ *
+ * Each output row is worked out into planar red, green and blue rows
+ * (columns 2 to w-3), eight channel samples (sixteen pixels) at a time
+ * where SSE2 is available, and then interleaved into the pixmap.
  *****************************************************************************/
-static void Interpolate( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8_t *greenR, uint8_t *greenB, uint8_t *blue, uint8_t *pp, int offset_r, int offset_g, int offset_b )
+
+#ifdef PIX_SSE2
+/* Eight samples widened to 16 bits */
+#define PIX_LOAD(p) _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(p) ), zero )
+
+/* Store the pixels 2x and 2x+1 of eight samples */
+#define PIX_STORE(out, even, odd) \
+	_mm_storeu_si128( (__m128i *)(out), \
+		_mm_unpacklo_epi8( _mm_packus_epi16( even, even ), \
+			_mm_packus_epi16( odd, odd )))
+#endif
+
+/* A row between red rows r0 and r1: r0, gr0, gb0 and b0 are the samples
+   of channel row y/2, r1 and gr1 of the one below */
+static void InterpolateOddRow( const uint8_t *r0, const uint8_t *r1, const uint8_t *gr0, const uint8_t *gr1, const uint8_t *gb0, const uint8_t *b0, int rawWidth, uint8_t *outR, uint8_t *outG, uint8_t *outB )
+{
+   int x = 1;
+#ifdef PIX_SSE2
+   __m128i zero = _mm_setzero_si128(),
+	   r0a, r0b, r1a, r1b, gr0b, gr0c, gr1b, gr1c, gb0a, gb0b, b0b, b0c,
+	   re, ro, ge, go;
+   
+   for( ; x + 8 <= rawWidth - 1; x += 8 )
+     {
+	r0a = PIX_LOAD( r0 + x - 1 );
+	r0b = PIX_LOAD( r0 + x );
+	r1a = PIX_LOAD( r1 + x - 1 );
+	r1b = PIX_LOAD( r1 + x );
+	gr0b = PIX_LOAD( gr0 + x );
+	gr0c = PIX_LOAD( gr0 + x + 1 );
+	gr1b = PIX_LOAD( gr1 + x );
+	gr1c = PIX_LOAD( gr1 + x + 1 );
+	gb0a = PIX_LOAD( gb0 + x - 1 );
+	gb0b = PIX_LOAD( gb0 + x );
+	b0b = PIX_LOAD( b0 + x );
+	b0c = PIX_LOAD( b0 + x + 1 );
+	
+	re = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( r0a, r0b ), _mm_add_epi16( r1a, r1b )), 2 );
+	ro = _mm_srli_epi16( _mm_add_epi16( r0b, r1b ), 1 );
+	ge = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( gr0b, gr1b ), _mm_add_epi16( gb0a, gb0b )), 2 );
+	go = _mm_srli_epi16( _mm_add_epi16( _mm_slli_epi16( gb0b, 2 ),
+		_mm_add_epi16( _mm_add_epi16( gr0b, gr0c ), _mm_add_epi16( gr1b, gr1c ))), 3 );
+	
+	PIX_STORE( outR + 2 * x, re, ro );
+	PIX_STORE( outG + 2 * x, ge, go );
+	PIX_STORE( outB + 2 * x, b0b, _mm_srli_epi16( _mm_add_epi16( b0b, b0c ), 1 ));
+     }
+#endif
+   for( ; x<rawWidth-1; x++ )
+     {
+	outR[2 * x] = (r0[x-1] + r0[x] + r1[x-1] + r1[x])>>2;
+	outG[2 * x] = (gr0[x] + gr1[x] + gb0[x-1] + gb0[x])>>2;
+	outB[2 * x] = b0[x];
+	
+	outR[2 * x + 1] = (r0[x] + r1[x])>>1;
+	outG[2 * x + 1] = ((gb0[x] << 2) + gr0[x] + gr0[x+1] + gr1[x] + gr1[x+1])>>3;
+	outB[2 * x + 1] = (b0[x] + b0[x+1])>>1;
+     }
+}
+
+/* A row between blue rows b0 and b1: r1, gr1, gb1 and b1 are the samples
+   of channel row y/2, gb0 and b0 of the one above */
+static void InterpolateEvenRow( const uint8_t *r1, const uint8_t *gr1, const uint8_t *gb0, const uint8_t *gb1, const uint8_t *b0, const uint8_t *b1, int rawWidth, uint8_t *outR, uint8_t *outG, uint8_t *outB )
 {
-   int idx, offset, ppOff;
-   int x, y, rowOff;
-   uint8_t r, g, b;
+   int x = 1;
+#ifdef PIX_SSE2
+   __m128i zero = _mm_setzero_si128(),
+	   r1a, r1b, gr1b, gr1c, gb0a, gb0b, gb1a, gb1b, b0a, b0b, b1b, b1c,
+	   ge, go, be, bo;
+   
+   for( ; x + 8 <= rawWidth - 1; x += 8 )
+     {
+	r1a = PIX_LOAD( r1 + x - 1 );
+	r1b = PIX_LOAD( r1 + x );
+	gr1b = PIX_LOAD( gr1 + x );
+	gr1c = PIX_LOAD( gr1 + x + 1 );
+	gb0a = PIX_LOAD( gb0 + x - 1 );
+	gb0b = PIX_LOAD( gb0 + x );
+	gb1a = PIX_LOAD( gb1 + x - 1 );
+	gb1b = PIX_LOAD( gb1 + x );
+	b0a = PIX_LOAD( b0 + x - 1 );
+	b0b = PIX_LOAD( b0 + x );
+	b1b = PIX_LOAD( b1 + x );
+	b1c = PIX_LOAD( b1 + x + 1 );
+	
+	ge = _mm_srli_epi16( _mm_add_epi16( _mm_slli_epi16( gr1b, 2 ),
+		_mm_add_epi16( _mm_add_epi16( gb0a, gb0b ), _mm_add_epi16( gb1a, gb1b ))), 3 );
+	go = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( gr1b, gr1c ), _mm_add_epi16( gb0b, gb1b )), 2 );
+	be = _mm_srli_epi16( _mm_add_epi16( b0b, b1b ), 1 );
+	bo = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( b0b, b0a ), _mm_add_epi16( b1b, b1c )), 2 );
+	
+	PIX_STORE( outR + 2 * x, _mm_srli_epi16( _mm_add_epi16( r1a, r1b ), 1 ), r1b );
+	PIX_STORE( outG + 2 * x, ge, go );
+	PIX_STORE( outB + 2 * x, be, bo );
+     }
+#endif
+   for( ; x<rawWidth-1; x++ )
+     {
+	outR[2 * x] = (r1[x-1] + r1[x])>>1;
+	outG[2 * x] = ((gr1[x] << 2) + gb0[x-1] + gb0[x] + gb1[x-1] + gb1[x])>>3;
+	outB[2 * x] = (b0[x] + b1[x])>>1;
+	
+	outR[2 * x + 1] = r1[x];
+	outG[2 * x + 1] = (gr1[x] + gr1[x+1] + gb0[x] + gb1[x])>>2;
+	outB[2 * x + 1] = (b0[x] + b0[x-1] + b1[x] + b1[x+1])>>2;
+     }
+}
+
+static int Interpolate( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8_t *greenR, uint8_t *greenB, uint8_t *blue, uint8_t *pp, int offset_r, int offset_g, int offset_b )
+{
+   int offset, x, y;
    int rawWidth = pixHdr->w/2;
+   uint8_t *rows, *outR, *outG, *outB, *out;
+   
+   rows = malloc( (size_t)(3 * pixHdr->w) );
+   if( rows == NULL )
+     return 0;
+   outR = rows;
+   outG = rows + pixHdr->w;
+   outB = rows + 2 * pixHdr->w;
    
    for( y=1; y<pixHdr->h-1; y++ )
      {
 	
-	idx = y/2;
-	offset = idx * rawWidth;
-	ppOff = y * pixHdr->w;
+	offset = (y/2) * rawWidth;
 	
 	if( y%2 == 1 )
-	  {
-	     for( x=1; x<rawWidth-1; x++ )
-	       {
-		  
-		  rowOff = x*2;
-		  
-		  r = (red[offset+x-1] + red[offset + x] + red[offset + rawWidth + x -1] + red[offset + rawWidth + x])>>2;
-		  g = (greenR[offset+x] + greenR[offset+x+rawWidth] + greenB[offset + x - 1] + greenB[offset + x])>>2;
-		  b = blue[offset + x];
-		  pp[3 * (ppOff + rowOff) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff) + offset_b] = b;
-		  
-		  r = (red[offset + x] + red[offset + rawWidth + x])>>1;
-		  g = (( greenB[offset + x] << 2 ) + greenR[offset+x] + greenR[offset+x+1] + greenR[offset+x+rawWidth] + greenR[offset+x+rawWidth+1] )>>3;
-		  b = (blue[offset + x] + blue[offset + x + 1])>>1;
-		  pp[3 * (ppOff + rowOff + 1) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff + 1) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff + 1) + offset_b] = b;
-		  
-	       }
-	  }
+	  InterpolateOddRow( red + offset, red + offset + rawWidth,
+			     greenR + offset, greenR + offset + rawWidth,
+			     greenB + offset, blue + offset,
+			     rawWidth, outR, outG, outB );
 	else
+	  InterpolateEvenRow( red + offset, greenR + offset,
+			      greenB + offset - rawWidth, greenB + offset,
+			      blue + offset - rawWidth, blue + offset,
+			      rawWidth, outR, outG, outB );
+	
+	out = pp + 3 * (y * pixHdr->w + 2);
+	for( x=2; x<pixHdr->w-2; x++ )
 	  {
-	     for( x=1; x<rawWidth-1; x++ )
-	       {
-		  rowOff = x*2;
-		  
-		  r = (red[offset + x - 1] + red[offset + x])>>1;
-		  g = (( greenR[offset + x] << 2 ) + greenB[offset-rawWidth+x-1] + greenB[offset-rawWidth+x] + greenB[offset+x-1] + greenB[offset+x] )>>3;
-		  b = (blue[offset-rawWidth+x] + blue[offset+x])>>1;
-		  pp[3 * (ppOff + rowOff) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff) + offset_b] = b;
-		  
-		  r = red[offset+x];
-		  g = (greenR[offset+x] + greenR[offset+x+1] + greenB[offset-rawWidth+x] + greenB[offset + x])>>2;
-		  b = (blue[offset+x-rawWidth] + blue[offset+x-rawWidth-1] + blue[offset+x] + blue[offset+x+1])>>2;
-		  pp[3 * (ppOff + rowOff + 1) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff + 1) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff + 1) + offset_b] = b;
-		  
-	       }
+	     out[offset_r] = outR[x];
+	     out[offset_g] = outG[x];
+	     out[offset_b] = outB[x];
+	     out += 3;
 	  }
      }
    
+   free( rows );
+   return 1;
 }
 
+/*****************************************************************************
+ * Each row but the first is coded against the row above: a sample is
+ * the mean of its left neighbour and the sample above it, plus a delta
+ * whose Huffman code (at most 12 bits) indexes PPLuts (code length) and
+ * PPLutsW (delta). The bit position is carried from row to row in
+ * *offset (bytes) and *firstWord (bits).
+ *****************************************************************************/
 void DecodeRow( uint8_t *compData, uint8_t *lastRow, uint8_t *unCompData, uint32_t *offset, int32_t *firstWord, uint16_t *PPLutsW, uint8_t *PPLuts, uint16_t halfWidth )
 {
-   uint8_t *saveStartP, shiftOut;
-   int16_t tmpW3, tmpResult, tmpW0, idx, resultW;
-   uint32_t lutIdx, tmpL0, tmpL2, tmpL5;
+   uint8_t *saveStartP;
+   uint64_t bits;
+   uint32_t lutIdx;
+   int idx, avail, resultW;
    
+   /* The next bits to decode are kept at the top of a 64 bit word,
+      refilled 32 bits at a time once fewer than 12 are left */
    saveStartP = compData;
-
-   tmpW3 = 32 - *firstWord;
-
-   tmpResult = 32 - tmpW3;
-   
-   tmpL5 = compData[0]<<24 | compData[1]<<16 | compData[2]<<8 | compData[3] ;
-   tmpL5 = tmpL5<<tmpResult;
-   tmpL0 = tmpL5;
-   
+   bits = (uint64_t)PIX_WORD( compData ) << (32 + *firstWord);
+   avail = 32 - *firstWord;
    compData += 4;
    
-   tmpL0 = tmpL0 >> 24;
+   resultW = (int)(bits >> 56);
+   unCompData[0] = (uint8_t)resultW;
+   bits <<= 8;
+   avail -= 8;
    
-   unCompData[0] = (uint8_t)tmpL0;
-   
-   tmpL5 = tmpL5 << 8;
-   tmpW3 = tmpW3 - 8;
-   idx = 1;           
-   
-   while( idx < halfWidth )
+   for( idx = 1; idx < halfWidth; idx++ )
      {
-	if( tmpW3 < 12 )
+	if( avail < 12 )
 	  {
-	     tmpW0 = 16 - tmpW3;
-	     tmpL2 = ( compData[0]<<8 | compData[1] ) << tmpW0;
-	     tmpL5 = tmpL5 | tmpL2;
-	     tmpW3 += 16;
-	     compData += 2;
+	     bits |= (uint64_t)PIX_WORD( compData ) << (32 - avail);
+	     compData += 4;
+	     avail += 32;
 	  }
-
-	lutIdx = tmpL5 >> 20;
-
-	shiftOut = PPLuts[lutIdx];
-
-	tmpL5 = tmpL5 << shiftOut;
-	
-	tmpW3 = tmpW3 - shiftOut;
-	
-	resultW = ( unCompData[idx-1] + lastRow[idx] ) >> 1;
 	
-	resultW = resultW + PPLutsW[lutIdx];
+	lutIdx = (uint32_t)(bits >> 52);
+	bits <<= PPLuts[lutIdx];
+	avail -= PPLuts[lutIdx];
 	
-	if( resultW > 255 )
-	  resultW = 255;
+	resultW = (( resultW + lastRow[idx] ) >> 1) + (int16_t)PPLutsW[lutIdx];
+	resultW = PIX_CLAMP( resultW );
 	
-	if( resultW < 0 ) 
-	  resultW = 0;
-	
-	unCompData[idx++] = (uint8_t)resultW;
-	  
+	unCompData[idx] = (uint8_t)resultW;
      }
    
-   while( tmpW3 > 0 )
-     {
-	compData--;
-	tmpW3 -= 8;
-     }
-     
-   *offset = compData - saveStartP;
-   *firstWord = -tmpW3;
-
+   /* bits decoded, from the start of this row's first byte */
+   avail = 8 * (compData - saveStartP) - avail;
+   *offset = avail >> 3;
+   *firstWord = avail & 7;
 }
 
 /* A binary PalmPixHeader is a record of length 196 in the following format.
@@ -1710,11 +1859,13 @@ int unpack_PalmPix (struct PalmPixState *s,
 	  }
 	  
 	
-	raw = malloc ((size_t)chansize_max);
+	raw = malloc ((size_t)chansize_max + PIX_PAD);
 	if (raw == NULL)
 	  goto failed;
+	memset (raw + chansize_max, 0, PIX_PAD);
 	
-	s->pixmap = malloc ((size_t)(h->w * h->h * 3));
+	/* Interpolate() leaves a one pixel border black */
+	s->pixmap = calloc ((size_t)(h->w * h->h), 3);
 	if (s->pixmap == NULL)
 	  goto failed;
 	
@@ -1776,10 +1927,11 @@ int unpack_PalmPix (struct PalmPixState *s,
 		  Histogram ( h, chan[pixChannelR], chan[pixChannelGR], 
 				  chan[pixChannelGB], chan[pixChannelB] ); 
 
-	Interpolate (h,
-		     chan[pixChannelR], chan[pixChannelGR],
-		     chan[pixChannelGB], chan[pixChannelB],
-		     s->pixmap, s->offset_r, s->offset_g, s->offset_b);
+	if (!Interpolate (h,
+			  chan[pixChannelR], chan[pixChannelGR],
+			  chan[pixChannelGB], chan[pixChannelB],
+			  s->pixmap, s->offset_r, s->offset_g, s->offset_b))
+	  goto failed;
 	   
 	failed = 0;
 	
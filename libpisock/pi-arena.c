@@ -0,0 +1,176 @@
+/*
+ * $Id$
+ *
+ * pi-arena.c:  bump allocation of many small blocks freed together
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-arena.h"
+
+#define PI_ARENA_CHUNK	16384
+
+/* Blocks are aligned for the most demanding of these */
+union pi_arena_align {
+	long	l;
+	double	d;
+	void	*p;
+};
+
+#define PI_ARENA_ALIGN	sizeof(union pi_arena_align)
+#define PI_ARENA_ROUND(n) \
+	(((n) + PI_ARENA_ALIGN - 1) / PI_ARENA_ALIGN * PI_ARENA_ALIGN)
+
+struct pi_arena_chunk {
+	struct pi_arena_chunk *next;
+	size_t	size;		/* bytes after the header */
+	size_t	used;
+};
+
+#define PI_ARENA_HEADER	PI_ARENA_ROUND(sizeof(struct pi_arena_chunk))
+
+struct pi_arena {
+	size_t	chunk_size;
+	struct pi_arena_chunk *first,
+		*current;	/* the chunks after it are unused */
+};
+
+pi_arena_t *
+pi_arena_new(size_t chunk_size)
+{
+	pi_arena_t *arena;
+
+	if ((arena = (pi_arena_t *) malloc(sizeof(pi_arena_t))) == NULL)
+		return NULL;
+
+	arena->chunk_size = chunk_size ? chunk_size : PI_ARENA_CHUNK;
+	arena->first = NULL;
+	arena->current = NULL;
+	return arena;
+}
+
+void *
+pi_arena_alloc(pi_arena_t *arena, size_t size)
+{
+	struct pi_arena_chunk *chunk;
+	size_t	chunk_size;
+	void	*block;
+
+	if (arena == NULL)
+		return malloc(size ? size : 1);
+
+	size = PI_ARENA_ROUND(size ? size : 1);
+
+	/* the current chunk, or the next one, left free by a reset */
+	chunk = arena->current;
+	if (chunk != NULL && chunk->size - chunk->used < size)
+		chunk = chunk->next;
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+		chunk = (struct pi_arena_chunk *)
+			malloc(PI_ARENA_HEADER + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		if (arena->current == NULL) {
+			chunk->next = arena->first;
+			arena->first = chunk;
+		} else {
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		}
+	}
+
+	arena->current = chunk;
+	block = (char *) chunk + PI_ARENA_HEADER + chunk->used;
+	chunk->used += size;
+	return block;
+}
+
+void *
+pi_arena_memdup(pi_arena_t *arena, const void *data, size_t size)
+{
+	void	*copy;
+
+	if ((copy = pi_arena_alloc(arena, size)) != NULL && size)
+		memcpy(copy, data, size);
+	return copy;
+}
+
+char *
+pi_arena_strndup(pi_arena_t *arena, const char *s, size_t maxlen)
+{
+	const char *end;
+	size_t	len;
+	char	*copy;
+
+	end = memchr(s, '\0', maxlen);
+	len = end != NULL ? (size_t) (end - s) : maxlen;
+	if ((copy = pi_arena_alloc(arena, len + 1)) != NULL) {
+		memcpy(copy, s, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+char *
+pi_arena_unpack_string(pi_arena_t *arena, const pi_buffer_t *buf,
+	unsigned char **p)
+{
+	size_t	ofs = *p - buf->data;
+	char	*s;
+
+	s = pi_arena_strndup(arena, (char *) *p,
+		ofs < buf->used ? buf->used - ofs : 0);
+	if (s != NULL)
+		*p += strlen(s) + 1;
+	return s;
+}
+
+void
+pi_arena_reset(pi_arena_t *arena)
+{
+	struct pi_arena_chunk *chunk;
+
+	if (arena == NULL)
+		return;
+
+	for (chunk = arena->first; chunk != NULL; chunk = chunk->next)
+		chunk->used = 0;
+	arena->current = arena->first;
+}
+
+void
+pi_arena_free(pi_arena_t *arena)
+{
+	struct pi_arena_chunk *chunk,
+		*next;
+
+	if (arena == NULL)
+		return;
+
+	for (chunk = arena->first; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
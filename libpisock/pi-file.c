@@ -29,6 +29,12 @@
  * along with this library; if not, write to the Free Software Foundation,
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,10 +42,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+#include <sys/mman.h>
+#define PI_FILE_MMAP 1
+#endif
+
 #include "pi-debug.h"
 #include "pi-source.h"
 #include "pi-file.h"
 #include "pi-error.h"
+#include "pi-md5.h"
 
 #undef FILEDEBUG
 #define pi_mktag(c1,c2,c3,c4) (((c1)<<24)|((c2)<<16)|((c3)<<8)|(c4))
@@ -95,12 +107,38 @@
 #define PI_RESOURCE_ENT_SIZE 10
 #define PI_RECORD_ENT_SIZE 8
 
+/* Chunk in which pi_file_close() moves record data that doesn't start
+   where the final header ends */
+#define PI_FILE_MOVE_CHUNK 65536
+
+/* Number of records pi_file_retrieve() keeps in flight */
+#define PI_FILE_RETRIEVE_DEPTH 8
+
+/* Files with fewer entries are searched without a hash table */
+#define PI_FILE_INDEX_MIN 16
+
+/* Record data a buffered file keeps in memory; past it, the data goes
+   to the file as with pi_file_create() */
+#define PI_FILE_BUFFER_MAX (1024 * 1024)
+
+/* Names pi_file_open_for_writing() tries before giving up */
+#define PI_FILE_TEMP_TRIES 100
+
 /* Local prototypes */
 static int pi_file_close_for_write(pi_file_t *pf);
 static void pi_file_free(pi_file_t *pf);
 static int pi_file_find_resource_by_type_id(const pi_file_t *pf, unsigned long restype, int resid, int *resindex);
+static int pi_file_find_entry(pi_file_t *pf, unsigned long type, unsigned long id);
 static pi_file_entry_t *pi_file_append_entry(pi_file_t *pf);
+static int pi_file_append_data(pi_file_t *pf, const void *data, size_t size);
+static void pi_file_reserve(pi_file_t *pf, unsigned long entries, size_t bytes);
 static int pi_file_set_rbuf_size(pi_file_t *pf, size_t size);
+static int pi_file_map(pi_file_t *pf, size_t size);
+static long pi_file_header_size(pi_file_t *pf, int entries);
+static int pi_file_move_data(pi_file_t *pf, long offset);
+static pi_file_t *pi_file_new_for_writing(const char *name, const struct DBInfo *info);
+static FILE *pi_file_open_for_writing(pi_file_t *pf);
+static void pi_file_free_block(pi_file_t *pf, void *block);
 
 /* this seems to work, but what about leap years? */
 /*#define PILOT_TIME_DELTA (((unsigned)(1970 - 1904) * 365 * 24 * 60 * 60) + 1450800)*/
@@ -150,7 +188,8 @@ pi_file_t
 	pi_file_entry_t *entp;
 		
 	unsigned char buf[PI_HDR_SIZE];
-	unsigned char *p;
+	unsigned char *p,
+		*table = NULL;
 	off_t offset, app_info_offset = 0, sort_info_offset = 0;
 
 	if ((pf = calloc(1, sizeof (pi_file_t))) == NULL)
@@ -163,13 +202,20 @@ pi_file_t
 	file_size = ftell(pf->f);
 	fseek(pf->f, 0, SEEK_SET);
 
-	if (fread(buf, PI_HDR_SIZE, 1, pf->f) != (size_t) 1) {
+	/* map the file if we can: then only the headers are parsed, and
+	   the data is never copied. The descriptor isn't needed anymore */
+	if (file_size >= PI_HDR_SIZE && pi_file_map(pf, (size_t)file_size) == 0) {
+		fclose(pf->f);
+		pf->f = NULL;
+		p = pf->map;
+	} else if (fread(buf, PI_HDR_SIZE, 1, pf->f) != (size_t) 1) {
 		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
  		     "FILE OPEN %s: can't read header\n", name));
 		goto bad;
+	} else {
+		p = buf;
 	}
 
-	p 	= buf;
 	ip 	= &pf->info;
 
 	memcpy(ip->name, p, 32);
@@ -236,13 +282,25 @@ pi_file_t
 				sizeof *pf->entries)) == NULL)
 			goto bad;
 
-		for (i = 0, entp = pf->entries; i < pf->num_entries;
-		     i++, entp++) {
-			if (fread(buf, (size_t) pf->ent_hdr_size, 1, pf->f)
-				!= (size_t) 1)
+		/* the entry headers follow the database header */
+		if (pf->map != NULL) {
+			if (PI_HDR_SIZE + pf->num_entries * pf->ent_hdr_size
+				> file_size)
 				goto bad;
+			p = (unsigned char *) pf->map + PI_HDR_SIZE;
+		} else {
+			if ((table = malloc((size_t) pf->num_entries
+					* pf->ent_hdr_size)) == NULL)
+				goto bad;
+			if (fread(table, (size_t) pf->ent_hdr_size,
+				(size_t) pf->num_entries, pf->f)
+				!= (size_t) pf->num_entries)
+				goto bad;
+			p = table;
+		}
 
-			p = buf;
+		for (i = 0, entp = pf->entries; i < pf->num_entries;
+		     i++, entp++, p += pf->ent_hdr_size) {
 			if (pf->resource_flag) {
 				entp->type 	= get_long(p);
 				entp->resource_id    = get_short(p + 4);
@@ -274,7 +332,7 @@ pi_file_t
 			     "FILE OPEN Entry: %d Size: %d\n",
 			     pf->num_entries - i - 1, entp->size));
 
-			if (entp->size < 0 ||
+			if (entp->size < 0 || entp->offset < 0 ||
 				(entp->offset + entp->size) > file_size) {
 				LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
 				 "FILE OPEN %s: Entry %d corrupt,"
@@ -310,6 +368,8 @@ pi_file_t
 
 	if (pf->app_info_size == 0)
 		pf->app_info = NULL;
+	else if (pf->map != NULL)
+		pf->app_info = (unsigned char *) pf->map + app_info_offset;
 	else {
 		if ((pf->app_info =
 			malloc((size_t) pf->app_info_size)) == NULL)
@@ -322,6 +382,8 @@ pi_file_t
 
 	if (pf->sort_info_size == 0)
 		pf->sort_info = NULL;
+	else if (pf->map != NULL)
+		pf->sort_info = (unsigned char *) pf->map + sort_info_offset;
 	else {
 		if ((pf->sort_info = malloc((size_t)pf->sort_info_size))
 			 == NULL)
@@ -332,9 +394,11 @@ pi_file_t
 			goto bad;
 	}
 
+	free(table);
 	return pf;
 
 bad:
+	free(table);
 	pi_file_close(pf);
 	return NULL;
 }
@@ -357,6 +421,14 @@ pi_file_close(pi_file_t *pf)
 	return err;
 }
 
+void
+pi_file_discard(pi_file_t *pf)
+{
+	/* the temporary file goes, and nothing replaces file_name */
+	if (pf)
+		pi_file_free(pf);
+}
+
 void
 pi_file_get_info(const pi_file_t *pf, struct DBInfo *infop)
 {
@@ -415,7 +487,9 @@ pi_file_read_resource(pi_file_t *pf, int i,
 
 	entp = &pf->entries[i];
 
-	if (bufp) {
+	if (bufp && pf->map != NULL) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0)
 			return result;
 		fseek(pf->f, pf->entries[i].offset, SEEK_SET);
@@ -451,7 +525,9 @@ pi_file_read_record(pi_file_t *pf, int recindex,
 
 	entp = &pf->entries[recindex];
 
-	if (bufp) {
+	if (bufp && pf->map != NULL) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0) {
 			LOG((PI_DBG_API, PI_DBG_LVL_ERR,
 			    "FILE READ_RECORD Unable to set buffer size!\n"));
@@ -491,65 +567,54 @@ pi_file_read_record_by_id(pi_file_t *pf, recordid_t uid,
 			  int *catp)
 {
 	int 	i;
-	struct 	pi_file_entry *entp;
-
-	for (i = 0, entp = pf->entries; i < pf->num_entries;
-	     i++, entp++) {
-		if (entp->uid == uid) {
-			if (idxp)
-				*idxp = i;
-			return (pi_file_read_record
-				(pf, i, bufp, sizep, attrp, catp, &uid));
-		}
-	}
 
-	return PI_ERR_FILE_NOT_FOUND;
+	if ((i = pi_file_find_entry(pf, 0, uid)) < 0)
+		return PI_ERR_FILE_NOT_FOUND;
+	if (idxp)
+		*idxp = i;
+	return pi_file_read_record(pf, i, bufp, sizep, attrp, catp, &uid);
 }
 
 int
 pi_file_id_used(const pi_file_t *pf, recordid_t uid)
 {
-	int 	i;
-	struct 	pi_file_entry *entp;
-
-	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
-		if (entp->uid == uid)
-			return 1;
-	}
-	return 0;
+	/* the hash table is a cache, building it doesn't change the file */
+	return pi_file_find_entry((pi_file_t *)pf, 0, uid) >= 0;
 }
 
 pi_file_t *
 pi_file_create(const char *name, const struct DBInfo *info)
 {
-	pi_file_t *pf = calloc(1, sizeof(pi_file_t));
+	pi_file_t *pf = pi_file_new_for_writing(name, info);
 
 	if (pf == NULL)
 		return NULL;
 
-	if ((pf->file_name = strdup(name)) == NULL)
-		goto bad;
+	/* record data is written as it comes, the header at close time */
+	if ((pf->f = pi_file_open_for_writing(pf)) == NULL) {
+		pi_file_free(pf);
+		return NULL;
+	}
 
-	pf->for_writing = 1;
-	pf->info = *info;
+	return (pf);
+}
 
-	if (info->flags & dlpDBFlagResource) {
-		pf->resource_flag = 1;
-		pf->ent_hdr_size = PI_RESOURCE_ENT_SIZE;
-	} else {
-		pf->resource_flag = 0;
-		pf->ent_hdr_size = PI_RECORD_ENT_SIZE;
-	}
+pi_file_t *
+pi_file_create_buffered(const char *name, const struct DBInfo *info)
+{
+	pi_file_t *pf = pi_file_new_for_writing(name, info);
 
-	pf->tmpbuf = pi_buffer_new(2048);
-	if (pf->tmpbuf == NULL)
-		goto bad;
+	if (pf == NULL)
+		return NULL;
 
-	return (pf);
+	/* nothing touches the disk before pi_file_close(), unless the
+	   data outgrows PI_FILE_BUFFER_MAX */
+	if ((pf->tmpbuf = pi_buffer_new(2048)) == NULL) {
+		pi_file_free(pf);
+		return NULL;
+	}
 
-bad:
-	pi_file_free(pf);
-	return NULL;
+	return (pf);
 }
 
 int
@@ -573,8 +638,8 @@ pi_file_set_app_info(pi_file_t *pf, void *data, size_t size)
 	void 	*p;
 
 	if (!size) {
-		if (pf->app_info)
-			free(pf->app_info);
+		pi_file_free_block(pf, pf->app_info);
+		pf->app_info = NULL;
 		pf->app_info_size = 0;
 		return 0;
 	}
@@ -584,8 +649,7 @@ pi_file_set_app_info(pi_file_t *pf, void *data, size_t size)
 
 	memcpy(p, data, size);
 
-	if (pf->app_info)
-		free(pf->app_info);
+	pi_file_free_block(pf, pf->app_info);
 
 	pf->app_info = p;
 	pf->app_info_size = size;
@@ -599,8 +663,8 @@ pi_file_set_sort_info(pi_file_t *pf, void *data, size_t size)
 	void 	*p;
 
 	if (!size) {
-		if (pf->sort_info)
-			free(pf->sort_info);
+		pi_file_free_block(pf, pf->sort_info);
+		pf->sort_info = NULL;
 		pf->sort_info_size = 0;
 		return 0;
 	}
@@ -610,8 +674,7 @@ pi_file_set_sort_info(pi_file_t *pf, void *data, size_t size)
 
 	memcpy(p, data, size);
 
-	if (pf->sort_info)
-		free(pf->sort_info);
+	pi_file_free_block(pf, pf->sort_info);
 
 	pf->sort_info = p;
 	pf->sort_info_size = size;
@@ -634,9 +697,9 @@ pi_file_append_resource(pi_file_t *pf, void *data, size_t size,
 	if (entp == NULL)
 		return PI_ERR_GENERIC_MEMORY;
 
-	if (size && pi_buffer_append(pf->tmpbuf, data, size) == NULL) {
-		pf->err = 1;
-		return PI_ERR_GENERIC_MEMORY;
+	if (size && pi_file_append_data(pf, data, size) < 0) {
+		pf->err = PI_ERR_FILE_ERROR;
+		return PI_ERR_FILE_ERROR;
 	}
 
 	entp->size 	= size;
@@ -661,9 +724,9 @@ pi_file_append_record(pi_file_t *pf, void *data, size_t size,
 	if (entp == NULL)
 		return PI_ERR_GENERIC_MEMORY;
 
-	if (size && pi_buffer_append(pf->tmpbuf, data, size) == NULL) {
-		pf->err = 1;
-		return PI_ERR_GENERIC_MEMORY;
+	if (size && pi_file_append_data(pf, data, size) < 0) {
+		pf->err = PI_ERR_FILE_ERROR;
+		return PI_ERR_FILE_ERROR;
 	}
 
 	entp->size 	= size;
@@ -679,6 +742,69 @@ pi_file_get_entries(pi_file_t *pf, int *entries)
 	*entries = pf->num_entries;
 }
 
+size_t
+pi_file_get_buffered_size(const pi_file_t *pf)
+{
+	return pf->tmpbuf != NULL ? pf->data_size : 0;
+}
+
+/* pi_file_retrieve() context for pi_file_retrieve_entry() */
+struct pi_file_retrieve_state {
+	pi_file_t *pf;
+	pi_progress_t *progress;
+	progress_func report_progress;
+};
+
+/***********************************************************************
+ *
+ * Function:    pi_file_retrieve_entry
+ *
+ * Summary:     Batch read callback for pi_file_retrieve(): append a
+ *		record or resource to the file and report progress
+ *
+ * Parameters:  socket, entry read, retrieve state
+ *
+ * Returns:     0 to go on, negative to abort the transfer
+ *
+ ***********************************************************************/
+static int
+pi_file_retrieve_entry(int socket, struct dlpPipelineCompletion *entry,
+	void *userdata)
+{
+	struct pi_file_retrieve_state *state =
+		(struct pi_file_retrieve_state *)userdata;
+	pi_file_t *pf = state->pf;
+	pi_buffer_t *buffer = entry->buffer;
+	int result;
+
+	if (pf->resource_flag) {
+		if ((result = pi_file_append_resource (pf, buffer->data, buffer->used,
+				entry->type, entry->resID)) < 0)
+			return pi_set_error(socket, result);
+	}
+
+	state->progress->transferred_bytes += buffer->used;
+	state->progress->data.db.transferred_records++;
+
+	if (state->report_progress && state->report_progress(socket,
+			state->progress) == PI_TRANSFER_STOP)
+		return pi_set_error(socket, PI_ERR_FILE_ABORTED);
+
+	if (pf->resource_flag)
+		return 0;
+
+	/* There is no way to restore records with these
+	   attributes, so there is no use in backing them up
+	 */
+	if (entry->attr & (dlpRecAttrArchived | dlpRecAttrDeleted))
+		return 0;
+	if ((result = pi_file_append_record(pf, buffer->data, buffer->used,
+			entry->attr, entry->category, entry->recuid)) < 0)
+		return pi_set_error(socket, result);
+
+	return 0;
+}
+
 int
 pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 	progress_func report_progress)
@@ -687,13 +813,12 @@ pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 		result,
 		old_device = 0;
 
-        unsigned int j;
-
 	struct DBInfo dbi;
 	struct DBSizeInfo size_info;
 
 	pi_buffer_t *buffer = NULL;
 	pi_progress_t progress;
+	struct pi_file_retrieve_state state;
 
 	pi_reset_errors(socket);
 	memset(&size_info, 0, sizeof(size_info));
@@ -768,87 +893,360 @@ pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 		}
 	}
 
-	if (pf->info.flags & dlpDBFlagResource) {
-		for (j = 0; j < size_info.numRecords; j++) {
-			int 	resource_id;
-			unsigned long type;
+	/* the size info is only a hint (see above), but when it's right
+	   the records are streamed to their final place in the file */
+	pi_file_reserve(pf, size_info.numRecords, size_info.totalBytes);
+
+	/* records are read in batches: while one is being appended, the
+	   next ones are already on their way */
+	state.pf = pf;
+	state.progress = &progress;
+	state.report_progress = report_progress;
+
+	if (pf->info.flags & dlpDBFlagResource)
+		result = dlp_ReadResourcesBatch(socket, db, 0,
+			(int)size_info.numRecords, PI_FILE_RETRIEVE_DEPTH, buffer,
+			pi_file_retrieve_entry, &state);
+	else
+		result = dlp_ReadRecordsBatch(socket, db, 0,
+			(int)size_info.numRecords, PI_FILE_RETRIEVE_DEPTH, buffer,
+			pi_file_retrieve_entry, &state);
+	if (result < 0)
+		goto fail;
 
-			if ((result = dlp_ReadResourceByIndex(socket, db, j, buffer,
-					&type, &resource_id)) < 0)
-				goto fail;
+	pi_buffer_free(buffer);
 
-			if ((result = pi_file_append_resource (pf, buffer->data, buffer->used,
-					type, resource_id)) < 0) {
-				pi_set_error(socket, result);
-				goto fail;
-			}
+	return dlp_CloseDB(socket, db);
 
-			progress.transferred_bytes += buffer->used;
-			progress.data.db.transferred_records++;
+fail:
+	if (db != -1 && pi_socket_connected(socket)) {
+		int err = pi_error(socket);			/* make sure we keep last error code */
+		int palmoserr = pi_palmos_error(socket);
+		
+		dlp_CloseDB(socket, db);
+		
+		pi_set_error(socket, err);			/* then restore it afterwards */
+		pi_set_palmos_error(socket, palmoserr);
+	}
 
-			if (report_progress && report_progress(socket,
-					&progress) == PI_TRANSFER_STOP) {
-				result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+	if (buffer != NULL)
+		pi_buffer_free (buffer);
+
+	if (result >= 0) {
+		/* one of our pi_file* calls failed */
+		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
+	}
+
+	/* pi_file_close() won't write what was retrieved so far */
+	pf->err = result;
+	return result;
+}
+
+/* A record pi_file_retrieve_incremental() read because it was dirty;
+   its data is at offset in the buffer of dirty records */
+struct pi_file_dirty {
+	recordid_t uid;
+	int	attr,
+		category;
+	size_t	offset,
+		size;
+};
+
+/***********************************************************************
+ *
+ * Function:    pi_file_find_dirty
+ *
+ * Summary:     Find a record among the dirty ones. They come in index
+ *		order, like the unique IDs, so the next one is usually it.
+ *
+ * Parameters:  dirty records, their number, where to look first, ID
+ *
+ * Returns:     The record, or NULL
+ *
+ ***********************************************************************/
+static struct pi_file_dirty *
+pi_file_find_dirty(struct pi_file_dirty *dirty, int count, int *next,
+	recordid_t uid)
+{
+	int	i;
+
+	if (*next < count && dirty[*next].uid == uid)
+		return &dirty[(*next)++];
+	for (i = 0; i < count; i++)
+		if (dirty[i].uid == uid)
+			return &dirty[i];
+	return NULL;
+}
+
+int
+pi_file_retrieve_incremental(pi_file_t *pf, pi_file_t *previous,
+	int socket, int cardno, progress_func report_progress)
+{
+	int	db = -1,
+		i,
+		j,
+		count,
+		num_records,
+		ndirty	= 0,
+		adirty	= 0,
+		next	= 0,
+		index,
+		attr,
+		category,
+		result;
+	recordid_t uid,
+		*uids	= NULL;
+	size_t	size;
+	void	*data;
+	struct DBInfo dbi;
+	struct DBSizeInfo size_info;
+	struct pi_file_dirty *dirty = NULL,
+		*d;
+	pi_buffer_t *buffer = NULL,
+		*dirty_data = NULL;
+	pi_progress_t progress;
+
+	/* dirty flags are only kept on records, in RAM */
+	if (previous == NULL || pf->resource_flag || previous->resource_flag
+	    || pi_version(socket) < 0x0102)
+		return pi_file_retrieve(pf, socket, cardno, report_progress);
+
+	pi_reset_errors(socket);
+	memset(&size_info, 0, sizeof(size_info));
+	if ((result = dlp_FindDBByName(socket, cardno, pf->info.name,
+			NULL, NULL, &dbi, &size_info)) < 0) {
+		if (result == PI_ERR_DLP_UNSUPPORTED)
+			return pi_file_retrieve(pf, socket, cardno,
+				report_progress);
+		goto fail;
+	}
+
+	/* resetting the dirty flags sets the backup date: if it changed,
+	   some records may have changed without saying so */
+	if (!(dbi.miscFlags & dlpDBMiscFlagRamBased)
+	    || (dbi.flags & dlpDBFlagResource)
+	    || dbi.type != previous->info.type
+	    || dbi.creator != previous->info.creator
+	    || dbi.createDate != previous->info.createDate
+	    || dbi.backupDate != previous->info.backupDate) {
+		LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+			"FILE RETRIEVE '%s' changed beyond its dirty flags, "
+			"reading all of it\n", pf->info.name));
+		return pi_file_retrieve(pf, socket, cardno, report_progress);
+	}
+
+	if ((result = dlp_OpenDB(socket, cardno, dlpOpenRead | dlpOpenSecret,
+			pf->info.name, &db)) < 0)
+		goto fail;
+
+	buffer = pi_buffer_new(DLP_BUF_SIZE);
+	dirty_data = pi_buffer_new(DLP_BUF_SIZE);
+	if (buffer == NULL || dirty_data == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+
+	memset(&progress, 0, sizeof(progress));
+	progress.type = PI_PROGRESS_RECEIVE_DB;
+	progress.data.db.pf = pf;
+	progress.data.db.size = size_info;
+
+	/* the appInfo block has no dirty flag, but it is small */
+	result = dlp_ReadAppBlock(socket, db, 0, DLP_BUF_SIZE, buffer);
+	if (result > 0) {
+		pi_file_set_app_info(pf, buffer->data, (size_t)result);
+		progress.transferred_bytes += result;
+	}
+
+	/* what is on the handheld, in index order */
+	if ((result = dlp_ReadOpenDBInfo(socket, db, &num_records)) < 0)
+		goto fail;
+	uids = (recordid_t *) malloc((num_records + 1) * sizeof(recordid_t));
+	if (uids == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+	for (i = 0; i < num_records; i += count) {
+		if ((result = dlp_ReadRecordIDList(socket, db, 0, i,
+				num_records - i < 500 ? num_records - i : 500,
+				uids + i, &count)) < 0)
+			goto fail;
+		if (count <= 0)
+			break;
+	}
+	num_records = i;
+
+	/* what changed */
+	if ((result = dlp_ResetDBIndex(socket, db)) < 0)
+		goto fail;
+	for (;;) {
+		result = dlp_ReadNextModifiedRec(socket, db, buffer, &uid,
+			&index, &attr, &category);
+		if (result == PI_ERR_DLP_PALMOS
+		    && pi_palmos_error(socket) == dlpErrNotFound)
+			break;
+		if (result < 0)
+			goto fail;
+
+		if (ndirty == adirty) {
+			d = (struct pi_file_dirty *) realloc(dirty,
+				(adirty * 2 + 16) * sizeof(struct pi_file_dirty));
+			if (d == NULL) {
+				result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
 				goto fail;
 			}
+			dirty = d;
+			adirty = adirty * 2 + 16;
 		}
-	} else for (j = 0; j < size_info.numRecords; j++) {
-		int 	attr,
-			category;
-		unsigned long resource_id;
-
-		if ((result = dlp_ReadRecordByIndex(socket, db, j, buffer, &resource_id, &attr,
-				&category)) < 0)
+		d = &dirty[ndirty++];
+		d->uid		= uid;
+		d->attr		= attr;
+		d->category	= category;
+		d->offset	= dirty_data->used;
+		d->size		= buffer->used;
+		if (pi_buffer_append_buffer(dirty_data, buffer) == NULL) {
+			result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
 			goto fail;
+		}
 
 		progress.transferred_bytes += buffer->used;
 		progress.data.db.transferred_records++;
-
-		if (report_progress
-			&& report_progress(socket,
+		if (report_progress && report_progress(socket,
 				&progress) == PI_TRANSFER_STOP) {
 			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
 			goto fail;
 		}
+	}
+	pi_reset_errors(socket);
 
-		/* There is no way to restore records with these
-		   attributes, so there is no use in backing them up
-		 */
-		if (attr &
-		    (dlpRecAttrArchived | dlpRecAttrDeleted))
+	pi_file_reserve(pf, num_records, size_info.totalBytes);
+
+	/* the records go in the handheld's order: those that changed as
+	   read, the others from the earlier copy, which usually has them
+	   in the same order */
+	for (i = 0, j = 0; i < num_records; i++) {
+		if ((d = pi_file_find_dirty(dirty, ndirty, &next,
+				uids[i])) != NULL) {
+			data		= dirty_data->data + d->offset;
+			size		= d->size;
+			attr		= d->attr;
+			category	= d->category;
+			result		= 0;
+		} else if (j < previous->num_entries
+			   && previous->entries[j].uid == uids[i]) {
+			result = pi_file_read_record(previous, j++, &data,
+				&size, &attr, &category, NULL);
+		} else if ((result = pi_file_read_record_by_id(previous,
+				uids[i], &data, &size, &j, &attr,
+				&category)) >= 0) {
+			j++;
+		} else {
+			/* not in the earlier copy, maybe because it was
+			   deleted or archived then */
+			if ((result = dlp_ReadRecordById(socket, db, uids[i],
+					buffer, NULL, &attr, &category)) < 0)
+				goto fail;
+			data = buffer->data;
+			size = buffer->used;
+			progress.transferred_bytes += size;
+			progress.data.db.transferred_records++;
+		}
+		if (result < 0) {
+			result = pi_set_error(socket, result);
+			goto fail;
+		}
+
+		/* as in pi_file_retrieve() */
+		if (attr & (dlpRecAttrArchived | dlpRecAttrDeleted))
 			continue;
-		if ((result = pi_file_append_record(pf, buffer->data, buffer->used,
-				attr, category, resource_id)) < 0) {
+		if ((result = pi_file_append_record(pf, data, size, attr,
+				category, uids[i])) < 0) {
 			pi_set_error(socket, result);
 			goto fail;
 		}
 	}
 
+	free(uids);
+	free(dirty);
+	pi_buffer_free(dirty_data);
 	pi_buffer_free(buffer);
 
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+		"FILE RETRIEVE '%s' %d of %d records read\n", pf->info.name,
+		progress.data.db.transferred_records, num_records));
+
 	return dlp_CloseDB(socket, db);
 
 fail:
 	if (db != -1 && pi_socket_connected(socket)) {
-		int err = pi_error(socket);			/* make sure we keep last error code */
+		int err = pi_error(socket);
 		int palmoserr = pi_palmos_error(socket);
-		
+
 		dlp_CloseDB(socket, db);
-		
-		pi_set_error(socket, err);			/* then restore it afterwards */
+
+		pi_set_error(socket, err);
 		pi_set_palmos_error(socket, palmoserr);
 	}
-
+	free(uids);
+	free(dirty);
+	if (dirty_data != NULL)
+		pi_buffer_free(dirty_data);
 	if (buffer != NULL)
-		pi_buffer_free (buffer);
+		pi_buffer_free(buffer);
 
-	if (result >= 0) {
-		/* one of our pi_file* calls failed */
+	if (result >= 0)
 		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
-	}
+
+	/* as in pi_file_retrieve() */
+	pf->err = result;
 	return result;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_install_app_info
+ *
+ * Summary:     Get the appInfo block to send to the handheld
+ *
+ * Parameters:  file, DLP version of the handheld, block and its size
+ *		on return
+ *
+ * Returns:     1 if the block was allocated and must be freed, 0 if it
+ *		belongs to the file
+ *
+ ***********************************************************************/
+static int
+pi_file_install_app_info(pi_file_t *pf, int version, void **buffer,
+	size_t *size)
+{
+	void	*b2;
+
+	pi_file_get_app_info(pf, buffer, size);
+
+	/* Compensate for bug in OS 2.x Memo */
+	if (version > 0x0100
+		&& strcmp(pf->info.name, "MemoDB") == 0
+		&& *size > 0
+		&& *size < 282) {
+		/* Justification: The appInfo structure was accidentally
+		   lengthend in OS 2.0, but the Memo application does not
+		   check that it is long enough, hence the shorter block
+		   from OS 1.x will cause the 2.0 Memo application to lock
+		   up if the sort preferences are modified. This code
+		   detects the installation of a short app info block on a
+		   2.0 machine, and lengthens it. This transformation will
+		   never lose information. */
+		if ((b2 = calloc(1, 282)) == NULL)
+			return 0;
+		memcpy(b2, *buffer, *size);
+		*buffer = b2;
+		*size = 282;
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 pi_file_install(pi_file_t *pf, int socket, int cardno,
 	progress_func report_progress)
@@ -967,28 +1365,8 @@ pi_file_install(pi_file_t *pf, int socket, int cardno,
 		}
 	}
 
-	pi_file_get_app_info(pf, &buffer, &l);
-
-	/* Compensate for bug in OS 2.x Memo */
-	if (version > 0x0100
-		&& strcmp(pf->info.name, "MemoDB") == 0
-		&& l > 0
-		&& l < 282) {
-		/* Justification: The appInfo structure was accidentally
-		   lengthend in OS 2.0, but the Memo application does not
-		   check that it is long enough, hence the shorter block
-		   from OS 1.x will cause the 2.0 Memo application to lock
-		   up if the sort preferences are modified. This code
-		   detects the installation of a short app info block on a
-		   2.0 machine, and lengthens it. This transformation will
-		   never lose information. */
-		void *b2 = calloc(1, 282);
-		memcpy(b2, buffer, (size_t)l);
-		buffer = b2;
-		progress.data.db.size.appBlockSize = 282;
-		l = 282;
-		freeai = 1;
-	}
+	freeai = pi_file_install_app_info(pf, version, &buffer, &l);
+	progress.data.db.size.appBlockSize = l;
 
 	/* All system updates seen to have the 'ptch' type, so trigger a
 	   reboot on those */
@@ -1250,8 +1628,643 @@ fail:
 	return result;
 }
 
-/*********************************************************************************/
-/*                                                                               */
+/* A record (by unique ID) or resource (by type and ID) and the digest
+   pi_file_install_diff() compares: its data and, for a record, its
+   category and the attributes the handheld keeps as they were sent */
+struct pi_file_digest {
+	unsigned long type;		/* 0 for records */
+	unsigned long id;		/* resource ID, or record unique ID */
+	int	index;			/* entry in the local file */
+	unsigned char md5[16];
+};
+
+/* What a database holds, as digests sorted by type and ID. The
+   manifest saved after an install is one of these, along with the
+   handheld's user, which tells which handheld it is about, and the
+   creation date and modification number the handheld reported, which
+   tell whether the database was touched since. */
+struct pi_file_manifest {
+	unsigned long user_id;
+	char	user_name[128];
+	time_t	created;
+	unsigned long modnum;
+	int	resource,
+		count,
+		allocated;
+	unsigned char app_info[16];
+	struct pi_file_digest *entries;
+};
+
+#define PI_FILE_MANIFEST_MAGIC	"pilot-link install manifest 2\n"
+
+/* Record attributes that survive an install */
+#define PI_FILE_DIGEST_ATTRS \
+	(dlpRecAttrDeleted | dlpRecAttrSecret | dlpRecAttrArchived)
+
+static void
+pi_file_digest_data(unsigned char md5[16], int record, int attr,
+	int category, const void *data, size_t size)
+{
+	struct MD5Context ctx;
+	unsigned char prefix[2];
+
+	MD5Init(&ctx);
+	if (record) {
+		prefix[0] = attr & PI_FILE_DIGEST_ATTRS;
+		prefix[1] = category;
+		MD5Update(&ctx, prefix, 2);
+	}
+	if (size > 0)
+		MD5Update(&ctx, (const unsigned char *)data, (unsigned)size);
+	MD5Final(md5, &ctx);
+}
+
+static struct pi_file_digest *
+pi_file_manifest_add(struct pi_file_manifest *m, unsigned long type,
+	unsigned long id, int index)
+{
+	struct pi_file_digest *d;
+
+	if (m->count == m->allocated) {
+		d = (struct pi_file_digest *) realloc(m->entries,
+			(m->allocated * 2 + 64) * sizeof(struct pi_file_digest));
+		if (d == NULL)
+			return NULL;
+		m->entries = d;
+		m->allocated = m->allocated * 2 + 64;
+	}
+	d = &m->entries[m->count++];
+	d->type = type;
+	d->id = id;
+	d->index = index;
+	return d;
+}
+
+static int
+pi_file_digest_cmp(const void *a, const void *b)
+{
+	const struct pi_file_digest *d1 = (const struct pi_file_digest *)a,
+		*d2 = (const struct pi_file_digest *)b;
+
+	if (d1->type != d2->type)
+		return d1->type < d2->type ? -1 : 1;
+	if (d1->id != d2->id)
+		return d1->id < d2->id ? -1 : 1;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_manifest_sort
+ *
+ * Summary:     Sort the digests of a manifest by type and ID
+ *
+ * Parameters:  manifest
+ *
+ * Returns:     0, or -1 if two entries have the same type and ID
+ *
+ ***********************************************************************/
+static int
+pi_file_manifest_sort(struct pi_file_manifest *m)
+{
+	int	i;
+
+	qsort(m->entries, (size_t)m->count, sizeof(struct pi_file_digest),
+		pi_file_digest_cmp);
+	for (i = 1; i < m->count; i++)
+		if (pi_file_digest_cmp(&m->entries[i - 1], &m->entries[i]) == 0)
+			return -1;
+	return 0;
+}
+
+static void
+pi_file_manifest_clear(struct pi_file_manifest *m)
+{
+	free(m->entries);
+	memset(m, 0, sizeof(struct pi_file_manifest));
+}
+
+static int
+pi_file_manifest_hex(const char *s, unsigned char md5[16])
+{
+	unsigned int byte;
+	int	i;
+
+	for (i = 0; i < 16; i++) {
+		if (sscanf(s + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		md5[i] = byte;
+	}
+	return 0;
+}
+
+static void
+pi_file_manifest_print_hex(FILE *f, const unsigned char md5[16])
+{
+	int	i;
+
+	for (i = 0; i < 16; i++)
+		fprintf(f, "%02x", md5[i]);
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_manifest_load
+ *
+ * Summary:     Read the manifest saved by the last install of a
+ *		database on a handheld
+ *
+ * Parameters:  manifest, file name, database name, user of the
+ *		handheld
+ *
+ * Returns:     0, or -1 if there is no usable manifest for the database
+ *		on that handheld
+ *
+ ***********************************************************************/
+static int
+pi_file_manifest_load(struct pi_file_manifest *m, const char *path,
+	const char *name, const struct PilotUser *user)
+{
+	FILE	*f;
+	char	line[256],
+		hex[33];
+	int	n = 0;
+	long	created;
+	unsigned long type = 0,
+		id;
+	struct pi_file_digest *d;
+	int	result = -1;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strcmp(line, PI_FILE_MANIFEST_MAGIC) != 0)
+		goto done;
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strncmp(line, "name ", 5) != 0
+	    || strncmp(line + 5, name, strlen(name)) != 0
+	    || strcmp(line + 5 + strlen(name), "\n") != 0)
+		goto done;
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, "user %lu%n", &m->user_id, &n) != 1
+	    || line[n++] != ' '
+	    || m->user_id != user->userID
+	    || strncmp(line + n, user->username, strlen(user->username)) != 0
+	    || strcmp(line + n + strlen(user->username), "\n") != 0)
+		goto done;
+	strncpy(m->user_name, user->username, sizeof(m->user_name) - 1);
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, "created %ld modnum %lu resource %d app %32s",
+		&created, &m->modnum, &m->resource, hex) != 4
+	    || pi_file_manifest_hex(hex, m->app_info) < 0)
+		goto done;
+	m->created = (time_t)created;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (m->resource
+		    ? sscanf(line, "%lx %lu %32s", &type, &id, hex) != 3
+		    : sscanf(line, "%lx %32s", &id, hex) != 2)
+			goto done;
+		if ((d = pi_file_manifest_add(m, type, id, -1)) == NULL
+		    || pi_file_manifest_hex(hex, d->md5) < 0)
+			goto done;
+	}
+	if (!ferror(f))
+		result = pi_file_manifest_sort(m);
+
+done:
+	fclose(f);
+	if (result < 0)
+		pi_file_manifest_clear(m);
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_manifest_save
+ *
+ * Summary:     Record what was installed, with the creation date and
+ *		modification number of the database on the handheld
+ *
+ * Parameters:  manifest, file name, socket, card, database name,
+ *		user of the handheld
+ *
+ * Returns:     0, or -1 if the manifest couldn't be written (in which
+ *		case there is none)
+ *
+ ***********************************************************************/
+static int
+pi_file_manifest_save(struct pi_file_manifest *m, const char *path,
+	int socket, int cardno, const char *name,
+	const struct PilotUser *user)
+{
+	FILE	*f;
+	char	*tmp;
+	struct DBInfo info;
+	int	i,
+		result;
+
+	unlink(path);
+	if (dlp_FindDBByName(socket, cardno, name, NULL, NULL, &info,
+			NULL) < 0)
+		return -1;
+
+	if ((tmp = (char *) malloc(strlen(path) + 5)) == NULL)
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		free(tmp);
+		return -1;
+	}
+
+	fprintf(f, "%sname %s\nuser %lu %s\n"
+		"created %ld modnum %lu resource %d app ",
+		PI_FILE_MANIFEST_MAGIC, name, user->userID, user->username,
+		(long)info.createDate, info.modnum, m->resource);
+	pi_file_manifest_print_hex(f, m->app_info);
+	fputc('\n', f);
+	for (i = 0; i < m->count; i++) {
+		if (m->resource)
+			fprintf(f, "%08lx %lu ", m->entries[i].type,
+				m->entries[i].id);
+		else
+			fprintf(f, "%08lx ", m->entries[i].id);
+		pi_file_manifest_print_hex(f, m->entries[i].md5);
+		fputc('\n', f);
+	}
+
+	result = ferror(f) ? -1 : 0;
+	if (fclose(f) != 0)
+		result = -1;
+	if (result == 0)
+		result = rename(tmp, path);
+	if (result < 0)
+		unlink(tmp);
+	free(tmp);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_diff_entry
+ *
+ * Summary:     Batch read callback for pi_file_install_diff(): digest a
+ *		record or resource of the database on the handheld
+ *
+ * Parameters:  socket, entry read, manifest of the handheld database
+ *
+ * Returns:     0 to go on, negative to stop reading
+ *
+ ***********************************************************************/
+static int
+pi_file_diff_entry(int socket, struct dlpPipelineCompletion *entry,
+	void *userdata)
+{
+	struct pi_file_manifest *m = (struct pi_file_manifest *)userdata;
+	struct pi_file_digest *d;
+
+	d = m->resource
+		? pi_file_manifest_add(m, entry->type,
+			(unsigned long)entry->resID, -1)
+		: pi_file_manifest_add(m, 0, entry->recuid, -1);
+	if (d == NULL)
+		return pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+	pi_file_digest_data(d->md5, !m->resource, entry->attr,
+		entry->category, entry->buffer->data, entry->buffer->used);
+
+	return 0;
+}
+
+int
+pi_file_install_diff(pi_file_t *pf, int socket, int cardno,
+	const char *manifest, progress_func report_progress)
+{
+	int	db = -1,
+		i,
+		j,
+		k,
+		cmp,
+		count,
+		reset	= 0,
+		changed	= 0,
+		digested = 0,
+		version,
+		freeai	= 0,
+		result	= 0,
+		err1,
+		err2,
+		attr	= 0,
+		category = 0,
+		resource_id;
+	unsigned long type;
+	recordid_t uid;
+	size_t	size,
+		l	= 0;
+	void	*buffer,
+		*app_info = NULL;
+	char	*send	= NULL;
+	unsigned char none[16];
+	struct DBInfo info;
+	struct PilotUser user;
+	struct pi_file_manifest local,
+		device;
+	struct pi_file_digest *d;
+	pi_buffer_t *rbuf = NULL;
+	pi_progress_t progress;
+
+	version = pi_version(socket);
+	pi_reset_errors(socket);
+
+	memset(&local, 0, sizeof(local));
+	memset(&device, 0, sizeof(device));
+	local.resource = device.resource =
+		(pf->info.flags & dlpDBFlagResource) != 0;
+	pi_file_digest_data(none, 0, 0, 0, NULL, 0);
+
+	/* Older handhelds can't tell us about the database, and the
+	   Graffiti shortcuts need the tricks pi_file_install() plays */
+	if (version < 0x0102
+	    || pf->info.creator == pi_mktag('g', 'r', 'a', 'f')
+	    || strncmp(pf->info.name, "Graffiti ShortCuts", 18) == 0)
+		goto install;
+
+	/* A manifest is only about the handheld it was saved for. One
+	   that was never synced can't be told from another, so it gets
+	   none. */
+	if (manifest != NULL
+	    && (dlp_ReadUserInfo(socket, &user) < 0
+		|| (user.userID == 0 && user.username[0] == '\0'))) {
+		if (!pi_socket_connected(socket)) {
+			result = pi_error(socket);
+			goto done;
+		}
+		manifest = NULL;
+	}
+
+	memset(&progress, 0, sizeof(progress));
+	progress.type = PI_PROGRESS_SEND_DB;
+	progress.data.db.pf = pf;
+	progress.data.db.size.numRecords = pf->num_entries;
+	progress.data.db.size.dataBytes = pf->app_info_size;
+	progress.data.db.size.maxRecSize = pi_maxrecsize(socket);
+
+	/* Digest the file. Records the handheld would give a new unique
+	   ID can't be matched later, so those go the long way. */
+	for (j = 0; j < pf->num_entries; j++) {
+		type = 0;
+		if (local.resource) {
+			result = pi_file_read_resource(pf, j, &buffer, &size,
+				&type, &resource_id);
+			uid = (unsigned long)resource_id;
+		} else {
+			result = pi_file_read_record(pf, j, &buffer, &size,
+				&attr, &category, &uid);
+		}
+		if (result < 0
+		    || (size > 65536 && version < 0x0104)
+		    || (!local.resource && uid == 0))
+			goto install;
+		progress.data.db.size.dataBytes += size;
+
+		/* empty resources aren't installed */
+		if (local.resource && size == 0)
+			continue;
+
+		if ((d = pi_file_manifest_add(&local, type, uid, j)) == NULL) {
+			result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+			goto done;
+		}
+		pi_file_digest_data(d->md5, !local.resource, attr, category,
+			buffer, size);
+	}
+	if (pi_file_manifest_sort(&local) < 0)
+		goto install;
+
+	progress.data.db.size.totalBytes =
+		progress.data.db.size.dataBytes +
+		pf->ent_hdr_size * pf->num_entries +
+		PI_HDR_SIZE + 2;
+
+	freeai = pi_file_install_app_info(pf, version, &app_info, &l);
+	progress.data.db.size.appBlockSize = l;
+	pi_file_digest_data(local.app_info, 0, 0, 0, app_info, l);
+	digested = 1;
+
+	/* Update the database in place only if it is the same kind of
+	   database, with the same flags */
+	if (dlp_FindDBByName(socket, cardno, pf->info.name, NULL, NULL,
+			&info, NULL) < 0
+	    || !(info.miscFlags & dlpDBMiscFlagRamBased)
+	    || info.type != pf->info.type
+	    || info.creator != pf->info.creator
+	    || info.version != pf->info.version
+	    || ((info.flags ^ pf->info.flags)
+		& ~(dlpDBFlagOpen | dlpDBFlagAppInfoDirty)))
+		goto install;
+
+	if ((result = dlp_OpenDB(socket, cardno,
+			dlpOpenReadWrite | dlpOpenSecret, pf->info.name,
+			&db)) < 0)
+		goto install;
+
+	/* If the database wasn't modified since the last install, the
+	   manifest says what it holds. Otherwise read it back. */
+	if (manifest == NULL
+	    || pi_file_manifest_load(&device, manifest, pf->info.name,
+			&user) < 0
+	    || device.created != info.createDate
+	    || device.modnum != info.modnum
+	    || device.resource != local.resource) {
+		LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+			"FILE INSTALL DIFF reading %s back\n", pf->info.name));
+
+		pi_file_manifest_clear(&device);
+		device.resource = local.resource;
+
+		if ((rbuf = pi_buffer_new(DLP_BUF_SIZE)) == NULL) {
+			result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+			goto fail;
+		}
+		if ((result = dlp_ReadOpenDBInfo(socket, db, &count)) < 0)
+			goto fail;
+		result = device.resource
+			? dlp_ReadResourcesBatch(socket, db, 0, count,
+				PI_FILE_RETRIEVE_DEPTH, rbuf,
+				pi_file_diff_entry, &device)
+			: dlp_ReadRecordsBatch(socket, db, 0, count,
+				PI_FILE_RETRIEVE_DEPTH, rbuf,
+				pi_file_diff_entry, &device);
+		if (result < 0)
+			goto fail;
+		pi_file_manifest_sort(&device);
+
+		result = dlp_ReadAppBlock(socket, db, 0, DLP_BUF_SIZE, rbuf);
+		if (result < 0 && !pi_socket_connected(socket))
+			goto fail;
+		pi_file_digest_data(device.app_info, 0, 0, 0, rbuf->data,
+			result > 0 ? (size_t)result : 0);
+	}
+
+	/* An appInfo block can be replaced, not removed */
+	if (l == 0 && memcmp(device.app_info, none, 16) != 0) {
+		dlp_CloseDB(socket, db);
+		db = -1;
+		goto install;
+	}
+
+	if (pf->info.creator == pi_mktag('p', 't', 'c', 'h')
+	    || (pf->info.flags & dlpDBFlagReset))
+		reset = 1;
+
+	if (memcmp(local.app_info, device.app_info, 16) != 0) {
+		if ((result = dlp_WriteAppBlock(socket, db, app_info, l)) < 0)
+			goto fail;
+		changed = 1;
+		progress.transferred_bytes = l;
+		if (report_progress && report_progress(socket,
+				&progress) == PI_TRANSFER_STOP) {
+			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+			goto fail;
+		}
+	}
+
+	/* Both lists are sorted: delete what's only on the handheld
+	   first, to make room, and note what to send */
+	if ((send = (char *) calloc((size_t)pf->num_entries + 1, 1)) == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+	for (i = 0, k = 0; i < local.count || k < device.count; ) {
+		if (i == local.count)
+			cmp = 1;
+		else if (k == device.count)
+			cmp = -1;
+		else
+			cmp = pi_file_digest_cmp(&local.entries[i],
+				&device.entries[k]);
+
+		if (cmp > 0) {
+			d = &device.entries[k++];
+			result = device.resource
+				? dlp_DeleteResource(socket, db, 0, d->type,
+					(int)d->id)
+				: dlp_DeleteRecord(socket, db, 0, d->id);
+			if (result < 0)
+				goto fail;
+			changed = 1;
+		} else {
+			if (cmp < 0 || memcmp(local.entries[i].md5,
+					device.entries[k].md5, 16) != 0)
+				send[local.entries[i].index] = 1;
+			if (cmp == 0)
+				k++;
+			i++;
+		}
+	}
+
+	/* Send in file order, so new records keep their order */
+	for (j = 0; j < pf->num_entries; j++) {
+		if (!send[j])
+			continue;
+
+		if (local.resource) {
+			if ((result = pi_file_read_resource(pf, j, &buffer,
+					&size, &type, &resource_id)) < 0)
+				goto fail;
+			if ((result = dlp_WriteResource(socket, db, type,
+					resource_id, buffer, size)) < 0)
+				goto fail;
+
+			/* If we see a 'boot' section, regardless of file
+			   type, require reset */
+			if (type == pi_mktag('b', 'o', 'o', 't'))
+				reset = 1;
+		} else {
+			if ((result = pi_file_read_record(pf, j, &buffer,
+					&size, &attr, &category, &uid)) < 0)
+				goto fail;
+			if ((result = dlp_WriteRecord(socket, db, attr, uid,
+					category, buffer, size, 0)) < 0)
+				goto fail;
+		}
+		changed = 1;
+
+		progress.transferred_bytes += size;
+		progress.data.db.transferred_records++;
+
+		if (report_progress && report_progress(socket,
+				&progress) == PI_TRANSFER_STOP) {
+			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+			goto fail;
+		}
+	}
+
+	LOG((PI_DBG_API, PI_DBG_LVL_INFO,
+		"FILE INSTALL DIFF %s: %d of %d entries sent\n",
+		pf->info.name, progress.data.db.transferred_records,
+		pf->num_entries));
+
+	if (reset && changed)
+		dlp_ResetSystem(socket);
+
+	result = dlp_CloseDB(socket, db);
+	db = -1;
+	if (result < 0)
+		goto fail;
+
+	if (manifest)
+		pi_file_manifest_save(&local, manifest, socket, cardno,
+			pf->info.name, &user);
+	goto done;
+
+install:
+	if (manifest)
+		unlink(manifest);
+	result = pi_file_install(pf, socket, cardno, report_progress);
+
+	/* with the whole file digested, next time needn't read back */
+	if (result >= 0 && manifest && digested)
+		pi_file_manifest_save(&local, manifest, socket, cardno,
+			pf->info.name, &user);
+	goto done;
+
+fail:
+	/* The database was updated in place, so it was the user's before
+	   this install: unlike pi_file_install(), keep it, even half
+	   updated. Without a manifest, the next install reads it back and
+	   sends what is missing. */
+	err1 = pi_error(socket);
+	err2 = pi_palmos_error(socket);
+
+	LOG((PI_DBG_API, PI_DBG_LVL_ERR, "FILE INSTALL DIFF error: "
+		"pilot-link 0x%04x, PalmOS 0x%04x\n", err1, err2));
+	if (db != -1 && pi_socket_connected(socket))
+		dlp_CloseDB(socket, db);
+	if (manifest)
+		unlink(manifest);
+
+	pi_set_error(socket, err1);
+	pi_set_palmos_error(socket, err2);
+
+	if (result >= 0)
+		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
+
+done:
+	if (freeai)
+		free(app_info);
+	if (rbuf != NULL)
+		pi_buffer_free(rbuf);
+	free(send);
+	pi_file_manifest_clear(&local);
+	pi_file_manifest_clear(&device);
+
+	return result;
+}
+
+/*********************************************************************************/
+/*                                                                               */
 /*              INTERNAL FUNCTIONS                                               */
 /*                                                                               */
 /*********************************************************************************/
@@ -1270,17 +2283,21 @@ fail:
 static int
 pi_file_close_for_write(pi_file_t *pf)
 {
-	int 	i,
-		offset;
+	int 	i;
+	long	offset;
 	FILE 	*f;
 	
 	struct 	DBInfo *ip;
 	struct 	pi_file_entry *entp;
-	struct	stat sbuf;
 		
 	unsigned char buf[512];
 	unsigned char *p;
 
+	/* a failed write or retrieve leaves the file at file_name alone;
+	   pi_file_free() removes the temporary file */
+	if (pf->err)
+		return pf->err;
+
 	ip = &pf->info;
 	if (pf->num_entries >= 64 * 1024) {
 		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
@@ -1290,22 +2307,31 @@ pi_file_close_for_write(pi_file_t *pf)
 		return PI_ERR_FILE_INVALID;
 	}
 
-	/*
-	 * Unlink instead of overwriting.
-	 * For the case of something along the lines of:
-	 * cp -lav backup_2005_05_27 backup_2005_05_28
-	 * Then updating the new copy.
-	 * -- Warp.
-	 */
+	offset = pi_file_header_size(pf, pf->num_entries);
 
-	if (!stat (pf->file_name, &sbuf))
-	    if (S_ISREG(sbuf.st_mode))
-		unlink (pf->file_name);
+	/* buffered data goes right after the header */
+	if (pf->tmpbuf != NULL) {
+		if ((pf->f = pi_file_open_for_writing(pf)) == NULL)
+			return PI_ERR_FILE_ERROR;
+		if (pf->tmpbuf->used > 0
+		    && (fseek(pf->f, offset, SEEK_SET) < 0
+			|| fwrite(pf->tmpbuf->data, pf->tmpbuf->used, 1, pf->f) != 1)) {
+			fclose(pf->f);
+			pf->f = NULL;
+			return PI_ERR_FILE_ERROR;
+		}
+		pf->data_offset = offset;
+	}
 
-	if ((f = fopen(pf->file_name, "wb")) == NULL)
+	f = pf->f;
+	if (f == NULL)
 		return PI_ERR_FILE_ERROR;
 
-	ip = &pf->info;
+	/* the data was streamed after room for the header we expected:
+	   move it if the header turned out to have another size */
+	if (pf->data_size > 0 && pf->data_offset != offset
+	    && pi_file_move_data(pf, offset) < 0)
+		goto bad;
 
 	offset = PI_HDR_SIZE + pf->num_entries * pf->ent_hdr_size + 2;
 
@@ -1327,7 +2353,7 @@ pi_file_close_for_write(pi_file_t *pf)
 	set_long(p + 72, pf->next_record_list_id);
 	set_short(p + 76, pf->num_entries);
 
-	if (fwrite(buf, PI_HDR_SIZE, 1, f) != 1)
+	if (fseek(f, 0, SEEK_SET) < 0 || fwrite(buf, PI_HDR_SIZE, 1, f) != 1)
 		goto bad;
 
 	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
@@ -1363,17 +2389,24 @@ pi_file_close_for_write(pi_file_t *pf)
 		(size_t) pf->sort_info_size))
 		goto bad;
 
-
-	fwrite(pf->tmpbuf->data, pf->tmpbuf->used, 1, f);
-	fflush(f);
-
-	if (ferror(f) || feof(f))
+	/* on disk before the rename, so that a crash can't leave the
+	   old file replaced by one that was never written */
+	if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) < 0)
 		goto bad;
 
-	fclose(f);
+	pf->f = NULL;
+	if (fclose(f) != 0)
+		return PI_ERR_FILE_ERROR;
+
+	/* only now does the new file replace the old one */
+	if (rename(pf->tmp_name, pf->file_name) < 0)
+		return PI_ERR_FILE_ERROR;
+	free(pf->tmp_name);
+	pf->tmp_name = NULL;
 	return 0;
 
 bad:
+	pf->f = NULL;
 	fclose(f);
 	return PI_ERR_FILE_ERROR;
 }
@@ -1397,17 +2430,28 @@ void pi_file_free(pi_file_t *pf)
 	if (pf->f != 0)
 		fclose(pf->f);
 	
-	if (pf->app_info != NULL)
-		free(pf->app_info);
-	
-	if (pf->sort_info != NULL)
-		free(pf->sort_info);
+	pi_file_free_block(pf, pf->app_info);
+	pi_file_free_block(pf, pf->sort_info);
+
+#ifdef PI_FILE_MMAP
+	if (pf->map != NULL)
+		munmap(pf->map, pf->map_size);
+#endif
 	
 	if (pf->entries != NULL)
 		free(pf->entries);
+
+	if (pf->index != NULL)
+		free(pf->index);
 	
 	if (pf->file_name != NULL)
 		free(pf->file_name);
+
+	/* still there if the file wasn't written out */
+	if (pf->tmp_name != NULL) {
+		unlink(pf->tmp_name);
+		free(pf->tmp_name);
+	}
 	
 	if (pf->rbuf != NULL)
 		free(pf->rbuf);
@@ -1421,6 +2465,155 @@ void pi_file_free(pi_file_t *pf)
 	free(pf);
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_new_for_writing
+ *
+ * Summary:     Internal function to allocate the structure of a file
+ *              being created
+ *
+ * Parameters:  access path, database info
+ *
+ * Returns:     pi_file_t*, or NULL on allocation error
+ *
+ ***********************************************************************/
+static pi_file_t *
+pi_file_new_for_writing(const char *name, const struct DBInfo *info)
+{
+	pi_file_t *pf = calloc(1, sizeof(pi_file_t));
+
+	if (pf == NULL)
+		return NULL;
+
+	if ((pf->file_name = strdup(name)) == NULL) {
+		pi_file_free(pf);
+		return NULL;
+	}
+
+	pf->for_writing = 1;
+	pf->info = *info;
+	pf->data_offset = -1;
+
+	if (info->flags & dlpDBFlagResource) {
+		pf->resource_flag = 1;
+		pf->ent_hdr_size = PI_RESOURCE_ENT_SIZE;
+	} else {
+		pf->resource_flag = 0;
+		pf->ent_hdr_size = PI_RECORD_ENT_SIZE;
+	}
+
+	return pf;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_open_for_writing
+ *
+ * Summary:     Internal function to create the temporary file a
+ *              database is written to, next to its final name, so that
+ *              rename() can replace the old file in one step. The old
+ *              file is never written through, which also keeps a hard
+ *              linked copy of it intact, as in:
+ *              cp -lav backup_2005_05_27 backup_2005_05_28
+ *
+ * Parameters:  pi_file_t*, whose tmp_name is set
+ *
+ * Returns:     FILE*, or NULL if it can't be created
+ *
+ ***********************************************************************/
+static FILE *
+pi_file_open_for_writing(pi_file_t *pf)
+{
+	static unsigned int counter = 0;
+	char	*tmp_name;
+	int	fd	= -1,
+		i;
+	FILE	*f;
+
+	tmp_name = malloc(strlen(pf->file_name) + 32);
+	if (tmp_name == NULL)
+		return NULL;
+
+	/* O_EXCL makes the name ours even if another thread or process
+	   came up with it at the same time; the mode is fopen()'s */
+	for (i = 0; i < PI_FILE_TEMP_TRIES && fd < 0; i++) {
+		sprintf(tmp_name, "%s.%ld-%u~", pf->file_name, (long)getpid(),
+			counter++);
+		fd = open(tmp_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (fd < 0 && errno != EEXIST)
+			break;
+	}
+	if (fd < 0 || (f = fdopen(fd, "w+b")) == NULL) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_name);
+		}
+		free(tmp_name);
+		return NULL;
+	}
+
+	free(pf->tmp_name);
+	pf->tmp_name = tmp_name;
+	return f;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_map
+ *
+ * Summary:	map a file open for reading in memory
+ *
+ * Parameters:  file handle pi_file_t*, file size
+ *
+ * Returns:     0 for success, negative if the file must be read
+ *
+ ***********************************************************************/
+static int
+pi_file_map(pi_file_t *pf, size_t size)
+{
+#ifdef PI_FILE_MMAP
+	void	*map;
+
+	/* private and writable, so that callers that scribble over the
+	   data they read only change their copy of a page */
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		fileno(pf->f), 0);
+	if (map == MAP_FAILED) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_INFO,
+		     "FILE OPEN can't map file, reading it\n"));
+		return PI_ERR_FILE_ERROR;
+	}
+
+	pf->map		= map;
+	pf->map_size	= size;
+	return 0;
+#else
+	return PI_ERR_FILE_ERROR;
+#endif
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_free_block
+ *
+ * Summary:	free an info block, unless it lives in the file mapping
+ *
+ * Parameters:  file handle pi_file_t*, block or NULL
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+pi_file_free_block(pi_file_t *pf, void *block)
+{
+	if (block == NULL)
+		return;
+	if (pf->map != NULL && (unsigned char *) block >= (unsigned char *) pf->map
+	    && (unsigned char *) block < (unsigned char *) pf->map + pf->map_size)
+		return;
+	free(block);
+}
+
 /***********************************************************************
  *
  * Function:    pi_file_set_rbuf_size
@@ -1457,6 +2650,190 @@ pi_file_set_rbuf_size(pi_file_t *pf, size_t size)
 	return 0;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_append_data
+ *
+ * Summary:     Internal function to write record data to the file
+ *              being created, after the data already written, or to
+ *              its buffer, moving the buffer to the file once it would
+ *              grow past PI_FILE_BUFFER_MAX
+ *
+ * Parameters:  pi_file_t*, data, size
+ *
+ * Returns:     0, PI_ERR_FILE_ERROR or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+pi_file_append_data(pi_file_t *pf, const void *data, size_t size)
+{
+	pi_buffer_t *buf = pf->tmpbuf;
+
+	/* buffered files grow geometrically, so that appending N records
+	   doesn't realloc N times */
+	if (buf != NULL && buf->used + size <= PI_FILE_BUFFER_MAX) {
+		if (buf->allocated - buf->used < size &&
+				pi_buffer_expect(buf, size > buf->allocated / 2 ?
+					size : buf->allocated / 2) == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+
+		pi_buffer_append(buf, data, size);
+		pf->data_size += size;
+		return 0;
+	}
+
+	/* a buffered file that got too big goes on as if it had been
+	   created with pi_file_create(), starting with the data so far */
+	if (buf != NULL) {
+		if ((pf->f = pi_file_open_for_writing(pf)) == NULL)
+			return PI_ERR_FILE_ERROR;
+		pf->data_offset = pi_file_header_size(pf, pf->reserved_entries);
+		if (fseek(pf->f, pf->data_offset, SEEK_SET) < 0
+		    || (buf->used > 0
+			&& fwrite(buf->data, buf->used, 1, pf->f) != 1))
+			return PI_ERR_FILE_ERROR;
+		pi_buffer_free(buf);
+		pf->tmpbuf = NULL;
+	}
+
+	/* the first data goes after the header we expect at this point */
+	if (pf->data_offset < 0) {
+		pf->data_offset = pi_file_header_size(pf, pf->reserved_entries);
+		if (fseek(pf->f, pf->data_offset, SEEK_SET) < 0)
+			return PI_ERR_FILE_ERROR;
+	}
+
+	if (fwrite(data, 1, size, pf->f) != size)
+		return PI_ERR_FILE_ERROR;
+	pf->data_size += size;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_reserve
+ *
+ * Summary:     Internal function to size the header of a file being
+ *              written for a number of entries about to be appended,
+ *              so that their data can be streamed after it and doesn't
+ *              have to be moved at close time, or to preallocate the
+ *              buffer of a buffered file. Failures are ignored, the
+ *              entries and buffer are grown on demand anyway
+ *
+ * Parameters:  pi_file_t*, number of entries, number of data bytes
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_file_reserve(pi_file_t *pf, unsigned long entries, size_t bytes)
+{
+	pi_file_entry_t *new_entries;
+	pi_buffer_t *buf = pf->tmpbuf;
+
+	if (entries > (unsigned long)pf->num_entries_allocated) {
+		new_entries = realloc(pf->entries, entries * sizeof *pf->entries);
+		if (new_entries != NULL) {
+			pf->entries = new_entries;
+			pf->num_entries_allocated = entries;
+		}
+	}
+
+	/* too late once the data has started */
+	if (pf->data_offset < 0 && entries < 64 * 1024)
+		pf->reserved_entries = entries;
+
+	/* no more than a buffered file keeps in memory */
+	if (buf != NULL && buf->used + bytes > PI_FILE_BUFFER_MAX)
+		bytes = buf->used < PI_FILE_BUFFER_MAX
+			? PI_FILE_BUFFER_MAX - buf->used : 0;
+	if (buf != NULL && bytes > buf->allocated - buf->used) {
+		unsigned char *data = realloc(buf->data, buf->used + bytes);
+		if (data != NULL) {
+			buf->data = data;
+			buf->allocated = buf->used + bytes;
+		}
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_header_size
+ *
+ * Summary:     Internal function to compute the size of everything
+ *              that precedes the record data in a file being written
+ *
+ * Parameters:  pi_file_t*, number of entries
+ *
+ * Returns:     Offset of the record data
+ *
+ ***********************************************************************/
+static long
+pi_file_header_size(pi_file_t *pf, int entries)
+{
+	return PI_HDR_SIZE + (long) entries * pf->ent_hdr_size + 2
+		+ pf->app_info_size + pf->sort_info_size;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_move_data
+ *
+ * Summary:     Internal function to move the record data streamed to a
+ *              file being written to another offset, a chunk at a time
+ *
+ * Parameters:  pi_file_t*, new offset of the data
+ *
+ * Returns:     0, or PI_ERR_FILE_ERROR
+ *
+ ***********************************************************************/
+static int
+pi_file_move_data(pi_file_t *pf, long offset)
+{
+	unsigned char *chunk;
+	long	done,
+		len,
+		from,
+		to;
+	int	result = 0;
+
+	if ((chunk = malloc(PI_FILE_MOVE_CHUNK)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	/* copy from the end when moving forward, so that nothing is
+	   overwritten before it has been copied */
+	for (done = 0; done < pf->data_size && result == 0; done += len) {
+		len = pf->data_size - done;
+		if (len > PI_FILE_MOVE_CHUNK)
+			len = PI_FILE_MOVE_CHUNK;
+		if (offset > pf->data_offset) {
+			from	= pf->data_offset + pf->data_size - done - len;
+			to	= offset + pf->data_size - done - len;
+		} else {
+			from	= pf->data_offset + done;
+			to	= offset + done;
+		}
+
+		if (fseek(pf->f, from, SEEK_SET) < 0
+		    || fread(chunk, 1, (size_t) len, pf->f) != (size_t) len
+		    || fseek(pf->f, to, SEEK_SET) < 0
+		    || fwrite(chunk, 1, (size_t) len, pf->f) != (size_t) len)
+			result = PI_ERR_FILE_ERROR;
+	}
+	free(chunk);
+
+	/* the data moved back: drop what's left of its old end */
+	if (result == 0 && offset < pf->data_offset) {
+		fflush(pf->f);
+		if (ftruncate(fileno(pf->f), offset + pf->data_size) < 0)
+			result = PI_ERR_FILE_ERROR;
+	}
+
+	if (result == 0)
+		pf->data_offset = offset;
+	return result;
+}
+
 /***********************************************************************
  *
  * Function:    pi_file_append_entry
@@ -1506,21 +2883,176 @@ pi_file_find_resource_by_type_id(const pi_file_t *pf,
 				 unsigned long restype, int resid, int *resindex)
 {
 	int 	i;
-	struct 	pi_file_entry *entp;
 
 	if (!pf->resource_flag)
 		return PI_ERR_FILE_INVALID;
 
-	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
-		if (entp->type == restype && entp->resource_id == resid) {
-			if (resindex)
-				*resindex = i;
-			return 1;
-		}
+	/* the hash table is a cache, building it doesn't change the file */
+	if ((i = pi_file_find_entry((pi_file_t *)pf, restype,
+			(unsigned long)resid)) < 0)
+		return 0;
+	if (resindex)
+		*resindex = i;
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_entry_key
+ *
+ * Summary:     Internal function to hash a record ID, or a resource
+ *              type and ID
+ *
+ * Parameters:  resource type (0 for records), record or resource ID
+ *
+ * Returns:     The hash, on 32 bits
+ *
+ ***********************************************************************/
+static unsigned long
+pi_file_entry_key(unsigned long type, unsigned long id)
+{
+	unsigned long h;
+
+	h = ((type & 0xffffffffUL) * 0x9e3779b1UL + id) & 0xffffffffUL;
+	h = (h * 0x85ebca6bUL) & 0xffffffffUL;
+	return h ^ (h >> 16);
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_entry_matches
+ *
+ * Summary:     Internal function to tell whether an entry has the given
+ *              record ID, or resource type and ID
+ *
+ * Parameters:  pi_file_t*, entry number, resource type (ignored for
+ *              records), record or resource ID
+ *
+ * Returns:     Non-zero if it has
+ *
+ ***********************************************************************/
+static int
+pi_file_entry_matches(const pi_file_t *pf, int i, unsigned long type,
+		      unsigned long id)
+{
+	const pi_file_entry_t *entp = &pf->entries[i];
+
+	if (pf->resource_flag)
+		return entp->type == type
+			&& (unsigned long)entp->resource_id == id;
+	return entp->uid == id;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_add
+ *
+ * Summary:     Internal function to add an entry to the hash table, after
+ *              the ones added before it on its probe sequence, so that
+ *              lookups find the first of several entries with one key
+ *
+ * Parameters:  pi_file_t*, entry number
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_file_index_add(pi_file_t *pf, int i)
+{
+	pi_file_entry_t *entp = &pf->entries[i];
+	unsigned long mask = (unsigned long)pf->index_size - 1,
+		slot;
+
+	if (pf->resource_flag)
+		slot = pi_file_entry_key(entp->type,
+			(unsigned long)entp->resource_id);
+	else
+		slot = pi_file_entry_key(0, entp->uid);
+
+	for (slot &= mask; pf->index[slot]; slot = (slot + 1) & mask)
+		;
+	pf->index[slot] = i + 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_update
+ *
+ * Summary:     Internal function to bring the hash table up to date with
+ *              the entries appended since the last lookup, building or
+ *              growing it as needed so that it stays at most half full
+ *
+ * Parameters:  pi_file_t*
+ *
+ * Returns:     0, or -1 if the file is searched without it
+ *
+ ***********************************************************************/
+static int
+pi_file_index_update(pi_file_t *pf)
+{
+	int	size,
+		*index;
+
+	if (pf->num_entries < PI_FILE_INDEX_MIN)
+		return -1;
+
+	if (pf->num_entries > pf->index_size / 2) {
+		for (size = 64; size < 2 * pf->num_entries; size *= 2)
+			;
+		if ((index = calloc((size_t)size, sizeof *index)) == NULL)
+			return -1;
+		free(pf->index);
+		pf->index = index;
+		pf->index_size = size;
+		pf->index_count = 0;
 	}
+
+	for (; pf->index_count < pf->num_entries; pf->index_count++)
+		pi_file_index_add(pf, pf->index_count);
+
 	return 0;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_find_entry
+ *
+ * Summary:     Internal function to find the first entry with a record
+ *              ID, or a resource type and ID
+ *
+ * Parameters:  pi_file_t*, resource type (ignored for records), record
+ *              or resource ID
+ *
+ * Returns:     The entry number, or -1 if there is none
+ *
+ ***********************************************************************/
+static int
+pi_file_find_entry(pi_file_t *pf, unsigned long type, unsigned long id)
+{
+	unsigned long mask,
+		slot;
+	int	i;
+
+	if (pf->resource_flag)
+		type &= 0xffffffffUL;
+	else
+		type = 0;
+
+	if (pi_file_index_update(pf) < 0) {
+		for (i = 0; i < pf->num_entries; i++)
+			if (pi_file_entry_matches(pf, i, type, id))
+				return i;
+		return -1;
+	}
+
+	mask = (unsigned long)pf->index_size - 1;
+	for (slot = pi_file_entry_key(type, id) & mask; pf->index[slot];
+	     slot = (slot + 1) & mask)
+		if (pi_file_entry_matches(pf, pf->index[slot] - 1, type, id))
+			return pf->index[slot] - 1;
+	return -1;
+}
+
 
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* ex: set tabstop=4 expandtab: */
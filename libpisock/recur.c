@@ -0,0 +1,625 @@
+/*
+ * $Id$
+ *
+ * recur.c: Occurrences of repeating appointments and calendar events
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-macros.h"
+#include "pi-error.h"
+#include "pi-recur.h"
+
+#define MINUTES_PER_DAY	1440
+
+/* Months a monthly or yearly rule may go without occurring, which is at
+   most eight years for February 29th */
+#define PI_RECUR_MAX_SKIPS	128
+
+/* A rule in the interval tree: it can only occur in [lo, hi) */
+struct pi_recur_node {
+	long	lo,
+		hi,
+		max_hi;		/* largest hi in the subtree */
+	int	index;
+};
+
+struct pi_recur_index {
+	pi_recur_t *rules;
+	void	**data;
+	int	count,
+		allocated;
+
+	/* The tree is kept in an array sorted by lo: the node of a range of
+	   it is in the middle, and each half is a subtree. It's built by the
+	   first query after rules are added. */
+	struct pi_recur_node *nodes;
+	int	built;
+};
+
+static long
+floor_div(long a, long b)
+{
+	return (a >= 0 ? a : a - b + 1) / b;
+}
+
+static int
+day_of_week(long day)
+{
+	/* 1970-01-01 was a Thursday */
+	return (int) (day + 4 - floor_div(day + 4, 7) * 7);
+}
+
+static int
+days_in_month(long year, int mon)
+{
+	static const int days[12] =
+		{ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if (mon == 1 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+		return 29;
+	return days[mon];
+}
+
+static int
+compare_days(const void *a, const void *b)
+{
+	long	x = *(const long *) a,
+		y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+long
+pi_recur_minutes(const struct tm *t)
+{
+	long	year = t->tm_year + 1900L + floor_div(t->tm_mon, 12);
+	int	mon = (int) (t->tm_mon - floor_div(t->tm_mon, 12) * 12);
+
+	return pi_days_from_civil(year, mon + 1, t->tm_mday) * MINUTES_PER_DAY
+		+ t->tm_hour * 60L + t->tm_min;
+}
+
+struct tm *
+pi_recur_tm(long minutes, struct tm *t)
+{
+	long	day = floor_div(minutes, MINUTES_PER_DAY),
+		year;
+	int	mon;
+
+	memset(t, 0, sizeof(*t));
+	minutes -= day * MINUTES_PER_DAY;
+	pi_civil_from_days(day, &year, &mon, &t->tm_mday);
+	t->tm_year = (int) (year - 1900);
+	t->tm_mon = mon - 1;
+	t->tm_hour = (int) (minutes / 60);
+	t->tm_min = (int) (minutes % 60);
+	t->tm_isdst = -1;
+	return pi_normalize_tm(t, 0);
+}
+
+/***********************************************************************
+ *
+ * Function:    recur_compile
+ *
+ * Summary:     Compile the repeat fields common to struct Appointment and
+ *		struct CalendarEvent
+ *
+ * Parameters:  The rule, then the fields
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+recur_compile(pi_recur_t *rule, int event, const struct tm *begin,
+	const struct tm *end, int type, int forever, const struct tm *repeatEnd,
+	int frequency, int repeatDay, const int *repeatDays, int weekstart,
+	int exceptions, const struct tm *exception)
+{
+	long	b = pi_recur_minutes(begin),
+		year;
+	int	mon,
+		i,
+		j;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->first = floor_div(b, MINUTES_PER_DAY);
+	if (event) {
+		rule->start = 0;
+		rule->duration = MINUTES_PER_DAY;
+	} else {
+		rule->start = (int) (b - rule->first * MINUTES_PER_DAY);
+		rule->duration = (int) (pi_recur_minutes(end) - b);
+		if (rule->duration < 0)
+			rule->duration = 0;
+	}
+
+	/* a repeat every 0 days, weeks... is taken as no repeat at all, as
+	   pilot-reminders does */
+	if (type <= repeatNone || type > repeatYearly || frequency <= 0) {
+		rule->type = repeatNone;
+		rule->frequency = 1;
+		rule->last = rule->first;
+		return 0;
+	}
+
+	rule->type = type;
+	rule->frequency = frequency;
+	rule->last = forever ? PI_RECUR_FOREVER
+		: floor_div(pi_recur_minutes(repeatEnd), MINUTES_PER_DAY);
+
+	pi_civil_from_days(rule->first, &year, &mon, &rule->mday);
+	rule->month0 = year * 12 + mon - 1;
+
+	switch (type) {
+	case repeatWeekly:
+		for (i = 0; i < 7; i++)
+			if (repeatDays[i])
+				rule->weekdays |= 1 << i;
+		if (rule->weekdays == 0)
+			rule->weekdays = 1 << day_of_week(rule->first);
+		weekstart = (weekstart % 7 + 7) % 7;
+		rule->week0 = rule->first
+			- (day_of_week(rule->first) - weekstart + 7) % 7;
+		break;
+	case repeatMonthlyByDay:
+		repeatDay = (repeatDay % 35 + 35) % 35;
+		rule->week = repeatDay / 7;
+		rule->weekday = repeatDay % 7;
+		break;
+	}
+
+	if (exceptions > 0 && exception != NULL) {
+		rule->exception = malloc(exceptions * sizeof(long));
+		if (rule->exception == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		for (i = 0; i < exceptions; i++)
+			rule->exception[i] = floor_div(
+				pi_recur_minutes(&exception[i]), MINUTES_PER_DAY);
+		qsort(rule->exception, exceptions, sizeof(long), compare_days);
+		for (i = j = 0; i < exceptions; i++)
+			if (j == 0 || rule->exception[i] != rule->exception[j - 1])
+				rule->exception[j++] = rule->exception[i];
+		rule->exceptions = j;
+	}
+	return 0;
+}
+
+int
+pi_recur_from_appointment(pi_recur_t *rule, const struct Appointment *appt)
+{
+	return recur_compile(rule, appt->event, &appt->begin, &appt->end,
+		appt->repeatType, appt->repeatForever, &appt->repeatEnd,
+		appt->repeatFrequency, appt->repeatDay, appt->repeatDays,
+		appt->repeatWeekstart, appt->exceptions, appt->exception);
+}
+
+int
+pi_recur_from_calendar(pi_recur_t *rule, const struct CalendarEvent *event)
+{
+	/* enum calendarRepeatType and enum calendarDayOfMonthType have the
+	   values of enum repeatTypes and enum DayOfMonthType */
+	return recur_compile(rule, event->event, &event->begin, &event->end,
+		(int) event->repeatType, event->repeatForever,
+		&event->repeatEnd, event->repeatFrequency,
+		(int) event->repeatDay, event->repeatDays,
+		event->repeatWeekstart, event->exceptions, event->exception);
+}
+
+void
+pi_recur_free(pi_recur_t *rule)
+{
+	free(rule->exception);
+	rule->exception = NULL;
+	rule->exceptions = 0;
+}
+
+static int
+is_exception(const pi_recur_t *rule, long day)
+{
+	int	lo = 0,
+		hi = rule->exceptions,
+		mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rule->exception[mid] < day)
+			lo = mid + 1;
+		else if (rule->exception[mid] > day)
+			hi = mid;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+/* First day on or after day in a week the rule repeats on */
+static long
+next_weekly(const pi_recur_t *rule, long day)
+{
+	long	week,
+		end;
+
+	for (;;) {
+		week = (day - rule->week0) / 7;
+		if (week % rule->frequency) {
+			week += rule->frequency - week % rule->frequency;
+			day = rule->week0 + week * 7;
+		}
+		for (end = rule->week0 + week * 7 + 7; day < end; day++)
+			if (rule->weekdays & (1 << day_of_week(day)))
+				return day;
+	}
+}
+
+/* Day a monthly or yearly rule falls on in a month (year * 12 + month),
+   or -1 if it doesn't */
+static int
+month_candidate(const pi_recur_t *rule, long month, long *day)
+{
+	long	year = floor_div(month, 12),
+		first;
+	int	mon = (int) (month - year * 12),
+		dim = days_in_month(year, mon);
+
+	if (rule->type != repeatMonthlyByDay) {
+		if (rule->mday > dim)
+			return -1;
+		*day = pi_days_from_civil(year, mon + 1, rule->mday);
+		return 0;
+	}
+
+	first = pi_days_from_civil(year, mon + 1, 1);
+	if (rule->week < 4)
+		*day = first + (rule->weekday - day_of_week(first) + 7) % 7
+			+ rule->week * 7;
+	else {
+		first += dim - 1;	/* the last day */
+		*day = first - (day_of_week(first) - rule->weekday + 7) % 7;
+	}
+	return 0;
+}
+
+/* First day on or after day a monthly or yearly rule occurs on */
+static int
+next_monthly(const pi_recur_t *rule, long day, long *next)
+{
+	long	step = rule->frequency,
+		year,
+		month,
+		candidate;
+	int	mon,
+		mday,
+		i;
+
+	if (rule->type == repeatYearly)
+		step *= 12;
+
+	pi_civil_from_days(day, &year, &mon, &mday);
+	month = year * 12 + mon - 1;
+	if (month < rule->month0)
+		month = rule->month0;
+	else
+		month = rule->month0
+			+ (month - rule->month0 + step - 1) / step * step;
+
+	for (i = 0; i < PI_RECUR_MAX_SKIPS; i++, month += step) {
+		if (month_candidate(rule, month, &candidate) == 0
+		    && candidate >= day) {
+			*next = candidate;
+			return 1;
+		}
+		year = floor_div(month, 12);
+		if (pi_days_from_civil(year, (int) (month - year * 12) + 1, 1)
+		    > rule->last)
+			break;
+	}
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_recur_next
+ *
+ * Summary:     Find the first day a rule occurs on, from a given day
+ *
+ * Parameters:  Rule, day to look from, where to store the day found
+ *
+ * Returns:     1 if found, 0 if the rule doesn't occur anymore
+ *
+ ***********************************************************************/
+int
+pi_recur_next(const pi_recur_t *rule, long day, long *next)
+{
+	long	found;
+
+	if (day < rule->first)
+		day = rule->first;
+
+	while (day <= rule->last) {
+		switch (rule->type) {
+		case repeatDaily:
+			found = rule->first + (day - rule->first
+				+ rule->frequency - 1) / rule->frequency
+				* rule->frequency;
+			break;
+		case repeatWeekly:
+			found = next_weekly(rule, day);
+			break;
+		case repeatMonthlyByDay:
+		case repeatMonthlyByDate:
+		case repeatYearly:
+			if (!next_monthly(rule, day, &found))
+				return 0;
+			break;
+		default:
+			if (day > rule->first)
+				return 0;
+			found = rule->first;
+			break;
+		}
+
+		if (found > rule->last)
+			return 0;
+		if (!is_exception(rule, found)) {
+			*next = found;
+			return 1;
+		}
+		day = found + 1;
+	}
+	return 0;
+}
+
+void
+pi_recur_iter_init(pi_recur_iter_t *iter, const pi_recur_t *rule, long from,
+	long to)
+{
+	long	length = rule->duration > 0 ? rule->duration : 1;
+
+	/* the days whose occurrence begins before to and ends after from */
+	iter->rule = rule;
+	iter->day = floor_div(from - rule->start - length, MINUTES_PER_DAY) + 1;
+	iter->last_day = floor_div(to - rule->start - 1, MINUTES_PER_DAY);
+}
+
+int
+pi_recur_iter_next(pi_recur_iter_t *iter, long *begin, long *end)
+{
+	long	day;
+
+	if (iter->day > iter->last_day
+	    || !pi_recur_next(iter->rule, iter->day, &day)
+	    || day > iter->last_day) {
+		iter->day = iter->last_day + 1;
+		return 0;
+	}
+
+	*begin = day * MINUTES_PER_DAY + iter->rule->start;
+	*end = *begin + iter->rule->duration;
+	iter->day = day + 1;
+	return 1;
+}
+
+pi_recur_index_t *
+pi_recur_index_new(void)
+{
+	return calloc(1, sizeof(pi_recur_index_t));
+}
+
+void
+pi_recur_index_free(pi_recur_index_t *index)
+{
+	int	i;
+
+	if (index == NULL)
+		return;
+	for (i = 0; i < index->count; i++)
+		pi_recur_free(&index->rules[i]);
+	free(index->rules);
+	free(index->data);
+	free(index->nodes);
+	free(index);
+}
+
+int
+pi_recur_index_add(pi_recur_index_t *index, pi_recur_t *rule, void *data)
+{
+	pi_recur_t *rules;
+	void	**datas;
+	int	allocated;
+
+	if (index->count == index->allocated) {
+		allocated = index->allocated ? index->allocated * 2 : 64;
+		rules = realloc(index->rules, allocated * sizeof(*rules));
+		if (rules != NULL)
+			index->rules = rules;
+		datas = realloc(index->data, allocated * sizeof(*datas));
+		if (datas != NULL)
+			index->data = datas;
+		if (rules == NULL || datas == NULL) {
+			pi_recur_free(rule);
+			return PI_ERR_GENERIC_MEMORY;
+		}
+		index->allocated = allocated;
+	}
+
+	index->rules[index->count] = *rule;
+	index->data[index->count] = data;
+	index->built = 0;
+	return index->count++;
+}
+
+static int
+compare_nodes(const void *a, const void *b)
+{
+	const struct pi_recur_node
+		*x = (const struct pi_recur_node *) a,
+		*y = (const struct pi_recur_node *) b;
+
+	if (x->lo != y->lo)
+		return x->lo < y->lo ? -1 : 1;
+	return x->index - y->index;
+}
+
+/* Set max_hi in the subtree of nodes[l, r) and return it */
+static long
+index_build_subtree(struct pi_recur_node *nodes, int l, int r)
+{
+	long	max_hi,
+		sub;
+	int	m;
+
+	if (l >= r)
+		return LONG_MIN;
+	m = l + (r - l) / 2;
+	max_hi = nodes[m].hi;
+	if ((sub = index_build_subtree(nodes, l, m)) > max_hi)
+		max_hi = sub;
+	if ((sub = index_build_subtree(nodes, m + 1, r)) > max_hi)
+		max_hi = sub;
+	nodes[m].max_hi = max_hi;
+	return max_hi;
+}
+
+static int
+index_build(pi_recur_index_t *index)
+{
+	struct pi_recur_node *nodes;
+	const pi_recur_t *rule;
+	long	length;
+	int	i;
+
+	nodes = realloc(index->nodes,
+		(index->count ? index->count : 1) * sizeof(*nodes));
+	if (nodes == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	index->nodes = nodes;
+
+	for (i = 0; i < index->count; i++) {
+		rule = &index->rules[i];
+		length = rule->duration > 0 ? rule->duration : 1;
+		nodes[i].lo = rule->first * MINUTES_PER_DAY + rule->start;
+		nodes[i].hi = rule->last == PI_RECUR_FOREVER ? LONG_MAX
+			: rule->last * MINUTES_PER_DAY + rule->start + length;
+		nodes[i].index = i;
+	}
+	qsort(nodes, index->count, sizeof(*nodes), compare_nodes);
+	index_build_subtree(nodes, 0, index->count);
+	index->built = 1;
+	return 0;
+}
+
+/* Append the occurrences of a rule in [from, to) */
+static int
+index_expand(pi_recur_index_t *index, int i, long from, long to,
+	pi_buffer_t *occurrences)
+{
+	pi_recur_iter_t iter;
+	pi_occurrence_t occurrence;
+
+	occurrence.index = i;
+	occurrence.data = index->data[i];
+	pi_recur_iter_init(&iter, &index->rules[i], from, to);
+	while (pi_recur_iter_next(&iter, &occurrence.begin, &occurrence.end))
+		if (pi_buffer_append(occurrences, &occurrence,
+				sizeof(occurrence)) == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+	return 0;
+}
+
+/* Expand the rules of the subtree of nodes[l, r) that overlap [from, to) */
+static int
+index_search(pi_recur_index_t *index, int l, int r, long from, long to,
+	pi_buffer_t *occurrences)
+{
+	struct pi_recur_node *node;
+	int	m;
+
+	while (l < r) {
+		m = l + (r - l) / 2;
+		node = &index->nodes[m];
+		if (node->max_hi <= from)
+			return 0;	/* all of them are over by then */
+		if (index_search(index, l, m, from, to, occurrences) < 0)
+			return PI_ERR_GENERIC_MEMORY;
+		if (node->lo >= to)
+			return 0;	/* this one and the ones after start later */
+		if (node->hi > from && index_expand(index, node->index, from,
+				to, occurrences) < 0)
+			return PI_ERR_GENERIC_MEMORY;
+		l = m + 1;
+	}
+	return 0;
+}
+
+static int
+compare_occurrences(const void *a, const void *b)
+{
+	const pi_occurrence_t
+		*x = (const pi_occurrence_t *) a,
+		*y = (const pi_occurrence_t *) b;
+
+	if (x->begin != y->begin)
+		return x->begin < y->begin ? -1 : 1;
+	return x->index - y->index;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_recur_index_query
+ *
+ * Summary:     Find the occurrences of the rules of an index in a range
+ *		of time
+ *
+ * Parameters:  Index, start and end of the range in minutes, buffer
+ *		that gets the pi_occurrence_t's
+ *
+ * Returns:     Number of occurrences, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+int
+pi_recur_index_query(pi_recur_index_t *index, long from, long to,
+	pi_buffer_t *occurrences)
+{
+	int	count;
+
+	occurrences->used = 0;
+	if (!index->built && index_build(index) < 0)
+		return PI_ERR_GENERIC_MEMORY;
+	if (from >= to)
+		return 0;
+	if (index_search(index, 0, index->count, from, to, occurrences) < 0)
+		return PI_ERR_GENERIC_MEMORY;
+
+	count = occurrences->used / sizeof(pi_occurrence_t);
+	qsort(occurrences->data, count, sizeof(pi_occurrence_t),
+		compare_occurrences);
+	return count;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
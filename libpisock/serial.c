@@ -96,6 +96,7 @@ pi_serial_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -156,6 +157,7 @@ pi_serial_protocol (pi_device_t *dev)
 	if (prot != NULL) {
 		prot->level 		= PI_LEVEL_DEV;
 		prot->dup 		= pi_serial_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= pi_serial_protocol_free;
 		prot->read 		= data->impl.read;
 		prot->write 		= data->impl.write;
@@ -218,6 +220,7 @@ pi_serial_device (int type)
 		return NULL;
 	}
 
+	dev->dup 	= NULL;
 	dev->free 	= pi_serial_device_free;
 	dev->protocol 	= pi_serial_protocol;	
 	dev->bind 	= pi_serial_bind;
@@ -236,12 +239,14 @@ pi_serial_device (int type)
 	}
 	
 	data->buf_size 		= 0;
+	data->buf_start 	= 0;
 	data->rate 		= -1;
 	data->establishrate 	= -1;
 	data->establishhighrate = -1;
 	data->timeout 		= 0;
 	data->rx_bytes 		= 0;
 	data->rx_errors 	= 0;
+	data->rx_syscalls 	= 0;
 	data->tx_bytes 		= 0;
 	data->tx_errors 	= 0;
 
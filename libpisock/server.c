@@ -0,0 +1,681 @@
+/*
+ * $Id$
+ *
+ * server.c:  Serve several devices from a single process
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-server.h"
+#include "pi-debug.h"
+#include "pi-error.h"
+#include "pi-threadsafe.h"
+
+#if HAVE_PTHREAD
+
+/* Seconds a listener on a single-connection port (serial, USB) waits
+   for a device before checking whether the server is being stopped.
+   Listeners that accept several connections block until the listening
+   socket is shut down. */
+#define PI_SERVER_ACCEPT_TIMEOUT	5
+#define PI_SERVER_BACKLOG		16
+
+struct pi_server_port;
+
+struct pi_server_session {
+	int	sd,
+		id,
+		done;
+	struct pi_server_port *port;
+	struct pi_server_session *next;
+};
+
+struct pi_server_port {
+	pi_server_t *server;
+	char	*name;
+	int	sd,		/* listening socket, -1 while a single-
+				   connection port is busy */
+		shared;		/* listener survives pi_accept_session() */
+	pthread_t thread;
+	struct pi_server_port *next;
+};
+
+struct pi_server {
+	pi_server_job job;
+	void	*userdata;
+	char	*log_dir;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* queue, session end, stop */
+
+	int	stopping,		/* listeners must exit */
+		draining,		/* workers exit once idle */
+		next_id,
+		completed,
+		failed;
+
+	struct pi_server_session *head,
+		*tail;
+	struct pi_server_port *ports;
+
+	int	workers,
+		running;		/* workers started so far */
+	pthread_t *threads;
+};
+
+
+/***********************************************************************
+ *
+ * Function:    server_listen
+ *
+ * Summary:     create the listening socket of a port
+ *
+ * Parameters:  port
+ *
+ * Returns:     listening socket, or negative error code
+ *
+ ***********************************************************************/
+static int
+server_listen(struct pi_server_port *port)
+{
+	int	sd,
+		result;
+	pi_socket_t *ps;
+
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_DLP);
+	if (sd < 0)
+		return PI_ERR_GENERIC_SYSTEM;
+
+	if ((result = pi_bind(sd, port->name)) < 0
+	    || (result = pi_listen(sd, PI_SERVER_BACKLOG)) < 0) {
+		pi_close(sd);
+		return result;
+	}
+
+	ps = find_pi_socket(sd);
+#ifdef HAVE_DUP2
+	port->shared = (ps->device->dup != NULL);
+#else
+	port->shared = 0;
+#endif
+	return sd;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    server_listener
+ *
+ * Summary:     accept connections on one port and queue them as
+ *		sessions for the workers
+ *
+ * Parameters:  port
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+server_listener(void *arg)
+{
+	struct pi_server_port *port = (struct pi_server_port *)arg;
+	pi_server_t *server = port->server;
+	struct pi_server_session *session;
+	int	sd,
+		lsd;
+
+	pthread_mutex_lock(&server->lock);
+	while (!server->stopping) {
+		if (port->sd < 0) {
+			/* a single-connection port is given back once its
+			   session is over */
+			pthread_mutex_unlock(&server->lock);
+			lsd = server_listen(port);
+			if (lsd < 0)
+				sleep(1);
+			pthread_mutex_lock(&server->lock);
+			if (lsd < 0)
+				continue;
+			port->sd = lsd;
+			if (server->stopping)
+				break;
+		}
+		lsd = port->sd;
+		pthread_mutex_unlock(&server->lock);
+
+		sd = pi_accept_session(lsd, NULL, NULL,
+			port->shared ? 0 : PI_SERVER_ACCEPT_TIMEOUT);
+
+		pthread_mutex_lock(&server->lock);
+		if (!port->shared) {
+			/* accepted or not, the listener is gone */
+			port->sd = -1;
+		}
+		if (sd < 0) {
+			/* the listener stays, so an error that lasts, like
+			   running out of descriptors, would spin: back off
+			   as when listening fails */
+			if (port->shared && !server->stopping) {
+				pthread_mutex_unlock(&server->lock);
+				sleep(1);
+				pthread_mutex_lock(&server->lock);
+			}
+			continue;
+		}
+
+		session = (struct pi_server_session *)
+			malloc(sizeof(struct pi_server_session));
+		if (session == NULL) {
+			pthread_mutex_unlock(&server->lock);
+			pi_close(sd);
+			pthread_mutex_lock(&server->lock);
+			continue;
+		}
+		session->sd	= sd;
+		session->id	= ++server->next_id;
+		session->done	= 0;
+		session->port	= port;
+		session->next	= NULL;
+
+		if (server->tail)
+			server->tail->next = session;
+		else
+			server->head = session;
+		server->tail = session;
+		pthread_cond_broadcast(&server->cond);
+
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
+			"SERVER session %d accepted on %s\n",
+			session->id, port->name));
+
+		if (!port->shared) {
+			while (!session->done)
+				pthread_cond_wait(&server->cond, &server->lock);
+			free(session);
+		}
+	}
+
+	lsd = port->sd;
+	port->sd = -1;
+	pthread_mutex_unlock(&server->lock);
+
+	if (lsd >= 0)
+		pi_close(lsd);
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    server_worker
+ *
+ * Summary:     run queued sessions until the server is stopped
+ *
+ * Parameters:  server
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+server_worker(void *arg)
+{
+	pi_server_t *server = (pi_server_t *)arg;
+	struct pi_server_session *session;
+	FILE	*log = NULL;
+	char	*path;
+	int	result,
+		shared;
+
+	pthread_mutex_lock(&server->lock);
+	for (;;) {
+		while (server->head == NULL && !server->draining)
+			pthread_cond_wait(&server->cond, &server->lock);
+		if (server->head == NULL)
+			break;
+
+		session = server->head;
+		server->head = session->next;
+		if (server->head == NULL)
+			server->tail = NULL;
+		shared = session->port->shared;
+
+		/* under the lock: pi_server_set_log_dir() may free it */
+		path = NULL;
+		if (server->log_dir != NULL
+		    && (path = malloc(strlen(server->log_dir) + 32)) != NULL)
+			sprintf(path, "%s/session-%d.log", server->log_dir,
+				session->id);
+		pthread_mutex_unlock(&server->lock);
+
+		if (path != NULL) {
+			if ((log = fopen(path, "a")) != NULL) {
+				fprintf(log, "session %d started on %s\n",
+					session->id, session->port->name);
+				fflush(log);
+				pi_debug_set_thread_file(log);
+			}
+			free(path);
+		}
+
+		result = server->job(session->sd, session->id,
+			server->userdata);
+		pi_close(session->sd);
+
+		if (log != NULL) {
+			pi_debug_set_thread_file(NULL);
+			fprintf(log, "session %d %s (%d)\n", session->id,
+				result < 0 ? "failed" : "completed", result);
+			fclose(log);
+			log = NULL;
+		}
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
+			"SERVER session %d ended: %d\n", session->id, result));
+
+		pthread_mutex_lock(&server->lock);
+		if (result < 0)
+			server->failed++;
+		else
+			server->completed++;
+		if (shared)
+			free(session);
+		else
+			session->done = 1;	/* its listener frees it */
+		pthread_cond_broadcast(&server->cond);
+	}
+	pthread_mutex_unlock(&server->lock);
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_new
+ *
+ * Summary:     create a server and start its workers
+ *
+ * Parameters:  number of workers, job, job data
+ *
+ * Returns:     the server, or NULL with errno set
+ *
+ ***********************************************************************/
+pi_server_t *
+pi_server_new(int workers, pi_server_job job, void *userdata)
+{
+	pi_server_t *server;
+
+	if (workers < 1 || job == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	server = (pi_server_t *) calloc(1, sizeof(pi_server_t));
+	if (server == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	server->threads = (pthread_t *) malloc(workers * sizeof(pthread_t));
+	if (server->threads == NULL) {
+		free(server);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	server->job		= job;
+	server->userdata	= userdata;
+	server->workers		= workers;
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->cond, NULL);
+
+	for (; server->running < workers; server->running++)
+		if (pthread_create(&server->threads[server->running], NULL,
+				server_worker, server) != 0)
+			break;
+
+	if (server->running == 0) {
+		pthread_cond_destroy(&server->cond);
+		pthread_mutex_destroy(&server->lock);
+		free(server->threads);
+		free(server);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	return server;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_set_log_dir
+ *
+ * Summary:     keep one log file per session in a directory
+ *
+ * Parameters:  server, directory or NULL
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_server_set_log_dir(pi_server_t *server, const char *dir)
+{
+	char	*copy = NULL;
+
+	if (dir != NULL && (copy = strdup(dir)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	pthread_mutex_lock(&server->lock);
+	if (server->log_dir != NULL)
+		free(server->log_dir);
+	server->log_dir = copy;
+	pthread_mutex_unlock(&server->lock);
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_add_port
+ *
+ * Summary:     bind a listening socket to a port and start accepting
+ *		connections on it
+ *
+ * Parameters:  server, port name
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_server_add_port(pi_server_t *server, const char *name)
+{
+	struct pi_server_port *port;
+
+	port = (struct pi_server_port *)
+		calloc(1, sizeof(struct pi_server_port));
+	if (port == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	port->server	= server;
+	port->name	= strdup(name);
+	if (port->name == NULL) {
+		free(port);
+		return PI_ERR_GENERIC_MEMORY;
+	}
+
+	port->sd = server_listen(port);
+	if (port->sd < 0) {
+		int	result = port->sd;
+
+		free(port->name);
+		free(port);
+		return result;
+	}
+
+	pthread_mutex_lock(&server->lock);
+	if (server->stopping
+	    || pthread_create(&port->thread, NULL, server_listener,
+			port) != 0) {
+		pthread_mutex_unlock(&server->lock);
+		pi_close(port->sd);
+		free(port->name);
+		free(port);
+		return PI_ERR_GENERIC_SYSTEM;
+	}
+	port->next	= server->ports;
+	server->ports	= port;
+	pthread_mutex_unlock(&server->lock);
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_getsockname
+ *
+ * Summary:     local address of the port added last
+ *
+ * Parameters:  server, address (out), address length (in/out)
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_server_getsockname(pi_server_t *server, struct sockaddr *addr,
+	size_t *namelen)
+{
+	int	result = PI_ERR_SOCK_INVALID;
+
+	pthread_mutex_lock(&server->lock);
+	if (server->ports != NULL && server->ports->sd >= 0)
+		result = pi_getsockname(server->ports->sd, addr, namelen);
+	pthread_mutex_unlock(&server->lock);
+
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_wait
+ *
+ * Summary:     wait for a number of sessions to finish, or for the
+ *		server to be stopped
+ *
+ * Parameters:  server, number of sessions (0 to wait for the stop)
+ *
+ * Returns:     number of finished sessions
+ *
+ ***********************************************************************/
+int
+pi_server_wait(pi_server_t *server, int sessions)
+{
+	int	finished;
+
+	pthread_mutex_lock(&server->lock);
+	while (!server->stopping
+	       && (sessions <= 0
+		   || server->completed + server->failed < sessions))
+		pthread_cond_wait(&server->cond, &server->lock);
+	finished = server->completed + server->failed;
+	pthread_mutex_unlock(&server->lock);
+
+	return finished;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_stats
+ *
+ * Summary:     session counters
+ *
+ * Parameters:  server, completed sessions (out), failed sessions (out)
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_server_stats(pi_server_t *server, int *completed, int *failed)
+{
+	pthread_mutex_lock(&server->lock);
+	if (completed)
+		*completed = server->completed;
+	if (failed)
+		*failed = server->failed;
+	pthread_mutex_unlock(&server->lock);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_stop
+ *
+ * Summary:     close the listeners and wait for the sessions already
+ *		accepted to finish
+ *
+ * Parameters:  server
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_server_stop(pi_server_t *server)
+{
+	struct pi_server_port *port,
+		*next;
+	int	i;
+
+	pthread_mutex_lock(&server->lock);
+	if (server->stopping) {
+		pthread_mutex_unlock(&server->lock);
+		return;
+	}
+	server->stopping = 1;
+
+	/* wake up listeners blocked in accept(); the others notice
+	   when their accept timeout expires */
+	for (port = server->ports; port != NULL; port = port->next)
+		if (port->shared && port->sd >= 0)
+			shutdown(port->sd, SHUT_RDWR);
+	pthread_cond_broadcast(&server->cond);
+	port = server->ports;
+	server->ports = NULL;
+	pthread_mutex_unlock(&server->lock);
+
+	for (; port != NULL; port = next) {
+		next = port->next;
+		pthread_join(port->thread, NULL);
+		free(port->name);
+		free(port);
+	}
+
+	/* no more sessions can be queued */
+	pthread_mutex_lock(&server->lock);
+	server->draining = 1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+
+	for (i = 0; i < server->running; i++)
+		pthread_join(server->threads[i], NULL);
+	server->running = 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    pi_server_free
+ *
+ * Summary:     stop the server and release it
+ *
+ * Parameters:  server
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_server_free(pi_server_t *server)
+{
+	if (server == NULL)
+		return;
+
+	pi_server_stop(server);
+
+	pthread_cond_destroy(&server->cond);
+	pthread_mutex_destroy(&server->lock);
+	if (server->log_dir != NULL)
+		free(server->log_dir);
+	free(server->threads);
+	free(server);
+}
+
+#else /* HAVE_PTHREAD */
+
+/* Without threads, sessions cannot run concurrently: applications
+   keep using pi_accept_to() on a single socket. */
+
+pi_server_t *
+pi_server_new(int workers, pi_server_job job, void *userdata)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int
+pi_server_set_log_dir(pi_server_t *server, const char *dir)
+{
+	return PI_ERR_GENERIC_ARGUMENT;
+}
+
+int
+pi_server_add_port(pi_server_t *server, const char *name)
+{
+	return PI_ERR_GENERIC_ARGUMENT;
+}
+
+int
+pi_server_getsockname(pi_server_t *server, struct sockaddr *addr,
+	size_t *namelen)
+{
+	return PI_ERR_SOCK_INVALID;
+}
+
+int
+pi_server_wait(pi_server_t *server, int sessions)
+{
+	return 0;
+}
+
+void
+pi_server_stats(pi_server_t *server, int *completed, int *failed)
+{
+	if (completed)
+		*completed = 0;
+	if (failed)
+		*failed = 0;
+}
+
+void
+pi_server_stop(pi_server_t *server)
+{
+}
+
+void
+pi_server_free(pi_server_t *server)
+{
+}
+
+#endif /* HAVE_PTHREAD */
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -76,6 +76,7 @@ slp_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL && new_data != NULL) {
 		new_prot->level	= prot->level;
 		new_prot->dup 	= prot->dup;
+		new_prot->next	= NULL;
 		new_prot->free 	= prot->free;
 		new_prot->read 	= prot->read;
 		new_prot->write	= prot->write;
@@ -153,6 +154,7 @@ slp_protocol (void)
 	if (prot != NULL && data != NULL) {
 		prot->level = PI_LEVEL_SLP;
 		prot->dup = slp_protocol_dup;
+		prot->next = NULL;
 		prot->free = slp_protocol_free;
 		prot->read = slp_rx;
 		prot->write = slp_tx;
@@ -205,12 +207,12 @@ slp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	unsigned int	i,
 			n;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_slp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -297,12 +299,12 @@ slp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	LOG((PI_DBG_SLP, PI_DBG_LVL_DEBUG, "SLP RX len=%d flags=0x%04x\n",
 		len, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_slp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -443,11 +445,11 @@ slp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -472,7 +474,7 @@ slp_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	struct 	pi_slp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -562,7 +564,7 @@ slp_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	struct 	pi_slp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_slp_data *)prot->data;
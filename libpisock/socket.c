@@ -48,6 +48,7 @@
 #endif
 #include "pi-bluetooth.h"
 #include "pi-inet.h"
+#include "pi-loopback.h"
 #include "pi-slp.h"
 #include "pi-sys.h"
 #include "pi-padp.h"
@@ -58,36 +59,91 @@
 #include "pi-debug.h"
 #include "pi-error.h"
 #include "pi-threadsafe.h"
+#include "pi-util.h"
+
+#include <sys/time.h>
 
 /* Declare function prototypes */
+#if !HAVE_PTHREAD
 static pi_socket_list_t *ps_list_append (pi_socket_list_t *list,
 	pi_socket_t *ps);
-static pi_socket_t *ps_list_find (pi_socket_list_t *list,
-	int pi_sd);
 static pi_socket_list_t *ps_list_remove (pi_socket_list_t *list,
 	int pi_sd);
-static pi_socket_list_t *ps_list_copy (pi_socket_list_t *list);
-static void ps_list_free (pi_socket_list_t *list);
+#endif
+
+static int ps_table_insert (pi_socket_t *ps);
+static void ps_table_remove (pi_socket_t *ps, int pi_sd);
 
 static void protocol_queue_add (pi_socket_t *ps, pi_protocol_t *prot);
 static void protocol_cmd_queue_add (pi_socket_t *ps, pi_protocol_t *prot);
 static pi_protocol_t *protocol_queue_find (pi_socket_t *ps, int level);
 static pi_protocol_t *protocol_queue_find_next (pi_socket_t *ps, int level);
+static void protocol_queue_link (pi_socket_t *ps);
 
 int pi_socket_init(pi_socket_t *ps);
 
 static int is_connected (pi_socket_t *ps);
 static int is_listener (pi_socket_t *ps);
 
+/* Sockets are kept in a table indexed by descriptor. Lookups read it
+   without locking: a table is only ever replaced by a larger copy, and
+   the tables it replaces are kept, so a lookup that raced with the
+   replacement still reads valid memory. Changes are made under
+   psl_mutex. */
+typedef struct pi_socket_table {
+	int	size;
+	struct pi_socket_table *prev;	/* replaced table */
+	pi_socket_t *slot[1];
+} pi_socket_table_t;
+
+#define PS_TABLE_MIN	32
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define PS_LOAD(p)	__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define PS_STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define PS_LOAD(p)	(p)
+#define PS_STORE(p, v)	((p) = (v))
+#endif
+
 /* GLOBALS */
 static PI_MUTEX_DEFINE(psl_mutex);
-static pi_socket_list_t *psl = NULL;
+static pi_socket_table_t *ps_table = NULL;
 
 static PI_MUTEX_DEFINE(watch_list_mutex);
+
+#if HAVE_PTHREAD
+/* The watchdog: one thread tickles every watched socket that has been
+   idle for its interval. pi_send() and pi_recv() hold the lock of a
+   watched socket while they run; the watchdog only tickles a socket
+   whose lock it can take without waiting, so it never gets in the way
+   of a transfer. Watches are reference counted: the list holds one
+   reference, and the watchdog one more while it tickles outside of
+   watch_list_mutex. */
+struct pi_watchdog {
+	pi_socket_t *ps;
+	int	interval,		/* seconds */
+		refs,
+		closed;			/* socket closed, under lock */
+	long	last,			/* last transfer (ms) */
+		retry;			/* watchdog thread only */
+	pthread_mutex_t lock;
+	struct pi_watchdog *next,
+		*due_next;
+};
+
+static struct pi_watchdog *watch_list = NULL;
+static pthread_cond_t watch_cond = PTHREAD_COND_INITIALIZER;
+static int watch_thread_started = 0;
+
+/* Seconds before trying again to tickle a busy or failing socket */
+#define PI_WATCHDOG_RETRY	1
+#else
 static pi_socket_list_t *watch_list = NULL;
 
 /* Automated tickling interval */
 static unsigned int interval = 0;
+#endif
 
 /* Indicates that the exit function has already been installed. Made non-static
  * so that library users can choose to not have an exit function installed */
@@ -117,6 +173,7 @@ ps_list_dump (pi_socket_list_t *list)
 }
 #endif
 
+#if !HAVE_PTHREAD
 /***********************************************************************
  *
  * Function:    ps_list_append
@@ -156,37 +213,6 @@ ps_list_append (pi_socket_list_t *list, pi_socket_t *ps)
 }
 
 
-/***********************************************************************
- *
- * Function:    ps_list_find
- *
- * Summary:     traverse a (possibly empty) pi_socket_list and find
- *		the first list element whose pi_socket_t* member points
- *		to a pi_socket matching the given socket descriptor
- *
- * Parameters:	pi_socket_list_t *, socket descriptor
- *
- * Returns:     pi_socket_t *, or NULL if no match
- *
- * NOTE:	ps_list_find returns a pointer which points directly to
- *		the socket (pi_socket_t *) whereas ps_find_elem returns a
- *		pointer to the list element (pi_socket_list_t *) which
- *		_contains_ a pointer to the socket
- *
- ***********************************************************************/
-static pi_socket_t *
-ps_list_find (pi_socket_list_t *list, int pi_sd) 
-{
-	pi_socket_list_t *elem;
-	
-	for (elem = list; elem != NULL; elem = elem->next)
-		if (elem->ps != NULL && elem->ps->sd == pi_sd)
-			return elem->ps;
-
-	return NULL;
-}
-
-
 /***********************************************************************
  *
  * Function:    ps_list_remove
@@ -227,64 +253,109 @@ ps_list_remove (pi_socket_list_t *list, int pi_sd)
 
 	return new_list;
 }
+#endif
 
 
+/* Socket Table Code */
 /***********************************************************************
  *
- * Function:    ps_list_copy
+ * Function:    ps_table_grow
  *
- * Summary:     copy pi_socket_list
+ * Summary:     replace the socket table with a copy large enough to
+ *		hold the given descriptor. Must be called with
+ *		psl_mutex held.
  *
- * Parameters:	pi_socket_list_t *
+ * Parameters:	socket descriptor
  *
- * Returns:     pi_socket_list_t* (new list head)
+ * Returns:     the new table, or NULL if out of memory
  *
- * NOTE:	pi_list_copy does _not_ copy the pi_socket member, it
- *		copies only the list elements
+ ***********************************************************************/
+static pi_socket_table_t *
+ps_table_grow (int pi_sd)
+{
+	pi_socket_table_t *table,
+		*old = ps_table;
+	int	size = (old != NULL) ? old->size : PS_TABLE_MIN;
+
+	while (size <= pi_sd)
+		size *= 2;
+
+	table = (pi_socket_table_t *) calloc (1, sizeof(pi_socket_table_t)
+		+ (size - 1) * sizeof(pi_socket_t *));
+	if (table == NULL)
+		return NULL;
+
+	table->size = size;
+	if (old != NULL) {
+		memcpy (table->slot, old->slot,
+			old->size * sizeof(pi_socket_t *));
+
+		/* never freed: readers may still be looking at it. Sizes
+		   double, so all the old tables together take less room
+		   than the current one */
+		table->prev = old;
+	}
+	PS_STORE(ps_table, table);
+
+	return table;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    ps_table_insert
+ *
+ * Summary:     enter a pi_socket in the table under its descriptor
+ *
+ * Parameters:	pi_socket_t *
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
  *
  ***********************************************************************/
-static pi_socket_list_t *
-ps_list_copy (pi_socket_list_t *list)
+static int
+ps_table_insert (pi_socket_t *ps)
 {
-	pi_socket_list_t *l, *new_list = NULL;
+	pi_socket_table_t *table;
 
-	for (l = list; l != NULL; l = l->next)
-		new_list = ps_list_append (new_list, l->ps);
+	ASSERT (ps != NULL && ps->sd >= 0);
 
-	return new_list;
+	pi_mutex_lock(&psl_mutex);
+	table = ps_table;
+	if (table == NULL || ps->sd >= table->size)
+		table = ps_table_grow (ps->sd);
+	if (table != NULL)
+		PS_STORE(table->slot[ps->sd], ps);
+	pi_mutex_unlock(&psl_mutex);
+
+	return (table != NULL) ? 0 : PI_ERR_GENERIC_MEMORY;
 }
 
 
 /***********************************************************************
  *
- * Function:    ps_list_free
+ * Function:    ps_table_remove
  *
- * Summary:     free pi_socket_list elements
+ * Summary:     remove a pi_socket from the table, if it is still the
+ *		one entered under the descriptor
  *
- * Parameters:	pi_socket_list_t *
+ * Parameters:	pi_socket_t *, socket descriptor
  *
  * Returns:     void
  *
- * NOTE:	only the pi_socket_list elements are freed,
- *		_not_ the pi_sockets.  Consequently, this function
- *		makes the (risky) assumption that the pi_sockets will
- *		be freed elsewhere.
+ * NOTE:	the pi_socket is _not_ freed
  *
  ***********************************************************************/
 static void
-ps_list_free (pi_socket_list_t *list)
+ps_table_remove (pi_socket_t *ps, int pi_sd)
 {
-	pi_socket_list_t *l, *next;
+	pi_socket_table_t *table;
 
-	if (list == NULL)
-		return;
-
-	l = list;
-	do {
-		next = l->next;
-		free(l);
-		l = next;
-	} while (l != NULL);
+	pi_mutex_lock(&psl_mutex);
+	table = ps_table;
+	if (table != NULL && pi_sd >= 0 && pi_sd < table->size
+	    && table->slot[pi_sd] == ps)
+		PS_STORE(table->slot[pi_sd], NULL);
+	pi_mutex_unlock(&psl_mutex);
 }
 
 /* Protocol Queue */
@@ -340,6 +411,42 @@ protocol_cmd_queue_add (pi_socket_t *ps, pi_protocol_t *prot)
 }
 
 
+/***********************************************************************
+ *
+ * Function:    protocol_queue_link
+ *
+ * Summary:     resolve the layers of both queues, so that the protocols
+ *		find their own entry and the one below without a lookup
+ *
+ * Parameters:	pi_socket_t*
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+protocol_queue_link (pi_socket_t *ps)
+{
+	int 	i;
+
+	memset(ps->layers, 0, sizeof(ps->layers));
+
+	for (i = ps->queue_len - 1; i >= 0; i--) {
+		ps->protocol_queue[i]->next = (i < ps->queue_len - 1) ?
+			ps->protocol_queue[i + 1] : NULL;
+		if (ps->protocol_queue[i]->level < PI_LEVEL_SOCK)
+			ps->layers[0][ps->protocol_queue[i]->level] =
+				ps->protocol_queue[i];
+	}
+	for (i = ps->cmd_len - 1; i >= 0; i--) {
+		ps->cmd_queue[i]->next = (i < ps->cmd_len - 1) ?
+			ps->cmd_queue[i + 1] : NULL;
+		if (ps->cmd_queue[i]->level < PI_LEVEL_SOCK)
+			ps->layers[1][ps->cmd_queue[i]->level] =
+				ps->cmd_queue[i];
+	}
+}
+
+
 /***********************************************************************
  *
  * Function:    protocol_queue_find
@@ -354,21 +461,10 @@ protocol_cmd_queue_add (pi_socket_t *ps, pi_protocol_t *prot)
 static pi_protocol_t*
 protocol_queue_find (pi_socket_t *ps, int level)
 {
-	int 	i;
-
-	if (ps->command) {
-		for (i = 0; i < ps->cmd_len; i++) {
-			if (ps->cmd_queue[i]->level == level)
-				return ps->cmd_queue[i];
-		}
-	} else {
-		for (i = 0; i < ps->queue_len; i++) {
-			if (ps->protocol_queue[i]->level == level)
-				return ps->protocol_queue[i];
-		}
-	}
+	if (level < 0 || level >= PI_LEVEL_SOCK)
+		return NULL;
 
-	return NULL;
+	return PI_SOCK_LAYER(ps, level);
 }
 
 
@@ -386,33 +482,17 @@ protocol_queue_find (pi_socket_t *ps, int level)
 static pi_protocol_t*
 protocol_queue_find_next (pi_socket_t *ps, int level)
 {
-	int 	i;
-
-	if (ps->command && ps->cmd_len == 0)
-		return NULL;
-
-	if (!ps->command && ps->queue_len == 0)
-		return NULL;
-
-	if (ps->command && level == 0)
-		return ps->cmd_queue[0];
-
-	if (!ps->command && level == 0)
-		return ps->protocol_queue[0];
+	pi_protocol_t *prot;
 
-	if (ps->command) {
-		for (i = 0; i < ps->cmd_len - 1; i++) {
-			if (ps->cmd_queue[i]->level == level)
-				return ps->cmd_queue[i + 1];
-		}
-	} else {
-		for (i = 0; i < ps->queue_len - 1; i++) {
-			if (ps->protocol_queue[i]->level == level)
-				return ps->protocol_queue[i + 1];
-		}
+	/* level 0 gives the top of the queue */
+	if (level == 0) {
+		if (ps->command)
+			return ps->cmd_len ? ps->cmd_queue[0] : NULL;
+		return ps->queue_len ? ps->protocol_queue[0] : NULL;
 	}
 
-	return NULL;
+	prot = protocol_queue_find(ps, level);
+	return prot ? prot->next : NULL;
 }
 
 
@@ -447,6 +527,7 @@ protocol_queue_build (pi_socket_t *ps, int autodetect)
 		LOG((PI_DBG_SOCK,PI_DBG_LVL_DEBUG, "RAW mode, no protocol\n",ps->sd,autodetect));
 		protocol_queue_add (ps, dev_prot);
 		protocol_cmd_queue_add (ps, dev_cmd_prot);
+		protocol_queue_link (ps);
 		return;
 	}
 
@@ -614,6 +695,7 @@ protocol_queue_build (pi_socket_t *ps, int autodetect)
 
 	protocol_queue_add (ps, dev_prot);
   	protocol_cmd_queue_add (ps, dev_cmd_prot);
+	protocol_queue_link (ps);
 }
 
 
@@ -641,6 +723,8 @@ protocol_queue_destroy (pi_socket_t *ps)
 		free(ps->protocol_queue);
 	if (ps->cmd_len > 0)
 		free(ps->cmd_queue);
+
+	memset(ps->layers, 0, sizeof(ps->layers));
 }
 
 
@@ -813,6 +897,180 @@ is_listener (pi_socket_t *ps)
 	return (ps->state == PI_SOCK_LISTEN) ? 1 : 0;
 }
 
+#if HAVE_PTHREAD
+/* Watchdog Code */
+/***********************************************************************
+ *
+ * Function:    watchdog_release
+ *
+ * Summary:     drop a reference to a watch, freeing it with the last
+ *		one (called with watch_list_mutex held)
+ *
+ * Parameters:	watch
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+watchdog_release(struct pi_watchdog *w)
+{
+	if (--w->refs == 0) {
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+	}
+}
+
+/***********************************************************************
+ *
+ * Function:    watchdog_tickle
+ *
+ * Summary:     tickle a socket that is due, unless a transfer is under
+ *		way on it
+ *
+ * Parameters:	watch, current time (ms)
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+watchdog_tickle(struct pi_watchdog *w, long now)
+{
+	pi_socket_t *ps = w->ps;
+
+	if (pthread_mutex_trylock(&w->lock) != 0) {
+		/* busy: a transfer is under way */
+		w->retry = now + PI_WATCHDOG_RETRY * 1000L;
+		return;
+	}
+
+	if (w->closed || !is_connected(ps)) {
+		/* nothing to keep alive: don't come back before another
+		   interval, or the watchdog would spin until pi_close() */
+		w->retry = now + w->interval * 1000L;
+	} else if (now - PS_LOAD(w->last) >= w->interval * 1000L) {
+		if (pi_tickle(ps->sd) < 0) {
+			LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
+				"SOCKET Socket %d is busy during tickle\n",
+				ps->sd));
+			w->retry = now + PI_WATCHDOG_RETRY * 1000L;
+		} else
+			PS_STORE(w->last, pi_clock_ms());
+	}
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+/***********************************************************************
+ *
+ * Function:    watchdog_thread
+ *
+ * Summary:     tickle watched sockets as they become due
+ *
+ * Parameters:	unused
+ *
+ * Returns:     never
+ *
+ ***********************************************************************/
+static void *
+watchdog_thread(void *arg)
+{
+	struct pi_watchdog *w,
+		*next,
+		*due;
+	struct timespec ts;
+	long	now,
+		left,
+		wait;
+
+	pthread_mutex_lock(&watch_list_mutex);
+	for (;;) {
+		now	= pi_clock_ms();
+		due	= NULL;
+		wait	= -1;
+
+		for (w = watch_list; w != NULL; w = w->next) {
+			left = PS_LOAD(w->last) + w->interval * 1000L - now;
+			if (left < w->retry - now)
+				left = w->retry - now;
+			if (left <= 0) {
+				w->refs++;
+				w->due_next = due;
+				due = w;
+				continue;
+			}
+			if (wait < 0 || left < wait)
+				wait = left;
+		}
+
+		if (due != NULL) {
+			/* tickle without blocking pi_watchdog() and
+			   pi_close() on other sockets */
+			pthread_mutex_unlock(&watch_list_mutex);
+			for (w = due; w != NULL; w = w->due_next)
+				watchdog_tickle(w, now);
+			pthread_mutex_lock(&watch_list_mutex);
+			for (w = due; w != NULL; w = next) {
+				next = w->due_next;
+				watchdog_release(w);
+			}
+			continue;
+		}
+
+		if (wait < 0)
+			pthread_cond_wait(&watch_cond, &watch_list_mutex);
+		else {
+			pi_timeout_to_timespec((int)wait, &ts);
+			pthread_cond_timedwait(&watch_cond, &watch_list_mutex,
+				&ts);
+		}
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    watchdog_remove
+ *
+ * Summary:     stop watching a socket
+ *
+ * Parameters:	pi_socket*
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+watchdog_remove(pi_socket_t *ps)
+{
+	struct pi_watchdog *w,
+		**pw;
+
+	pthread_mutex_lock(&watch_list_mutex);
+	w = ps->watchdog;
+	if (w == NULL) {
+		pthread_mutex_unlock(&watch_list_mutex);
+		return;
+	}
+	for (pw = &watch_list; *pw != NULL; pw = &(*pw)->next)
+		if (*pw == w) {
+			*pw = w->next;
+			break;
+		}
+	PS_STORE(ps->watchdog, NULL);
+	pthread_mutex_unlock(&watch_list_mutex);
+
+	/* wait for a tickle or a transfer under way, without holding up
+	   the watchdog and the other sockets: the list's reference keeps
+	   the watch around until then */
+	pthread_mutex_lock(&w->lock);
+	w->closed = 1;
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_mutex_lock(&watch_list_mutex);
+	watchdog_release(w);
+	pthread_mutex_unlock(&watch_list_mutex);
+}
+#else
 /* Alarm Handling Code */
 static RETSIGTYPE
 onalarm(int signo)
@@ -843,6 +1101,7 @@ onalarm(int signo)
 
 	pi_mutex_unlock(&watch_list_mutex);
 }
+#endif
 
 /* Exit Handling Code */
 /***********************************************************************
@@ -860,17 +1119,17 @@ onalarm(int signo)
 static void
 onexit(void)
 {
-	pi_socket_list_t *l,
-			 *list;
+	pi_socket_table_t *table;
+	int	i;
 
-	pi_mutex_lock(&psl_mutex);
-	list = ps_list_copy (psl);
-	pi_mutex_unlock(&psl_mutex);
-
-	for (l = list; l != NULL; l = l->next)
-		pi_close(l->ps->sd);
+	table = PS_LOAD(ps_table);
+	if (table == NULL)
+		return;
 
-	ps_list_free (list);
+	/* pi_close() only ever clears slots of the current table */
+	for (i = 0; i < table->size; i++)
+		if (PS_LOAD(table->slot[i]) != NULL)
+			pi_close(i);
 }
 
 
@@ -898,7 +1157,6 @@ int
 pi_socket(int domain, int type, int protocol)
 {
 	pi_socket_t *ps;
-	pi_socket_list_t *list;
 
 	env_dbgcheck ();
 
@@ -932,9 +1190,8 @@ pi_socket(int domain, int type, int protocol)
 	ps->honor_rx_to	= 1;
 	ps->command 	= 1;
 
-	/* post the new socket to the list */
-	list = pi_socket_recognize(ps);
-	if (list == NULL) {
+	/* post the new socket to the table */
+	if (pi_socket_recognize(ps) < 0) {
 		close (ps->sd);
 		free(ps);
 		errno = ENOMEM;
@@ -951,12 +1208,20 @@ pi_socket_setsd(pi_socket_t *ps, int pi_sd)
 #ifdef HAVE_DUP2
 	ps->sd = dup2(pi_sd, ps->sd);
 #else
+	int	old_sd = ps->sd;
+
     close(ps->sd);
     #ifdef F_DUPFD
 		ps->sd = fcntl(pi_sd, F_DUPFD, ps->sd);
 	#else
 		ps->sd = dup(pi_sd);
 	#endif
+	/* the socket may have changed descriptor */
+	if (ps->sd != old_sd) {
+		ps_table_remove (ps, old_sd);
+		if (ps->sd != -1)
+			ps_table_insert (ps);
+	}
 #endif
     if (ps->sd == -1)
         return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
@@ -989,20 +1254,17 @@ pi_socket_init(pi_socket_t *ps)
  *
  * Function:    pi_socket_recognize
  *
- * Summary:     appends the pi_socket to global list
+ * Summary:     enters the pi_socket in the global socket table
  *
  * Parameters:  pi_socket*
  *
- * Returns:     pi_socket_list_t *
+ * Returns:     0, or negative error code
  *
  ***********************************************************************/
-pi_socket_list_t *
+int
 pi_socket_recognize(pi_socket_t *ps)
 {
-	pi_mutex_lock(&psl_mutex);
-	psl = ps_list_append(psl, ps);
-	pi_mutex_unlock(&psl_mutex);
-	return psl;
+	return ps_table_insert (ps);
 }
 
 /***********************************************************************
@@ -1045,6 +1307,11 @@ pi_devsocket(int pi_sd, const char *port, struct pi_sockaddr *addr)
 	} else if (!strncmp (port, "net:", 4)) {
 		strncpy(addr->pi_device, port + 4, sizeof(addr->pi_device));
 		ps->device = pi_inet_device (PI_NET_DEV);
+#if HAVE_PTHREAD
+	} else if (!strncmp (port, "loop:", 5)) {
+		strncpy(addr->pi_device, port + 5, sizeof(addr->pi_device));
+		ps->device = pi_loopback_device (PI_LOOPBACK_DEV);
+#endif
 #ifdef HAVE_BLUEZ
 	} else if (!strncmp (port, "bluetooth:", 10) || !strncmp (port, "bt:", 3)) {
 		strncpy(addr->pi_device, strchr(port, ':') + 1, sizeof(addr->pi_device));
@@ -1147,6 +1414,62 @@ pi_accept_to(int pi_sd, struct sockaddr *addr, size_t *addrlen, int timeout)
 	return result;
 }
 
+int
+pi_accept_session(int pi_sd, struct sockaddr *addr, size_t *addrlen,
+	int timeout)
+{
+	pi_socket_t *ps,
+		    *nps;
+	int nsd,
+	    result;
+
+	if (!(ps = find_pi_socket(pi_sd))) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (!is_listener (ps))
+		return PI_ERR_SOCK_LISTENER;
+
+#ifdef HAVE_DUP2
+	if (ps->device->dup == NULL)
+#endif
+		return pi_accept_to(pi_sd, addr, addrlen, timeout);
+
+#ifdef HAVE_DUP2
+	if ((nsd = pi_socket(PI_AF_PILOT, ps->type, ps->protocol)) < 0)
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_MEMORY);
+	nps = find_pi_socket(nsd);
+
+	nps->device = ps->device->dup(ps->device);
+	if (nps->device == NULL) {
+		pi_close(nsd);
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_MEMORY);
+	}
+	nps->cmd 	= ps->cmd;
+	nps->state 	= PI_SOCK_LISTEN;
+	nps->accept_to 	= timeout;
+
+	/* the new socket accepts on a duplicate of the listening
+	   descriptor, which the device then replaces with the connection */
+	if (dup2(ps->sd, nps->sd) < 0) {
+		pi_close(nsd);
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_SYSTEM);
+	}
+
+	result = nps->device->accept(nps, addr, addrlen);
+	if (result < 0) {
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+			"pi_accept_session: accept returned %d\n", result));
+		pi_set_error(pi_sd, result);
+		pi_close(nsd);
+		return result;
+	}
+
+	return nsd;
+#endif
+}
+
 int
 pi_getsockopt(int pi_sd, int level, int option_name,
 	      void *option_value, size_t *option_len)
@@ -1258,6 +1581,10 @@ int
 pi_send(int pi_sd, const void *msg, size_t len, int flags)
 {
 	pi_socket_t *ps;
+#if HAVE_PTHREAD
+	struct pi_watchdog *w;
+	int	result;
+#endif
 
 	if (!(ps = find_pi_socket(pi_sd))) {
 		errno = ESRCH;
@@ -1267,8 +1594,19 @@ pi_send(int pi_sd, const void *msg, size_t len, int flags)
 	if (!is_connected (ps))
 		return PI_ERR_SOCK_DISCONNECTED;
 
+#if HAVE_PTHREAD
+	if ((w = PS_LOAD(ps->watchdog)) != NULL) {
+		pthread_mutex_lock(&w->lock);
+		result = ps->protocol_queue[0]->write (ps, (void *)msg, len,
+			flags);
+		PS_STORE(w->last, pi_clock_ms());
+		pthread_mutex_unlock(&w->lock);
+		return result;
+	}
+#else
 	if (interval)
 		alarm(interval);
+#endif
 
 	return ps->protocol_queue[0]->write (ps, (void *)msg, len, flags);
 }
@@ -1288,6 +1626,10 @@ ssize_t
 pi_recv(int pi_sd, pi_buffer_t *msg, size_t len, int flags)
 {
 	pi_socket_t *ps;
+#if HAVE_PTHREAD
+	struct pi_watchdog *w;
+	ssize_t	result;
+#endif
 
 	if (!(ps = find_pi_socket(pi_sd))) {
 		errno = ESRCH;
@@ -1297,6 +1639,16 @@ pi_recv(int pi_sd, pi_buffer_t *msg, size_t len, int flags)
 	if (!is_connected (ps))
 		return PI_ERR_SOCK_DISCONNECTED;
 
+#if HAVE_PTHREAD
+	if ((w = PS_LOAD(ps->watchdog)) != NULL) {
+		pthread_mutex_lock(&w->lock);
+		result = ps->protocol_queue[0]->read (ps, msg, len, flags);
+		PS_STORE(w->last, pi_clock_ms());
+		pthread_mutex_unlock(&w->lock);
+		return result;
+	}
+#endif
+
 	return ps->protocol_queue[0]->read (ps, msg, len, flags);
 }
 
@@ -1434,20 +1786,23 @@ pi_close(int pi_sd)
 	}
 
 	if (result == 0) {
-		/* we need to remove the entry from the list prior to
+		/* we need to remove the entry from the table prior to
 		 * closing it, because closing it will reset the pi_sd */
-		pi_mutex_lock(&psl_mutex);
-		psl = ps_list_remove (psl, pi_sd);
-		pi_mutex_unlock(&psl_mutex);
+		ps_table_remove (ps, pi_sd);
 
+#if HAVE_PTHREAD
+		watchdog_remove(ps);
+#else
 		pi_mutex_lock(&watch_list_mutex);
 		watch_list = ps_list_remove (watch_list, pi_sd);
 		pi_mutex_unlock(&watch_list_mutex);
+#endif
 
 		if (ps->device != NULL)
 			result = ps->device->close (ps);
 
 		protocol_queue_destroy(ps);
+		dlp_rxbuf_release(ps->dlp_rxbuf);
 
 		if (ps->device != NULL)
 		    ps->device->free(ps->device);
@@ -1484,7 +1839,7 @@ pi_getsockname(int pi_sd, struct sockaddr *addr, size_t *namelen)
 
 	if (*namelen > ps->laddrlen)
 		*namelen = ps->laddrlen;
-	memcpy(addr, &ps->laddr, *namelen);
+	memcpy(addr, ps->laddr, *namelen);
 
 	return 0;
 }
@@ -1513,7 +1868,7 @@ pi_getsockpeer(int pi_sd, struct sockaddr *addr, size_t *namelen)
 
 	if (*namelen > ps->raddrlen)
 		*namelen = ps->raddrlen;
-	memcpy(addr, &ps->raddr, *namelen);
+	memcpy(addr, ps->raddr, *namelen);
 
 	return 0;
 }
@@ -1569,35 +1924,76 @@ pi_maxrecsize(int pi_sd)
  *
  * Function:    find_pi_socket
  *
- * Summary:     Thread-safe wrapper for ps_list_find
+ * Summary:     Looks up the pi_socket of a descriptor. Thread-safe,
+ *		and does not take any lock.
  *
- * Parameters:  None
+ * Parameters:  socket descriptor
  *
- * Returns:     Nothing
+ * Returns:     pi_socket_t *, or NULL if no match
  *
  ***********************************************************************/
 pi_socket_t *
 find_pi_socket(int pi_sd)
 {
-	pi_socket_t *result;
+	pi_socket_table_t *table = PS_LOAD(ps_table);
 
-	pi_mutex_lock(&psl_mutex);
-	result = ps_list_find (psl, pi_sd);
-	pi_mutex_unlock(&psl_mutex);
+	if (table == NULL || pi_sd < 0 || pi_sd >= table->size)
+		return NULL;
 
-	return result;
+	return PS_LOAD(table->slot[pi_sd]);
 }
 
 int
 pi_watchdog(int pi_sd, int newinterval)
 {
 	pi_socket_t *ps;
+#if HAVE_PTHREAD
+	struct pi_watchdog *w;
+	pthread_t thread;
+#endif
 
 	if (!(ps = find_pi_socket(pi_sd))) {
 		errno = ESRCH;
 		return PI_ERR_SOCK_INVALID;
 	}
 
+#if HAVE_PTHREAD
+	if (newinterval <= 0) {
+		watchdog_remove(ps);
+		return 0;
+	}
+
+	pthread_mutex_lock(&watch_list_mutex);
+	if (!watch_thread_started) {
+		if (pthread_create(&thread, NULL, watchdog_thread, NULL) != 0) {
+			pthread_mutex_unlock(&watch_list_mutex);
+			return PI_ERR_GENERIC_SYSTEM;
+		}
+		pthread_detach(thread);
+		watch_thread_started = 1;
+	}
+
+	w = ps->watchdog;
+	if (w == NULL) {
+		w = (struct pi_watchdog *)calloc(1, sizeof(struct pi_watchdog));
+		if (w == NULL) {
+			pthread_mutex_unlock(&watch_list_mutex);
+			errno = ENOMEM;
+			return PI_ERR_GENERIC_MEMORY;
+		}
+		w->ps	= ps;
+		w->refs	= 1;
+		w->last	= pi_clock_ms();
+		pthread_mutex_init(&w->lock, NULL);
+		w->next	= watch_list;
+		watch_list = w;
+		PS_STORE(ps->watchdog, w);
+	}
+	w->interval = newinterval;
+	w->retry = 0;
+	pthread_cond_signal(&watch_cond);
+	pthread_mutex_unlock(&watch_list_mutex);
+#else
 	pi_mutex_lock(&watch_list_mutex);
 	watch_list = ps_list_append (watch_list, ps);
 	pi_mutex_unlock(&watch_list_mutex);
@@ -1605,6 +2001,7 @@ pi_watchdog(int pi_sd, int newinterval)
 	signal(SIGALRM, onalarm);
 	interval = newinterval;
 	alarm(interval);
+#endif
 
 	return 0;
 }
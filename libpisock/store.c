@@ -0,0 +1,952 @@
+/*
+ * $Id$
+ *
+ * store.c: Deduplicating backup store
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-error.h"
+#include "pi-md5.h"
+#include "pi-store.h"
+
+#define PI_STORE_MAGIC	"pilot-link backup manifest 1\n"
+
+/* Records pi_store_retrieve() keeps in flight */
+#define PI_STORE_RETRIEVE_DEPTH	8
+
+/* A record, resource or block of a database, and where its data is */
+struct pi_store_entry {
+	unsigned long type,		/* resources */
+		id;			/* resource ID, or record unique ID */
+	int	attr,			/* records */
+		category;
+	size_t	size;
+	unsigned char md5[16];
+};
+
+/* A manifest */
+struct pi_store_db {
+	struct DBInfo info;
+	int	has_app_info,
+		has_sort_info,
+		count,
+		allocated;
+	struct pi_store_entry app_info,
+		sort_info,
+		*entries;
+};
+
+struct pi_store {
+	char	*dir;
+	unsigned int serial;		/* names of temporary objects */
+	struct pi_store_stats stats;
+};
+
+struct pi_store_retrieve_state {
+	pi_store_t *store;
+	struct pi_store_db *db;
+	pi_progress_t *progress;
+	progress_func report_progress;
+};
+
+static void
+pi_store_db_free(struct pi_store_db *db)
+{
+	free(db->entries);
+	memset(db, 0, sizeof(struct pi_store_db));
+}
+
+static struct pi_store_entry *
+pi_store_db_add(struct pi_store_db *db)
+{
+	struct pi_store_entry *entry;
+
+	if (db->count == db->allocated) {
+		entry = (struct pi_store_entry *) realloc(db->entries,
+			(db->allocated * 2 + 64) * sizeof(struct pi_store_entry));
+		if (entry == NULL)
+			return NULL;
+		db->entries = entry;
+		db->allocated = db->allocated * 2 + 64;
+	}
+	entry = &db->entries[db->count++];
+	memset(entry, 0, sizeof(struct pi_store_entry));
+	return entry;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_object_path
+ *
+ * Summary:     Name the file that holds an object: objects/, the first
+ *		two hex digits of the digest, then the others
+ *
+ * Parameters:  store, digest, 0 for the object or 1 for its directory
+ *
+ * Returns:     The path, to be freed, or NULL
+ *
+ ***********************************************************************/
+static char *
+pi_store_object_path(pi_store_t *store, const unsigned char md5[16],
+	int dir)
+{
+	char	*path,
+		*p;
+	int	i;
+
+	path = (char *) malloc(strlen(store->dir) + 9 + 3 + 32 + 1);
+	if (path == NULL)
+		return NULL;
+	p = path + sprintf(path, "%s/objects/%02x", store->dir, md5[0]);
+	if (!dir) {
+		*p++ = '/';
+		for (i = 1; i < 16; i++)
+			p += sprintf(p, "%02x", md5[i]);
+	}
+	return path;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_put
+ *
+ * Summary:     Store data unless the store already has it, and fill
+ *		in the entry's size and digest
+ *
+ * Parameters:  store, data, size, entry
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+static int
+pi_store_put(pi_store_t *store, const void *data, size_t size,
+	struct pi_store_entry *entry)
+{
+	struct MD5Context ctx;
+	struct stat sbuf;
+	FILE	*f;
+	char	*path,
+		*tmp = NULL;
+	int	result = PI_ERR_FILE_ERROR;
+
+	MD5Init(&ctx);
+	if (size > 0)
+		MD5Update(&ctx, (const unsigned char *)data, (unsigned)size);
+	MD5Final(entry->md5, &ctx);
+	entry->size = size;
+
+	store->stats.objects++;
+	store->stats.bytes += size;
+
+	if ((path = pi_store_object_path(store, entry->md5, 0)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	if (stat(path, &sbuf) == 0 && (size_t)sbuf.st_size == size) {
+		free(path);
+		return 0;
+	}
+
+	/* another process may be storing the same object: write it under
+	   a name of our own, then rename it into place */
+	tmp = (char *) malloc(strlen(path) + 32);
+	if (tmp == NULL) {
+		free(path);
+		return PI_ERR_GENERIC_MEMORY;
+	}
+	strcpy(tmp, path);
+	sprintf(strrchr(tmp, '/') + 1, ".tmp-%ld-%u", (long)getpid(),
+		store->serial++);
+
+	if ((f = fopen(tmp, "wb")) == NULL && errno == ENOENT) {
+		char	*dir = pi_store_object_path(store, entry->md5, 1);
+
+		if (dir != NULL) {
+			mkdir(dir, 0777);
+			free(dir);
+		}
+		f = fopen(tmp, "wb");
+	}
+	if (f != NULL) {
+		if ((size == 0 || fwrite(data, size, 1, f) == 1)
+		    && fflush(f) == 0 && fsync(fileno(f)) == 0)
+			result = 0;
+		if (fclose(f) != 0)
+			result = PI_ERR_FILE_ERROR;
+		if (result == 0 && rename(tmp, path) < 0)
+			result = PI_ERR_FILE_ERROR;
+		if (result < 0)
+			unlink(tmp);
+	}
+
+	if (result == 0) {
+		store->stats.new_objects++;
+		store->stats.new_bytes += size;
+	} else {
+		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+			"STORE unable to write %s\n", path));
+	}
+	free(tmp);
+	free(path);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_get
+ *
+ * Summary:     Read an object, checking it against the digest
+ *
+ * Parameters:  store, entry, buffer to fill
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+static int
+pi_store_get(pi_store_t *store, const struct pi_store_entry *entry,
+	pi_buffer_t *buffer)
+{
+	struct MD5Context ctx;
+	unsigned char md5[16];
+	FILE	*f;
+	char	*path;
+	int	result = PI_ERR_FILE_ERROR;
+
+	pi_buffer_clear(buffer);
+	if (pi_buffer_expect(buffer, entry->size + 1) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	if ((path = pi_store_object_path(store, entry->md5, 0)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	if ((f = fopen(path, "rb")) != NULL) {
+		/* ask for one more byte, to notice a longer object */
+		buffer->used = fread(buffer->data, 1, entry->size + 1, f);
+		fclose(f);
+
+		MD5Init(&ctx);
+		MD5Update(&ctx, buffer->data, (unsigned)buffer->used);
+		MD5Final(md5, &ctx);
+		if (buffer->used == entry->size
+		    && memcmp(md5, entry->md5, 16) == 0)
+			result = 0;
+	}
+	if (result < 0)
+		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+			"STORE %s is missing or damaged\n", path));
+	free(path);
+
+	return result;
+}
+
+static void
+pi_store_print_entry(FILE *f, const struct pi_store_entry *entry)
+{
+	int	i;
+
+	for (i = 0; i < 16; i++)
+		fprintf(f, "%02x", entry->md5[i]);
+	fprintf(f, " %lu\n", (unsigned long)entry->size);
+}
+
+static int
+pi_store_scan_entry(const char *s, struct pi_store_entry *entry)
+{
+	unsigned int byte;
+	unsigned long size;
+	int	i;
+
+	for (i = 0; i < 16; i++) {
+		if (sscanf(s + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		entry->md5[i] = byte;
+	}
+	if (sscanf(s + 32, " %lu", &size) != 1)
+		return -1;
+	entry->size = size;
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_db_write
+ *
+ * Summary:     Write a manifest, under a temporary name first so that
+ *		a manifest is always complete
+ *
+ * Parameters:  manifest, file name
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+static int
+pi_store_db_write(struct pi_store_db *db, const char *manifest)
+{
+	struct DBInfo *info = &db->info;
+	struct pi_store_entry *entry;
+	FILE	*f;
+	char	*tmp;
+	int	i,
+		result;
+
+	if ((tmp = (char *) malloc(strlen(manifest) + 5)) == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+	sprintf(tmp, "%s.tmp", manifest);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		free(tmp);
+		return PI_ERR_FILE_ERROR;
+	}
+
+	fprintf(f, "%sname %s\n", PI_STORE_MAGIC, info->name);
+	fprintf(f, "info %x %x %u %lx %lx %lu %ld %ld %ld\n", info->flags,
+		info->miscFlags, info->version, info->type, info->creator,
+		info->modnum, (long)info->createDate, (long)info->modifyDate,
+		(long)info->backupDate);
+	if (db->has_app_info) {
+		fputs("app ", f);
+		pi_store_print_entry(f, &db->app_info);
+	}
+	if (db->has_sort_info) {
+		fputs("sort ", f);
+		pi_store_print_entry(f, &db->sort_info);
+	}
+	for (i = 0; i < db->count; i++) {
+		entry = &db->entries[i];
+		if (info->flags & dlpDBFlagResource)
+			fprintf(f, "res %lx %lu ", entry->type, entry->id);
+		else
+			fprintf(f, "rec %x %d %lx ", entry->attr,
+				entry->category, entry->id);
+		pi_store_print_entry(f, entry);
+	}
+
+	/* on disk before it replaces the old manifest, as the objects
+	   it names are */
+	result = ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0
+		? PI_ERR_FILE_ERROR : 0;
+	if (fclose(f) != 0)
+		result = PI_ERR_FILE_ERROR;
+	if (result == 0 && rename(tmp, manifest) < 0)
+		result = PI_ERR_FILE_ERROR;
+	if (result < 0)
+		unlink(tmp);
+	free(tmp);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_db_read
+ *
+ * Summary:     Read a manifest
+ *
+ * Parameters:  manifest, file name
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+static int
+pi_store_db_read(struct pi_store_db *db, const char *manifest)
+{
+	struct DBInfo *info = &db->info;
+	struct pi_store_entry *entry;
+	FILE	*f;
+	char	line[256];
+	long	dates[3];
+	int	n,
+		result = PI_ERR_FILE_INVALID;
+
+	memset(db, 0, sizeof(struct pi_store_db));
+	if ((f = fopen(manifest, "r")) == NULL)
+		return PI_ERR_FILE_NOT_FOUND;
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strcmp(line, PI_STORE_MAGIC) != 0)
+		goto done;
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strncmp(line, "name ", 5) != 0
+	    || strlen(line + 5) > sizeof(info->name))
+		goto done;
+	strncpy(info->name, line + 5, strlen(line + 5) - 1);
+	if (fgets(line, sizeof(line), f) == NULL
+	    || sscanf(line, "info %x %x %u %lx %lx %lu %ld %ld %ld",
+		&info->flags, &info->miscFlags, &info->version, &info->type,
+		&info->creator, &info->modnum, &dates[0], &dates[1],
+		&dates[2]) != 9)
+		goto done;
+	info->createDate = (time_t)dates[0];
+	info->modifyDate = (time_t)dates[1];
+	info->backupDate = (time_t)dates[2];
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n = 0;
+		if (strncmp(line, "app ", 4) == 0) {
+			entry = &db->app_info;
+			db->has_app_info = 1;
+			n = 4;
+		} else if (strncmp(line, "sort ", 5) == 0) {
+			entry = &db->sort_info;
+			db->has_sort_info = 1;
+			n = 5;
+		} else if ((entry = pi_store_db_add(db)) == NULL) {
+			result = PI_ERR_GENERIC_MEMORY;
+			goto done;
+		} else if (info->flags & dlpDBFlagResource) {
+			sscanf(line, "res %lx %lu %n", &entry->type, &entry->id,
+				&n);
+		} else {
+			sscanf(line, "rec %x %d %lx %n", (unsigned int *)&entry->attr,
+				&entry->category, &entry->id, &n);
+		}
+		if (n == 0 || pi_store_scan_entry(line + n, entry) < 0)
+			goto done;
+	}
+	if (!ferror(f))
+		result = 0;
+
+done:
+	fclose(f);
+	if (result < 0) {
+		LOG((PI_DBG_API, PI_DBG_LVL_ERR,
+			"STORE %s is not a valid manifest\n", manifest));
+		pi_store_db_free(db);
+	}
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_open
+ *
+ * Summary:     Open a store, making its directory and objects/ in it
+ *		if needed
+ *
+ * Parameters:  store directory
+ *
+ * Returns:     The store, or NULL with errno set
+ *
+ ***********************************************************************/
+pi_store_t *
+pi_store_open(const char *dir)
+{
+	pi_store_t *store;
+	char	*objects;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+		return NULL;
+
+	store = (pi_store_t *) calloc(1, sizeof(pi_store_t));
+	if (store == NULL)
+		return NULL;
+	objects = (char *) malloc(strlen(dir) + 9);
+	store->dir = strdup(dir);
+	if (objects == NULL || store->dir == NULL) {
+		free(objects);
+		pi_store_close(store);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	sprintf(objects, "%s/objects", dir);
+	if (mkdir(objects, 0777) < 0 && errno != EEXIST) {
+		free(objects);
+		pi_store_close(store);
+		return NULL;
+	}
+	free(objects);
+
+	return store;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_close
+ *
+ * Summary:     Close a store
+ *
+ * Parameters:  store, may be NULL
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_store_close(pi_store_t *store)
+{
+	if (store == NULL)
+		return;
+	free(store->dir);
+	free(store);
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_get_stats
+ *
+ * Summary:     Get what went into a store since it was opened
+ *
+ * Parameters:  store, counters to fill in
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+pi_store_get_stats(pi_store_t *store, struct pi_store_stats *stats)
+{
+	*stats = store->stats;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_get_info
+ *
+ * Summary:     Read the database header a manifest keeps, and the
+ *		sizes of its entries, without reading the objects
+ *
+ * Parameters:  manifest, header to fill in, sizes to fill in or NULL
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_store_get_info(const char *manifest, struct DBInfo *info,
+	struct DBSizeInfo *size)
+{
+	struct pi_store_db db;
+	int	i,
+		result;
+
+	if ((result = pi_store_db_read(&db, manifest)) < 0)
+		return result;
+	*info = db.info;
+
+	if (size != NULL) {
+		memset(size, 0, sizeof(struct DBSizeInfo));
+		size->numRecords = db.count;
+		if (db.has_app_info)
+			size->appBlockSize = db.app_info.size;
+		if (db.has_sort_info)
+			size->sortBlockSize = db.sort_info.size;
+		for (i = 0; i < db.count; i++) {
+			size->dataBytes += db.entries[i].size;
+			if (db.entries[i].size > size->maxRecSize)
+				size->maxRecSize = db.entries[i].size;
+		}
+
+		/* as in a database file: the header, the entry list and
+		   the two bytes after it */
+		size->totalBytes = 78 + db.count
+			* (db.info.flags & dlpDBFlagResource ? 10 : 8) + 2
+			+ size->appBlockSize + size->sortBlockSize
+			+ size->dataBytes;
+	}
+	pi_store_db_free(&db);
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_add
+ *
+ * Summary:     Put each block, record or resource of a database file
+ *		into the store, and write its manifest
+ *
+ * Parameters:  store, open file, manifest
+ *
+ * Returns:     0, or negative error code
+ *
+ ***********************************************************************/
+int
+pi_store_add(pi_store_t *store, pi_file_t *pf, const char *manifest)
+{
+	struct pi_store_db db;
+	struct pi_store_entry *entry;
+	void	*data;
+	size_t	size;
+	int	i,
+		count,
+		result = 0;
+
+	memset(&db, 0, sizeof(db));
+	pi_file_get_info(pf, &db.info);
+
+	pi_file_get_app_info(pf, &data, &size);
+	if (size > 0) {
+		db.has_app_info = 1;
+		if ((result = pi_store_put(store, data, size, &db.app_info)) < 0)
+			goto done;
+	}
+	pi_file_get_sort_info(pf, &data, &size);
+	if (size > 0) {
+		db.has_sort_info = 1;
+		if ((result = pi_store_put(store, data, size, &db.sort_info)) < 0)
+			goto done;
+	}
+
+	pi_file_get_entries(pf, &count);
+	for (i = 0; i < count; i++) {
+		if ((entry = pi_store_db_add(&db)) == NULL) {
+			result = PI_ERR_GENERIC_MEMORY;
+			goto done;
+		}
+		if (db.info.flags & dlpDBFlagResource) {
+			int	id;
+
+			result = pi_file_read_resource(pf, i, &data, &size,
+				&entry->type, &id);
+			entry->id = (unsigned long)id;
+		} else {
+			result = pi_file_read_record(pf, i, &data, &size,
+				&entry->attr, &entry->category, &entry->id);
+		}
+		if (result < 0
+		    || (result = pi_store_put(store, data, size, entry)) < 0)
+			goto done;
+	}
+
+	result = pi_store_db_write(&db, manifest);
+
+done:
+	pi_store_db_free(&db);
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_retrieve_entry
+ *
+ * Summary:     Batch read callback for pi_store_retrieve(): store a
+ *		record or resource and report progress
+ *
+ * Parameters:  socket, entry read, retrieve state
+ *
+ * Returns:     0 to go on, negative to abort the transfer
+ *
+ ***********************************************************************/
+static int
+pi_store_retrieve_entry(int socket, struct dlpPipelineCompletion *entry,
+	void *userdata)
+{
+	struct pi_store_retrieve_state *state =
+		(struct pi_store_retrieve_state *)userdata;
+	struct pi_store_entry *e;
+	int	result;
+
+	state->progress->transferred_bytes += entry->buffer->used;
+	state->progress->data.db.transferred_records++;
+
+	if (state->report_progress && state->report_progress(socket,
+			state->progress) == PI_TRANSFER_STOP)
+		return pi_set_error(socket, PI_ERR_FILE_ABORTED);
+
+	/* as in pi_file_retrieve(), records that can't be restored
+	   aren't kept */
+	if (!(state->db->info.flags & dlpDBFlagResource)
+	    && (entry->attr & (dlpRecAttrArchived | dlpRecAttrDeleted)))
+		return 0;
+
+	if ((e = pi_store_db_add(state->db)) == NULL)
+		return pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+	if (state->db->info.flags & dlpDBFlagResource) {
+		e->type = entry->type;
+		e->id = (unsigned long)entry->resID;
+	} else {
+		e->attr = entry->attr & 0xf0;
+		e->category = entry->category;
+		e->id = entry->recuid;
+	}
+	if ((result = pi_store_put(state->store, entry->buffer->data,
+			entry->buffer->used, e)) < 0)
+		return pi_set_error(socket, result);
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_retrieve
+ *
+ * Summary:     Back up a database from the handheld into the store,
+ *		reading its records in batches as pi_file_retrieve()
+ *		does, and write its manifest
+ *
+ * Parameters:  store, socket, card, database, manifest, progress
+ *		callback
+ *
+ * Returns:     0, or negative error code, in which case there is no
+ *		manifest
+ *
+ ***********************************************************************/
+int
+pi_store_retrieve(pi_store_t *store, int socket, int cardno,
+	const struct DBInfo *info, const char *manifest,
+	progress_func report_progress)
+{
+	int	db = -1,
+		result,
+		old_device = 0;
+	struct DBInfo dbi;
+	struct DBSizeInfo size_info;
+	struct pi_store_db sdb;
+	struct pi_store_retrieve_state state;
+	pi_buffer_t *buffer = NULL;
+	pi_progress_t progress;
+
+	pi_reset_errors(socket);
+	memset(&size_info, 0, sizeof(size_info));
+	memset(&dbi, 0, sizeof(dbi));
+	memset(&sdb, 0, sizeof(sdb));
+	sdb.info = *info;
+
+	/* see pi_file_retrieve() about the size info and appInfo blocks
+	   in ROM */
+	if ((result = dlp_FindDBByName(socket, cardno, info->name, NULL,
+			NULL, &dbi, &size_info)) < 0) {
+		if (result != PI_ERR_DLP_UNSUPPORTED)
+			goto fail;
+		old_device = 1;
+	}
+
+	if ((result = dlp_OpenDB(socket, cardno, dlpOpenRead | dlpOpenSecret,
+			info->name, &db)) < 0)
+		goto fail;
+
+	buffer = pi_buffer_new(DLP_BUF_SIZE);
+	if (buffer == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+
+	if (old_device) {
+		int	num_records;
+
+		if ((result = dlp_ReadOpenDBInfo(socket, db, &num_records)) < 0)
+			goto fail;
+		size_info.numRecords = num_records;
+	}
+
+	memset(&progress, 0, sizeof(progress));
+	progress.type = PI_PROGRESS_RECEIVE_DB;
+	progress.data.db.size = size_info;
+
+	if (size_info.appBlockSize
+	    || (dbi.miscFlags & dlpDBMiscFlagRamBased)
+	    || old_device) {
+		result = dlp_ReadAppBlock(socket, db, 0, DLP_BUF_SIZE, buffer);
+		if (result > 0) {
+			sdb.has_app_info = 1;
+			if ((result = pi_store_put(store, buffer->data,
+					(size_t)result, &sdb.app_info)) < 0) {
+				pi_set_error(socket, result);
+				goto fail;
+			}
+			progress.transferred_bytes += sdb.app_info.size;
+			if (report_progress && report_progress(socket,
+					&progress) == PI_TRANSFER_STOP) {
+				result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+				goto fail;
+			}
+		}
+	}
+
+	state.store = store;
+	state.db = &sdb;
+	state.progress = &progress;
+	state.report_progress = report_progress;
+
+	if (info->flags & dlpDBFlagResource)
+		result = dlp_ReadResourcesBatch(socket, db, 0,
+			(int)size_info.numRecords, PI_STORE_RETRIEVE_DEPTH,
+			buffer, pi_store_retrieve_entry, &state);
+	else
+		result = dlp_ReadRecordsBatch(socket, db, 0,
+			(int)size_info.numRecords, PI_STORE_RETRIEVE_DEPTH,
+			buffer, pi_store_retrieve_entry, &state);
+	if (result < 0)
+		goto fail;
+
+	pi_buffer_free(buffer);
+	buffer = NULL;
+
+	result = dlp_CloseDB(socket, db);
+	db = -1;
+	if (result < 0)
+		goto fail;
+
+	if ((result = pi_store_db_write(&sdb, manifest)) < 0) {
+		pi_set_error(socket, result);
+		goto fail;
+	}
+	pi_store_db_free(&sdb);
+
+	return 0;
+
+fail:
+	if (db != -1 && pi_socket_connected(socket)) {
+		int	err = pi_error(socket),
+			palmoserr = pi_palmos_error(socket);
+
+		dlp_CloseDB(socket, db);
+
+		pi_set_error(socket, err);
+		pi_set_palmos_error(socket, palmoserr);
+	}
+	if (buffer != NULL)
+		pi_buffer_free(buffer);
+	pi_store_db_free(&sdb);
+
+	if (result >= 0)
+		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_materialize
+ *
+ * Summary:     Write the database a manifest describes to a file,
+ *		checking each object read against its digest
+ *
+ * Parameters:  store, manifest, database file
+ *
+ * Returns:     0, or negative error code, in which case there is no
+ *		file
+ *
+ ***********************************************************************/
+int
+pi_store_materialize(pi_store_t *store, const char *manifest,
+	const char *path)
+{
+	struct pi_store_db db;
+	struct pi_store_entry *entry;
+	pi_file_t *pf;
+	pi_buffer_t *buffer;
+	int	i,
+		result;
+
+	if ((result = pi_store_db_read(&db, manifest)) < 0)
+		return result;
+	if ((buffer = pi_buffer_new(DLP_BUF_SIZE)) == NULL) {
+		pi_store_db_free(&db);
+		return PI_ERR_GENERIC_MEMORY;
+	}
+	if ((pf = pi_file_create(path, &db.info)) == NULL) {
+		pi_buffer_free(buffer);
+		pi_store_db_free(&db);
+		return PI_ERR_FILE_ERROR;
+	}
+
+	if (db.has_app_info) {
+		if ((result = pi_store_get(store, &db.app_info, buffer)) < 0
+		    || (result = pi_file_set_app_info(pf, buffer->data,
+				buffer->used)) < 0)
+			goto done;
+	}
+	if (db.has_sort_info) {
+		if ((result = pi_store_get(store, &db.sort_info, buffer)) < 0
+		    || (result = pi_file_set_sort_info(pf, buffer->data,
+				buffer->used)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < db.count; i++) {
+		entry = &db.entries[i];
+		if ((result = pi_store_get(store, entry, buffer)) < 0)
+			goto done;
+		if (db.info.flags & dlpDBFlagResource)
+			result = pi_file_append_resource(pf, buffer->data,
+				buffer->used, entry->type, (int)entry->id);
+		else
+			result = pi_file_append_record(pf, buffer->data,
+				buffer->used, entry->attr, entry->category,
+				entry->id);
+		if (result < 0)
+			goto done;
+	}
+	result = 0;
+
+done:
+	if (pi_file_close(pf) < 0 && result == 0)
+		result = PI_ERR_FILE_ERROR;
+	if (result < 0)
+		unlink(path);
+	pi_buffer_free(buffer);
+	pi_store_db_free(&db);
+
+	return result;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_store_open_file
+ *
+ * Summary:     Open the database a manifest describes, through an
+ *		unlinked temporary file
+ *
+ * Parameters:  store, manifest
+ *
+ * Returns:     The open file, or NULL
+ *
+ ***********************************************************************/
+pi_file_t *
+pi_store_open_file(pi_store_t *store, const char *manifest)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	pi_file_t *pf = NULL;
+	char	*path;
+	int	fd;
+
+	if (tmpdir == NULL || *tmpdir == '\0')
+		tmpdir = "/tmp";
+	if ((path = (char *) malloc(strlen(tmpdir) + 20)) == NULL)
+		return NULL;
+	sprintf(path, "%s/pi-storeXXXXXX", tmpdir);
+	if ((fd = mkstemp(path)) < 0) {
+		free(path);
+		return NULL;
+	}
+	close(fd);
+
+	/* the open file keeps the data once its name is gone */
+	if (pi_store_materialize(store, manifest, path) == 0)
+		pf = pi_file_open(path);
+	unlink(path);
+	free(path);
+
+	return pf;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -75,6 +75,7 @@ sys_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL && new_data != NULL) {	
 		new_prot->level	= prot->level;
 		new_prot->dup 	= prot->dup;
+		new_prot->next	= NULL;
 		new_prot->free 	= prot->free;
 		new_prot->read 	= prot->read;
 		new_prot->write = prot->write;
@@ -144,6 +145,7 @@ sys_protocol (void)
 	if (prot != NULL && data != NULL) {
 		prot->level 	= PI_LEVEL_SYS;
 		prot->dup 	= sys_protocol_dup;
+		prot->next	= NULL;
 		prot->free 	= sys_protocol_free;
 		prot->read 	= sys_rx;
 		prot->write 	= sys_tx;
@@ -183,13 +185,13 @@ sys_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 
 	size_t	size;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_sys_data_t *)prot->data;
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -244,12 +246,12 @@ sys_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	pi_sys_data_t *data;
 	size_t 	data_len;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_sys_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -278,11 +280,11 @@ sys_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = PI_SOCK_LAYER(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = prot->next;
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
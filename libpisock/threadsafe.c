@@ -22,6 +22,10 @@
  * -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "pi-threadsafe.h"
 
 int pi_mutex_lock(pi_mutex_t *mutex)
@@ -32,6 +32,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>		/* Needed for Redhat 6.x machines */
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <string.h>
 
@@ -39,6 +40,7 @@
 #include "pi-source.h"
 #include "pi-serial.h"
 #include "pi-error.h"
+#include "pi-event.h"
 
 /* if this is running on a NeXT system... */
 #ifdef NeXT
@@ -129,6 +131,9 @@ static ssize_t s_write(pi_socket_t *ps, const unsigned char *buf,
 	size_t len, int flags);
 static ssize_t s_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len,
 	int flags);
+static ssize_t s_read_buf(pi_socket_t *ps, pi_buffer_t *buf, size_t len,
+	int flags);
+static ssize_t s_ring_fill(pi_socket_t *ps);
 static int s_poll(pi_socket_t *ps, int timeout);
 
 static speed_t calcrate(int baudrate);
@@ -275,24 +280,20 @@ s_poll(pi_socket_t *ps, int timeout)
 {
 	struct 	pi_serial_data *data =
 		 (struct pi_serial_data *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
+	int	ready;
 
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
+	/* data already read ahead */
+	if (data->buf_size > 0)
+		return 0;
 
 	/* If timeout == 0, wait forever for packet, otherwise wait till
 	   timeout milliseconds */
-	if (timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= timeout / 1000;
-		t.tv_usec 	= (timeout % 1000) * 1000;
-		if (select(ps->sd + 1, &ready, 0, 0, &t) == 0)
-			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-	}
+	data->rx_syscalls++;
+	ready = pi_event_wait(ps->sd, PI_EVENT_READ, timeout);
+	if (ready == 0)
+		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 
-	if (!FD_ISSET(ps->sd, &ready)) {
+	if (ready < 0) {
 		/* otherwise throw out any current packet and return */
 		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
 			"DEV POLL unixserial timeout\n"));
@@ -326,24 +327,10 @@ s_write(pi_socket_t *ps, const unsigned char *buf, size_t len,
 		nwrote;
 	struct 	pi_serial_data *data =
 		(struct pi_serial_data *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
-
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
 
 	total = len;
 	while (total > 0) {
-		if (data->timeout == 0)
-			select(ps->sd + 1, 0, &ready, 0, 0);
-		else {
-			t.tv_sec 	= data->timeout / 1000;
-			t.tv_usec 	= (data->timeout % 1000) * 1000;
-			if (select(ps->sd + 1, 0, &ready, 0, &t) == 0)
-				return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-		}
-
-		if (!FD_ISSET(ps->sd, &ready))
+		if (pi_event_wait(ps->sd, PI_EVENT_WRITE, data->timeout) <= 0)
 			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 
 		nwrote = write(ps->sd, buf, len);
@@ -372,24 +359,32 @@ s_write(pi_socket_t *ps, const unsigned char *buf, size_t len,
  *
  * Function:    s_read_buf
  *
- * Summary:     read from data buffer
+ * Summary:     read from the read-ahead ring
  *
- * Parameters:	pi_socket_t*, pi_buffer_t* to buf, length to get
+ * Parameters:	pi_socket_t*, pi_buffer_t* to buf, length to get, flags
  *
- * Returns:     number of bytes read
+ * Returns:     number of bytes read or negative on error
  *
  ***********************************************************************/
-static size_t
+static ssize_t
 s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags) 
 {
 	struct 	pi_serial_data *data =
 		(struct pi_serial_data *)ps->device->data;
-	size_t	rbuf = data->buf_size;
+	size_t	rbuf = data->buf_size,
+		first;
 
 	if (rbuf > len)
 		rbuf = len;
 
-	if (pi_buffer_append (buf, data->buf, rbuf) == NULL) {
+	/* the bytes may wrap around the end of the ring */
+	first = PI_SERIAL_RING_SIZE - data->buf_start;
+	if (first > rbuf)
+		first = rbuf;
+
+	if (pi_buffer_append (buf, &data->buf[data->buf_start], first) == NULL
+	    || (rbuf > first
+		&& pi_buffer_append (buf, data->buf, rbuf - first) == NULL)) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
@@ -397,7 +392,10 @@ s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	if (flags != PI_MSG_PEEK) {
 		data->buf_size -= rbuf;
 		if (data->buf_size > 0)
-			memmove(data->buf, &data->buf[rbuf], data->buf_size);
+			data->buf_start = (data->buf_start + rbuf)
+				% PI_SERIAL_RING_SIZE;
+		else
+			data->buf_start = 0;
 	}
 
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
@@ -408,75 +406,30 @@ s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 
 /***********************************************************************
  *
- * Function:    s_read
+ * Function:    s_ring_fill
  *
- * Summary:     Read incoming data from the socket/file descriptor
+ * Summary:     Wait for data, then read as much as the kernel has into
+ *		the free space of the read-ahead ring, with one call
  *
- * Parameters:	pi_socket_t*, pi_buffer_t* to buf, expect length, flags
+ * Parameters:	pi_socket_t*
  *
  * Returns:     number of bytes read or negative on error
  *
  ***********************************************************************/
 static ssize_t
-s_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
+s_ring_fill(pi_socket_t *ps)
 {
-	ssize_t rbuf = 0,
-		bytes;
+	ssize_t bytes;
+	size_t	tail;
+	int	iovcnt = 1;
 	struct 	pi_serial_data *data =
 		(struct pi_serial_data *)ps->device->data;
-	struct 	timeval t;
-	fd_set 	ready;
-
-	/* check whether we have at least partial data in store */
-	if (data->buf_size) {
-		rbuf = s_read_buf(ps, buf, len, flags);
-		if (rbuf < 0)
-			return rbuf;
-		len -= rbuf;
-		if (len == 0)
-			return rbuf;
-	}
+	struct	iovec iov[2];
 
 	/* If timeout == 0, wait forever for packet, otherwise wait till
 	   timeout milliseconds */
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
-	if (data->timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= data->timeout / 1000;
-		t.tv_usec 	= (data->timeout % 1000) * 1000;
-		if (select(ps->sd + 1, &ready, 0, 0, &t) == 0)
-			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-	}
-
-	/* If data is available in time, read it */
-	if (FD_ISSET(ps->sd, &ready)) {
-		if (flags == PI_MSG_PEEK && len > 256)
-			len = 256;
-
-		if (pi_buffer_expect (buf, len) == NULL) {
-			errno = ENOMEM;
-			return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
-		}
-
-		bytes = read(ps->sd, &buf->data[buf->used], len);
-
-		if (bytes > 0) {
-			if (flags == PI_MSG_PEEK) {
-				memcpy(data->buf + data->buf_size, buf->data + buf->used, bytes);
-				data->buf_size += bytes;
-			}
-			buf->used += bytes;
-			data->rx_bytes += bytes;
-			rbuf += bytes;
-
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
-				"DEV RX unixserial read %d bytes\n", bytes));
-		} else if (bytes < 0) {
-			rbuf = bytes;
-		}
-	} else {
+	data->rx_syscalls++;
+	if (pi_event_wait(ps->sd, PI_EVENT_READ, data->timeout) <= 0) {
 		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
 			"DEV RX unixserial timeout\n"));
 		data->rx_errors++;
@@ -484,7 +437,64 @@ s_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 	}
 
-	return rbuf;
+	/* The free space runs from the end of the data to the end of the
+	   ring, then from the start of the ring to the start of the data */
+	tail = (data->buf_start + data->buf_size) % PI_SERIAL_RING_SIZE;
+	iov[0].iov_base = &data->buf[tail];
+	if (tail >= data->buf_start) {
+		iov[0].iov_len	= PI_SERIAL_RING_SIZE - tail;
+		iov[1].iov_base	= data->buf;
+		iov[1].iov_len	= data->buf_start;
+		if (data->buf_start > 0)
+			iovcnt = 2;
+	} else
+		iov[0].iov_len	= data->buf_start - tail;
+
+	data->rx_syscalls++;
+	bytes = readv(ps->sd, iov, iovcnt);
+	if (bytes < 0) {
+		data->rx_errors++;
+		return pi_set_error(ps->sd, PI_ERR_SOCK_IO);
+	}
+
+	data->buf_size += bytes;
+	data->rx_bytes += bytes;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
+		"DEV RX unixserial read %d bytes\n", bytes));
+
+	return bytes;
+}
+
+/***********************************************************************
+ *
+ * Function:    s_read
+ *
+ * Summary:     Read incoming data from the socket/file descriptor
+ *
+ * Parameters:	pi_socket_t*, pi_buffer_t* to buf, expect length, flags
+ *
+ * Returns:     number of bytes read or negative on error
+ *
+ ***********************************************************************/
+static ssize_t
+s_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
+{
+	ssize_t bytes;
+	struct 	pi_serial_data *data =
+		(struct pi_serial_data *)ps->device->data;
+
+	/* Only go to the device when the ring can't serve the request:
+	   when it is empty, or when a peek wants more than it holds */
+	if (data->buf_size == 0
+	    || (flags == PI_MSG_PEEK && data->buf_size < len
+		&& data->buf_size < PI_SERIAL_RING_SIZE)) {
+		bytes = s_ring_fill(ps);
+		if (bytes < 0)
+			return bytes;
+	}
+
+	return s_read_buf(ps, buf, len, flags);
 }
 
 /***********************************************************************
@@ -514,6 +524,7 @@ s_flush(pi_socket_t *ps, int flags)
 	if (flags & PI_FLUSH_INPUT) {
 		/* clear internal buffer */
 		data->buf_size = 0;
+		data->buf_start = 0;
 
 		/* flush pending data (we assume the socket is in blocking mode) */
 		if ((fl = fcntl(ps->sd, F_GETFL, 0)) != -1)
@@ -91,6 +91,7 @@ pi_usb_protocol_dup (pi_protocol_t *prot)
 	if (new_prot != NULL) {
 		new_prot->level 	= prot->level;
 		new_prot->dup 		= prot->dup;
+		new_prot->next		= NULL;
 		new_prot->free 		= prot->free;
 		new_prot->read 		= prot->read;
 		new_prot->write 	= prot->write;
@@ -151,6 +152,7 @@ pi_usb_protocol (pi_device_t *dev)
 	if (prot != NULL) {
 		prot->level 		= PI_LEVEL_DEV;
 		prot->dup 		= pi_usb_protocol_dup;
+		prot->next		= NULL;
 		prot->free 		= pi_usb_protocol_free;
 		prot->read 		= data->impl.read;
 		prot->write 		= data->impl.write;
@@ -212,6 +214,7 @@ pi_usb_device (int type)
 			free(dev);
 			dev = NULL;
 		} else {
+			dev->dup 		= NULL;
 			dev->free 		= pi_usb_device_free;
 			dev->protocol 		= pi_usb_protocol;
 			dev->bind 		= pi_usb_bind;
@@ -27,13 +27,388 @@
 #include <stdlib.h>
 #include <string.h>
 #include "pi-util.h"
+#include "pi-buffer.h"
 
 #ifdef HAVE_ICONV
 #include <iconv.h>
 #endif
 
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #define PILOT_CHARSET "CP1252" 
 
+#ifdef HAVE_ICONV
+/* Number of converters each thread keeps open */
+#define CONVERTER_CACHE_SIZE 8
+
+struct converter {
+	char	*to,
+		*from;
+	iconv_t	cd;
+	int	ascii;		/* bytes 0 to 127 come out unchanged */
+};
+
+struct converter_cache {
+	char	*pilot_charset;	/* PILOT_CHARSET, read once */
+	int	count,
+		next;		/* slot reused once the cache is full */
+	struct converter conv[CONVERTER_CACHE_SIZE];
+};
+
+#if HAVE_PTHREAD
+static pthread_key_t converter_cache_key;
+static pthread_once_t converter_cache_once = PTHREAD_ONCE_INIT;
+#else
+static struct converter_cache *converter_cache_global = NULL;
+#endif
+
+/***********************************************************************
+ *
+ * Function:    converter_close
+ *
+ * Summary:     Close a cached converter
+ *
+ * Parameters:  converter
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+converter_close(struct converter *conv)
+{
+	iconv_close(conv->cd);
+	free(conv->to);
+	free(conv->from);
+}
+
+#if HAVE_PTHREAD
+/***********************************************************************
+ *
+ * Function:    converter_cache_free
+ *
+ * Summary:     Close the converters of a thread when it exits
+ *
+ * Parameters:  converter cache
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+converter_cache_free(void *data)
+{
+	struct converter_cache *cache = (struct converter_cache *) data;
+	int	i;
+
+	for (i = 0; i < cache->count; i++)
+		converter_close(&cache->conv[i]);
+	free(cache->pilot_charset);
+	free(cache);
+}
+
+static void
+converter_cache_key_init(void)
+{
+	pthread_key_create(&converter_cache_key, converter_cache_free);
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    converter_cache
+ *
+ * Summary:     Get the converter cache of the calling thread, creating
+ *		it if needed
+ *
+ * Parameters:  None
+ *
+ * Returns:     The cache, or NULL if out of memory
+ *
+ ***********************************************************************/
+static struct converter_cache *
+converter_cache(void)
+{
+	struct converter_cache *cache;
+
+#if HAVE_PTHREAD
+	pthread_once(&converter_cache_once, converter_cache_key_init);
+	cache = (struct converter_cache *)
+		pthread_getspecific(converter_cache_key);
+#else
+	cache = converter_cache_global;
+#endif
+	if (cache != NULL)
+		return cache;
+
+	if ((cache = calloc(1, sizeof(struct converter_cache))) == NULL)
+		return NULL;
+#if HAVE_PTHREAD
+	pthread_setspecific(converter_cache_key, cache);
+#else
+	converter_cache_global = cache;
+#endif
+	return cache;
+}
+
+/***********************************************************************
+ *
+ * Function:    pilot_charset
+ *
+ * Summary:     Get the Palm charset, from the 'PILOT_CHARSET'
+ *		environment variable or CP1252. The variable is read the
+ *		first time a thread needs it
+ *
+ * Parameters:  None
+ *
+ * Returns:     iconv-recognised charset identifier
+ *
+ ***********************************************************************/
+static const char *
+pilot_charset(void)
+{
+	struct converter_cache *cache = converter_cache();
+	const char *pcharset;
+
+	if (cache != NULL && cache->pilot_charset != NULL)
+		return cache->pilot_charset;
+
+	if ((pcharset = getenv("PILOT_CHARSET")) == NULL)
+		pcharset = PILOT_CHARSET;
+	if (cache != NULL)
+		cache->pilot_charset = strdup(pcharset);
+	return pcharset;
+}
+
+/***********************************************************************
+ *
+ * Function:    converter_get
+ *
+ * Summary:     Get a converter between two charsets, reusing the one
+ *		the calling thread opened before if there is one
+ *
+ * Parameters:
+ *		to		iconv-recognised destination charset
+ *		from		iconv-recognised source charset
+ *
+ * Returns:     The converter, or NULL if iconv can't convert
+ *
+ ***********************************************************************/
+static struct converter *
+converter_get(const char *to, const char *from)
+{
+	struct converter_cache *cache;
+	struct converter *conv;
+	char	ascii[128],
+		out[128 * 4],
+		*ib,
+		*ob;
+	size_t	ibl,
+		obl;
+	iconv_t	cd;
+	int	i;
+
+	if ((cache = converter_cache()) == NULL)
+		return NULL;
+
+	for (i = 0; i < cache->count; i++) {
+		conv = &cache->conv[i];
+		if (strcmp(conv->to, to) == 0 && strcmp(conv->from, from) == 0) {
+			/* back to the initial shift state */
+			iconv(conv->cd, NULL, NULL, NULL, NULL);
+			return conv;
+		}
+	}
+
+	if ((cd = iconv_open(to, from)) == (iconv_t)-1)
+		return NULL;
+
+	if (cache->count < CONVERTER_CACHE_SIZE) {
+		conv = &cache->conv[cache->count++];
+	} else {
+		conv = &cache->conv[cache->next];
+		cache->next = (cache->next + 1) % CONVERTER_CACHE_SIZE;
+		converter_close(conv);
+	}
+	conv->cd	= cd;
+	conv->to	= strdup(to);
+	conv->from	= strdup(from);
+	if (conv->to == NULL || conv->from == NULL) {
+		converter_close(conv);
+		*conv = cache->conv[--cache->count];
+		return NULL;
+	}
+
+	/* Text that is plain ASCII is copied as is when both charsets
+	   leave it alone, which most Palm and desktop charsets do */
+	for (i = 0; i < 128; i++)
+		ascii[i] = (char) i;
+	ib	= ascii;
+	ibl	= sizeof(ascii);
+	ob	= out;
+	obl	= sizeof(out);
+	conv->ascii = iconv(cd, &ib, &ibl, &ob, &obl) != (size_t)-1
+		&& iconv(cd, NULL, NULL, &ob, &obl) != (size_t)-1
+		&& ob - out == sizeof(ascii)
+		&& memcmp(ascii, out, sizeof(ascii)) == 0;
+	iconv(cd, NULL, NULL, NULL, NULL);
+
+	return conv;
+}
+
+/***********************************************************************
+ *
+ * Function:    converter_run
+ *
+ * Summary:     Convert a string, and null-terminate it
+ *
+ * Parameters:
+ *		conv		converter from converter_get()
+ *		text		text to convert
+ *		bytes		number of bytes from 'text' to convert
+ *		out		output, at least 'bytes' * 4 + 8 bytes
+ *
+ * Returns:     Number of bytes written before the null, or -1 on failure
+ *
+ ***********************************************************************/
+static int
+converter_run(struct converter *conv, const char *text, size_t bytes,
+	      char *out)
+{
+	char	*ib,
+		*ob;
+	size_t	ibl,
+		obl,
+		i;
+
+	if (conv->ascii) {
+		for (i = 0; i < bytes; i++)
+			if (text[i] & 0x80)
+				break;
+		if (i == bytes) {
+			memcpy(out, text, bytes);
+			out[bytes] = '\0';
+			return (int) bytes;
+		}
+	}
+
+	ib	= (char *) text;
+	ibl	= bytes;
+	ob	= out;
+	obl	= bytes * 4 + 7;
+	if (iconv(conv->cd, &ib, &ibl, &ob, &obl) == (size_t)-1
+	    || iconv(conv->cd, NULL, NULL, &ob, &obl) == (size_t)-1) {
+		iconv(conv->cd, NULL, NULL, NULL, NULL);
+		return -1;
+	}
+	*ob = '\0';
+
+	return (int) (ob - out);
+}
+
+/***********************************************************************
+ *
+ * Function:    convert_string
+ *
+ * Summary:     Convert a string to a newly allocated one
+ *
+ * Parameters:
+ *		to		iconv-recognised destination charset
+ *		from		iconv-recognised source charset
+ *		text		text to convert
+ *		bytes		maximum number of bytes from 'text' to convert
+ *		out (output)	on success, the converted string
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+static int
+convert_string(const char *to, const char *from, const char *text,
+	       int bytes, char **out)
+{
+	struct converter *conv;
+
+	if ((conv = converter_get(to, from)) == NULL)
+		return -1;
+	if ((*out = malloc((size_t) bytes * 4 + 8)) == NULL)
+		return -1;
+	if (converter_run(conv, text, (size_t) bytes, *out) < 0) {
+		free(*out);
+		*out = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    convert_strings
+ *
+ * Summary:     Convert null-terminated strings one after the other into
+ *		a buffer
+ *
+ * Parameters:
+ *		to		iconv-recognised destination charset
+ *		from		iconv-recognised source charset
+ *		count		number of strings
+ *		texts		strings to convert, NULL ones are skipped
+ *		out (output)	on success, the converted strings, which
+ *				point in 'arena'
+ *		arena		buffer the converted strings are appended to
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+static int
+convert_strings(const char *to, const char *from, int count,
+		char * const *texts, char **out, pi_buffer_t *arena)
+{
+	struct converter *conv;
+	size_t	start	= arena->used,
+		*offsets,
+		bytes,
+		need;
+	int	i,
+		written;
+
+	if ((conv = converter_get(to, from)) == NULL)
+		return -1;
+
+	/* offsets first, the arena moves as it grows */
+	if ((offsets = malloc((count > 0 ? count : 1) * sizeof(size_t)))
+	    == NULL)
+		return -1;
+	for (i = 0; i < count; i++) {
+		if (texts[i] == NULL)
+			continue;
+		bytes = strlen(texts[i]);
+		need = bytes * 4 + 8;
+		if (arena->allocated - arena->used < need
+		    && pi_buffer_expect(arena, need > arena->allocated
+			    ? need : arena->allocated) == NULL)
+			goto fail;
+		written = converter_run(conv, texts[i], bytes,
+			(char *) arena->data + arena->used);
+		if (written < 0)
+			goto fail;
+		offsets[i] = arena->used - start;
+		arena->used += written + 1;
+	}
+
+	for (i = 0; i < count; i++)
+		out[i] = texts[i] != NULL
+			? (char *) arena->data + start + offsets[i] : NULL;
+	free(offsets);
+	return 0;
+
+fail:
+	free(offsets);
+	arena->used = start;
+	return -1;
+}
+#endif
+
 /***********************************************************************
  *
  * Function:    convert_ToPilotChar
@@ -64,12 +439,7 @@ convert_ToPilotChar(const char *charset, const char *text,
 		    int bytes, char **ptext)
 {
 #ifdef HAVE_ICONV
-	char*   pcharset;
-
-	if ((pcharset = getenv("PILOT_CHARSET")) == NULL)
-		pcharset = PILOT_CHARSET;
-	return convert_ToPilotChar_WithCharset(charset, text, bytes,
-	    ptext, pcharset);
+	return convert_string(pilot_charset(), charset, text, bytes, ptext);
 #else
 	return -1;
 #endif
@@ -104,29 +474,11 @@ convert_ToPilotChar_WithCharset(const char *charset, const char *text,
 		    int bytes, char **ptext, const char * pi_charset)
 {
 #ifdef HAVE_ICONV
-	char*	ob;
-	iconv_t cd;
-	size_t 	ibl, obl;
-
 	if(NULL==pi_charset){
 		pi_charset = PILOT_CHARSET;
 	}
 
-	cd = iconv_open(pi_charset, charset);
-	if (cd==(iconv_t)-1)
-		return -1;
-
-	ibl 	= bytes;
-	obl 	= bytes * 4 + 1;
-	*ptext 	= ob = malloc(obl);
-	
-	if (iconv(cd, &text, &ibl, &ob, &obl) == (size_t)-1)
-		return -1;
-	*ob = '\0';
-
-	iconv_close(cd);
-
-	return 0;
+	return convert_string(pi_charset, charset, text, bytes, ptext);
 #else
 	return -1;
 #endif
@@ -159,12 +511,7 @@ convert_FromPilotChar(const char *charset, const char *ptext,
 		      int bytes, char **text)
 {
 #ifdef HAVE_ICONV
-	char*   pcharset;
-
-	if ((pcharset = getenv("PILOT_CHARSET")) == NULL)
-		pcharset = PILOT_CHARSET;
-	return convert_FromPilotChar_WithCharset(charset, ptext, bytes,
-	    text, pcharset);
+	return convert_string(charset, pilot_charset(), ptext, bytes, text);
 #else
 	return -1;
 #endif
@@ -195,33 +542,90 @@ convert_FromPilotChar_WithCharset(const char *charset, const char *ptext,
 		      int bytes, char **text, const char * pi_charset)
 {
 #ifdef HAVE_ICONV
-	char*	ob;
-	iconv_t cd;
-	size_t 	ibl, obl;
-
 	if(NULL==pi_charset){
 		pi_charset = PILOT_CHARSET;
 	}
 
-	cd = iconv_open(charset, pi_charset);
-	if (cd==(iconv_t)-1)
-		return -1;
-
-	ibl 	= bytes;
-	obl 	= bytes * 4 + 1;
-	*text 	= ob = malloc(obl);
-	
-	if (iconv(cd, &ptext, &ibl, &ob, &obl) == (size_t)-1)
-		return -1;
-	*ob = '\0';
+	return convert_string(charset, pi_charset, ptext, bytes, text);
+#else
+	return -1;
+#endif
+}
 
-	iconv_close(cd);
+/***********************************************************************
+ *
+ * Function:    convert_ToPilotChar_Strings
+ *
+ * Summary:     Convert null-terminated strings in a supported desktop
+ *		text encoding to the Palm encoding, into one buffer
+ *
+ * Parameters:
+ *		charset		iconv-recognised source charset
+ *		count		number of strings
+ *		texts		strings in the desktop charset, NULL ones
+ *				are left NULL
+ *		ptexts (output)	on success, the converted strings, which
+ *				point in 'arena'
+ *		arena		buffer the converted strings are appended to
+ *		pi_charset	iconv-recognised pilot-charset identifier,
+ *				or NULL for the one convert_ToPilotChar()
+ *				uses
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+int
+convert_ToPilotChar_Strings(const char *charset, int count,
+		    char * const *texts, char **ptexts, pi_buffer_t *arena,
+		    const char *pi_charset)
+{
+#ifdef HAVE_ICONV
+	if (pi_charset == NULL)
+		pi_charset = pilot_charset();
+	return convert_strings(pi_charset, charset, count, texts, ptexts,
+	    arena);
+#else
+	return -1;
+#endif
+}
 
-	return 0;
+/***********************************************************************
+ *
+ * Function:    convert_FromPilotChar_Strings
+ *
+ * Summary:     Convert null-terminated strings in the Palm encoding to
+ *		a supported desktop text encoding, into one buffer
+ *
+ * Parameters:
+ *		charset		iconv-recognised destination charset
+ *		count		number of strings
+ *		ptexts		strings in the pilot's charset, NULL ones
+ *				are left NULL
+ *		texts (output)	on success, the converted strings, which
+ *				point in 'arena'
+ *		arena		buffer the converted strings are appended to
+ *		pi_charset	iconv-recognised pilot-charset identifier,
+ *				or NULL for the one convert_FromPilotChar()
+ *				uses
+ *
+ * Returns:     0 on success, -1 on failure
+ *
+ ***********************************************************************/
+int
+convert_FromPilotChar_Strings(const char *charset, int count,
+		    char * const *ptexts, char **texts, pi_buffer_t *arena,
+		    const char *pi_charset)
+{
+#ifdef HAVE_ICONV
+	if (pi_charset == NULL)
+		pi_charset = pilot_charset();
+	return convert_strings(charset, pi_charset, count, ptexts, texts,
+	    arena);
 #else
 	return -1;
 #endif
 }
+
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* Local Variables: */
 /* indent-tabs-mode: t */
@@ -551,6 +551,7 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 		category;
 	struct 	Address addr;
 	pi_buffer_t *buf;
+	pi_arena_t *arena;
 
 	int count = 0;
 	const char *progress = "   Writing Palm Address Book entries to file... ";
@@ -575,6 +576,13 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 	}
 
 	buf = pi_buffer_new (0xffff);
+	arena = pi_arena_new (0);
+	if (buf == NULL || arena == NULL) {
+		fprintf(stderr, "\n   ERROR: Out of memory.\n");
+		pi_arena_free (arena);
+		pi_buffer_free (buf);
+		return -1;
+	}
 	for (i = 0;
 	     (j =
 	      dlp_ReadRecordByIndex(sd, db, i, buf, 0,
@@ -584,7 +592,10 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 
 		if (attribute & dlpRecAttrDeleted)
 			continue;
-		unpack_Address(&addr, buf, address_v1);
+		/* the strings of the last record are reused */
+		pi_arena_reset(arena);
+		if (unpack_Address_arena(&addr, buf, address_v1, arena) < 0)
+			continue;
 
 		if (!human) {
 			write_record_CSV(out,aai,&addr,attribute,category);
@@ -599,6 +610,7 @@ int write_file(FILE *out, int sd, int db, struct AddressAppInfo *aai, int human)
 			fflush(stdout);
 		}
 	}
+	pi_arena_free (arena);
 	pi_buffer_free (buf);
 
 	if (!plu_quiet) {
@@ -100,6 +100,7 @@ int main(int argc, const char *argv[])
 	struct ToDoAppInfo tai;
 	pi_buffer_t *recbuf,
 	    *appblock;
+	pi_arena_t *arena;
 
 	poptContext pc;
 
@@ -227,6 +228,14 @@ int main(int argc, const char *argv[])
 	}
 
 	recbuf = pi_buffer_new (0xffff);
+	arena = pi_arena_new (0);
+	if (recbuf == NULL || arena == NULL) {
+		fprintf(stderr,"   ERROR: Out of memory.\n");
+		pi_arena_free (arena);
+		pi_buffer_free (recbuf);
+		dlp_CloseDB(sd, db);
+		goto error_close;
+	}
 
 	for (i = 0;; i++) {
 		int 	j,
@@ -246,7 +255,10 @@ int main(int argc, const char *argv[])
 		    || (attr & dlpRecAttrArchived))
 			continue;
 
-		unpack_Appointment(&a, recbuf, datebook_v1);
+		/* the strings of the last appointment are reused */
+		pi_arena_reset(arena);
+		if (unpack_Appointment_arena(&a, recbuf, datebook_v1, arena) < 0)
+			continue;
 
 		if (a.event) {
 			fprintf(ical, "set i [notice]\n");
@@ -365,11 +377,9 @@ int main(int argc, const char *argv[])
 		sprintf(id_buf, "%lx", id_);
 		fprintf(ical, "$i option PilotRecordId %s\n", id_buf);
 		fprintf(ical, "cal add $i\n");
-
-		free_Appointment(&a);
-
 	}
 
+	pi_arena_free (arena);
 	pi_buffer_free (recbuf);
 
 	fprintf(ical, "cal save [cal main]\n");
@@ -37,6 +37,7 @@
 #include "pi-socket.h"
 #include "pi-header.h"
 #include "pi-palmpix.h"
+#include "pi-export.h"
 
 #include "pi-userland.h"
 
@@ -48,110 +49,77 @@ const char *progname;
 
 /***********************************************************************
  *
- * Function:    PalmPixState_pi_file
+ * Function:    PalmPixState_records
  *
- * Summary:
- *
- * Parameters:  None
- *
- * Returns:     Nothing
+ * Summary:     Picture state reading from the records of a database,
+ *		copied in memory
  *
  ***********************************************************************/
-struct PalmPixState_pi_file
+struct PalmPixState_records
 {
 	struct PalmPixState state;
-	struct pi_file *f;
+	pi_export_records_t *records;
 };
 
 
 /***********************************************************************
  *
- * Function:    getrecord_pi_file
+ * Function:    getrecord_records
  *
- * Summary:
+ * Summary:     Look up a record of the database
  *
- * Parameters:  None
+ * Parameters:  state, record number, record data, record size
  *
- * Returns:     Nothing
+ * Returns:     0 on success, -1 if there is no such record
  *
  ***********************************************************************/
-static int getrecord_pi_file (struct PalmPixState *vstate, int recno,
+static int getrecord_records (struct PalmPixState *vstate, int recno,
 	void **buf, size_t *bufsize)
 {
 
-	struct PalmPixState_pi_file *state =
-		(struct PalmPixState_pi_file *) vstate;
+	struct PalmPixState_records *state =
+		(struct PalmPixState_records *) vstate;
 
-	return pi_file_read_record (state->f, recno, buf, bufsize, NULL,
-		NULL, NULL) < 0 ? -1 : 0;
+	return pi_export_records_get (state->records, recno, buf,
+		bufsize) < 0 ? -1 : 0;
 }
 
 
 /***********************************************************************
  *
- * Function:    PalmPixState_pi_socket
- *
- * Summary:
- *
- * Parameters:  None
+ * Function:    palmpix_picture
  *
- * Returns:     Nothing
+ * Summary:     One picture being converted by the export pool
  *
  ***********************************************************************/
-struct PalmPixState_pi_socket
+struct palmpix_picture
 {
-	struct PalmPixState state;
-	int 	sd,
-		db;
+	struct PalmPixState_records s;
+	struct PalmPixHeader header;
+	int	recno;
+	FILE	*f;
+	time_t	mtime;
+	char	fname[FILENAME_MAX];
 };
 
-
-/***********************************************************************
- *
- * Function:    getrecord_pi_socket
- *
- * Summary:
- *
- * Parameters:  None
- *
- * Returns:     Nothing
- *
- ***********************************************************************/
-static int getrecord_pi_socket (struct PalmPixState *vstate, int recno,
-	void **buf, size_t *bufsize)
-{
-
-	static char buffer[65536];
-    static pi_buffer_t fakebuf;
-
-	struct PalmPixState_pi_socket *state =
-		(struct PalmPixState_pi_socket *) vstate;
-
-	*buf = buffer;
-    fakebuf.data = buffer;
-    fakebuf.allocated = 0;
-    fakebuf.used = 0;
-
-	return dlp_ReadRecordByIndex (state->sd, state->db, recno, &fakebuf,
-		NULL, NULL, NULL) < 0 ? 1 : 0;
-}
+/* Pictures converted at the same time by write_all() */
+static int jobs = 4;
+static pi_export_t *pool;
 
 
 /***********************************************************************
  *
  * Function:    fmt_date
  *
- * Summary:
+ * Summary:     Format the date a picture was taken
  *
- * Parameters:  None
+ * Parameters:  header, buffer of 24 characters
  *
- * Returns:     Nothing
+ * Returns:     The buffer
  *
  ***********************************************************************/
-static const char *fmt_date (const struct PalmPixHeader *h)
+static const char *fmt_date (const struct PalmPixHeader *h, char *buf)
 {
-	static char buf[24];
-
 	sprintf (buf, "%d-%02d-%02d %02d:%02d:%02d", h->year, h->month,
 		h->day, h->hour, h->min, h->sec);
 
@@ -192,8 +160,10 @@ void init_for_ppm (struct PalmPixState *state)
 void write_ppm (FILE *f, const struct PalmPixState *state,
 	const struct PalmPixHeader *header)
 {
+	char date[24];
+
 	fprintf (f, "P6\n# %s (taken at %s)\n%d %d\n255\n",
-		state->pixname, fmt_date (header), header->w, header->h);
+		state->pixname, fmt_date (header, date), header->w, header->h);
 
 	fwrite (state->pixmap, header->w * header->h * 3, 1, f);
 }
@@ -233,7 +203,6 @@ void write_png( FILE *f, const struct PalmPixState *state,
 
 	if( setjmp( png_jmpbuf(png_ptr))) {
 		png_destroy_write_struct(&png_ptr, &info_ptr);
-		fclose(f);
 		return;
 	}
 
@@ -301,29 +270,106 @@ static int write_one (const struct PalmPixHeader *header,
 
 /***********************************************************************
  *
- * Function:    write_all
+ * Function:    convert_picture
  *
- * Summary:
+ * Summary:     Decode a picture and write it to its file, on a worker
+ *		of the export pool
  *
- * Parameters:  None
+ * Parameters:  palmpix_picture
+ *
+ * Returns:     0 on success, negative if the picture couldn't be
+ *		decoded
+ *
+ ***********************************************************************/
+static int convert_picture (void *job)
+{
+	struct palmpix_picture *pic = (struct palmpix_picture *) job;
+	struct PalmPixState *state = &pic->s.state;
+	const struct PalmPixHeader *header = &pic->header;
+	struct	utimbuf timep;
+
+	init_for_ppm (state);
+	if (!unpack_PalmPix (state, header, pic->recno, pixPixmap)) {
+		fclose (pic->f);
+		unlink (pic->fname);
+		return PI_ERR_FILE_INVALID;
+	}
+
+#ifdef HAVE_PNG
+	if( state->output_type == PALMPIX_OUT_PPM )
+		write_ppm(pic->f, state, header);
+
+	else if( state->output_type == PALMPIX_OUT_PNG )
+		write_png(pic->f, state, header);
+#else
+	write_ppm (pic->f, state, header);
+#endif
+	fclose (pic->f);
+	free_PalmPix_data (state);
+
+	/* Keep file date the same date as the photo */
+	timep.actime = timep.modtime = pic->mtime;
+	utime (pic->fname, &timep);
+
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    picture_done
+ *
+ * Summary:     Report a picture the export pool is done with, and free
+ *		it
+ *
+ * Parameters:  palmpix_picture, result of convert_picture()
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
+static void picture_done (void *job, int result)
+{
+	struct palmpix_picture *pic = (struct palmpix_picture *) job;
+
+	if (result < 0)
+		fprintf (stderr, "%s: can't decode %s\n", progname,
+			pic->fname);
+	free (pic);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_all
+ *
+ * Summary:     Name the file of a picture, and queue the picture on
+ *		the export pool
+ *
+ * Parameters:  header, state, record number of the header, unused
+ *
+ * Returns:     Last record of the picture
+ *
+ ***********************************************************************/
 static int write_all (const struct PalmPixHeader *header,
 	struct PalmPixState *state, int recno, const char *ignored)
 {
-	char fname[FILENAME_MAX], ext[10];
+	struct palmpix_picture *pic;
+	struct tm timeptr;
+	char ext[10];
 	FILE *f;
 
-	init_for_ppm (state);
-	if (!unpack_PalmPix (state, header, recno, pixName | pixPixmap)) {
+	if (!unpack_PalmPix (state, header, recno, pixName)) {
 		/* bail */
 		return recno;
 	}
 
+	pic = (struct palmpix_picture *) malloc (sizeof(*pic));
+	if (pic == NULL) {
+		fprintf (stderr, "%s: out of memory\n", progname);
+		return state->highest_recno;
+	}
 
-	sprintf( fname, "%s", state->pixname );
+	sprintf( pic->fname, "%s", state->pixname );
 
 	if( state->output_type == PALMPIX_OUT_PPM )
 		sprintf( ext, "_pp.ppm" );
@@ -331,47 +377,46 @@ static int write_all (const struct PalmPixHeader *header,
 	else if( state->output_type == PALMPIX_OUT_PNG )
 		sprintf( ext, "_pp.png" );
 
-	if (plu_protect_files( fname, ext, sizeof(fname) ) < 1) {
+	if (plu_protect_files( pic->fname, ext, sizeof(pic->fname) ) < 1) {
+		free (pic);
 		return recno;
 	}
 
-	printf ("Generating %s...\n", fname);
+	printf ("Generating %s...\n", pic->fname);
 
-	f = fopen (fname, "wb");
-	if (f) {
-                struct  utimbuf timep   ;
-                struct  tm      timeptr ;
-
-#ifdef HAVE_PNG
-		if( state->output_type == PALMPIX_OUT_PPM )
-			write_ppm(f, state, header);
-
-		else if( state->output_type == PALMPIX_OUT_PNG )
-			write_png(f, state, header);
-#else
-			write_ppm (f, state, header);
-#endif
-			fclose (f);
-
-                        /* Keep file date the same date as the photo */
-                        timeptr.tm_year = header->year - 1900;
-                        timeptr.tm_mon  = header->month -1;
-                        timeptr.tm_mday = header->day;
-                        timeptr.tm_hour = header->hour;
-                        timeptr.tm_min  = header->min;
-                        timeptr.tm_sec  = header->sec;
-                        timep.actime    = timep.modtime = mktime(&timeptr);
-
-                        utime (fname,&timep);
-	} else {
+	/* the file is created here, so that the next picture with the same
+	   name gets another one */
+	f = fopen (pic->fname, "wb");
+	if (f == NULL) {
 		fprintf (stderr, "%s: can't write to %s\n",
-			progname, fname);
+			progname, pic->fname);
+		free (pic);
+		return state->highest_recno;
 	}
 
-		free_PalmPix_data (state);
-		recno = state->highest_recno;
+	pic->s = *(struct PalmPixState_records *) state;
+	pic->header = *header;
+	pic->recno = recno;
+	pic->f = f;
+
+	memset (&timeptr, 0, sizeof(timeptr));
+	timeptr.tm_year = header->year - 1900;
+	timeptr.tm_mon  = header->month -1;
+	timeptr.tm_mday = header->day;
+	timeptr.tm_hour = header->hour;
+	timeptr.tm_min  = header->min;
+	timeptr.tm_sec  = header->sec;
+	timeptr.tm_isdst = -1;
+	pic->mtime = mktime (&timeptr);
+
+	if (pi_export_queue (pool, convert_picture, picture_done, pic) < 0) {
+		fprintf (stderr, "%s: out of memory\n", progname);
+		fclose (f);
+		unlink (pic->fname);
+		free (pic);
+	}
 
-	return recno;
+	return state->highest_recno;
 }
 
 
@@ -389,10 +434,12 @@ static int write_all (const struct PalmPixHeader *header,
 static int list (const struct PalmPixHeader *h, struct PalmPixState *state,
 	int recno, const char *ignored)
 {
+	char date[24];
+
 	if (unpack_PalmPix (state, h, recno, pixName) != 0) {
 
 		printf ("%d x %d\t%d\t%s\t%s\n",
-			h->w, h->h, h->num, fmt_date (h), state->pixname);
+			h->w, h->h, h->num, fmt_date (h, date), state->pixname);
 		recno = state->highest_recno;
 	}
 	return recno;
@@ -403,29 +450,40 @@ static int list (const struct PalmPixHeader *h, struct PalmPixState *state,
  *
  * Function:    read_db
  *
- * Summary:
+ * Summary:     Run an action on every picture of a database, and wait
+ *		for the pictures it queued on the export pool
  *
- * Parameters:  None
+ * Parameters:  state reading the database, action, action argument
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
-void read_db (struct PalmPixState *state, int n, int (*action)
+void read_db (struct PalmPixState_records *s, int (*action)
 	(const struct PalmPixHeader *, struct PalmPixState *,
 	int, const char *), const char *action_arg)
 {
-	int i;
+	int i,
+	    n = pi_export_records_count (s->records);
+
+	pool = pi_export_new (action == write_all ? jobs : 1);
+	if (pool == NULL) {
+		fprintf (stderr, "%s: out of memory\n", progname);
+		return;
+	}
 
 	for (i = 0; i < n; i++) {
 		void *buffer;
 		size_t bufsize;
 		struct PalmPixHeader header;
 
-		if (state->getrecord (state, i, &buffer, &bufsize) == 0
+		if (s->state.getrecord (&s->state, i, &buffer, &bufsize) == 0
 			&& unpack_PalmPixHeader (&header, buffer, bufsize) != 0)
 
-		i = action (&header, state, i, action_arg);
+		i = action (&header, &s->state, i, action_arg);
 	}
+
+	pi_export_finish (pool);
+	pool = NULL;
 }
 
 static int fail (const char *func) {
@@ -462,6 +520,7 @@ int main (int argc, const char **argv) {
 		{"bias", 'b', POPT_ARG_INT,    &bias,      0 , "lighten or darken the image (0..49 darken, 51..100 lighten)", "bias"},
 		{"list", 'l', POPT_ARG_NONE,   NULL,      'l', "List picture information instead of converting", NULL},
 		{"name", 'n', POPT_ARG_STRING, &pixname,  'n', "Convert only <name>, and output to STDOUT as type", "name"},
+		{"jobs", 'j', POPT_ARG_INT,    &jobs,      0 , "Number of pictures to convert at the same time (default 4)", "jobs"},
 		POPT_TABLEEND
 	};
 
@@ -512,6 +571,8 @@ int main (int argc, const char **argv) {
 		fprintf( stderr, "   ERROR: Bad bias valud %d, defaulting to 50.\n", bias );
 		bias=50;
 	}
+	if (jobs < 1)
+		jobs = 1;
 
 	if(poptPeekArg(pc) != NULL) {
 		int i = 0;
@@ -527,17 +588,25 @@ int main (int argc, const char **argv) {
 					printf ("%s:\n", file_arg);
 
 				pi_file_get_info (f, &info);
-                if (info.flags & dlpDBFlagResource) {
+				if (!(info.flags & dlpDBFlagResource)) {
 
-				struct PalmPixState_pi_file s;
-				int n = 0;
+				struct PalmPixState_records s;
 
+				memset (&s, 0, sizeof(s));
 				s.state.output_type = output_type;
-
-				pi_file_get_entries (f, &n);
-				s.state.getrecord = getrecord_pi_file;
-				s.f = f;
-				read_db (&s.state, n, action, pixname);
+				s.state.bias = bias;
+				s.state.flags = flags;
+				s.state.getrecord = getrecord_records;
+				s.records = pi_export_records_new ();
+
+				if (s.records != NULL
+				    && pi_export_records_from_file (s.records, f) >= 0)
+					read_db (&s, action, pixname);
+				else
+					fprintf (stderr,
+						"   ERROR: can't read %s\n",
+						file_arg);
+				pi_export_records_free (s.records);
 				} else {
 				fprintf (stderr,
 					"   ERROR: %s is not a valid record database\n",
@@ -564,18 +633,25 @@ int main (int argc, const char **argv) {
 
 		if (dlp_OpenDB (sd, 0, dlpOpenRead, PalmPix_DB, &db) >= 0) {
 
-			struct PalmPixState_pi_socket s;
-			int n = 0;
+			struct PalmPixState_records s;
 
+			memset (&s, 0, sizeof(s));
 			s.state.output_type = output_type;
-		    s.state.bias = bias;
-		    s.state.flags = flags;
-
-			dlp_ReadOpenDBInfo (sd, db, &n);
-			s.state.getrecord = getrecord_pi_socket;
-			s.sd = sd;
-			s.db = db;
-			read_db (&s.state, n, action, pixname);
+			s.state.bias = bias;
+			s.state.flags = flags;
+			s.state.getrecord = getrecord_records;
+			s.records = pi_export_records_new ();
+
+			/* the whole database is read first, a few records in
+			   flight at a time, then converted from memory */
+			if (s.records != NULL
+			    && pi_export_records_from_dlp (s.records, sd, db) >= 0)
+				read_db (&s, action, pixname);
+			else
+				fprintf (stderr,
+					"   ERROR: can't read database %s\n",
+					PalmPix_DB);
+			pi_export_records_free (s.records);
 			dlp_CloseDB (sd, db);
 
 			dlp_AddSyncLogEntry (sd,
@@ -37,6 +37,7 @@
 #include "pi-file.h"
 #include "pi-header.h"
 #include "pi-userland.h"
+#include "pi-export.h"
 
 #ifdef HAVE_PNG
 # include "png.h"
@@ -47,6 +48,9 @@
 #define OUT_PPM	 1
 #define OUT_PNG	 2
 
+/* Largest screenshot record; bigger screens span several records */
+#define SS_RECORD_SIZE	61440
+
 struct ss_state {
 	int w,
 	  h,
@@ -54,6 +58,21 @@ struct ss_state {
 	unsigned char *pix_map;
 };
 
+/* One screenshot being converted by the export pool */
+struct ss_picture {
+	struct ss_state state;
+	unsigned char *pixels,
+	  clut[1024];		/* 4 bytes per entry: index, red, green, blue */
+	int mask,
+	  type;
+	FILE *f;
+	char fname[FILENAME_MAX];
+};
+
+/* Pictures converted at the same time */
+static int jobs = 4;
+static pi_export_t *pool;
+
 
 
 #define max(a,b) (( a > b ) ? a : b )
@@ -71,13 +90,12 @@ struct ss_state {
  *
  ***********************************************************************/
 #ifdef HAVE_PNG
-void write_png ( char *fname, struct ss_state *state )
+void write_png ( FILE *f, struct ss_state *state )
 {
-	unsigned char *gray_buf;
+	unsigned char *gray_buf = NULL;
 	int i, j;
 	png_structp png_ptr;
 	png_infop info_ptr;
-	FILE *f;
 
 	if( state->depth < 8 )
 		gray_buf = malloc( state->w );
@@ -87,24 +105,26 @@ void write_png ( char *fname, struct ss_state *state )
 		NULL, NULL);
 
 	if (!png_ptr)
+	{
+		free( gray_buf );
 		return;
+	}
 
 	info_ptr = png_create_info_struct (png_ptr);
 	if (!info_ptr)
 	{
 		png_destroy_write_struct (&png_ptr, (png_infopp) NULL);
+		free( gray_buf );
 		return;
 	}
 
 	if (setjmp (png_jmpbuf (png_ptr)))
 	{
 		png_destroy_write_struct (&png_ptr, &info_ptr);
-		fclose (f);
+		free( gray_buf );
 		return;
 	}
 
-	f = fopen (fname, "wb");
-
 	png_init_io (png_ptr, f);
 
 	if( state->depth < 8 )
@@ -142,20 +162,12 @@ void write_png ( char *fname, struct ss_state *state )
 	png_write_end (png_ptr, info_ptr);
 	png_destroy_write_struct (&png_ptr, &info_ptr);
 
-	fclose( f );
-
-	if( state->depth < 8 )
-		free( gray_buf );
+	free( gray_buf );
 }
 #endif
 
-void write_ppm ( char *fname, struct ss_state *state)
+void write_ppm ( FILE *f, char *fname, struct ss_state *state)
 {
-	int i;
-	FILE *f;
-
-	f = fopen (fname, "wb");
-
 	fprintf (f, "P6\n# ");
 
 	fprintf (f, "%s\n", fname );
@@ -164,211 +176,287 @@ void write_ppm ( char *fname, struct ss_state *state)
 
 	fprintf (f, "255\n" );
 
-	for( i = 0; i < 3*state->h*state->w; i += 3 )
-		fwrite( &state->pix_map[i], 3, 1, f);
+	fwrite( state->pix_map, 3, state->h*state->w, f);
+}
+
+
+/***********************************************************************
+ *
+ * Function:	 ConvertPicture
+ *
+ * Summary:	Convert a screenshot to RGB and write it to its file, on
+ *		a worker of the export pool
+ *
+ * Parameters:	ss_picture
+ *
+ * Returns:	0 on success, negative on failure
+ *
+ ***********************************************************************/
+static int ConvertPicture (void *job)
+{
+	struct ss_picture *pic = (struct ss_picture *) job;
+	struct ss_state *state = &pic->state;
+	unsigned char *pixels = pic->pixels;
+	int i, j, k, val, mask = pic->mask;
+
+	state->pix_map = malloc( state->h * state->w * 3 );
+	if( !state->pix_map )
+	{
+		fclose( pic->f );
+		unlink( pic->fname );
+		return PI_ERR_GENERIC_MEMORY;
+	}
+
+	switch( state->depth )
+	{
+		case 1:
+		case 2:
+		case 4:
+			for( i = 0; i < state->h*state->w/(8/state->depth); i++)
+			{
+				for( j=(8/state->depth-1), k=0; j >= 0; j--, k++ )
+				{
+					/* get right bits */
+					val = ((pixels[i] >> (j * state->depth)) & mask);
+					/* invert */
+					val = mask - val;
+					/* stretch */
+					val *= (255/mask);
+
+					state->pix_map[3*(i*(8/state->depth)+k)] = val;
+					state->pix_map[3*(i*(8/state->depth)+k)+1] = val;
+					state->pix_map[3*(i*(8/state->depth)+k)+2] = val;
+				}
+ 			}
+	 	break;
+
+		case 8:
+			for( i = 0; i < state->h*state->w; i++)
+			{
+				state->pix_map[3*i] = pic->clut[4*pixels[i]+1];
+				state->pix_map[3*i+1] = pic->clut[4*pixels[i]+2];
+				state->pix_map[3*i+2] = pic->clut[4*pixels[i]+3];
+			}
+		break;
+
+		case 16:
+			for( i = 0; i < state->h*state->w; i++)
+			{
+				state->pix_map[i*3] = pixels[i*2] & 0xF8;
+				state->pix_map[i*3+1] = ((pixels[i*2] & 0x07 ) << 5)
+				+ (( pixels[i*2+1] & 0xE0 ) >> 3 );
+				state->pix_map[i*3+2] = ( pixels[i*2+1] & 0x1F ) << 3;
+			}
+			break;
+
+		default:
+			free( state->pix_map );
+			fclose( pic->f );
+			unlink( pic->fname );
+			return PI_ERR_FILE_INVALID;
+	}
+
+	if( pic->type == OUT_PPM )
+		write_ppm( pic->f, pic->fname, state );
+	#ifdef HAVE_PNG
+	else
+		write_png( pic->f, state );
+	#endif
+
+	fclose( pic->f );
+	free( state->pix_map );
 
-	fclose( f );
+	return 0;
 }
 
+/***********************************************************************
+ *
+ * Function:	 PictureDone
+ *
+ * Summary:	Report a screenshot the export pool is done with, and
+ *		free it
+ *
+ * Parameters:	ss_picture, result of ConvertPicture()
+ *
+ * Returns:	Nothing
+ *
+ ***********************************************************************/
+static void PictureDone (void *job, int result)
+{
+	struct ss_picture *pic = (struct ss_picture *) job;
+
+	if( result == PI_ERR_FILE_INVALID )
+		fprintf( stderr, "I'm out of my depth :)\n" );
+	else if( result < 0 )
+		fprintf( stderr, "Memory Allocation failed\n" );
+
+	free( pic->pixels );
+	free( pic );
+}
 
 /***********************************************************************
  *
  * Function:	 WritePictures
  *
- * Summary:	FIXME
+ * Summary:	Name the file of each screenshot in a database, and queue
+ *		a copy of the screenshot on the export pool
  *
- * Parameters:
+ * Parameters:	records - the records of the screenshot database
  *
- * Returns:
+ * Returns:	Number of screenshots found
  *
  ***********************************************************************/
-void WritePictures (int sd, int db, int type )
+int WritePictures (pi_export_records_t *records, int type )
 {
-	char fname[FILENAME_MAX];
+	static int imgNum = 0;
 	char extension[8];
-	int i, len, idx = 0, recs, imgNum = 0;
-//	unsigned char inBuf[61440], *pixelBuf;
-	pi_buffer_t *inBuf, *pixelBuf;
-	unsigned long clut[256], magic;
-	int attr, category, val, mask, j, k;
-	struct ss_state state;
+	int i, idx = 0, count, recs, found = 0;
+	size_t len, size;
+	unsigned char *data;
+	unsigned long magic;
+	struct ss_picture *pic;
 
 	if( type == OUT_PPM )
 		sprintf (extension, ".ppm");
 	else if( type == OUT_PNG )
 		sprintf (extension, ".png");
 	else
-		return;
+		return 0;
 
-	inBuf = pi_buffer_new (61440);
+	count = pi_export_records_count (records);
+	while( idx < count )
+	{
+		pi_export_records_get (records, idx, (void **)&data, &len);
 
-	if (sd)
-		while( 1 )
+		if( len == 0 )
 		{
-			len =
-			 dlp_ReadRecordByIndex (sd, db, idx, inBuf, 0, &attr, &category);
+			/* EOF */
+			break;
+		}
 
-			if( len <= 0 )
-			{
-				/* EOF */
-				break;
-			}
+		pic = calloc( 1, sizeof( struct ss_picture ));
+		if( !pic )
+		{
+			fprintf( stderr, "Memory Allocation failed\n" );
+			return found;
+		}
+		pic->type = type;
+
+		idx++;
+		pic->state.w = ( data[4] << 8 )+ data[5];
+		pic->state.h = ( data[6] << 8 ) + data[7];
+		recs = data[9];
+		pic->state.depth = data[8];
+		/* the magic number is stored little-endian */
+		magic = (unsigned long) data[0] | (unsigned long) data[1] << 8
+			| (unsigned long) data[2] << 16
+			| (unsigned long) data[3] << 24;
+
+		if(  magic != 0xBECEDEFE && magic != 0xDEDEFEFE )
+		{
+			 /* no magic must version 1 db */
 
-			idx++;
-			state.w = ( inBuf->data[4] << 8 )+ inBuf->data[5];
-			state.h = ( inBuf->data[6] << 8 ) + inBuf->data[7];
-			recs = inBuf->data[9];
-			state.depth = inBuf->data[8];
-			magic = ((unsigned long *)inBuf->data)[0];
+			 pic->state.w = 160;
+			 pic->state.h = 160;
+			 recs = 1;
 
-			if(  magic != 0xBECEDEFE && magic != 0xDEDEFEFE )
+			switch( len )
 			{
-				 /* no magic must version 1 db */
-	//			 fprintf( stderr, "No Magic !\n" );
+			case 3200:
+				pic->state.depth = 1;
+				pic->mask = 1;
+				break;
 
-				 state.w = 160;
-				 state.h = 160;
-				 recs = 1;
+			case 6400:
+				pic->state.depth = 2;
+				pic->mask = 3;
+				break;
 
-				switch( len )
-				{
-				case 3200:
-					state.depth = 1;
-					mask = 1;
-					break;
-
-				case 6400:
-					state.depth = 2;
-					mask = 3;
-					break;
-
-				case 12800:
-					state.depth = 4;
-					mask = 0x0f;
-					break;
-
-				case 26624:
-					state.depth = 8;
-					break;
-
-				case 51200:
-					state.depth = 16;
-					break;
-
-				default:
-					/* unknown record */
-					/* get next */
-					fprintf( stderr, "Unknown record" );
-					continue;
-				}
-			}
+			case 12800:
+				pic->state.depth = 4;
+				pic->mask = 0x0f;
+				break;
 
-			pixelBuf
-			= pi_buffer_new (state.h * state.w * state.depth / 8 + 10 + 1024);
+			case 26624:
+				pic->state.depth = 8;
+				break;
 
-	//		pixelBuf = malloc( state.h * state.w * state.depth / 8 + 10 + 1024 );
-			state.pix_map = malloc( state.h * state.w * 3 );
+			case 51200:
+				pic->state.depth = 16;
+				break;
 
-			if( !pixelBuf || !state.pix_map )
-			{
-				fprintf( stderr, "Memory Allocation failed\n" );
-				return;
+			default:
+				/* unknown record */
+				/* get next */
+				fprintf( stderr, "Unknown record" );
+				free( pic );
+				continue;
 			}
+		}
 
-			if( magic == 0xBECEDEFE || magic == 0xDEDEFEFE )
-				memcpy( pixelBuf->data, &inBuf->data[10], len - 10 );
-			else
-				memcpy( pixelBuf->data, inBuf->data, len );
+		size = pic->state.h * pic->state.w * pic->state.depth / 8 + 10 + 1024;
+		pic->pixels = calloc( 1, size );
 
-			for( i=1; i< recs; i++ )
-			{
-				len =
-				dlp_ReadRecordByIndex (sd, db, idx, inBuf, 0, &attr, &category);
-				memcpy( &pixelBuf->data[i*61440-10], inBuf->data, len );
-				idx++;
-			}
+		if( !pic->pixels )
+		{
+			fprintf( stderr, "Memory Allocation failed\n" );
+			free( pic );
+			return found;
+		}
 
-			sprintf (fname, "ScreenShot%d", ++imgNum );
+		if( magic == 0xBECEDEFE || magic == 0xDEDEFEFE )
+			memcpy( pic->pixels, &data[10], min( len - 10, size ));
+		else
+			memcpy( pic->pixels, data, min( len, size ));
 
-			if (plu_protect_files (fname, extension, sizeof(fname)) < 1) {
-				goto cleanup;
-			}
+		for( i=1; i< recs && idx < count; i++ )
+		{
+			size_t offset = i*SS_RECORD_SIZE-10;
 
-			printf ("Generating %s...\n", fname);
-			fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
-				, state.h, state.w, recs, state.depth );
+			pi_export_records_get (records, idx, (void **)&data, &len);
+			if( offset < size )
+				memcpy( &pic->pixels[offset], data, min( len, size - offset ));
+			idx++;
+		}
 
-			if( state.depth == 8 )
-			memcpy( clut, &inBuf->data[len-1024], 1024 );
+		found++;
+		sprintf (pic->fname, "ScreenShot%d", ++imgNum );
 
-			switch( state.depth )
-			{
-				case 1:
-				case 2:
-				case 4:
-					for( i = 0; i < state.h*state.w/(8/state.depth); i++)
-					{
-						for( j=(8/state.depth-1), k=0; j >= 0; j--, k++ )
-						{
-							/* get right bits */
-							val = ((pixelBuf->data[i] >> (j * state.depth)) & mask);
-							/* invert */
-							val = mask - val;
-							/* stretch */
-							val *= (255/mask);
-
-							state.pix_map[3*(i*(8/state.depth)+k)] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+1] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+2] = val;
-						}
-		 			}
-			 	break;
-
-				case 8:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[3*i] =
-						*(1 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+1] =
-						*(2 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+2] =
-						*(3 + (char *)&clut[pixelBuf->data[i]]);
-					}
-				break;
+		if (plu_protect_files (pic->fname, extension, sizeof(pic->fname)) < 1) {
+			free( pic->pixels );
+			free( pic );
+			continue;
+		}
 
-				case 16:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[i*3] = pixelBuf->data[i*2] & 0xF8;
-						state.pix_map[i*3+1] = ((pixelBuf->data[i*2] & 0x07 ) << 5)
-						+ (( pixelBuf->data[i*2+1] & 0xE0 ) >> 3 );
-						state.pix_map[i*3+2] = ( pixelBuf->data[i*2+1] & 0x1F ) << 3;
-					}
-					break;
-
-				default:
-					fprintf( stderr, "I'm out of my depth :)\n" );
-				break;
-			}
+		printf ("Generating %s...\n", pic->fname);
+		fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
+			, pic->state.h, pic->state.w, recs, pic->state.depth );
 
-			if( type == OUT_PPM )
-				write_ppm( fname, &state );
-			#ifdef HAVE_PNG
-			else
-				write_png( fname, &state );
-			#endif
+		if( pic->state.depth == 8 && len >= 1024 )
+			memcpy( pic->clut, &data[len-1024], 1024 );
 
-cleanup:
-			pi_buffer_free (pixelBuf);
-			//	  free( pixelBuf );
-			free( state.pix_map );
+		/* the file is created here, so that the next screenshot
+		   gets another name */
+		pic->f = fopen (pic->fname, "wb");
+		if( !pic->f )
+		{
+			fprintf( stderr, "   ERROR: can't write to %s\n", pic->fname );
+			free( pic->pixels );
+			free( pic );
+			continue;
+		}
 
-			//	  fclose (f);
+		if( pi_export_queue( pool, ConvertPicture, PictureDone, pic ) < 0 )
+		{
+			fprintf( stderr, "Memory Allocation failed\n" );
+			fclose( pic->f );
+			unlink( pic->fname );
+			free( pic->pixels );
+			free( pic );
 		}
-	else
-		return;
+	}
 
-	pi_buffer_free (inBuf);
+	return found;
 }
 
 int main (int argc, const char *argv[])
@@ -380,20 +468,24 @@ int main (int argc, const char *argv[])
 	  type = OUT_PPM;
 
 	const char
-                *pformat;
+                *pformat = "ppm";
 
 	struct PilotUser User;
+	pi_export_records_t *records;
 
 	poptContext po;
 
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
 		{"format", 	'f', POPT_ARG_STRING, &pformat, 0, "Specify picture output type (ppm or png)"},
+		{"jobs", 	'j', POPT_ARG_INT, &jobs, 0, "Number of pictures to convert at the same time (default 4)", "jobs"},
 		POPT_TABLEEND
 	};
 
 	po = poptGetContext("pilot-read-screenshot", argc, argv, options, 0);
-	poptSetOtherOptionHelp(po,"\n\n");
+	poptSetOtherOptionHelp(po,"[file] ...\n\n"
+		"   Convert the screenshots in the files given, or found via connecting\n"
+		"   to a Palm handheld if no files are given.\n\n");
 
 	if (argc<2) {
 		poptPrintUsage(po,stderr,0);
@@ -407,6 +499,8 @@ int main (int argc, const char *argv[])
 	if (c<-1) {
 		plu_badoption(po,c);
 	}
+	if (jobs < 1)
+		jobs = 1;
 
 	if (!strncmp ("png", pformat, 3))
 	{
@@ -426,6 +520,47 @@ int main (int argc, const char *argv[])
 		type = OUT_PPM;
 	}
 
+	pool = pi_export_new (jobs);
+	if (pool == NULL)
+	{
+		fprintf (stderr, "   ERROR: out of memory\n");
+		return -1;
+	}
+
+	if (poptPeekArg (po) != NULL)
+	{
+		const char *file_arg;
+
+		while ((file_arg = poptGetArg (po)) != NULL)
+		{
+			pi_file_t *pf = pi_file_open (file_arg);
+
+			if (pf == NULL)
+			{
+				fprintf (stderr, "   ERROR: can't open %s\n", file_arg);
+				continue;
+			}
+
+			records = pi_export_records_new ();
+			if (records != NULL
+			    && pi_export_records_from_file (records, pf) >= 0)
+				dbcount += WritePictures (records, type );
+			else
+				fprintf (stderr, "   ERROR: can't read %s\n", file_arg);
+
+			pi_export_records_free (records);
+			pi_file_close (pf);
+		}
+
+		pi_export_finish (pool);
+
+		if (!plu_quiet) {
+			printf ("\nList complete. %d files found.\n", dbcount);
+		}
+
+		return 0;
+	}
+
 	sd = plu_connect ();
 
 	if (sd < 0)
@@ -441,7 +576,15 @@ int main (int argc, const char *argv[])
 		goto error_close;
 	}
 
-	WritePictures (sd, db, type );
+	/* the records are read here, a few in flight at a time, and the
+	   screenshots are converted from memory */
+	records = pi_export_records_new ();
+	if (records == NULL || pi_export_records_from_dlp (records, sd, db) < 0)
+	{
+		fprintf (stderr,"   ERROR: Unable to read Screen Shot database on Palm.\n");
+		pi_export_records_free (records);
+		records = NULL;
+	}
 
 	if (sd)
 	{
@@ -458,6 +601,11 @@ int main (int argc, const char *argv[])
 		pi_close (sd);
 	}
 
+	if (records != NULL)
+		dbcount = WritePictures (records, type );
+	pi_export_records_free (records);
+	pi_export_finish (pool);
+
 	if (!plu_quiet) {
 		printf ("\nList complete. %d files found.\n", dbcount);
 	}
@@ -468,6 +616,7 @@ error_close:
 	pi_close (sd);
 
 error:
+	pi_export_finish (pool);
 	return -1;
 }
 
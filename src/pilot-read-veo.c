@@ -38,6 +38,7 @@
 #include "pi-file.h"
 #include "pi-header.h"
 #include "pi-userland.h"
+#include "pi-export.h"
 
 #ifdef HAVE_PNG
 # include "png.h"
@@ -48,10 +49,33 @@
 #define VEO_COLOUR_CORRECT 0x01
 #define VEO_BIAS           0x12
 
-uint8_t redLUT[256], greenLUT[256], blueLUT[256];
+/* The compressed record can be upto twice as large as the
+ * uncompressed record ??? */
+#define VEO_RECORD_MAX     5120
+
+/***********************************************************************
+ *
+ * Function:    veo_picture
+ *
+ * Summary:     One picture being converted by the export pool
+ *
+ ***********************************************************************/
+struct veo_picture {
+   struct Veo v;
+   pi_export_records_t *records;
+   uint8_t redLUT[256], greenLUT[256], blueLUT[256];
+   long flags;
+   int type;
+   FILE *f;
+   char fname[FILENAME_MAX];
+};
 
 double bias_factor = 0.50;
 
+/* Pictures converted at the same time */
+static int jobs = 4;
+static pi_export_t *pool;
+
 
 /***********************************************************************
  *
@@ -59,15 +83,14 @@ double bias_factor = 0.50;
  *
  * Summary:     Format the output date on the images
  *
- * Parameters:
+ * Parameters:  v - veo record
+ *              buf - buffer of 24 characters
  *
- * Returns:
+ * Returns:     the buffer
  *
  ***********************************************************************/
-static const char *fmt_date (struct Veo *v)
+static const char *fmt_date (struct Veo *v, char *buf)
 {
-   static char buf[24];
-
    sprintf (buf, "%d-%02d-%02d", v->year, v->month, v->day);
    return buf;
 
@@ -388,41 +411,37 @@ int Decode (unsigned char *inP, unsigned char *outP, short w)
  *
  * Function:	GetPicData
  *
- * Summary:     Requests one record of bayer data from the palm
+ * Summary:     Looks up one record of bayer data in the picture
  *              and then decodes it.
  *
- * Parameters:  r - the row we are looking for
- *              v - veo record
+ * Parameters:  pic - the picture
+ *              r - the row we are looking for
  *              row - the bayer data containg our row
  *
  * Returns:     the size of the encoded record
+ *              -1 if there is no such record
  *
  ***********************************************************************/
 static int
-  GetPicData (uint32_t flags, int r, struct Veo *v, unsigned char *row)
+  GetPicData (struct veo_picture *pic, int r, unsigned char *row)
 {
-   int attr, category, len;
-   pi_buffer_t *tmpRow;
-
-   if (!v->sd)
-	 return (-1);
+   unsigned char tmpRow[VEO_RECORD_MAX + 2];
+   void *data;
+   size_t len;
 
    /* Each record contains four rows of bayer data */
-   /* The compressed record can be upto twice as large as the
-    * uncompressed record ??? */
-   tmpRow = pi_buffer_new (5120);
-
-   len = dlp_ReadRecordByIndex (v->sd, v->db, 1 + r / 4, tmpRow, 0,
-								&attr, &category);
-
-   if (len < 0)
-	 return 0;
+   if (pi_export_records_get (pic->records, 1 + r / 4, &data, &len) < 0)
+	 return (-1);
 
-   Decode (tmpRow->data, row, v->width);
+   /* Decode() looks a couple of bytes past the end of the record */
+   if (len > VEO_RECORD_MAX)
+	 len = VEO_RECORD_MAX;
+   memcpy (tmpRow, data, len);
+   memset (tmpRow + len, 0, sizeof (tmpRow) - len);
 
-   pi_buffer_free(tmpRow);
+   Decode (tmpRow, row, pic->v.width);
 
-   return (len);
+   return ((int) len);
 }
 
 #define max(a,b) (( a > b ) ? a : b )
@@ -457,8 +476,10 @@ static void Bias( double bias, int width, int height, uint8_t *data )
      }
 }
 
-int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, long flags )
+int ColourCorrect (struct veo_picture *pic)
 {
+	struct Veo *v = &pic->v;
+	uint8_t *red = pic->redLUT, *green = pic->greenLUT, *blue = pic->blueLUT;
 	uint8_t *tmpRow;
 	uint8_t gMin, gMax, rMin, rMax, bMin, bMax;
 	float gInc, rInc, bInc, gCur, rCur, bCur;
@@ -479,7 +500,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 
 	tmpRow = malloc( 2560 );
 
-	GetPicData( 0, 0, v, tmpRow );
+	GetPicData( pic, 0, tmpRow );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -519,7 +540,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 		}
 	}
 
-	GetPicData( 0, height/2, v, tmpRow );
+	GetPicData( pic, height/2, tmpRow );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -558,7 +579,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 		}
 	}
 
-	GetPicData( 0, height-1, v, tmpRow );
+	GetPicData( pic, height-1, tmpRow );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -663,15 +684,17 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
  * Summary:     It requests some decoded bayer pattern data from the palm
  *              and then interpolates one RGB row from that data.
  *
- * Parameters:  r - the row to be interpolated
- *              v - veo record
+ * Parameters:  pic - the picture
+ *              r - the row to be interpolated
  *              row - the returned RGB data
  * Returns:     1 success
  *              -1 failure
  *
  ***********************************************************************/
-int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
+int Gen24bitRow (struct veo_picture *pic, int r, unsigned char *row)
 {
+   struct Veo *v = &pic->v;
+   long flags = pic->flags;
    int i, rawW, rawH, modR = r % 4;
 
    unsigned char rowA[2560], rowB[2560];
@@ -682,7 +705,7 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 
    if (r == 0)
 	 {
-		if (-1 == GetPicData (flags, r, v, rowB))
+		if (-1 == GetPicData (pic, r, rowB))
 		  return (-1);
 		rAP = rBP = rowB;
 		rCP = rowB + v->width;
@@ -690,7 +713,7 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 	 }
    else if (r == (v->height - 1))
 	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
+		if (-1 == GetPicData (pic, r, rowA))
 		  return (-1);
 		rAP = rowA + v->width * 2;
 		rCP = rBP = rowA + v->width * 3;
@@ -698,10 +721,10 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 	 }
    else if (modR == 0)
 	 {
-		if (-1 == GetPicData (flags, r - 1, v, rowA))
+		if (-1 == GetPicData (pic, r - 1, rowA))
 		  return (-1);
 		rAP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r, v, rowB))
+		if (-1 == GetPicData (pic, r, rowB))
 		  return (-1);
 		rBP = rowB;
 		rCP = rowB + v->width;
@@ -709,18 +732,18 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 	 }
    else if (modR == 3)
 	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
+		if (-1 == GetPicData (pic, r, rowA))
 		  return (-1);
 		rAP = rowA + v->width * 2;
 		rBP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r + 1, v, rowB))
+		if (-1 == GetPicData (pic, r + 1, rowB))
 		  return (-1);
 		rCP = rowB;
 
 	 }
    else
 	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
+		if (-1 == GetPicData (pic, r, rowA))
 		  return (-1);
 		rAP = rowA + v->width * (modR - 1);
 		rBP = rowA + v->width * modR;
@@ -820,9 +843,9 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 	 {
 		for (i = 0; i < v->width * 3; i += 3)
 		  {
-			 row[i] = redLUT[row[i]];
-			 row[i + 1] = greenLUT[row[i + 1]];
-			 row[i + 2] = blueLUT[row[i + 2]];
+			 row[i] = pic->redLUT[row[i]];
+			 row[i + 1] = pic->greenLUT[row[i + 1]];
+			 row[i + 2] = pic->blueLUT[row[i + 2]];
 		  }
 	 }
 
@@ -840,12 +863,14 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
  *
  * Parameters:  None
  *
- * Returns:     Nothing
+ * Returns:     1 success
+ *              -1 failure
  *
  ***********************************************************************/
 #ifdef HAVE_PNG
-void write_png (FILE * f, struct Veo *v, long flags)
+int write_png (FILE * f, struct veo_picture *pic)
 {
+   struct Veo *v = &pic->v;
    unsigned char outBuf[2560];
    int i;
    png_structp png_ptr;
@@ -856,20 +881,19 @@ void write_png (FILE * f, struct Veo *v, long flags)
 	  NULL, NULL);
 
    if (!png_ptr)
-	 return;
+	 return (-1);
 
    info_ptr = png_create_info_struct (png_ptr);
    if (!info_ptr)
 	 {
 		png_destroy_write_struct (&png_ptr, (png_infopp) NULL);
-		return;
+		return (-1);
 	 }
 
    if (setjmp (png_jmpbuf (png_ptr)))
 	 {
 		png_destroy_write_struct (&png_ptr, &info_ptr);
-		fclose (f);
-		return;
+		return (-1);
 	 }
 
    png_init_io (png_ptr, f);
@@ -882,7 +906,11 @@ void write_png (FILE * f, struct Veo *v, long flags)
 
    for (i = 0; i < v->height; i++)
 	 {
-		Gen24bitRow (flags, i, v, outBuf);
+		if (Gen24bitRow (pic, i, outBuf) < 0)
+		  {
+			 png_destroy_write_struct (&png_ptr, &info_ptr);
+			 return (-1);
+		  }
 		png_write_row (png_ptr, outBuf);
 		png_write_flush (png_ptr);
 	 }
@@ -890,6 +918,7 @@ void write_png (FILE * f, struct Veo *v, long flags)
    png_write_end (png_ptr, info_ptr);
    png_destroy_write_struct (&png_ptr, &info_ptr);
 
+   return (1);
 }
 #endif
 
@@ -901,98 +930,166 @@ void write_png (FILE * f, struct Veo *v, long flags)
  *
  * Parameters:  None
  *
- * Returns:     Nothing
+ * Returns:     1 success
+ *              -1 failure
  *
  ***********************************************************************/
-void write_ppm (FILE * f, struct Veo *v, long flags)
+int write_ppm (FILE * f, struct veo_picture *pic)
 {
+   struct Veo *v = &pic->v;
    unsigned char outBuf[2560];
+   char date[24];
    int i;
 
    fprintf (f, "P6\n# ");
 
    if (v->name != NULL)
-	 fprintf (f, "%s (created on %s)\n", v->name, fmt_date (v));
+	 fprintf (f, "%s (created on %s)\n", v->name, fmt_date (v, date));
 
    fprintf (f, "%d %d\n255\n", v->width, v->height);
 
    for (i = 0; i < v->height; i++)
 	 {
-		Gen24bitRow (flags, i, v, outBuf);
+		if (Gen24bitRow (pic, i, outBuf) < 0)
+		  return (-1);
 
 		fwrite (outBuf, v->width * 3, 1, f);
 	 }
+
+   return (1);
+}
+
+/***********************************************************************
+ *
+ * Function:    ConvertPicture
+ *
+ * Summary:	Decode a picture and write it to its file, on a worker
+ *		of the export pool
+ *
+ * Parameters:	veo_picture
+ *
+ * Returns:	0 success
+ *		negative if the picture couldn't be decoded
+ *
+ ***********************************************************************/
+static int ConvertPicture (void *job)
+{
+   struct veo_picture *pic = (struct veo_picture *) job;
+   int result = -1;
+
+   ColourCorrect (pic);
+
+   if (pic->type == VEO_OUT_PPM)
+	 result = write_ppm (pic->f, pic);
+#ifdef HAVE_PNG
+   else if (pic->type == VEO_OUT_PNG)
+	 result = write_png (pic->f, pic);
+#endif
+
+   fclose (pic->f);
+   if (result < 0)
+	 {
+		unlink (pic->fname);
+		return PI_ERR_FILE_INVALID;
+	 }
+
+   return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    PictureDone
+ *
+ * Summary:	Report a picture the export pool is done with, and free
+ *		it
+ *
+ * Parameters:	veo_picture, result of ConvertPicture()
+ *
+ * Returns:	Nothing
+ *
+ ***********************************************************************/
+static void PictureDone (void *job, int result)
+{
+   struct veo_picture *pic = (struct veo_picture *) job;
+
+   if (result < 0)
+	 fprintf (stderr, "   ERROR: can't decode %s\n", pic->fname);
+
+   pi_export_records_free (pic->records);
+   free (pic);
 }
 
 /***********************************************************************
  *
  * Function:    WritePicture
  *
- * Summary:	FIXME
+ * Summary:	Name the file of a picture, and queue the picture on
+ *		the export pool, which takes over the records
  *
- * Parameters:
+ * Parameters:	records - the records of the Veo database
  *
- * Returns:
+ * Returns:	Nothing
  *
  ***********************************************************************/
-void WritePicture (int sd, int db, int type, char *name, const char *progname, long flags)
+void WritePicture (pi_export_records_t *records, int type, char *name, const char *progname, long flags)
 {
-   char fname[FILENAME_MAX];
-   FILE *f;
+   struct veo_picture *pic;
    char extension[8];
-   static int len;
-   struct Veo v;
-   pi_buffer_t *inBuf;
-   int attr, category;
+   void *data;
+   size_t len;
+
+   pic = (struct veo_picture *) calloc (1, sizeof (struct veo_picture));
+   if (pic == NULL
+	   || pi_export_records_get (records, 0, &data, &len) < 0)
+	 {
+		fprintf (stderr, "%s: can't read %s\n", progname, name);
+		pi_export_records_free (records);
+		free (pic);
+		return;
+	 }
 
    if (type == VEO_OUT_PNG)
 	 sprintf (extension, ".png");
    else if (type == VEO_OUT_PPM)
 	 sprintf (extension, ".ppm");
 
-   sprintf (fname, "%s", name);
-   strcpy (v.name, name);
+   sprintf (pic->fname, "%s", name);
+   strcpy (pic->v.name, name);
 
-	if (plu_protect_files (fname, extension, sizeof(fname) ) < 1) {
+	if (plu_protect_files (pic->fname, extension, sizeof(pic->fname) ) < 1) {
 		/* no suitable filename could be found. */
+		pi_export_records_free (records);
+		free (pic);
 		return;
 	}
 
-   printf ("Generating %s...\n", fname);
+   printf ("Generating %s...\n", pic->fname);
 
-   f = fopen (fname, "wb");
+   /* the file is created here, so that the next picture with the same
+	  name gets another one */
+   pic->f = fopen (pic->fname, "wb");
 
-   if (f)
+   if (pic->f == NULL)
 	 {
-		if (sd)
-		  {
-             inBuf = pi_buffer_new (2560);
-			 len =
-			   dlp_ReadRecordByIndex (sd, db, 0, inBuf, 0, &attr, &category);
-			 unpack_Veo (&v, inBuf->data, inBuf->used);
-             pi_buffer_free (inBuf);
-			 v.sd = sd;
-			 v.db = db;
-		  }
-		else
-		  return;
-
-		ColourCorrect (&v, redLUT, greenLUT, blueLUT, flags);
+		fprintf (stderr, "%s: can't write to %s\n", progname, pic->fname);
+		pi_export_records_free (records);
+		free (pic);
+		return;
+	 }
 
-		if (type == VEO_OUT_PPM)
-		  write_ppm (f, &v, flags);
-#ifdef HAVE_PNG
-		else if (type == VEO_OUT_PNG)
-		  write_png (f, &v, flags);
-#endif
+   unpack_Veo (&pic->v, data, len);
+   pic->records = records;
+   pic->flags = flags;
+   pic->type = type;
 
-		fclose (f);
-	 }
-   else
+   if (pi_export_queue (pool, ConvertPicture, PictureDone, pic) < 0)
 	 {
-		fprintf (stderr, "%s: can't write to %s\n", progname, fname);
+		fprintf (stderr, "%s: out of memory\n", progname);
+		fclose (pic->f);
+		unlink (pic->fname);
+		pi_export_records_free (records);
+		free (pic);
 	 }
-
 }
 
 int main (int argc, const char *argv[])
@@ -1031,12 +1128,15 @@ int main (int argc, const char *argv[])
 		 "colour correct the output colours", NULL},
 		{"type", 't', POPT_ARG_STRING, &imgtype, 't',
 		 "Specify picture output type (ppm or png)", "[ppm|png]"},
+		{"jobs", 'j', POPT_ARG_INT, &jobs, 0,
+		 "Number of pictures to convert at the same time (default 4)", "jobs"},
 		POPT_TABLEEND
 	};
 
 	po = poptGetContext("read-veo", argc, argv, options, 0);
-	poptSetOtherOptionHelp(po,"\n\n"
-		"   Synchronize your Veo Traveler databases with your desktop machine.\n"
+	poptSetOtherOptionHelp(po,"[file] ...\n\n"
+		"   Synchronize your Veo Traveler databases with your desktop machine,\n"
+		"   or convert the Veo databases in the files given.\n"
 		"   Output defaults to ppm.\n\n");
 
 	if (argc<2) {
@@ -1080,6 +1180,69 @@ int main (int argc, const char *argv[])
 	if (c < -1) {
 		plu_badoption(po,c);
 	}
+	if (jobs < 1)
+		jobs = 1;
+
+	pool = pi_export_new (action == VEO_ACTION_LIST ? 1 : jobs);
+	if (pool == NULL) {
+		fprintf (stderr, "   ERROR: out of memory\n");
+		return -1;
+	}
+
+	if (poptPeekArg (po) != NULL) {
+		const char *file_arg;
+
+		while ((file_arg = poptGetArg (po)) != NULL) {
+			pi_file_t *pf = pi_file_open (file_arg);
+			pi_export_records_t *records;
+
+			if (pf == NULL) {
+				fprintf (stderr, "   ERROR: can't open %s\n", file_arg);
+				continue;
+			}
+			pi_file_get_info (pf, &info);
+			if (info.type != pi_mktag ('E', 'Z', 'V', 'I')
+			    || info.creator != pi_mktag ('O', 'D', 'I', '2')
+			    || (info.flags & dlpDBFlagResource)) {
+				fprintf (stderr, "   ERROR: %s is not a Veo database\n",
+					file_arg);
+				pi_file_close (pf);
+				continue;
+			}
+			dbcount++;
+			switch (action) {
+				case VEO_ACTION_LIST:
+				  printf ("%s\n", info.name);
+				  break;
+
+				case VEO_ACTION_OUTPUT_ONE:
+				  if (strcmp (info.name, picname))
+					break;
+
+				case VEO_ACTION_OUTPUT:
+				  records = pi_export_records_new ();
+				  if (records == NULL
+				      || pi_export_records_from_file (records, pf) < 0) {
+					   fprintf (stderr, "   ERROR: can't read %s\n",
+						file_arg);
+					   pi_export_records_free (records);
+					   break;
+				  }
+
+				  WritePicture(records, type, info.name, "read-veo", flags);
+				  break;
+			}
+			pi_file_close (pf);
+		}
+
+		pi_export_finish (pool);
+
+		if (!plu_quiet) {
+			printf ("\nList complete. %d files found.\n", dbcount);
+		}
+
+		return 0;
+	}
 
 	sd = plu_connect ();
 
@@ -1091,6 +1254,8 @@ int main (int argc, const char *argv[])
 
    buf = pi_buffer_new (sizeof (struct DBInfo));
 	for (;;) {
+		pi_export_records_t *records;
+
 		if (dlp_ReadDBList (sd, 0, 0x80, i, buf) < 0)
 		  break;
         memcpy (&info, buf->data, sizeof(struct DBInfo));
@@ -1114,14 +1279,25 @@ int main (int argc, const char *argv[])
 					   goto error_close;
 					}
 
-				  WritePicture(sd, db, type, info.name, "read-veo", flags);
-
+				  /* the records are read here, a few in flight at a
+				     time, and the picture is converted from memory */
+				  records = pi_export_records_new ();
+				  if (records == NULL
+				      || pi_export_records_from_dlp (records, sd, db) < 0) {
+					   fprintf (stderr,"   ERROR:Unable to read Veo database %s.\n",
+						info.name);
+					   pi_export_records_free (records);
+					   records = NULL;
+					}
 
 				if (sd) {
 					   /* Close the database */
 					   dlp_CloseDB (sd, db);
 					}
 
+				  if (records != NULL)
+					WritePicture(records, type, info.name, "read-veo", flags);
+
 				  break;
 			   }
 		  }
@@ -1135,6 +1311,8 @@ int main (int argc, const char *argv[])
 		pi_close (sd);
 	 }
 
+	pi_export_finish (pool);
+
 	if (!plu_quiet) {
 		printf ("\nList complete. %d files found.\n", dbcount);
 	}
@@ -1145,6 +1323,7 @@ int main (int argc, const char *argv[])
    pi_close (sd);
 
   error:
+   pi_export_finish (pool);
    return -1;
 
 }
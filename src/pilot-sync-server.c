@@ -0,0 +1,384 @@
+/*
+ * $Id$
+ *
+ * pilot-sync-server.c:  Back up any number of Palm devices at once
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-server.h"
+#include "pi-util.h"
+#include "pi-userland.h"
+
+struct backup_options {
+	const char	*dirname;
+	int		unsaved;
+
+	/* directories being backed up to, one slot per worker: two devices
+	   with the same user never write to the same one at once */
+	char		**active;
+	int		slots;
+#if HAVE_PTHREAD
+	pthread_mutex_t	lock;
+#endif
+};
+
+
+/***********************************************************************
+ *
+ * Function:    claim_directory
+ *
+ * Summary:     Mark a backup directory as in use by a session
+ *
+ * Parameters:  backup_options, directory
+ *
+ * Return:      0, or -1 if another session is backing up to it
+ *
+ ***********************************************************************/
+static int
+claim_directory(struct backup_options *options, char *dirname)
+{
+	int	i,
+		free_slot = -1;
+
+#if HAVE_PTHREAD
+	pthread_mutex_lock(&options->lock);
+#endif
+	for (i = 0; i < options->slots; i++) {
+		if (options->active[i] == NULL) {
+			if (free_slot < 0)
+				free_slot = i;
+		} else if (strcmp(options->active[i], dirname) == 0) {
+			free_slot = -1;
+			break;
+		}
+	}
+	if (free_slot >= 0)
+		options->active[free_slot] = dirname;
+#if HAVE_PTHREAD
+	pthread_mutex_unlock(&options->lock);
+#endif
+
+	return free_slot >= 0 ? 0 : -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    release_directory
+ *
+ * Summary:     Let other sessions back up to a directory again
+ *
+ * Parameters:  backup_options, directory given to claim_directory
+ *
+ * Return:      Nothing
+ *
+ ***********************************************************************/
+static void
+release_directory(struct backup_options *options, char *dirname)
+{
+	int	i;
+
+#if HAVE_PTHREAD
+	pthread_mutex_lock(&options->lock);
+#endif
+	for (i = 0; i < options->slots; i++)
+		if (options->active[i] == dirname)
+			options->active[i] = NULL;
+#if HAVE_PTHREAD
+	pthread_mutex_unlock(&options->lock);
+#endif
+}
+
+
+/***********************************************************************
+ *
+ * Function:    backup_session
+ *
+ * Summary:     Back up the RAM databases of one device to a directory
+ *              named after its user. Runs on a server worker, possibly
+ *              alongside other sessions; a device whose user is being
+ *              backed up already is turned away.
+ *
+ * Parameters:  connected socket, session number, backup_options
+ *
+ * Return:      number of databases backed up, or -1 on failure
+ *
+ ***********************************************************************/
+static int
+backup_session(int sd, int session, void *userdata)
+{
+	struct backup_options *options = (struct backup_options *)userdata;
+	struct PilotUser user;
+	struct DBInfo	info;
+	pi_file_t	*pf;
+	pi_buffer_t	*buffer;
+	char		*dirname,
+			*name = NULL,
+			synclog[70];
+	int		i,
+			dbcount,
+			count = 0,
+			failed = 0,
+			claimed = 0;
+
+	if (dlp_ReadUserInfo(sd, &user) < 0 || dlp_OpenConduit(sd) < 0) {
+		fprintf(stderr, "   [%d] Unable to start the backup.\n",
+			session);
+		return -1;
+	}
+
+	/* one directory per user, so that devices never share one */
+	dirname = malloc(strlen(options->dirname) + 3 * sizeof(user.username)
+		+ 16);
+	buffer = pi_buffer_new(sizeof(struct DBInfo));
+	if (dirname == NULL || buffer == NULL) {
+		fprintf(stderr, "   [%d] Out of memory.\n", session);
+		failed = 1;
+		goto done;
+	}
+
+	strcpy(dirname, options->dirname);
+	strcat(dirname, "/");
+	if (user.username[0] != '\0')
+		plu_protect_name(dirname + strlen(dirname), user.username);
+	else
+		sprintf(dirname + strlen(dirname), "user-%lu", user.userID);
+
+	name = malloc(strlen(dirname) + PLU_BACKUP_NAME_EXTRA);
+	if (name == NULL) {
+		fprintf(stderr, "   [%d] Out of memory.\n", session);
+		failed = 1;
+		goto done;
+	}
+
+	if (claim_directory(options, dirname) < 0) {
+		fprintf(stderr, "   [%d] '%s' is being backed up by another "
+			"device, refused.\n", session, user.username);
+		dlp_AddSyncLogEntry(sd, "A device with the same user is being "
+			"backed up.\nPlease try again later.");
+		failed = 1;
+		goto done;
+	}
+	claimed = 1;
+	mkdir(dirname, 0700);
+
+	printf("   [%d] Backing up '%s' to %s\n", session, user.username,
+		dirname);
+
+	/* the whole list at once, in as few round trips as the device
+	   allows */
+	dbcount = dlp_ReadDBCatalog(sd, 0, dlpDBListRAM, buffer, NULL);
+	if (dbcount < 0) {
+		fprintf(stderr, "   [%d] Unable to read the database list.\n",
+			session);
+		failed = 1;
+		goto done;
+	}
+
+	for (i = 0; i < dbcount; i++) {
+		memcpy(&info, buffer->data + i * sizeof(struct DBInfo),
+			sizeof(struct DBInfo));
+
+		if (info.creator == pi_mktag('a', '6', '8', 'k'))
+			continue;
+		if (!options->unsaved
+		    && strcmp(info.name, "Unsaved Preferences") == 0)
+			continue;
+
+		if (dlp_OpenConduit(sd) < 0) {
+			fprintf(stderr, "   [%d] Cancelled before '%s'.\n",
+				session, info.name);
+			failed++;
+			break;
+		}
+
+		plu_backup_name(name, dirname, &info);
+
+		if (plu_backup_retrieve(sd, name, &info, 0, &pf) < 0) {
+			fprintf(stderr, "   [%d] Unable to retrieve '%s'\n",
+				session, info.name);
+			failed++;
+			if (!pi_socket_connected(sd))
+				break;
+			continue;
+		}
+		if (plu_backup_write(pf, name, &info) < 0) {
+			fprintf(stderr, "   [%d] Unable to write %s\n",
+				session, name);
+			failed++;
+			continue;
+		}
+		count++;
+	}
+
+	printf("   [%d] %d databases backed up, %d failed.\n", session,
+		count, failed);
+
+	if (pi_socket_connected(sd)) {
+		sprintf(synclog, "%d files successfully backed up.\n\n"
+			"Thank you for using pilot-link.", count);
+		dlp_AddSyncLogEntry(sd, synclog);
+	}
+
+done:
+	if (claimed)
+		release_directory(options, dirname);
+	if (buffer != NULL)
+		pi_buffer_free(buffer);
+	free(name);
+	free(dirname);
+
+	return failed ? -1 : count;
+}
+
+
+int
+main(int argc, const char *argv[])
+{
+	int		optc,
+			workers	= 4,
+			ports	= 0;
+	const char	*log_dir	= NULL,
+			**rargv;
+	struct backup_options options;
+	struct stat	sbuf;
+	pi_server_t	*server;
+	poptContext	pc;
+
+	struct poptOption	opts[]	=
+	{
+		USERLAND_RESERVED_OPTIONS
+		{"backup",  'b', POPT_ARG_STRING, NULL, 'b', "Back up each device to a directory named after its user in <dir>", "dir"},
+		{"jobs",    'j', POPT_ARG_INT, &workers, 0, "Number of devices to back up at the same time (default 4)", "jobs"},
+		{"logdir",  'L', POPT_ARG_STRING, &log_dir, 0, "Write one log file per session in <dir>", "dir"},
+		{"illegal",  0 , POPT_ARG_NONE, NULL, 'I', "Also back up Unsaved Preferences.prc (normally skipped)", NULL},
+		POPT_TABLEEND
+	};
+
+	options.dirname	= NULL;
+	options.unsaved	= 0;
+
+	pc = poptGetContext("pilot-sync-server", argc, argv, opts, 0);
+	poptSetOtherOptionHelp(pc, "[port ...]\n\n"
+		"   Back up every device that connects to any of the ports\n"
+		"   (--port and the remaining arguments), several at a time.\n\n");
+
+	while ((optc = poptGetNextOpt(pc)) >= 0) {
+		switch (optc) {
+		case 'b':
+			options.dirname = poptGetOptArg(pc);
+			break;
+		case 'I':
+			options.unsaved = 1;
+			break;
+		default:
+			plu_badoption(pc, optc);
+		}
+	}
+
+	if (optc < -1)
+		plu_badoption(pc, optc);
+
+	if (options.dirname == NULL) {
+		fprintf(stderr, "   ERROR: Must specify a backup directory (-b).\n");
+		return 1;
+	}
+	if (stat(options.dirname, &sbuf) != 0 || !S_ISDIR(sbuf.st_mode)) {
+		fprintf(stderr, "   ERROR: '%s' is not a directory.\n",
+			options.dirname);
+		return 1;
+	}
+
+	options.slots	= workers > 0 ? workers : 1;
+	options.active	= calloc(options.slots, sizeof(char *));
+	if (options.active == NULL) {
+		fprintf(stderr, "   ERROR: Out of memory.\n");
+		return 1;
+	}
+#if HAVE_PTHREAD
+	pthread_mutex_init(&options.lock, NULL);
+#endif
+
+	server = pi_server_new(workers, backup_session, &options);
+	if (server == NULL) {
+		fprintf(stderr, "   ERROR: Unable to start the server: %s\n",
+			strerror(errno));
+		return 1;
+	}
+	if (log_dir != NULL)
+		pi_server_set_log_dir(server, log_dir);
+
+	if (plu_port == NULL)
+		plu_port = getenv("PILOTPORT");
+	if (plu_port != NULL) {
+		if (pi_server_add_port(server, plu_port) < 0)
+			fprintf(stderr, "   Unable to listen on %s\n", plu_port);
+		else
+			ports++;
+	}
+	for (rargv = poptGetArgs(pc); rargv && *rargv; rargv++) {
+		if (pi_server_add_port(server, *rargv) < 0)
+			fprintf(stderr, "   Unable to listen on %s\n", *rargv);
+		else
+			ports++;
+	}
+
+	if (ports == 0) {
+		fprintf(stderr, "\n   No port to listen on\n"
+			"   Please use --help for more information\n\n");
+		pi_server_free(server);
+		return 1;
+	}
+
+	if (!plu_quiet)
+		printf("   Listening on %d port%s, %d device%s at a time...\n",
+			ports, ports == 1 ? "" : "s",
+			workers, workers == 1 ? "" : "s");
+
+	/* runs until killed */
+	pi_server_wait(server, 0);
+	pi_server_free(server);
+	free(options.active);
+
+	return 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -25,6 +25,10 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -38,10 +42,16 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "pi-debug.h"
 #include "pi-socket.h"
 #include "pi-file.h"
+#include "pi-store.h"
 #include "pi-header.h"
 #include "pi-util.h"
 #include "pi-userland.h"
@@ -107,12 +117,60 @@ typedef enum {
 int	sd	= -1;
 char    *vfsdir = NULL;
 
+/* -i --diff: send only what changed, remembering in manifest_dir what
+   was installed */
+int	install_diff	= 0;
+char	*manifest_dir	= NULL;
+
+/* -burs --store: keep the records in a deduplicating store and only
+   manifests in the backup directory */
+char	*store_dir	= NULL;
+pi_store_t *store	= NULL;
+
 #define MAXEXCLUDE 100
 char	*exclude[MAXEXCLUDE];
 int		numexclude = 0;
 
 static int findVFSPath(const char *path, long *volume, char *rpath, int *rpathlen);
 
+/* palm_backup() retrieves databases in memory and hands them over to a
+   pool of writer threads, so that the link never waits for the disk.
+   Retrieval pauses while the databases waiting to be written hold more
+   than BACKUP_QUEUE_BYTES of data. A database with more than a megabyte
+   of data isn't held in memory: it goes to its file as it comes (see
+   pi_file_create_buffered()), so one big database doesn't blow the cap
+   either. */
+#define BACKUP_WRITERS		2
+#define BACKUP_QUEUE_BYTES	(16 * 1024 * 1024)
+
+/* A database retrieved from the handheld, waiting to be written */
+struct backup_job {
+	pi_file_t	*pf;
+	char		*name;
+	char		crid[5];
+	int		number;
+	long		bytes;
+	struct DBInfo	info;
+	struct backup_job *next;
+};
+
+struct backup_writer {
+	const char	*synctext;
+	struct backup_job *head,
+			**tail;
+	long		queued_bytes,
+			total_bytes;	/* size of the files written */
+	int		written,
+			failed,
+			done;
+#if HAVE_PTHREAD
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_t	threads[BACKUP_WRITERS];
+	int		nthreads;
+#endif
+};
+
 const char
 *media_name(int m)
 {
@@ -169,72 +227,6 @@ make_excludelist(const char *efile)
 }
 
 
-/***********************************************************************
- *
- * Function:    protect_name
- *
- * Summary:     Protects filenames and paths which include 'illegal'
- *              characters, such as '/' and '=' in them.
- *
- * Parameters:  None
- *
- * Return:      Nothing
- *
- ***********************************************************************/
-static void
-protect_name(char *d, const char *s)
-{
-
-	/* Maybe even..
-	char *c = strchr("/=\r\n", foo);
-
-	if (c) {
-		d += sprintf(d, "=%02X", c);
-	}
-	*/
-
-	while (*s) {
-		switch (*s) {
-		case '/':
-			*(d++) = '=';
-			*(d++) = '2';
-			*(d++) = 'F';
-			break;
-
-		case '=':
-			*(d++) = '=';
-			*(d++) = '3';
-			*(d++) = 'D';
-			break;
-
-		case '\x0A':
-			*(d++) = '=';
-			*(d++) = '0';
-			*(d++) = 'A';
-			break;
-
-		case '\x0D':
-			*(d++) = '=';
-			*(d++) = '0';
-			*(d++) = 'D';
-			break;
-
-		/* Replace spaces in names with =20
-		case ' ':
-			*(d++) = '=';
-			*(d++) = '2';
-			*(d++) = '0';
-			break;
-		*/
-		default:
-			*(d++) = *s;
-		}
-		++s;
-	}
-	*d = '\0';
-}
-
-
 /***********************************************************************
  *
  * Function:    list_remove
@@ -303,6 +295,336 @@ static int palm_creator(unsigned long creator)
 	return 1;
 }
 
+/* The list of databases on the handheld is read once per connection,
+   for each set of dlpDBList flags, and shared by everything that walks
+   it. Adding or deleting a database forgets it. */
+static pi_buffer_t	*catalog	= NULL;
+static int		catalog_flags	= -1;
+
+/***********************************************************************
+ *
+ * Function:    palm_catalog
+ *
+ * Summary:     Get the list of databases, reading it if needed
+ *
+ * Parameters:  dlpDBList flags, number of databases on return
+ *
+ * Returns:     The databases, or NULL if the list can't be read
+ *
+ ***********************************************************************/
+static struct DBInfo *palm_catalog(int flags, int *count)
+{
+	*count = 0;
+	if (catalog == NULL
+	    && (catalog = pi_buffer_new(sizeof(struct DBInfo))) == NULL)
+		return NULL;
+
+	if (catalog_flags != flags)
+	{
+		catalog_flags = -1;
+		if (dlp_ReadDBCatalog(sd, 0, flags, catalog, NULL) < 0)
+			return NULL;
+		catalog_flags = flags;
+	}
+
+	*count = catalog->used / sizeof(struct DBInfo);
+	return (struct DBInfo *)catalog->data;
+}
+
+static void palm_catalog_forget(void)
+{
+	catalog_flags = -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    palm_find
+ *
+ * Summary:     Find a database by name, in RAM rather than in ROM if
+ *              both have it
+ *
+ * Parameters:  name, its information on return
+ *
+ * Returns:     0, or -1 if there is no such database
+ *
+ ***********************************************************************/
+static int palm_find(const char *dbname, struct DBInfo *info)
+{
+	struct DBInfo	*dbs;
+	int		i,
+			count,
+			found	= -1;
+
+	dbs = palm_catalog(dlpDBListRAM | dlpDBListROM, &count);
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(dbs[i].name, dbname) != 0)
+			continue;
+		if (found < 0 || (dbs[i].miscFlags & dlpDBMiscFlagRamBased))
+			found = i;
+	}
+	if (found < 0)
+		return -1;
+
+	*info = dbs[found];
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    backup_write
+ *
+ * Summary:     Write a retrieved database to disk, flush it and give it
+ *              the dates of the database
+ *
+ * Parameters:  writer, database
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+backup_write(struct backup_writer *writer, struct backup_job *job)
+{
+	long		size,
+			total;
+
+	size = plu_backup_write(job->pf, job->name, &job->info);
+	if (size < 0) {
+		printf("   [-][fail][%s] Failed, unable to write '%s'.\n",
+			job->crid, job->info.name);
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&writer->lock);
+#endif
+		writer->failed++;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&writer->lock);
+#endif
+		return;
+	}
+
+#if HAVE_PTHREAD
+	pthread_mutex_lock(&writer->lock);
+#endif
+	writer->written++;
+	writer->total_bytes += size;
+	total = writer->total_bytes;
+#if HAVE_PTHREAD
+	pthread_mutex_unlock(&writer->lock);
+#endif
+
+	printf("   [+][%-4d][%s] %s '%s', %ld bytes, %ld KiB...\n",
+		job->number, job->crid, writer->synctext, job->info.name,
+		size, total / 1024);
+}
+
+#if HAVE_PTHREAD
+/***********************************************************************
+ *
+ * Function:    backup_writer_thread
+ *
+ * Summary:     Write databases as they are retrieved
+ *
+ * Parameters:  writer
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+backup_writer_thread(void *data)
+{
+	struct backup_writer *writer = (struct backup_writer *)data;
+	struct backup_job *job;
+
+	pthread_mutex_lock(&writer->lock);
+	for (;;) {
+		while (writer->head == NULL && !writer->done)
+			pthread_cond_wait(&writer->cond, &writer->lock);
+		if ((job = writer->head) == NULL)
+			break;
+		if ((writer->head = job->next) == NULL)
+			writer->tail = &writer->head;
+		pthread_mutex_unlock(&writer->lock);
+
+		backup_write(writer, job);
+
+		pthread_mutex_lock(&writer->lock);
+		writer->queued_bytes -= job->bytes;
+		pthread_cond_broadcast(&writer->cond);
+		free(job->name);
+		free(job);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    backup_writer_start
+ *
+ * Summary:     Start the writer threads. Without threads, or if they
+ *              can't be started, databases are written as they come
+ *
+ * Parameters:  writer, verb of the progress lines
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+backup_writer_start(struct backup_writer *writer, const char *synctext)
+{
+	memset(writer, 0, sizeof(struct backup_writer));
+	writer->synctext = synctext;
+	writer->tail = &writer->head;
+
+#if HAVE_PTHREAD
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	for (writer->nthreads = 0; writer->nthreads < BACKUP_WRITERS;
+	     writer->nthreads++)
+		if (pthread_create(&writer->threads[writer->nthreads], NULL,
+				backup_writer_thread, writer) != 0)
+			break;
+#endif
+}
+
+/***********************************************************************
+ *
+ * Function:    backup_writer_queue
+ *
+ * Summary:     Hand a retrieved database over to the writers, waiting
+ *              for them to catch up if too much data is pending
+ *
+ * Parameters:  writer, database, access path, creator, file number,
+ *              database info
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+backup_writer_queue(struct backup_writer *writer, pi_file_t *pf,
+		const char *name, const char *crid, int number,
+		const struct DBInfo *info)
+{
+	struct backup_job *job;
+
+	job = calloc(1, sizeof(struct backup_job));
+	if (job == NULL || (job->name = strdup(name)) == NULL) {
+		free(job);
+		printf("   [-][fail][%s] Failed, out of memory for '%s'.\n",
+			crid, info->name);
+		/* the earlier copy is left as it was */
+		pi_file_discard(pf);
+#if HAVE_PTHREAD
+		pthread_mutex_lock(&writer->lock);
+#endif
+		writer->failed++;
+#if HAVE_PTHREAD
+		pthread_mutex_unlock(&writer->lock);
+#endif
+		return;
+	}
+	job->pf			= pf;
+	job->number		= number;
+	/* what it holds in memory: a big database went to its file as
+	   it came */
+	job->bytes		= pi_file_get_buffered_size(pf);
+	job->info		= *info;
+	strcpy(job->crid, crid);
+
+#if HAVE_PTHREAD
+	if (writer->nthreads > 0) {
+		pthread_mutex_lock(&writer->lock);
+		while (writer->head != NULL
+		       && writer->queued_bytes >= BACKUP_QUEUE_BYTES)
+			pthread_cond_wait(&writer->cond, &writer->lock);
+		*writer->tail = job;
+		writer->tail = &job->next;
+		writer->queued_bytes += job->bytes;
+		pthread_cond_broadcast(&writer->cond);
+		pthread_mutex_unlock(&writer->lock);
+		return;
+	}
+#endif
+
+	backup_write(writer, job);
+	free(job->name);
+	free(job);
+}
+
+/***********************************************************************
+ *
+ * Function:    backup_writer_finish
+ *
+ * Summary:     Wait until every database queued is on disk, and stop
+ *              the writer threads
+ *
+ * Parameters:  writer
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+backup_writer_finish(struct backup_writer *writer)
+{
+#if HAVE_PTHREAD
+	int	i;
+
+	pthread_mutex_lock(&writer->lock);
+	writer->done = 1;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+
+	for (i = 0; i < writer->nthreads; i++)
+		pthread_join(writer->threads[i], NULL);
+	writer->nthreads = 0;
+
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->cond);
+#endif
+}
+
+/***********************************************************************
+ *
+ * Function:    backup_store
+ *
+ * Summary:     Back up a database into the store, writing its manifest
+ *              with the dates of the database. Nothing is queued to
+ *              the writers: the store writes the records as they come.
+ *
+ * Parameters:  writer, database, manifest path, creator, file number
+ *
+ * Returns:     0, or -1 if the database couldn't be retrieved
+ *
+ ***********************************************************************/
+static int
+backup_store(struct backup_writer *writer, const struct DBInfo *info,
+	const char *name, const char *crid, int number)
+{
+	struct pi_store_stats before,
+			after;
+	struct utimbuf	times;
+
+	pi_store_get_stats(store, &before);
+	if (pi_store_retrieve(store, sd, 0, info, name, NULL) < 0)
+		return -1;
+	pi_store_get_stats(store, &after);
+
+	times.actime	= info->createDate;
+	times.modtime	= info->modifyDate;
+	utime(name, &times);
+
+	writer->written++;
+	writer->total_bytes += after.bytes - before.bytes;
+
+	printf("   [+][%-4d][%s] %s '%s', %lu bytes, %lu new...\n",
+		number, crid, writer->synctext, info->name,
+		after.bytes - before.bytes, after.new_bytes - before.new_bytes);
+	return 0;
+}
+
 
 /***********************************************************************
  *
@@ -327,7 +649,10 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			failed		= 0,
 			skipped		= 0;
 
-	static int	totalsize;
+	double		elapsed;
+	struct timeval	start,
+			end;
+	struct backup_writer writer;
 
 	char		**orig_files    = NULL,
 				*name,
@@ -335,7 +660,8 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 
 	const char	*synctext       = (flags & UPDATE) ? "Synchronizing" : "Backing up";
 	DIR		*dir;
-	pi_buffer_t	*buffer;
+	struct DBInfo	*dbs;
+	int		count;
 
 	/* Check if the directory exists before writing to it. If it doesn't
 	   exist as a directory, and it isn't a file, create it. */
@@ -390,36 +716,37 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 		}
 	}
 
-	buffer = pi_buffer_new (sizeof(struct DBInfo));
+	dbs = palm_catalog((flags & MEDIA_MASK) ? dlpDBListROM : dlpDBListRAM,
+			&count);
 	name = (char *)malloc(strlen(dirname) + 1 + 256);
 
-	for (;;)
+	gettimeofday(&start, NULL);
+	backup_writer_start(&writer, synctext);
+
+	for (i = 0; i < count; i++)
 	{
 		struct DBInfo	info;
 		struct pi_file	*f;
-		struct utimbuf	times;
 		int				skip	= 0;
 		int				excl	= 0;
+		int				incremental;
 		struct stat		sbuf;
 		char			crid[5];
 
 		if (!pi_socket_connected(sd))
 		{
+			backup_writer_finish(&writer);
 			printf("\n   Connection broken - Exiting. All data was not backed up\n");
 			exit(EXIT_FAILURE);
 		}
 
-		if (dlp_ReadDBList(sd, 0, ((flags & MEDIA_MASK)
-						? dlpDBListROM : dlpDBListRAM), i, buffer) < 0)
-			break;
-
-		memcpy(&info, buffer->data, sizeof(struct DBInfo));
-		i = info.index + 1;
+		memcpy(&info, &dbs[i], sizeof(struct DBInfo));
 
 		pi_untag(crid,info.creator);
 
 		if (dlp_OpenConduit(sd) < 0)
 		{
+			backup_writer_finish(&writer);
 			printf("\n   Exiting on cancel, all data was not backed up"
 					"\n   Stopped before backing up: '%s'\n\n", info.name);
 			sprintf(synclog, "\npilot-xfer was cancelled by the user "
@@ -428,9 +755,7 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			exit(EXIT_FAILURE);
 		}
 
-		strcpy(name, dirname);
-		strcat(name, "/");
-		protect_name(name + strlen(name), info.name);
+		plu_backup_name(name, dirname, &info);
 
 		if (palm_creator(info.creator))
 		{
@@ -439,17 +764,6 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			continue;
 		}
 
-		if (info.flags & dlpDBFlagResource)
-		{
-			strcat(name, ".prc");
-		} else if ((info.flags & dlpDBFlagLaunchable) &&
-				   info.type == pi_mktag('p','q','a',' '))
-		{
-			strcat(name, ".pqa");
-		} else {
-			strcat(name, ".pdb");
-		}
-
 		for (excl = 0; excl < numexclude; excl++)
 		{
 			if (strcmp(exclude[excl], info.name) == 0)
@@ -478,6 +792,7 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 		}
 
 			list_remove(name, orig_files, ofile_total);
+		incremental = 0;
 		if ((0 == stat(name, &sbuf)) && ((flags & UPDATE) == UPDATE))
 		{
 			if (info.modifyDate == sbuf.st_mtime)
@@ -486,48 +801,47 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 						name);
 				continue;
 			}
+
+			/* only the records that changed are read again */
+			incremental = (store == NULL);
 		}
 
 		/* Ensure that DB-open and DB-ReadOnly flags are not kept */
 		info.flags &= ~(dlpDBFlagOpen | dlpDBFlagReadOnly);
 
-		printf("   [+][%-4d]", filecount);
-		printf("[%s] %s '%s'", crid, synctext, info.name);
-		fflush(NULL);
-
 		setlocale(LC_ALL, "");
 
-		f = pi_file_create(name, &info);
-
-		if (f == 0)
+		if (store != NULL)
 		{
-			printf("\nFailed, unable to create file.\n");
-			break;
-		} else if (pi_file_retrieve(f, sd, 0, NULL) < 0)
+			if (backup_store(&writer, &info, name, crid,
+					filecount) < 0)
+			{
+				printf("   [-][fail][%s] Failed, unable to retrieve '%s' from the Palm.\n",
+					crid, info.name);
+				failed++;
+			}
+			filecount++;
+			continue;
+		}
+
+		/* a writer thread puts the database on disk while the next
+		   one comes over the link */
+		if (plu_backup_retrieve(sd, name, &info, incremental, &f) < 0)
 		{
-			printf("\n   [-][fail][%s] Failed, unable to retrieve '%s' from the Palm.",
+			printf("   [-][fail][%s] Failed, unable to retrieve '%s' from the Palm.\n",
 				crid, info.name);
 			failed++;
-			pi_file_close(f);
-			unlink(name);
 		} else {
-			pi_file_close(f);		/* writes the file to disk so we can stat() it */
-			stat(name, &sbuf);
-			totalsize += sbuf.st_size;
-			printf(", %ld bytes, %ld KiB... ",
-					(long)sbuf.st_size, (long)totalsize/1024);
-			fflush(NULL);
+			backup_writer_queue(&writer, f, name, crid, filecount,
+				&info);
 		}
 
 		filecount++;
-
-		printf("\n");
-
-		times.actime	= info.createDate;
-		times.modtime	= info.modifyDate;
-		utime(name, &times);
 	}
-	pi_buffer_free(buffer);
+
+	backup_writer_finish(&writer);
+	gettimeofday(&end, NULL);
+	failed += writer.failed;
 
 	if (orig_files)
 	{
@@ -572,6 +886,24 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			(filecount ? filecount - 1 : 0),
 			skipped, failed, (failed == 1) ? "" : "s");
 
+	elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1000000.0;
+	if (elapsed > 0)
+		printf("   %d databases, %ld bytes in %.1f seconds"
+			" (%.1f KiB/s, %.1f databases/s).\n",
+			writer.written, writer.total_bytes, elapsed,
+			writer.total_bytes / 1024.0 / elapsed,
+			writer.written / elapsed);
+	if (store != NULL)
+	{
+		struct pi_store_stats stats;
+
+		pi_store_get_stats(store, &stats);
+		printf("   %lu of %lu records and blocks, %lu of %lu bytes"
+			" were new to the store.\n", stats.new_objects,
+			stats.objects, stats.new_bytes, stats.bytes);
+	}
+
 	sprintf(synclog, "%d files successfully backed up.\n\n"
 			"Thank you for using pilot-link.", filecount - 1);
 	dlp_AddSyncLogEntry(sd, synclog);
@@ -644,7 +976,7 @@ palm_fetch_internal(const char *dbname)
 
 	printf("   Parsing list of files from handheld... ");
 	fflush(stdout);
-	if (dlp_FindDBInfo(sd, 0, 0, dbname, 0, 0, &info) < 0)
+	if (palm_find(dbname, &info) < 0)
 	{
 		printf("\n   Unable to locate app/database '%s', ",
 				dbname);
@@ -654,7 +986,7 @@ palm_fetch_internal(const char *dbname)
 		printf("done.\n");
 	}
 
-	protect_name(name, dbname);
+	plu_protect_name(name, dbname);
 
 	/* Judd - Graffiti hack
 	   Graffiti ShortCuts with a space on the end or not is really
@@ -902,11 +1234,13 @@ static void palm_delete(const char *dbname)
 {
 	struct DBInfo	info;
 
-	dlp_FindDBInfo(sd, 0, 0, dbname, 0, 0, &info);
+	if (palm_find(dbname, &info) < 0)
+		info.type = 0;
 
 	printf("Deleting '%s'... ", dbname);
 	if (dlp_DeleteDB(sd, 0, dbname) >= 0)
 	{
+		palm_catalog_forget();
 		if (info.type == pi_mktag('b', 'o', 'o', 't'))
 		{
 			printf(" (rebooting afterwards) ");
@@ -924,7 +1258,8 @@ struct db {
 	int				flags,
 					maxblock;
 	char			name[256];
-	unsigned long	creator, type;
+	unsigned long	creator, type,
+					size;
 };
 
 static int
@@ -943,6 +1278,65 @@ compare(struct db *d1, struct db *d2)
 }
 
 
+/***********************************************************************
+ *
+ * Function:    restore_scan
+ *
+ * Summary:     Read what restoring needs to know of a file of the
+ *              directory being restored: a database file, or with
+ *              --store a manifest, which is all that is read of it
+ *
+ * Parameters:  entry with the file name, to fill in
+ *
+ * Returns:     0, or -1 if it can't be read
+ *
+ ***********************************************************************/
+static int
+restore_scan(struct db *db)
+{
+	struct pi_file	*f;
+	struct DBInfo	info;
+	struct DBSizeInfo size;
+	struct stat	sbuf;
+	size_t		len;
+	int		i,
+			max;
+
+	db->maxblock	= 0;
+	db->size	= 0;
+	if (store != NULL)
+	{
+		if (pi_store_get_info(db->name, &info, &size) < 0)
+			return -1;
+		db->maxblock	= size.maxRecSize;
+		db->size	= size.totalBytes;
+	} else {
+		if ((f = pi_file_open(db->name)) == NULL)
+			return -1;
+		if (stat(db->name, &sbuf) == 0)
+			db->size = sbuf.st_size;
+
+		pi_file_get_info(f, &info);
+		pi_file_get_entries(f, &max);
+		for (i = 0; i < max; i++)
+		{
+			if (info.flags & dlpDBFlagResource)
+				pi_file_read_resource(f, i, 0, &len, 0, 0);
+			else
+				pi_file_read_record(f, i, 0, &len, 0, 0, 0);
+
+			if (len > (size_t)db->maxblock)
+				db->maxblock = len;
+		}
+		pi_file_close(f);
+	}
+
+	db->creator	= info.creator;
+	db->type	= info.type;
+	db->flags	= info.flags;
+	return 0;
+}
+
 /***********************************************************************
  *
  * Function:    palm_restore
@@ -960,15 +1354,11 @@ palm_restore(const char *dirname)
 	int				dbcount		= 0,
 					i,
 					j,
-					max,
 					save_errno	= errno;
-	size_t			size;
 	DIR				*dir;
 	struct dirent	*dirent;
-	struct DBInfo	info;
 	struct db		**db		= NULL;
 	struct pi_file	*f;
-	struct stat		sbuf;
 
 	struct  CardInfo Card;
 
@@ -1015,37 +1405,13 @@ palm_restore(const char *dirname)
 		sprintf(db[dbcount]->name, "%s/%s", dirname,
 			dirent->d_name);
 
-		f = pi_file_open(db[dbcount]->name);
-		if (f == 0)
+		if (restore_scan(db[dbcount]) < 0)
 		{
 			printf("Unable to open '%s'!\n",
 				   db[dbcount]->name);
+			free(db[dbcount]);
 			break;
 		}
-
-		pi_file_get_info(f, &info);
-
-		db[dbcount]->creator	= info.creator;
-		db[dbcount]->type		= info.type;
-		db[dbcount]->flags		= info.flags;
-		db[dbcount]->maxblock	= 0;
-
-		pi_file_get_entries(f, &max);
-
-		for (i = 0; i < max; i++)
-		{
-			if (info.flags & dlpDBFlagResource)
-			{
-				pi_file_read_resource(f, i, 0, &size, 0, 0);
-			} else {
-				pi_file_read_record(f, i, 0, &size, 0, 0, 0);
-			}
-
-			if (size > db[dbcount]->maxblock)
-				db[dbcount]->maxblock = size;
-		}
-
-		pi_file_close(f);
 		dbcount++;
 	}
 
@@ -1068,7 +1434,11 @@ palm_restore(const char *dirname)
 	for (i = 0; i < dbcount; i++)
 	{
 
-		f = pi_file_open(db[i]->name);
+		/* a manifest's database only exists while it is open */
+		if (store != NULL)
+			f = pi_store_open_file(store, db[i]->name);
+		else
+			f = pi_file_open(db[i]->name);
 		if (f == 0) {
 			printf("Unable to open '%s'!\n", db[i]->name);
 			break;
@@ -1076,20 +1446,18 @@ palm_restore(const char *dirname)
 		printf("Restoring %s... ", db[i]->name);
 		fflush(stdout);
 
-		stat(db[i]->name, &sbuf);
-
 		while (Card.more)
 		{
 			if (dlp_ReadStorageInfo(sd, Card.card + 1, &Card) < 0)
 				break;
 		}
 
-		if ((unsigned long)sbuf.st_size > Card.ramFree)
+		if (db[i]->size > Card.ramFree)
 		{
 			fprintf(stderr, "\n\n");
 			fprintf(stderr, "   Insufficient space to install this file on your Palm.\n");
 			fprintf(stderr, "   We needed %lu and only had %lu available..\n\n",
-				(unsigned long)sbuf.st_size, Card.ramFree);
+				db[i]->size, Card.ramFree);
 			exit(EXIT_FAILURE);
 		}
 
@@ -1099,6 +1467,7 @@ palm_restore(const char *dirname)
 		} else {
 			printf("OK\n");
 		}
+		palm_catalog_forget();
 
 		pi_file_close(f);
 	}
@@ -1395,6 +1764,8 @@ static void palm_install_internal(const char *filename)
 	struct stat		sbuf;
 	struct CardInfo	Card;
 	const char *basename = strrchr(filename,'/');
+	char	manifest[FILENAME_MAX],
+		protected[3 * sizeof(f->info.name) + 1];
 
 	if (basename) {
 		basename = basename+1;
@@ -1448,13 +1819,30 @@ static void palm_install_internal(const char *filename)
 	/* TODO: shouldn't this use Card.card? If we're looking for _a_
 	   card that can hold the file, shouldn't we check in the while
 	   loop above?  */
-	if (pi_file_install(f, sd, 0, plu_quiet ? NULL : install_progress) < 0) {
+	if (manifest_dir) {
+		plu_protect_name(protected, f->info.name);
+		if (snprintf(manifest, sizeof(manifest), "%s/%s.manifest",
+				manifest_dir, protected)
+		    >= (int)sizeof(manifest)) {
+			fprintf(stderr, "   ERROR: Manifest path too long in '%s'.\n",
+				manifest_dir);
+			pi_file_close(f);
+			return;
+		}
+	}
+
+	if ((install_diff || manifest_dir)
+		? pi_file_install_diff(f, sd, 0, manifest_dir ? manifest : NULL,
+			plu_quiet ? NULL : install_progress) < 0
+		: pi_file_install(f, sd, 0,
+			plu_quiet ? NULL : install_progress) < 0) {
 		/* TODO: Does pi_file_install print a diagnostic? */
 		fprintf(stderr,
 				"\n   ERROR: pi_file_install failed "
 				"(%i, PalmOS 0x%04x).\n",
 				pi_error(sd), pi_palmos_error(sd));
 	} else {
+		palm_catalog_forget();
 		totalsize += sbuf.st_size;
 		printf("   %ld KiB total.\n", totalsize/1024);
 		fflush(stdout);
@@ -1603,6 +1991,7 @@ palm_merge(const char *filename)
 		printf("failed.\n");
 	else
 		printf("OK\n");
+	palm_catalog_forget();
 	pi_file_close(f);
 
 	printf("Merge done\n");
@@ -1624,35 +2013,18 @@ palm_merge(const char *filename)
 static void
 palm_list_internal(unsigned long int flags)
 {
-	int				i		= 0,
-					j,
+	int				i,
 					dbcount	= 0;
-	struct DBInfo	info;
+	struct DBInfo	*dbs;
 	char			synclog[68];
-	pi_buffer_t		*buffer;
 
 	printf("   Reading list of databases in RAM%s...\n",
 			(flags & MEDIA_MASK) ? " and ROM" : "");
 
-	buffer = pi_buffer_new(sizeof(struct DBInfo));
-
-	for (;;)
-	{
-		if (dlp_ReadDBList
-				(sd, 0, ((flags & MEDIA_MASK) ? 0x40 : 0) | 0x80 |
-				 dlpDBListMultiple, i, buffer) < 0)
-			break;
-		for (j=0; j < (buffer->used / sizeof(struct DBInfo)); j++)
-		{
-			memcpy(&info, buffer->data + j * sizeof(struct DBInfo),
-					sizeof(struct DBInfo));
-			dbcount++;
-			i = info.index + 1;
-			printf("   %s\n", info.name);
-		}
-		fflush(stdout);
-	}
-	pi_buffer_free(buffer);
+	dbs = palm_catalog(((flags & MEDIA_MASK) ? 0x40 : 0) | 0x80, &dbcount);
+	for (i = 0; i < dbcount; i++)
+		printf("   %s\n", dbs[i].name);
+	fflush(stdout);
 
 	printf("\n   List complete. %d files found.\n\n", dbcount);
 	sprintf(synclog, "List complete. %d files found..\n\nThank you for using pilot-link.",
@@ -2254,22 +2626,18 @@ palm_list(unsigned long int flags)
 static void
 palm_purge(void)
 {
-	int				i	= 0,
-					h;
-	struct DBInfo	info;
-	pi_buffer_t		*buffer;
+	int				i,
+					h,
+					count;
+	struct DBInfo	*dbs,
+					info;
 
 	printf("Reading list of databases to purge...\n");
 
-	buffer = pi_buffer_new(sizeof(struct DBInfo));
-
-	for (;;)
+	dbs = palm_catalog(0x80, &count);
+	for (i = 0; i < count; i++)
 	{
-		if (dlp_ReadDBList(sd, 0, 0x80, i, buffer) < 0)
-			break;
-
-		memcpy (&info, buffer->data, sizeof(struct DBInfo));
-		i = info.index + 1;
+		memcpy (&info, &dbs[i], sizeof(struct DBInfo));
 
 		if (info.flags & 1)
 			continue;	/* skip resource databases */
@@ -2290,8 +2658,6 @@ palm_purge(void)
 			dlp_CloseDB(sd, h);
 	}
 
-	pi_buffer_free (buffer);
-
 	printf("Purge complete.\n");
 }
 
@@ -2342,6 +2708,9 @@ main(int argc, const char *argv[])
 		{"rom",       0 , POPT_ARG_NONE, NULL, MEDIA_FLASH, "Modifies -b, -u, and -s, to back up non-OS dbs from Flash ROM", NULL},
 		{"with-os",   0 , POPT_ARG_NONE, NULL, MEDIA_ROM, "Modifies -b, -u, and -s, to back up OS dbs from Flash ROM", NULL},
 		{"illegal",   0 , POPT_ARG_NONE, &unsaved, 0, "Modifies -b, -u, and -s, to back up the illegal database Unsaved Preferences.prc (normally skipped)", NULL},
+		{"diff",      0 , POPT_ARG_NONE, &install_diff, 0, "Modifies -i to send only the records and resources that changed", NULL},
+		{"manifest",  0 , POPT_ARG_STRING, &manifest_dir, 0, "Modifies -i like --diff, remembering what was installed in <dir>", "dir"},
+		{"store",     0 , POPT_ARG_STRING, &store_dir, 0, "Modifies -b, -u, -s and -r to keep the records in the deduplicating store <dir>", "dir"},
 
 		/* misc */
 		{"exec",     'x', POPT_ARG_STRING, NULL, 'x', "Execute a shell command for intermediate processing", "command"},
@@ -2515,6 +2884,24 @@ main(int argc, const char *argv[])
 			break;
 	}
 
+	if (store_dir)
+	{
+		if (palm_operation != palm_op_backup
+		    && palm_operation != palm_op_update
+		    && palm_operation != palm_op_sync
+		    && palm_operation != palm_op_restore)
+		{
+			fprintf(stderr,"   ERROR: --store only modifies -burs.\n");
+			return 1;
+		}
+		if ((store = pi_store_open(store_dir)) == NULL)
+		{
+			fprintf(stderr,"   ERROR: unable to open the store %s: %s\n",
+					store_dir, strerror(errno));
+			return 1;
+		}
+	}
+
 	/* plu_connect() prints diagnostics as needed, returns -1 on
 	failure so just bail in that case. */
 	sd = plu_connect();
@@ -2579,6 +2966,9 @@ main(int argc, const char *argv[])
 	if (sync_flags & PURGE)
 		palm_purge();
 
+	pi_store_close(store);
+	if (catalog != NULL)
+		pi_buffer_free(catalog);
 	pi_close(sd);
 	puts(gracias);
 	return 0;
@@ -26,11 +26,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "pi-header.h"
 #include "pi-socket.h"
 #include "pi-dlp.h"
 #include "pi-source.h"
+#include "pi-util.h"
 
 static const char *env_pilotport = "PILOTPORT";
 
@@ -187,6 +192,107 @@ int plu_protect_files(char *name, const char *extension, const size_t namelength
 }
 
 
+void plu_protect_name(char *d, const char *s)
+{
+	while (*s) {
+		switch (*s) {
+		case '/':
+			*(d++) = '=';
+			*(d++) = '2';
+			*(d++) = 'F';
+			break;
+		case '=':
+			*(d++) = '=';
+			*(d++) = '3';
+			*(d++) = 'D';
+			break;
+		case '\x0A':
+			*(d++) = '=';
+			*(d++) = '0';
+			*(d++) = 'A';
+			break;
+		case '\x0D':
+			*(d++) = '=';
+			*(d++) = '0';
+			*(d++) = 'D';
+			break;
+		default:
+			*(d++) = *s;
+		}
+		++s;
+	}
+	*d = '\0';
+}
+
+
+void plu_backup_name(char *name, const char *dirname,
+	const struct DBInfo *info)
+{
+	sprintf(name, "%s/", dirname);
+	plu_protect_name(name + strlen(name), info->name);
+
+	if (info->flags & dlpDBFlagResource) {
+		strcat(name, ".prc");
+	} else if ((info->flags & dlpDBFlagLaunchable) &&
+		   info->type == pi_mktag('p','q','a',' ')) {
+		strcat(name, ".pqa");
+	} else {
+		strcat(name, ".pdb");
+	}
+}
+
+
+int plu_backup_retrieve(int sd, const char *name, struct DBInfo *info,
+	int incremental, pi_file_t **pf)
+{
+	pi_file_t *previous = NULL;
+	int result;
+
+	/* Ensure that DB-open and DB-ReadOnly flags are not kept */
+	info->flags &= ~(dlpDBFlagOpen | dlpDBFlagReadOnly);
+
+	/* The database is retrieved in memory, so that the caller can
+	   write it while the next one comes over the link */
+	*pf = pi_file_create_buffered(name, info);
+	if (*pf == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	if (incremental)
+		previous = pi_file_open(name);
+
+	/* the records kept are copied into pf, so the earlier copy can go
+	   before pf is written over it */
+	result = pi_file_retrieve_incremental(*pf, previous, sd, 0, NULL);
+	if (previous)
+		pi_file_close(previous);
+
+	if (result < 0) {
+		/* nothing is written */
+		pi_file_close(*pf);
+		*pf = NULL;
+	}
+	return result;
+}
+
+
+long plu_backup_write(pi_file_t *pf, const char *name,
+	const struct DBInfo *info)
+{
+	struct stat sbuf;
+	struct utimbuf times;
+
+	/* if this fails, the earlier copy is still there as it was;
+	   pi_file_close() syncs the new one before it replaces it */
+	if (pi_file_close(pf) != 0 || stat(name, &sbuf) < 0)
+		return -1;
+
+	times.actime	= info->createDate;
+	times.modtime	= info->modifyDate;
+	utime(name, &times);
+
+	return (long)sbuf.st_size;
+}
+
 int plu_getromversion(int sd, plu_romversion_t *d)
 {
 	unsigned long ROMversion;
@@ -0,0 +1,273 @@
+/*
+ * arena-test.c:  Check pi_arena_t and the unpackers that allocate in one
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Packs addresses, contacts, appointments and calendar events, and checks
+ * that unpacking them in an arena gives what unpacking them with malloc()
+ * does, many records at a time, and that a reset reuses the memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-arena.h"
+#include "pi-address.h"
+#include "pi-calendar.h"
+#include "pi-contact.h"
+#include "pi-datebook.h"
+
+#define RECORDS	500
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static int
+same_string(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static void
+check_arena(void)
+{
+	pi_arena_t *arena = pi_arena_new(256);
+	pi_buffer_t *rec;
+	unsigned char *q;
+	char	*first,
+		*p,
+		*big;
+	int	i;
+
+	CHECK(arena != NULL);
+	first = pi_arena_alloc(arena, 3);
+	for (i = 0; i < 1000; i++) {
+		p = pi_arena_alloc(arena, i % 37 + 1);
+		CHECK(p != NULL && ((size_t) p % sizeof(void *)) == 0);
+		memset(p, 'x', i % 37 + 1);
+	}
+	big = pi_arena_alloc(arena, 10000);
+	CHECK(big != NULL);
+	memset(big, 'y', 10000);
+
+	p = pi_arena_strndup(arena, "abcdef", 3);
+	CHECK(p != NULL && strcmp(p, "abc") == 0);
+	p = pi_arena_strndup(arena, "ab\0cdef", 6);
+	CHECK(p != NULL && strcmp(p, "ab") == 0);
+	p = pi_arena_memdup(arena, "12345", 5);
+	CHECK(p != NULL && memcmp(p, "12345", 5) == 0);
+
+	/* strings of a record, the last one cut short by its end */
+	rec = pi_buffer_new(16);
+	pi_buffer_append(rec, "one\0two\0thr", 11);
+	q = rec->data;
+	p = pi_arena_unpack_string(arena, rec, &q);
+	CHECK(p != NULL && strcmp(p, "one") == 0 && q == rec->data + 4);
+	p = pi_arena_unpack_string(arena, rec, &q);
+	CHECK(p != NULL && strcmp(p, "two") == 0 && q == rec->data + 8);
+	p = pi_arena_unpack_string(arena, rec, &q);
+	CHECK(p != NULL && strcmp(p, "thr") == 0);
+	pi_buffer_free(rec);
+
+	/* the memory is handed out again from the start */
+	pi_arena_reset(arena);
+	CHECK(pi_arena_alloc(arena, 3) == first);
+	pi_arena_free(arena);
+
+	/* without an arena, it comes from malloc(), and there is nothing
+	   to reset */
+	pi_arena_reset(NULL);
+	p = pi_arena_strndup(NULL, "heap", 10);
+	CHECK(p != NULL && strcmp(p, "heap") == 0);
+	free(p);
+}
+
+static void
+check_address(pi_arena_t *arena)
+{
+	Address_t addr,
+		heap,
+		mine[RECORDS];
+	pi_buffer_t *buf[RECORDS];
+	char	text[RECORDS][32];
+	int	i,
+		j;
+
+	for (i = 0; i < RECORDS; i++) {
+		memset(&addr, 0, sizeof(addr));
+		sprintf(text[i], "Name %d", i);
+		addr.entry[entryLastname] = text[i];
+		addr.entry[entryCity] = "Springfield";
+		if (i % 3 == 0)
+			addr.entry[entryNote] = "A longer note about this one";
+		buf[i] = pi_buffer_new(64);
+		CHECK(pack_Address(&addr, buf[i], address_v1) == 0);
+	}
+
+	/* all of them stay valid until the reset */
+	for (i = 0; i < RECORDS; i++)
+		CHECK(unpack_Address_arena(&mine[i], buf[i], address_v1,
+			arena) == 0);
+	for (i = 0; i < RECORDS; i++) {
+		CHECK(unpack_Address(&heap, buf[i], address_v1) == 0);
+		for (j = 0; j < 19; j++)
+			CHECK(same_string(heap.entry[j], mine[i].entry[j]));
+		free_Address(&heap);
+		pi_buffer_free(buf[i]);
+	}
+	pi_arena_reset(arena);
+
+	/* a string cut by the end of the record isn't read past it */
+	buf[0] = pi_buffer_new(64);
+	memset(&addr, 0, sizeof(addr));
+	addr.entry[entryLastname] = "Truncated";
+	pack_Address(&addr, buf[0], address_v1);
+	buf[0]->used -= 4;
+	CHECK(unpack_Address_arena(&mine[0], buf[0], address_v1, arena) == 0);
+	CHECK(strcmp(mine[0].entry[entryLastname], "Trunca") == 0);
+	pi_buffer_free(buf[0]);
+	pi_arena_reset(arena);
+}
+
+static void
+check_appointment(pi_arena_t *arena)
+{
+	Appointment_t appt,
+		heap,
+		mine;
+	struct tm exceptions[3];
+	pi_buffer_t *buf = pi_buffer_new(64);
+	int	i;
+
+	memset(&appt, 0, sizeof(appt));
+	appt.begin.tm_year = 107;
+	appt.begin.tm_mon = 4;
+	appt.begin.tm_mday = 1;
+	appt.begin.tm_hour = 9;
+	appt.end = appt.begin;
+	appt.end.tm_hour = 10;
+	appt.repeatType = repeatDaily;
+	appt.repeatForever = 1;
+	appt.repeatFrequency = 1;
+	for (i = 0; i < 3; i++) {
+		exceptions[i] = appt.begin;
+		exceptions[i].tm_mday = 2 + i;
+	}
+	appt.exceptions = 3;
+	appt.exception = exceptions;
+	appt.description = "Stand-up";
+	appt.note = "Room 4";
+	CHECK(pack_Appointment(&appt, buf, datebook_v1) == 0);
+
+	CHECK(unpack_Appointment(&heap, buf, datebook_v1) == 0);
+	CHECK(unpack_Appointment_arena(&mine, buf, datebook_v1, arena) == 0);
+	CHECK(same_string(heap.description, mine.description));
+	CHECK(same_string(heap.note, mine.note));
+	CHECK(mine.exceptions == 3);
+	for (i = 0; i < 3 && i < mine.exceptions; i++)
+		CHECK(mine.exception[i].tm_mday == heap.exception[i].tm_mday);
+	free_Appointment(&heap);
+	pi_buffer_free(buf);
+	pi_arena_reset(arena);
+}
+
+static void
+check_calendar(pi_arena_t *arena)
+{
+	CalendarEvent_t event,
+		heap,
+		mine;
+	Blob_t	blob;
+	pi_buffer_t *buf = pi_buffer_new(64);
+
+	new_CalendarEvent(&event);
+	event.begin.tm_year = 107;
+	event.begin.tm_mon = 4;
+	event.begin.tm_mday = 1;
+	event.begin.tm_hour = 9;
+	event.end = event.begin;
+	event.end.tm_hour = 10;
+	event.repeatForever = 1;
+	event.description = "Review";
+	event.location = "Lab";
+	memcpy(blob.type, "Bd01", 4);
+	blob.length = 5;
+	blob.data = (uint8_t *) "12345";
+	event.blob[0] = &blob;
+	CHECK(pack_CalendarEvent(&event, buf, calendar_v1) == 0);
+
+	CHECK(unpack_CalendarEvent(&heap, buf, calendar_v1) == 0);
+	CHECK(unpack_CalendarEvent_arena(&mine, buf, calendar_v1, arena) == 0);
+	CHECK(same_string(heap.description, mine.description));
+	CHECK(same_string(heap.note, mine.note));
+	CHECK(same_string(heap.location, mine.location));
+	CHECK(mine.blob[0] != NULL && mine.blob[0]->length == 5
+		&& memcmp(mine.blob[0]->data, "12345", 5) == 0);
+	CHECK(mine.blob[1] == NULL && mine.tz == NULL);
+	free_CalendarEvent(&heap);
+	pi_buffer_free(buf);
+	pi_arena_reset(arena);
+}
+
+static void
+check_contact(pi_arena_t *arena)
+{
+	struct Contact contact,
+		heap,
+		mine;
+	pi_buffer_t *buf = pi_buffer_new(64);
+	int	i;
+
+	memset(&contact, 0, sizeof(contact));
+	contact.entry[contLastname] = "Doe";
+	contact.entry[contFirstname] = "Jane";
+	contact.entry[contCompany] = "Example";
+	contact.entry[contNote] = "Met at the show";
+	CHECK(pack_Contact(&contact, buf, contacts_v11) > 0);
+
+	CHECK(unpack_Contact(&heap, buf, contacts_v11) > 0);
+	CHECK(unpack_Contact_arena(&mine, buf, contacts_v11, arena) > 0);
+	for (i = 0; i < NUM_CONTACT_ENTRIES; i++)
+		CHECK(same_string(heap.entry[i], mine.entry[i]));
+	free_Contact(&heap);
+	pi_buffer_free(buf);
+	pi_arena_reset(arena);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pi_arena_t *arena = pi_arena_new(0);
+
+	check_arena();
+	check_address(arena);
+	check_appointment(arena);
+	check_calendar(arena);
+	check_contact(arena);
+	pi_arena_free(arena);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * catalog-test.c:  Check dlp_ReadDBCatalog() against a virtual handheld
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Creates more databases than fit in one list reply, and checks that the
+ * catalog has each of them once, in order, with the right sizes, and
+ * that an empty list reply gives an empty catalog.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-util.h"
+#include "vhandheld.h"
+
+#if HAVE_PTHREAD
+
+#define PORT		"loop:catalog-test"
+#define DATABASES	50
+#define RECSIZE		20
+
+int
+main(int argc, char *argv[])
+{
+	struct vh_device dev;
+	struct DBInfo *dbs;
+	struct DBSizeInfo *sizes;
+	vhandheld_t *vh;
+	pi_buffer_t *dblist,
+		*sizelist;
+	char	dir[] = "/tmp/catalogXXXXXX",
+		name[32];
+	unsigned char data[RECSIZE];
+	int	sd,
+		db,
+		base,
+		count,
+		i,
+		j;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	if ((vh = vh_new(dir)) == NULL
+	    || (sd = vh_start(&dev, vh, PORT)) < 0)
+		return 1;
+
+	dblist = pi_buffer_new(sizeof(struct DBInfo));
+	sizelist = pi_buffer_new(sizeof(struct DBSizeInfo));
+
+	/* whatever the device starts with */
+	base = dlp_ReadDBCatalog(sd, 0, dlpDBListRAM, dblist, NULL);
+	CHECK(base >= 0);
+	if (base < 0)
+		base = 0;
+
+	/* database i has i records */
+	memset(data, 'x', RECSIZE);
+	for (i = 0; i < DATABASES; i++) {
+		sprintf(name, "CatalogDB%02d", i);
+		CHECK(dlp_CreateDB(sd, pi_mktag('c', 't', 'l', 'g'),
+			pi_mktag('D', 'A', 'T', 'A'), 0, 0, 1, name, &db) >= 0);
+		for (j = 0; j < i; j++)
+			CHECK(dlp_WriteRecord(sd, db, 0, 0, 0, data, RECSIZE,
+				NULL) >= 0);
+		CHECK(dlp_CloseDB(sd, db) >= 0);
+	}
+
+	count = dlp_ReadDBCatalog(sd, 0, dlpDBListRAM, dblist, sizelist);
+	CHECK(count == base + DATABASES);
+	CHECK(dblist->used == count * sizeof(struct DBInfo));
+	CHECK(sizelist->used == count * sizeof(struct DBSizeInfo));
+
+	/* the new databases come last, in the order they were made */
+	dbs = (struct DBInfo *)dblist->data;
+	sizes = (struct DBSizeInfo *)sizelist->data;
+	for (i = 0; i < DATABASES && base + i < count; i++) {
+		sprintf(name, "CatalogDB%02d", i);
+		CHECK(strcmp(dbs[base + i].name, name) == 0);
+		CHECK(sizes[base + i].numRecords == (unsigned long)i);
+		CHECK(sizes[base + i].dataBytes
+			== (unsigned long)(i * RECSIZE));
+	}
+	for (i = 1; i < count; i++)
+		CHECK(dbs[i].index > dbs[i - 1].index);
+
+	/* ROM only: the device answers with an empty list */
+	CHECK(dlp_ReadDBCatalog(sd, 0, dlpDBListROM, dblist, sizelist) == 0);
+	CHECK(dblist->used == 0 && sizelist->used == 0);
+
+	pi_buffer_free(dblist);
+	pi_buffer_free(sizelist);
+
+	for (i = 0; i < DATABASES; i++) {
+		sprintf(name, "CatalogDB%02d", i);
+		dlp_DeleteDB(sd, 0, name);
+	}
+
+	CHECK(vh_finish(&dev, sd) >= 0);
+	vh_free(vh);
+	rmdir(dir);
+
+	return vh_failures ? 1 : 0;
+}
+
+#else
+VH_MAIN_WITHOUT_THREADS("catalog-test")
+#endif
@@ -0,0 +1,308 @@
+/*
+ * convert-bench.c:  Time the charset conversion of an address book
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Converts every field of every record of an AddressDB from CP1252 to
+ * UTF-8 three ways: opening an iconv converter for each string, as
+ * libpisync used to; with convert_FromPilotChar_WithCharset(); and one
+ * record at a time with convert_FromPilotChar_Strings(). Without a file,
+ * an address book of mostly ASCII names, phones and addresses with a
+ * few accented ones is made up.
+ *
+ * Usage: convert-bench [AddressDB.pdb | records]
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-address.h"
+#include "pi-file.h"
+#include "pi-util.h"
+
+#ifdef HAVE_ICONV
+#include <iconv.h>
+
+#define ROUNDS	5
+
+static const char *first[] = {
+	"John", "Mary", "Robert", "Linda", "Michael", "Susan", "David",
+	"Karen", "Jos\xe9", "Fran\xe7ois", "J\xfcrgen", "Ana", "Peter",
+	"Nancy", "Thomas", "Lisa", "Bj\xf6rn", "Chlo\xe9"
+};
+
+static const char *last[] = {
+	"Smith", "Johnson", "Williams", "Brown", "Jones", "Miller", "Davis",
+	"Wilson", "Anderson", "Taylor", "M\xfcller", "Garc\xed" "a", "Dubois",
+	"Nguyen", "Clark", "Lewis", "Walker", "\xc5str\xf6m"
+};
+
+static const char *street[] = {
+	"Main St", "Oak Ave", "Park Rd", "Elm St", "Cedar Ln", "Hauptstra\xdf" "e",
+	"Rue de la Paix", "Lake View Dr"
+};
+
+static const char *city[] = {
+	"Springfield", "Portland", "Austin", "Denver", "M\xfcnchen",
+	"Montr\xe9" "al", "Seattle", "Boston"
+};
+
+/* Packed records of the address book */
+static pi_buffer_t **records;
+static int record_count;
+
+static void
+add_record(pi_buffer_t *buf)
+{
+	pi_buffer_t *copy = pi_buffer_new(buf->used);
+
+	pi_buffer_append(copy, buf->data, buf->used);
+	records = realloc(records, (record_count + 1) * sizeof(*records));
+	records[record_count++] = copy;
+}
+
+static void
+make_up(int count)
+{
+	Address_t addr;
+	pi_buffer_t *buf = pi_buffer_new(256);
+	char	fields[19][64];
+	int	i,
+		j;
+
+	for (i = 0; i < count; i++) {
+		memset(&addr, 0, sizeof(addr));
+		for (j = 0; j < 19; j++)
+			addr.entry[j] = NULL;
+		for (j = 0; j < 5; j++)
+			addr.phoneLabel[j] = j;
+
+		strcpy(fields[entryLastname], last[i % 18]);
+		strcpy(fields[entryFirstname], first[(i / 18) % 18]);
+		sprintf(fields[entryPhone1], "(555) %03d-%04d", i % 1000,
+			(i * 37) % 10000);
+		sprintf(fields[entryPhone2], "555-%04d", (i * 91) % 10000);
+		sprintf(fields[entryPhone3], "%s.%s@example.com",
+			first[(i / 18) % 18], last[i % 18]);
+		sprintf(fields[entryAddress], "%d %s", 1 + i % 999,
+			street[i % 8]);
+		strcpy(fields[entryCity], city[(i / 8) % 8]);
+		strcpy(fields[entryState], "CA");
+		sprintf(fields[entryZip], "%05d", (i * 13) % 100000);
+		addr.entry[entryLastname] = fields[entryLastname];
+		addr.entry[entryFirstname] = fields[entryFirstname];
+		addr.entry[entryPhone1] = fields[entryPhone1];
+		addr.entry[entryPhone2] = fields[entryPhone2];
+		addr.entry[entryPhone3] = fields[entryPhone3];
+		addr.entry[entryAddress] = fields[entryAddress];
+		addr.entry[entryCity] = fields[entryCity];
+		addr.entry[entryState] = fields[entryState];
+		addr.entry[entryZip] = fields[entryZip];
+		if (i % 4 == 0) {
+			strcpy(fields[entryCompany], "Acme Widgets Inc.");
+			addr.entry[entryCompany] = fields[entryCompany];
+		}
+		if (i % 7 == 0) {
+			strcpy(fields[entryNote], "Met at the trade show,"
+				" call back about the spring order.");
+			addr.entry[entryNote] = fields[entryNote];
+		}
+
+		buf->used = 0;
+		pack_Address(&addr, buf, address_v1);
+		add_record(buf);
+	}
+	pi_buffer_free(buf);
+}
+
+static int
+load(const char *path)
+{
+	pi_file_t *pf;
+	pi_buffer_t *buf = pi_buffer_new(256);
+	void	*data;
+	size_t	size;
+	int	i,
+		count;
+
+	if ((pf = pi_file_open(path)) == NULL)
+		return -1;
+	pi_file_get_entries(pf, &count);
+	for (i = 0; i < count; i++) {
+		if (pi_file_read_record(pf, i, &data, &size, NULL, NULL,
+				NULL) < 0)
+			continue;
+		buf->used = 0;
+		pi_buffer_append(buf, data, size);
+		add_record(buf);
+	}
+	pi_file_close(pf);
+	pi_buffer_free(buf);
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* What convert_FromPilotChar_WithCharset() did before the converters
+   were kept open */
+static int
+convert_uncached(const char *ptext, int bytes, char **text)
+{
+	iconv_t	cd;
+	char	*ib,
+		*ob;
+	size_t	ibl,
+		obl;
+
+	if ((cd = iconv_open("UTF-8", "CP1252")) == (iconv_t)-1)
+		return -1;
+	ib	= (char *) ptext;
+	ibl	= bytes;
+	obl	= bytes * 4 + 1;
+	*text	= ob = malloc(obl);
+	if (iconv(cd, &ib, &ibl, &ob, &obl) == (size_t)-1) {
+		iconv_close(cd);
+		return -1;
+	}
+	*ob = '\0';
+	iconv_close(cd);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	Address_t *addrs;
+	pi_buffer_t *arena;
+	char	*out,
+		*outs[19];
+	double	start,
+		uncached,
+		cached,
+		bulk;
+	long	strings = 0,
+		bytes	= 0,
+		check[3] = { 0, 0, 0 };
+	int	i,
+		j,
+		r;
+
+	if (argc > 1 && load(argv[1]) == 0)
+		printf("%s: ", argv[1]);
+	else
+		make_up(argc > 1 ? atoi(argv[1]) : 5000);
+	printf("%d addresses\n", record_count);
+
+	addrs = calloc(record_count, sizeof(*addrs));
+	for (i = 0; i < record_count; i++) {
+		unpack_Address(&addrs[i], records[i], address_v1);
+		for (j = 0; j < 19; j++)
+			if (addrs[i].entry[j] != NULL) {
+				strings++;
+				bytes += strlen(addrs[i].entry[j]);
+			}
+	}
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < record_count; i++)
+			for (j = 0; j < 19; j++) {
+				if (addrs[i].entry[j] == NULL)
+					continue;
+				if (convert_uncached(addrs[i].entry[j],
+						strlen(addrs[i].entry[j]), &out) < 0)
+					return 1;
+				check[0] += strlen(out);
+				free(out);
+			}
+	uncached = now() - start;
+
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < record_count; i++)
+			for (j = 0; j < 19; j++) {
+				if (addrs[i].entry[j] == NULL)
+					continue;
+				if (convert_FromPilotChar_WithCharset("UTF-8",
+						addrs[i].entry[j],
+						strlen(addrs[i].entry[j]), &out,
+						"CP1252") < 0)
+					return 1;
+				check[1] += strlen(out);
+				free(out);
+			}
+	cached = now() - start;
+
+	arena = pi_buffer_new(4096);
+	start = now();
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < record_count; i++) {
+			arena->used = 0;
+			if (convert_FromPilotChar_Strings("UTF-8", 19,
+					addrs[i].entry, outs, arena,
+					"CP1252") < 0)
+				return 1;
+			for (j = 0; j < 19; j++)
+				if (outs[j] != NULL)
+					check[2] += strlen(outs[j]);
+		}
+	bulk = now() - start;
+	pi_buffer_free(arena);
+
+	printf("%ld strings, %ld bytes, converted %d times:\n",
+		strings, bytes, ROUNDS);
+	printf("   iconv_open per string    %8.3f s\n", uncached);
+	printf("   cached converter         %8.3f s, %5.1fx\n", cached,
+		uncached / cached);
+	printf("   one arena per record     %8.3f s, %5.1fx\n", bulk,
+		uncached / bulk);
+
+	if (check[0] != check[1] || check[0] != check[2]) {
+		fprintf(stderr, "convert-bench: the conversions differ\n");
+		return 1;
+	}
+
+	for (i = 0; i < record_count; i++) {
+		free_Address(&addrs[i]);
+		pi_buffer_free(records[i]);
+	}
+	free(addrs);
+	free(records);
+	return 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+	fprintf(stderr, "convert-bench: pilot-link was built without iconv\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * crc16-test.c:  Check crc16() against the bit-at-a-time CRC-CCITT
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * crc16() folds eight bytes per step through precomputed tables. This
+ * compares it with the original shift-and-xor loop on every length up
+ * to a few SLP packets, at every alignment, for several patterns.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+
+#define MAXLEN	1100
+
+/* The SLP CRC as libpisock always computed it, one bit at a time */
+static int
+crc16_bitwise(unsigned char *ptr, int count)
+{
+	int	crc,
+		i;
+
+	crc = 0;
+	while (--count >= 0) {
+		crc = crc ^ (int) *ptr++ << 8;
+		for (i = 0; i < 8; ++i)
+			if (crc & 0x8000)
+				crc = crc << 1 ^ 0x1021;
+			else
+				crc = crc << 1;
+	}
+	return (crc & 0xFFFF);
+}
+
+static void
+fill(unsigned char *buf, int len, int pattern)
+{
+	int	i;
+
+	for (i = 0; i < len; i++) {
+		switch (pattern) {
+		case 0:
+			buf[i] = 0;
+			break;
+		case 1:
+			buf[i] = 0xFF;
+			break;
+		case 2:
+			buf[i] = i & 0xFF;
+			break;
+		default:
+			buf[i] = rand() & 0xFF;
+			break;
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned char buf[MAXLEN + 8];
+	int	pattern,
+		offset,
+		len,
+		expected,
+		result,
+		failures = 0;
+
+	/* the CRC-16/XMODEM check value */
+	memcpy(buf, "123456789", 9);
+	if ((result = crc16(buf, 9)) != 0x31C3) {
+		printf("crc16(\"123456789\") = 0x%04x, expected 0x31c3\n",
+			result);
+		failures++;
+	}
+
+	srand(1);
+	for (pattern = 0; pattern < 4; pattern++) {
+		fill(buf, sizeof(buf), pattern);
+		for (offset = 0; offset < 8; offset++)
+			for (len = 0; len <= MAXLEN; len++) {
+				expected = crc16_bitwise(buf + offset, len);
+				result = crc16(buf + offset, len);
+				if (result != expected && failures++ < 10)
+					printf("pattern %d, offset %d, length %d:"
+						" 0x%04x, expected 0x%04x\n",
+						pattern, offset, len, result,
+						expected);
+			}
+	}
+
+	if (failures)
+		printf("crc16: %d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * date-test.c:  Check the date arithmetic of the unpackers against mktime()
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * With the timezone set to UTC, where mktime() does the same job, checks
+ * pi_days_from_civil() and pi_civil_from_days() on a few known dates and
+ * on every day of four centuries around 2000, and pi_normalize_tm() on
+ * dates with negative and out of range fields, including leap days and
+ * century years.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi-macros.h"
+
+#define DATES	20000
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Days since 1970-01-01 of a date, from mktime() */
+static long
+mktime_days(long year, int mon, int mday)
+{
+	struct tm t;
+	time_t	secs;
+
+	memset(&t, 0, sizeof(t));
+	t.tm_year = (int) (year - 1900);
+	t.tm_mon = mon - 1;
+	t.tm_mday = mday;
+	t.tm_hour = 12;
+	secs = mktime(&t);
+	return (long) ((secs - 12 * 3600) / 86400);
+}
+
+static void
+check_known(void)
+{
+	long	year;
+	int	mon,
+		mday;
+
+	CHECK(pi_days_from_civil(1970, 1, 1) == 0);
+	CHECK(pi_days_from_civil(1969, 12, 31) == -1);
+	CHECK(pi_days_from_civil(2000, 3, 1) == 11017);
+	CHECK(pi_days_from_civil(1900, 3, 1) == -25508);
+	CHECK(pi_days_from_civil(2100, 3, 1) == 47541);
+	CHECK(pi_days_from_civil(1600, 1, 1) == -135140);
+	CHECK(pi_days_from_civil(2400, 2, 29) == 157113);
+
+	/* days out of range carry into the neighbouring months */
+	CHECK(pi_days_from_civil(2000, 3, 0) == 11016);
+	CHECK(pi_days_from_civil(2000, 2, 30) == 11017);
+	CHECK(pi_days_from_civil(2000, 1, -30) == pi_days_from_civil(1999,
+		12, 1));
+
+	/* leap days of century years: 1900 and 2100 have none */
+	pi_civil_from_days(pi_days_from_civil(1900, 2, 29), &year, &mon,
+		&mday);
+	CHECK(year == 1900 && mon == 3 && mday == 1);
+	pi_civil_from_days(pi_days_from_civil(2100, 2, 29), &year, &mon,
+		&mday);
+	CHECK(year == 2100 && mon == 3 && mday == 1);
+	pi_civil_from_days(pi_days_from_civil(2000, 2, 29), &year, &mon,
+		&mday);
+	CHECK(year == 2000 && mon == 2 && mday == 29);
+	pi_civil_from_days(-135140, &year, &mon, &mday);
+	CHECK(year == 1600 && mon == 1 && mday == 1);
+}
+
+/* Every day from first to last year, one after the other, against
+   mktime() */
+static void
+check_every_day(long first, long last)
+{
+	struct tm t;
+	long	days,
+		year,
+		end;
+	int	mon,
+		mday,
+		wrong = 0;
+
+	days = pi_days_from_civil(first, 1, 1);
+	CHECK(days == mktime_days(first, 1, 1));
+	end = pi_days_from_civil(last + 1, 1, 1);
+	for (; days < end && wrong < 10; days++) {
+		pi_civil_from_days(days, &year, &mon, &mday);
+		memset(&t, 0, sizeof(t));
+		t.tm_year = (int) (first - 1900);
+		t.tm_mday = (int) (days - pi_days_from_civil(first, 1, 1)) + 1;
+		t.tm_hour = 12;
+		mktime(&t);
+		if (t.tm_year + 1900L != year || t.tm_mon + 1 != mon
+		    || t.tm_mday != mday
+		    || pi_days_from_civil(year, mon, mday) != days) {
+			printf("day %ld: %ld-%02d-%02d, mktime() gives "
+				"%d-%02d-%02d\n", days, year, mon, mday,
+				t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+			wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+static int
+random_field(int low, int high)
+{
+	return low + (int) (rand() % (high - low + 1));
+}
+
+/* Dates with fields out of range both ways, against mktime() */
+static void
+check_normalize(int first_year, int last_year)
+{
+	struct tm mine,
+		theirs;
+	int	i,
+		wrong = 0;
+
+	srand(4);
+	for (i = 0; i < DATES && wrong < 10; i++) {
+		memset(&mine, 0, sizeof(mine));
+		mine.tm_year = random_field(first_year, last_year) - 1900;
+		mine.tm_mon = random_field(-30, 30);
+		mine.tm_hour = random_field(-100, 100);
+		mine.tm_min = random_field(-3000, 3000);
+		mine.tm_sec = random_field(-100000, 100000);
+		switch (i % 4) {
+		case 0:
+			/* a leap day, or the day after it in other years */
+			mine.tm_mon = 1;
+			mine.tm_mday = 29;
+			mine.tm_hour = mine.tm_min = mine.tm_sec = 0;
+			break;
+		case 1:
+			/* a century year */
+			mine.tm_year = random_field((first_year + 99) / 100,
+				last_year / 100) * 100 - 1900;
+			mine.tm_mday = random_field(-400, 400);
+			break;
+		default:
+			mine.tm_mday = random_field(-1000, 1000);
+			break;
+		}
+		theirs = mine;
+		pi_normalize_tm(&mine, 0);
+		mktime(&theirs);
+		if (mine.tm_year != theirs.tm_year
+		    || mine.tm_mon != theirs.tm_mon
+		    || mine.tm_mday != theirs.tm_mday
+		    || mine.tm_hour != theirs.tm_hour
+		    || mine.tm_min != theirs.tm_min
+		    || mine.tm_sec != theirs.tm_sec
+		    || mine.tm_wday != theirs.tm_wday
+		    || mine.tm_yday != theirs.tm_yday) {
+			printf("date %d: %d-%02d-%02d %02d:%02d:%02d wday %d "
+				"yday %d, mktime() gives %d-%02d-%02d "
+				"%02d:%02d:%02d wday %d yday %d\n", i,
+				mine.tm_year + 1900, mine.tm_mon + 1,
+				mine.tm_mday, mine.tm_hour, mine.tm_min,
+				mine.tm_sec, mine.tm_wday, mine.tm_yday,
+				theirs.tm_year + 1900, theirs.tm_mon + 1,
+				theirs.tm_mday, theirs.tm_hour, theirs.tm_min,
+				theirs.tm_sec, theirs.tm_wday, theirs.tm_yday);
+			wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	setenv("TZ", "UTC", 1);
+	tzset();
+
+	check_known();
+	/* a 32-bit time_t only reaches from 1901 to 2038, and the fields
+	   out of range move dates by a few years */
+	if (sizeof(time_t) > 4) {
+		check_every_day(1800, 2200);
+		check_normalize(1600, 2400);
+	} else {
+		check_every_day(1902, 2037);
+		check_normalize(1910, 2030);
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * datebook-bench.c:  Time unpacking a large datebook
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Packs made-up appointments and calendar events (some of them repeating,
+ * with an end date and exceptions, and some on days like April 31st that
+ * need carrying) and unpacks them all, then unpacks them again and calls
+ * mktime() on each date, as the unpackers used to. Both are also timed in
+ * several threads at once. Last, in UTC, the dates the unpackers set are
+ * checked against those from mktime().
+ *
+ * Usage: datebook-bench [events]
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-arena.h"
+#include "pi-calendar.h"
+#include "pi-datebook.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+#define THREADS	4
+#endif
+
+/* Packed records */
+static pi_buffer_t **appointments,
+	**events;
+static int count;
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+make_up(void)
+{
+	Appointment_t appt;
+	CalendarEvent_t event;
+	struct tm exceptions[3];
+	int	i,
+		j;
+
+	appointments = malloc(count * sizeof(*appointments));
+	events = malloc(count * sizeof(*events));
+	for (i = 0; i < count; i++) {
+		memset(&appt, 0, sizeof(appt));
+		appt.begin.tm_year = 95 + i % 36;
+		appt.begin.tm_mon = (i / 36) % 12;
+		appt.begin.tm_mday = 1 + (i * 7) % 31;
+		appt.begin.tm_hour = (i * 5) % 24;
+		appt.begin.tm_min = (i % 4) * 15;
+		appt.end = appt.begin;
+		appt.end.tm_hour = (appt.begin.tm_hour + 1) % 24;
+		appt.event = i % 10 == 0;
+		appt.description = "Made up";
+		if (i % 3 == 0) {
+			appt.repeatType = i % 2 ? repeatDaily : repeatWeekly;
+			appt.repeatDays[i % 7] = 1;
+			appt.repeatFrequency = 1;
+			appt.repeatEnd = appt.begin;
+			appt.repeatEnd.tm_year++;
+			appt.repeatEnd.tm_mday = 1 + i % 31;
+			for (j = 0; j < 3; j++) {
+				exceptions[j] = appt.begin;
+				exceptions[j].tm_mday += 7 * (j + 1);
+				pi_normalize_tm(&exceptions[j], 0);
+			}
+			appt.exceptions = 3;
+			appt.exception = exceptions;
+		}
+		appointments[i] = pi_buffer_new(64);
+		pack_Appointment(&appt, appointments[i], datebook_v1);
+
+		new_CalendarEvent(&event);
+		event.event = appt.event;
+		event.begin = appt.begin;
+		event.end = appt.end;
+		event.repeatType = (enum calendarRepeatType) appt.repeatType;
+		memcpy(event.repeatDays, appt.repeatDays,
+			sizeof(event.repeatDays));
+		event.repeatFrequency = appt.repeatFrequency;
+		event.repeatForever = appt.repeatType == repeatNone;
+		event.repeatEnd = appt.repeatEnd;
+		event.exceptions = appt.exceptions;
+		event.exception = appt.exception;
+		event.description = "Made up";
+		event.location = "Here";
+		events[i] = pi_buffer_new(64);
+		pack_CalendarEvent(&event, events[i], calendar_v1);
+	}
+}
+
+static void
+with_mktime(struct tm *begin, struct tm *end, struct tm *repeatEnd,
+	int repeatForever, struct tm *exception, int exceptions)
+{
+	int	i;
+
+	mktime(begin);
+	mktime(end);
+	if (!repeatForever)
+		mktime(repeatEnd);
+	for (i = 0; i < exceptions; i++)
+		mktime(&exception[i]);
+}
+
+/* Unpacks every record, calling mktime() on the dates as well if asked,
+   and returns the sum of the days of the week to keep the compiler from
+   dropping the work */
+static long
+unpack_all(int mktime_too)
+{
+	Appointment_t appt;
+	CalendarEvent_t event;
+	pi_arena_t *arena = pi_arena_new(0);
+	long	sum = 0;
+	int	i;
+
+	for (i = 0; i < count; i++) {
+		pi_arena_reset(arena);
+		unpack_Appointment_arena(&appt, appointments[i], datebook_v1,
+			arena);
+		if (mktime_too)
+			with_mktime(&appt.begin, &appt.end, &appt.repeatEnd,
+				appt.repeatType == repeatNone
+				|| appt.repeatForever,
+				appt.exception, appt.exceptions);
+		sum += appt.begin.tm_wday;
+
+		unpack_CalendarEvent_arena(&event, events[i], calendar_v1,
+			arena);
+		if (mktime_too)
+			with_mktime(&event.begin, &event.end, &event.repeatEnd,
+				event.repeatType == calendarRepeatNone
+				|| event.repeatForever,
+				event.exception, event.exceptions);
+		sum += event.begin.tm_wday;
+	}
+	pi_arena_free(arena);
+	return sum;
+}
+
+#if HAVE_PTHREAD
+static void *
+unpack_thread(void *mktime_too)
+{
+	unpack_all(mktime_too != NULL);
+	return NULL;
+}
+
+static double
+unpack_threads(int mktime_too)
+{
+	pthread_t threads[THREADS];
+	double	start = now();
+	int	i;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, unpack_thread,
+			mktime_too ? &threads[i] : NULL);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	return now() - start;
+}
+#endif
+
+static int
+same_tm(const struct tm *a, const struct tm *b)
+{
+	return a->tm_year == b->tm_year && a->tm_mon == b->tm_mon
+		&& a->tm_mday == b->tm_mday && a->tm_hour == b->tm_hour
+		&& a->tm_min == b->tm_min && a->tm_sec == b->tm_sec
+		&& a->tm_wday == b->tm_wday && a->tm_yday == b->tm_yday;
+}
+
+/* Returns the number of dates that differ from mktime()'s */
+static int
+check(void)
+{
+	Appointment_t appt;
+	struct tm t;
+	pi_arena_t *arena = pi_arena_new(0);
+	int	i,
+		j,
+		differ	= 0;
+
+	setenv("TZ", "UTC", 1);
+	tzset();
+	for (i = 0; i < count; i++) {
+		pi_arena_reset(arena);
+		unpack_Appointment_arena(&appt, appointments[i], datebook_v1,
+			arena);
+		t = appt.begin;
+		mktime(&t);
+		differ += !same_tm(&t, &appt.begin);
+		t = appt.end;
+		mktime(&t);
+		differ += !same_tm(&t, &appt.end);
+		if (appt.repeatType != repeatNone && !appt.repeatForever) {
+			t = appt.repeatEnd;
+			mktime(&t);
+			differ += !same_tm(&t, &appt.repeatEnd);
+		}
+		for (j = 0; j < appt.exceptions; j++) {
+			t = appt.exception[j];
+			mktime(&t);
+			differ += !same_tm(&t, &appt.exception[j]);
+		}
+	}
+	pi_arena_free(arena);
+	return differ;
+}
+
+static void
+report(const char *what, int records, double seconds, double before)
+{
+	printf("   %-30s %8.3f s, %8.0f records per second, %5.1fx\n", what,
+		seconds, records / seconds, before / seconds);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double	start,
+		before,
+		after;
+	int	differ,
+		i;
+
+	count = argc > 1 ? atoi(argv[1]) : 50000;
+	if (count <= 0)
+		return 1;
+	make_up();
+	printf("%d appointments and %d calendar events:\n", count, count);
+
+	start = now();
+	unpack_all(1);
+	before = now() - start;
+	start = now();
+	unpack_all(0);
+	after = now() - start;
+	report("unpack + mktime (as before)", 2 * count, before, before);
+	report("unpack", 2 * count, after, before);
+
+#if HAVE_PTHREAD
+	printf("%d threads at once:\n", THREADS);
+	before = unpack_threads(1);
+	after = unpack_threads(0);
+	report("unpack + mktime (as before)", 2 * count * THREADS, before,
+		before);
+	report("unpack", 2 * count * THREADS, after, before);
+#endif
+
+	differ = check();
+	if (differ)
+		fprintf(stderr, "datebook-bench: %d dates differ from mktime()\n",
+			differ);
+
+	for (i = 0; i < count; i++) {
+		pi_buffer_free(appointments[i]);
+		pi_buffer_free(events[i]);
+	}
+	free(appointments);
+	free(events);
+	return differ ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * event-test.c:  Check the event loop and its timer wheel
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Watches pipes whose descriptor numbers go past FD_SETSIZE, and runs
+ * timers that expire in order, get cancelled, or lie more than a turn
+ * of the wheel away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+
+#include "pi-event.h"
+
+#define PIPES	8
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static long
+now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000L;
+}
+
+/* Descriptors: read one byte, stop watching at end of file */
+static int reads = 0;
+
+static void
+on_read(pi_event_loop_t *loop, int fd, int events, void *userdata)
+{
+	char	c;
+
+	CHECK(events & PI_EVENT_READ);
+	if (read(fd, &c, 1) == 1) {
+		CHECK(c == *(char *)userdata);
+		reads++;
+	} else {
+		pi_event_remove(loop, fd);
+		close(fd);
+	}
+}
+
+/* Timers: record when and in which order they expire */
+struct fired {
+	int	id,
+		due;		/* ms after start */
+	long	at;
+};
+
+static struct fired order[16];
+static int nfired = 0;
+static long start;
+static pi_event_timer_t *same_tick[2];	/* timers 1 and 2 */
+
+static void
+on_timer(pi_event_loop_t *loop, pi_event_timer_t *timer, void *userdata)
+{
+	struct fired *f = (struct fired *)userdata;
+
+	f->at = now_ms() - start;
+	order[nfired++] = *f;
+	if (f->id == 1 || f->id == 2) {
+		/* whichever runs first cancels the other, due at the
+		   same tick and already taken off the wheel */
+		same_tick[f->id - 1] = NULL;
+		if (same_tick[2 - f->id] != NULL) {
+			pi_event_timer_cancel(loop, same_tick[2 - f->id]);
+			same_tick[2 - f->id] = NULL;
+		}
+	}
+}
+
+static void
+on_stop(pi_event_loop_t *loop, pi_event_timer_t *timer, void *userdata)
+{
+	pi_event_loop_stop(loop);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct fired timers[] = {
+		{ 0, 30 }, { 1, 60 }, { 2, 60 }, { 3, 0 }, { 4, 5300 }
+	};
+	static char tags[PIPES];
+	pi_event_loop_t *loop;
+	pi_event_timer_t *t;
+	struct rlimit rl;
+	int	fds[2],
+		writers[PIPES],
+		i;
+
+	loop = pi_event_loop_new();
+	CHECK(loop != NULL);
+	if (loop == NULL)
+		return 1;
+
+	/* descriptors above FD_SETSIZE, where select() can't go */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0
+	    && rl.rlim_cur < FD_SETSIZE + 2 * PIPES + 16
+	    && rl.rlim_max >= FD_SETSIZE + 2 * PIPES + 16) {
+		rl.rlim_cur = FD_SETSIZE + 2 * PIPES + 16;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	for (i = 0; i < PIPES; i++) {
+		CHECK(pipe(fds) == 0);
+		if (i % 2 && dup2(fds[0], FD_SETSIZE + i) == FD_SETSIZE + i) {
+			close(fds[0]);
+			fds[0] = FD_SETSIZE + i;
+		}
+		tags[i] = 'a' + i;
+		writers[i] = fds[1];
+		CHECK(pi_event_add(loop, fds[0], PI_EVENT_READ, on_read,
+			&tags[i]) == 0);
+		CHECK(pi_event_add(loop, fds[0], PI_EVENT_READ, on_read,
+			&tags[i]) < 0);
+		CHECK(pi_event_wait(fds[0], PI_EVENT_READ, 1) == 0);
+	}
+	for (i = 0; i < PIPES; i++) {
+		CHECK(write(writers[i], &tags[i], 1) == 1);
+		CHECK(write(writers[i], &tags[i], 1) == 1);
+		close(writers[i]);
+	}
+	CHECK(pi_event_loop_run(loop) == 0);
+	CHECK(reads == 2 * PIPES);
+
+	/* timers */
+	start = now_ms();
+	for (i = 0; i < (int) (sizeof(timers) / sizeof(timers[0])); i++) {
+		t = pi_event_timer_add(loop, timers[i].due, on_timer,
+			&timers[i]);
+		CHECK(t != NULL);
+		if (timers[i].id == 1 || timers[i].id == 2)
+			same_tick[timers[i].id - 1] = t;
+	}
+	t = pi_event_timer_add(loop, 100000, on_stop, NULL);
+	pi_event_timer_cancel(loop, t);
+	CHECK(pi_event_loop_run(loop) == 0);
+
+	CHECK(nfired == 4);
+	for (i = 0; i < nfired; i++) {
+		CHECK(order[i].at >= order[i].due);
+		if (i > 0)
+			CHECK(order[i].due >= order[i - 1].due);
+	}
+	if (nfired == 4) {
+		CHECK(order[0].id == 3);
+		CHECK(order[1].id == 0);
+		CHECK(order[3].id == 4);
+	}
+
+	/* stop from a handler, with a timer left pending */
+	pi_event_timer_add(loop, 10, on_stop, NULL);
+	pi_event_timer_add(loop, 60000, on_stop, NULL);
+	start = now_ms();
+	CHECK(pi_event_loop_run(loop) == 0);
+	CHECK(now_ms() - start < 1000);
+
+	pi_event_loop_free(loop);
+
+	if (failures)
+		printf("event: %d failures\n", failures);
+	return failures ? 1 : 0;
+}
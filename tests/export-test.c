@@ -0,0 +1,203 @@
+/*
+ * export-test.c:  Check that the export pool keeps queue order
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Queues pictures on pools of several jobs, the later ones quicker to
+ * convert than the earlier ones so that they finish first, some of them
+ * failing. Checks that the pictures are converted at the same time, that
+ * the completion callbacks run on the queueing thread, in queue order,
+ * after their work, and that what they print comes out in that order.
+ * Also checks a pool of one job, and the record sets pictures are read
+ * into.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pi-export.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+#define PICTURES	40
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+struct picture {
+	int	number,
+		written;
+	char	text[32];		/* what converting it gave */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t queueing;
+static int running,			/* pictures being converted */
+	most_running,
+	done_count,
+	out_of_order;
+static FILE *out;
+
+static int
+convert(void *arg)
+{
+	struct picture *pic = (struct picture *)arg;
+
+	pthread_mutex_lock(&lock);
+	if (++running > most_running)
+		most_running = running;
+	pthread_mutex_unlock(&lock);
+
+	/* the later pictures are done first */
+	usleep((PICTURES - pic->number) * 1000);
+	sprintf(pic->text, "picture %d\n", pic->number);
+	pic->written = 1;
+
+	pthread_mutex_lock(&lock);
+	running--;
+	pthread_mutex_unlock(&lock);
+
+	return pic->number % 7 == 3 ? -1 : 0;
+}
+
+static void
+done(void *arg, int result)
+{
+	struct picture *pic = (struct picture *)arg;
+
+	CHECK(pthread_equal(pthread_self(), queueing));
+	CHECK(pic->written);
+	CHECK(result == (pic->number % 7 == 3 ? -1 : 0));
+	if (pic->number != done_count)
+		out_of_order++;
+	done_count++;
+	fputs(pic->text, out);
+	free(pic);
+}
+
+/* Queue the pictures on a pool of jobs, and return how many of them
+   were converted at the same time at most */
+static int
+check_pool(int jobs)
+{
+	pi_export_t *pool;
+	struct picture *pic;
+	char	line[32];
+	int	i,
+		expected_failures = 0;
+
+	running		= 0;
+	most_running	= 0;
+	done_count	= 0;
+	out_of_order	= 0;
+	out = tmpfile();
+	CHECK(out != NULL);
+	if (out == NULL)
+		return 0;
+
+	pool = pi_export_new(jobs);
+	CHECK(pool != NULL);
+	if (pool == NULL)
+		return 0;
+	for (i = 0; i < PICTURES; i++) {
+		pic = calloc(1, sizeof(struct picture));
+		pic->number = i;
+		if (i % 7 == 3)
+			expected_failures++;
+		CHECK(pi_export_queue(pool, convert, done, pic) == 0);
+		/* at most twice as many in flight as there are jobs */
+		CHECK(i + 1 - done_count <= 2 * jobs);
+	}
+	CHECK(pi_export_finish(pool) == expected_failures);
+	CHECK(done_count == PICTURES);
+	CHECK(out_of_order == 0);
+
+	rewind(out);
+	for (i = 0; i < PICTURES; i++) {
+		sprintf(line, "picture %d\n", i);
+		if (fgets(line + 16, 16, out) == NULL
+		    || strcmp(line, line + 16) != 0)
+			break;
+	}
+	CHECK(i == PICTURES);
+	CHECK(fgetc(out) == EOF);
+	fclose(out);
+
+	return most_running;
+}
+
+static void
+check_records(void)
+{
+	pi_export_records_t *records;
+	void	*data;
+	size_t	size;
+
+	records = pi_export_records_new();
+	CHECK(records != NULL);
+	if (records == NULL)
+		return;
+	CHECK(pi_export_records_count(records) == 0);
+	CHECK(pi_export_records_add(records, "first", 5) == 0);
+	CHECK(pi_export_records_add(records, "", 0) == 1);
+	CHECK(pi_export_records_add(records, "third", 6) == 2);
+	CHECK(pi_export_records_count(records) == 3);
+	CHECK(pi_export_records_get(records, 0, &data, &size) == 0
+		&& size == 5 && memcmp(data, "first", 5) == 0);
+	CHECK(pi_export_records_get(records, 1, &data, &size) == 0
+		&& size == 0);
+	CHECK(pi_export_records_get(records, 2, &data, &size) == 0
+		&& size == 6 && strcmp(data, "third") == 0);
+	CHECK(pi_export_records_get(records, 3, &data, &size) < 0);
+	CHECK(pi_export_records_get(records, -1, &data, &size) < 0);
+	pi_export_records_free(records);
+}
+
+int
+main(int argc, char *argv[])
+{
+	queueing = pthread_self();
+
+	CHECK(check_pool(4) > 1);
+	CHECK(check_pool(2) > 1);
+	/* one job runs each picture as it is queued */
+	CHECK(check_pool(1) == 1);
+	check_records();
+
+	return failures ? 1 : 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+	return 77;
+}
+
+#endif
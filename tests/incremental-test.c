@@ -0,0 +1,338 @@
+/*
+ * incremental-test.c:  Check pi_file_retrieve_incremental() against a
+ *                      virtual handheld
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Backs a database up, changes it on the handheld, and checks that an
+ * incremental backup only reads the dirty records yet gives the same
+ * file as a full one; and that it reads everything once the dirty flags
+ * were reset behind its back. Also checks that a failed retrieve leaves
+ * the earlier file alone, and that a buffered file too big to keep in
+ * memory is written right.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-util.h"
+#include "vhandheld.h"
+
+#if HAVE_PTHREAD
+
+#define PORT	"loop:incremental-test"
+#define NAME	"IncrementalDB"
+#define RECORDS	400
+#define RECSIZE	150
+
+/* Records read by the last retrieve */
+static int read_records;
+
+static int
+progress(int sd, pi_progress_t *p)
+{
+	read_records = p->data.db.transferred_records;
+	return PI_TRANSFER_CONTINUE;
+}
+
+/* Back the database up to path, incrementally from previous if given */
+static void
+retrieve(int sd, const char *path, const char *previous)
+{
+	struct DBInfo info;
+	pi_file_t *pf,
+		*prev = NULL;
+
+	read_records = 0;
+	CHECK(dlp_FindDBByName(sd, 0, NAME, NULL, NULL, &info, NULL) >= 0);
+	if (previous != NULL)
+		CHECK((prev = pi_file_open(previous)) != NULL);
+	pf = pi_file_create(path, &info);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return;
+	CHECK(pi_file_retrieve_incremental(pf, prev, sd, 0, progress) >= 0);
+	if (prev != NULL)
+		pi_file_close(prev);
+	CHECK(pi_file_close(pf) == 0);
+}
+
+/* Count the files in a directory */
+static int
+count_files(const char *path)
+{
+	DIR	*dir = opendir(path);
+	struct dirent *entry;
+	int	count = 0;
+
+	if (dir == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL)
+		if (entry->d_name[0] != '.')
+			count++;
+	closedir(dir);
+	return count;
+}
+
+/* Write a buffered file with more data than it keeps in memory, and
+   read it back after discarding another one written over it */
+static void
+check_big_buffered(const char *path)
+{
+	static unsigned char big[8192];
+	struct DBInfo info;
+	pi_file_t *pf;
+	void	*data;
+	size_t	size;
+	int	i,
+		count;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "BigDB");
+	info.type	= pi_mktag('D', 'A', 'T', 'A');
+	info.creator	= pi_mktag('i', 'n', 'c', 'r');
+	pf = pi_file_create_buffered(path, &info);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return;
+	for (i = 0; i < 300; i++) {
+		memset(big, i, sizeof(big));
+		CHECK(pi_file_append_record(pf, big, sizeof(big), 0, 0,
+			0x1000 + i) >= 0);
+		if (i == 0)
+			CHECK(pi_file_get_buffered_size(pf) == sizeof(big));
+	}
+	CHECK(pi_file_get_buffered_size(pf) == 0);
+	CHECK(pi_file_close(pf) == 0);
+
+	/* a discarded file leaves the one written alone */
+	pf = pi_file_create_buffered(path, &info);
+	CHECK(pf != NULL);
+	if (pf != NULL) {
+		CHECK(pi_file_append_record(pf, big, 10, 0, 0, 0x1000) >= 0);
+		pi_file_discard(pf);
+	}
+
+	pf = pi_file_open(path);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return;
+	pi_file_get_entries(pf, &count);
+	CHECK(count == 300);
+	for (i = 0; i < count; i++) {
+		memset(big, i, sizeof(big));
+		CHECK(pi_file_read_record(pf, i, &data, &size, NULL, NULL,
+			NULL) == 0 && size == sizeof(big)
+			&& memcmp(data, big, size) == 0);
+	}
+	pi_file_close(pf);
+	unlink(path);
+}
+
+/* Check that two files hold the same records */
+static void
+check_same(const char *path, const char *path2)
+{
+	pi_file_t *pf,
+		*pf2;
+	void	*data,
+		*data2;
+	size_t	size,
+		size2;
+	int	i,
+		count,
+		count2,
+		attr,
+		attr2,
+		category,
+		category2;
+	recordid_t uid,
+		uid2;
+
+	pf = pi_file_open(path);
+	pf2 = pi_file_open(path2);
+	CHECK(pf != NULL && pf2 != NULL);
+	if (pf == NULL || pf2 == NULL)
+		return;
+
+	pi_file_get_app_info(pf, &data, &size);
+	pi_file_get_app_info(pf2, &data2, &size2);
+	CHECK(size == size2 && memcmp(data, data2, size) == 0);
+
+	pi_file_get_entries(pf, &count);
+	pi_file_get_entries(pf2, &count2);
+	CHECK(count == count2);
+	for (i = 0; i < count && i < count2; i++) {
+		pi_file_read_record(pf, i, &data, &size, &attr, &category,
+			&uid);
+		pi_file_read_record(pf2, i, &data2, &size2, &attr2,
+			&category2, &uid2);
+		CHECK(uid == uid2 && attr == attr2 && category == category2);
+		CHECK(size == size2 && memcmp(data, data2, size) == 0);
+	}
+	pi_file_close(pf);
+	pi_file_close(pf2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vh_device dev;
+	struct DBInfo info;
+	vhandheld_t *vh;
+	pi_file_t *pf;
+	char	dir[] = "/tmp/incrementalXXXXXX",
+		full[sizeof(dir) + 16],
+		incr[sizeof(dir) + 16],
+		prev[sizeof(dir) + 16];
+	unsigned char data[RECSIZE];
+	recordid_t uid;
+	int	sd,
+		db,
+		i;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	sprintf(full, "%s/full.pdb", dir);
+	sprintf(incr, "%s/incr.pdb", dir);
+	sprintf(prev, "%s/prev.pdb", dir);
+
+	check_big_buffered(full);
+
+	/* the database to install */
+	pf = vh_make_db(prev, NAME, pi_mktag('i', 'n', 'c', 'r'), 0);
+	if (pf == NULL)
+		return 1;
+	for (i = 0; i < RECORDS; i++)
+		vh_add_record(pf, i, RECSIZE, i % 5, 0x3000 + i);
+	pi_file_get_info(pf, &info);
+	CHECK(pi_file_close(pf) == 0);
+
+	sprintf(full, "%s/device", dir);
+	mkdir(full, 0700);
+	vh = vh_new(full);
+	rmdir(full);
+	if (vh == NULL || (sd = vh_start(&dev, vh, PORT)) < 0)
+		return 1;
+	sprintf(full, "%s/full.pdb", dir);
+
+	pf = pi_file_open(prev);
+	CHECK(pf != NULL && pi_file_install(pf, sd, 0, NULL) >= 0);
+	if (pf != NULL)
+		pi_file_close(pf);
+
+	/* the first backup has nothing to start from */
+	retrieve(sd, prev, NULL);
+	CHECK(read_records == RECORDS);
+
+	/* a retrieve that fails leaves the earlier file alone, and no
+	   temporary file behind */
+	info.flags = 0;
+	strcpy(info.name, "NoSuchDB");
+	pf = pi_file_create(prev, &info);
+	CHECK(pf != NULL);
+	if (pf != NULL) {
+		CHECK(pi_file_retrieve(pf, sd, 0, NULL) < 0);
+		CHECK(pi_file_close(pf) != 0);
+	}
+	CHECK(count_files(dir) == 1);
+	pf = pi_file_open(prev);
+	CHECK(pf != NULL);
+	if (pf != NULL) {
+		pi_file_get_entries(pf, &i);
+		CHECK(i == RECORDS);
+		pi_file_close(pf);
+	}
+
+	/* one record edited, one added, one deleted, one deleted but
+	   kept for the desktop */
+	CHECK(dlp_OpenDB(sd, 0, dlpOpenReadWrite, NAME, &db) >= 0);
+	vh_fill(data, RECSIZE, 5000);
+	CHECK(dlp_WriteRecord(sd, db, dlpRecAttrDirty, 0x3000 + 10, 2,
+		data, RECSIZE, NULL) >= 0);
+	vh_fill(data, RECSIZE, 6000);
+	CHECK(dlp_WriteRecord(sd, db, dlpRecAttrDirty, 0, 1, data, RECSIZE,
+		&uid) >= 0);
+	CHECK(dlp_DeleteRecord(sd, db, 0, 0x3000 + 20) >= 0);
+	vh_fill(data, RECSIZE, 30);
+	CHECK(dlp_WriteRecord(sd, db, dlpRecAttrDirty | dlpRecAttrDeleted,
+		0x3000 + 30, 0, data, RECSIZE, NULL) >= 0);
+	CHECK(dlp_CloseDB(sd, db) >= 0);
+
+	/* only the dirty records are read */
+	retrieve(sd, incr, prev);
+	CHECK(read_records == 3);
+	retrieve(sd, full, NULL);
+	CHECK(read_records == RECORDS);
+	check_same(full, incr);
+
+	/* written over the earlier copy */
+	retrieve(sd, prev, prev);
+	CHECK(read_records == 3);
+	check_same(full, prev);
+
+	/* the first record edited as well */
+	CHECK(dlp_OpenDB(sd, 0, dlpOpenReadWrite, NAME, &db) >= 0);
+	vh_fill(data, RECSIZE, 8000);
+	CHECK(dlp_WriteRecord(sd, db, dlpRecAttrDirty, 0x3000, 4, data,
+		RECSIZE, NULL) >= 0);
+	CHECK(dlp_CloseDB(sd, db) >= 0);
+	retrieve(sd, incr, prev);
+	CHECK(read_records == 4);
+	retrieve(sd, full, NULL);
+	check_same(full, incr);
+	retrieve(sd, prev, prev);
+	check_same(full, prev);
+
+	/* a sync resets the flags, and a record changes without them:
+	   the backup date tells, and everything is read */
+	CHECK(dlp_OpenDB(sd, 0, dlpOpenReadWrite, NAME, &db) >= 0);
+	CHECK(dlp_ResetSyncFlags(sd, db) >= 0);
+	vh_fill(data, RECSIZE, 7000);
+	CHECK(dlp_WriteRecord(sd, db, 0, 0x3000 + 50, 3, data, RECSIZE,
+		NULL) >= 0);
+	CHECK(dlp_CloseDB(sd, db) >= 0);
+	retrieve(sd, incr, prev);
+	CHECK(read_records == RECORDS);
+	retrieve(sd, full, NULL);
+	check_same(full, incr);
+
+	CHECK(vh_finish(&dev, sd) >= 0);
+	vh_free(vh);
+
+	unlink(full);
+	unlink(incr);
+	unlink(prev);
+	rmdir(dir);
+
+	return vh_failures ? 1 : 0;
+}
+
+#else
+VH_MAIN_WITHOUT_THREADS("incremental-test")
+#endif
@@ -0,0 +1,350 @@
+/*
+ * install-diff-test.c:  Check pi_file_install_diff() against a virtual
+ *                       handheld
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Installs two versions of a record database and of a resource database
+ * over each other, with and without a manifest, and checks that only
+ * the records and resources that differ are sent, and that the
+ * handheld ends up with the same database as a full install would
+ * give. Also checks that a manifest saved for another handheld isn't
+ * used, and that a stopped install leaves the database there.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-util.h"
+#include "vhandheld.h"
+
+#if HAVE_PTHREAD
+
+#define PORT	"loop:install-diff-test"
+#define RECORDS	500
+#define RECSIZE	200
+
+/* What the last install sent */
+static int sent_records,
+	sent_bytes;
+
+/* Records after which to stop an install, 0 to let it finish */
+static int stop_after = 0;
+
+static int
+progress(int sd, pi_progress_t *p)
+{
+	sent_records	= p->data.db.transferred_records;
+	sent_bytes	= p->transferred_bytes;
+	if (stop_after > 0 && sent_records >= stop_after)
+		return PI_TRANSFER_STOP;
+	return PI_TRANSFER_CONTINUE;
+}
+
+/* Make a manifest claim another modification number */
+static void
+set_manifest_modnum(const char *path, unsigned long modnum)
+{
+	static char text[65536];
+	char	*p,
+		*end;
+	FILE	*f;
+	size_t	size;
+
+	CHECK((f = fopen(path, "r")) != NULL);
+	if (f == NULL)
+		return;
+	size = fread(text, 1, sizeof(text) - 1, f);
+	text[size] = '\0';
+	fclose(f);
+
+	p = strstr(text, " modnum ");
+	CHECK(p != NULL);
+	if (p == NULL)
+		return;
+	p += 8;
+	strtoul(p, &end, 10);
+
+	CHECK((f = fopen(path, "w")) != NULL);
+	if (f == NULL)
+		return;
+	fprintf(f, "%.*s%lu%s", (int)(p - text), text, modnum, end);
+	fclose(f);
+}
+
+/* Version 1 of each database, or version 2: record 10 changed, 20
+   gone, 30 in another category, one more at the end; resource 3
+   changed and 7 gone */
+static void
+make_db(const char *path, int resource, int version)
+{
+	pi_file_t *pf;
+	int	i;
+
+	pf = vh_make_db(path, resource ? "DiffTestRsrc" : "DiffTestDB",
+		pi_mktag('d', 'i', 'f', 'f'), resource);
+	if (pf == NULL)
+		return;
+
+	for (i = 0; i < (resource ? 10 : RECORDS); i++) {
+		int	seed = i + (version == 2 && i == (resource ? 3 : 10)
+			? 1000 : 0);
+
+		if (resource) {
+			if (version == 2 && i == 7)
+				continue;
+			vh_add_resource(pf, seed, RECSIZE, i);
+		} else {
+			if (version == 2 && i == 20)
+				continue;
+			vh_add_record(pf, seed, RECSIZE,
+				version == 2 && i == 30 ? 5 : i % 4, 0x1000 + i);
+		}
+	}
+	if (version == 2 && !resource)
+		vh_add_record(pf, 5000, RECSIZE, 1, 0x5000);
+	CHECK(pi_file_close(pf) == 0);
+}
+
+static int
+install(int sd, const char *path, const char *manifest)
+{
+	pi_file_t *pf;
+	int	result;
+
+	sent_records = sent_bytes = 0;
+	if ((pf = pi_file_open(path)) == NULL)
+		return -1;
+	result = pi_file_install_diff(pf, sd, 0, manifest, progress);
+	pi_file_close(pf);
+	return result;
+}
+
+/* Check that the handheld has the database in the file at path */
+static void
+check_db(int sd, const char *path, const char *copy)
+{
+	struct DBInfo info;
+	pi_file_t *pf,
+		*dev;
+	void	*data,
+		*data2,
+		*app,
+		*app2;
+	size_t	size,
+		size2,
+		app_size,
+		app_size2;
+	int	i,
+		count,
+		count2,
+		attr,
+		category,
+		attr2,
+		category2,
+		id;
+	unsigned long type;
+	recordid_t uid;
+
+	pf = pi_file_open(path);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return;
+	pi_file_get_info(pf, &info);
+
+	dev = pi_file_create(copy, &info);
+	CHECK(pi_file_retrieve(dev, sd, 0, NULL) >= 0);
+	pi_file_close(dev);
+	dev = pi_file_open(copy);
+	CHECK(dev != NULL);
+	if (dev == NULL) {
+		pi_file_close(pf);
+		return;
+	}
+
+	pi_file_get_app_info(pf, &app, &app_size);
+	pi_file_get_app_info(dev, &app2, &app_size2);
+	CHECK(app_size == app_size2 && memcmp(app, app2, app_size) == 0);
+
+	pi_file_get_entries(pf, &count);
+	pi_file_get_entries(dev, &count2);
+	CHECK(count == count2);
+	for (i = 0; i < count; i++) {
+		if (info.flags & dlpDBFlagResource) {
+			pi_file_read_resource(pf, i, &data, &size, &type, &id);
+			CHECK(pi_file_read_resource_by_type_id(dev, type, id,
+				&data2, &size2, NULL) >= 0);
+		} else {
+			pi_file_read_record(pf, i, &data, &size, &attr,
+				&category, &uid);
+			CHECK(pi_file_read_record_by_id(dev, uid, &data2,
+				&size2, NULL, &attr2, &category2) >= 0);
+			CHECK(category == category2);
+		}
+		CHECK(size == size2 && memcmp(data, data2, size) == 0);
+	}
+
+	pi_file_close(dev);
+	pi_file_close(pf);
+	unlink(copy);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vh_device dev;
+	struct PilotUser user;
+	struct DBInfo info;
+	vhandheld_t *vh;
+	char	dir[] = "/tmp/install-diffXXXXXX",
+		v1[sizeof(dir) + 16],
+		v2[sizeof(dir) + 16],
+		r1[sizeof(dir) + 16],
+		r2[sizeof(dir) + 16],
+		copy[sizeof(dir) + 16],
+		manifest[sizeof(dir) + 16],
+		rmanifest[sizeof(dir) + 16];
+	unsigned char data[RECSIZE];
+	int	sd,
+		db;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	sprintf(v1, "%s/v1.pdb", dir);
+	sprintf(v2, "%s/v2.pdb", dir);
+	sprintf(r1, "%s/r1.prc", dir);
+	sprintf(r2, "%s/r2.prc", dir);
+	sprintf(copy, "%s/copy", dir);
+	sprintf(manifest, "%s/db.manifest", dir);
+	sprintf(rmanifest, "%s/rsrc.manifest", dir);
+	make_db(v1, 0, 1);
+	make_db(v2, 0, 2);
+	make_db(r1, 1, 1);
+	make_db(r2, 1, 2);
+
+	/* an empty handheld */
+	sprintf(copy, "%s/device", dir);
+	mkdir(copy, 0700);
+	vh = vh_new(copy);
+	rmdir(copy);
+	if (vh == NULL || (sd = vh_start(&dev, vh, PORT)) < 0)
+		return 1;
+	sprintf(copy, "%s/copy", dir);
+
+	/* not on the handheld yet: everything goes */
+	CHECK(install(sd, v1, manifest) >= 0);
+	CHECK(sent_records == RECORDS);
+	CHECK(access(manifest, R_OK) == 0);
+	check_db(sd, v1, copy);
+
+	/* the manifest says what's there: only the changes go */
+	CHECK(install(sd, v2, manifest) >= 0);
+	CHECK(sent_records == 3);
+	CHECK(sent_bytes == 3 * RECSIZE);
+	check_db(sd, v2, copy);
+
+	/* nothing changed */
+	CHECK(install(sd, v2, manifest) >= 0);
+	CHECK(sent_records == 0);
+
+	/* a manifest saved for another handheld isn't used, even if the
+	   database there has the creation date and modification number
+	   it says */
+	CHECK(dlp_ReadUserInfo(sd, &user) >= 0);
+	user.userID = 2;
+	strcpy(user.username, "Other");
+	CHECK(dlp_WriteUserInfo(sd, &user) >= 0);
+	CHECK(dlp_OpenDB(sd, 0, dlpOpenReadWrite, "DiffTestDB", &db) >= 0);
+	vh_fill(data, RECSIZE, 3000);
+	CHECK(dlp_WriteRecord(sd, db, 0, 0x1000 + 50, 0, data, RECSIZE,
+		NULL) >= 0);
+	CHECK(dlp_CloseDB(sd, db) >= 0);
+	CHECK(dlp_FindDBByName(sd, 0, "DiffTestDB", NULL, NULL, &info,
+		NULL) >= 0);
+	set_manifest_modnum(manifest, info.modnum);
+	CHECK(install(sd, v2, manifest) >= 0);
+	CHECK(sent_records == 1);
+	check_db(sd, v2, copy);
+
+	/* changed on the handheld behind our back: the manifest is
+	   stale, and the database is read back */
+	CHECK(dlp_OpenDB(sd, 0, dlpOpenReadWrite, "DiffTestDB", &db) >= 0);
+	vh_fill(data, RECSIZE, 4000);
+	CHECK(dlp_WriteRecord(sd, db, 0, 0x1000 + 40, 0, data, RECSIZE,
+		NULL) >= 0);
+	CHECK(dlp_CloseDB(sd, db) >= 0);
+	CHECK(install(sd, v2, manifest) >= 0);
+	CHECK(sent_records == 1);
+	check_db(sd, v2, copy);
+
+	/* without a manifest, back to version 1 */
+	CHECK(install(sd, v1, NULL) >= 0);
+	CHECK(sent_records == 3);
+	check_db(sd, v1, copy);
+
+	/* stopped while updating: the database stays, and so does what
+	   was sent, but not the manifest */
+	stop_after = 1;
+	CHECK(install(sd, v2, manifest) < 0);
+	stop_after = 0;
+	CHECK(dlp_FindDBByName(sd, 0, "DiffTestDB", NULL, NULL, &info,
+		NULL) >= 0);
+	CHECK(access(manifest, F_OK) != 0);
+	CHECK(install(sd, v2, manifest) >= 0);
+	CHECK(sent_records == 2);
+	check_db(sd, v2, copy);
+	CHECK(install(sd, v1, NULL) >= 0);
+	check_db(sd, v1, copy);
+
+	/* resources */
+	CHECK(install(sd, r1, rmanifest) >= 0);
+	CHECK(sent_records == 10);
+	check_db(sd, r1, copy);
+	CHECK(install(sd, r2, rmanifest) >= 0);
+	CHECK(sent_records == 1);
+	check_db(sd, r2, copy);
+	CHECK(install(sd, r1, NULL) >= 0);
+	CHECK(sent_records == 2);
+	check_db(sd, r1, copy);
+
+	CHECK(vh_finish(&dev, sd) >= 0);
+	vh_free(vh);
+
+	unlink(v1);
+	unlink(v2);
+	unlink(r1);
+	unlink(r2);
+	unlink(manifest);
+	unlink(rmanifest);
+	rmdir(dir);
+
+	return vh_failures ? 1 : 0;
+}
+
+#else
+VH_MAIN_WITHOUT_THREADS("install-diff-test")
+#endif
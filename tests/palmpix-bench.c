@@ -0,0 +1,96 @@
+/*
+ * palmpix-bench.c:  PalmPix decoding throughput
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Decodes a synthetic 640x480 picture over and over, plain and with
+ * colour correction and histogram stretch, and prints megapixels per
+ * second for each.
+ *
+ * Usage: palmpix-bench [pictures]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "pi-palmpix.h"
+#include "palmpix-sample.h"
+
+#define WIDTH	640
+#define HEIGHT	480
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+run(struct palmpix_sample *sample, const char *what, int flags,
+	int pictures)
+{
+	double	start,
+		elapsed;
+	int	i;
+
+	sample->state.flags = flags;
+	start = now();
+	for (i = 0; i < pictures; i++) {
+		if (!unpack_PalmPix(&sample->state, &sample->header, 0,
+				pixPixmap)) {
+			fprintf(stderr, "unable to decode the picture\n");
+			return -1;
+		}
+		free_PalmPix_data(&sample->state);
+	}
+	elapsed = now() - start;
+
+	printf("%-24s %d pictures in %.3f s: %.1f megapixels/s, "
+		"%.2f ms per picture\n", what, pictures, elapsed,
+		(double) WIDTH * HEIGHT * pictures / elapsed / 1000000.0,
+		elapsed * 1000.0 / pictures);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct palmpix_sample *sample;
+	int	pictures = argc > 1 ? atoi(argv[1]) : 200,
+		result;
+
+	if (pictures <= 0) {
+		fprintf(stderr, "usage: %s [pictures]\n", argv[0]);
+		return 1;
+	}
+	if ((sample = palmpix_sample_new(WIDTH, HEIGHT, 1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	result = run(sample, "decode", 0, pictures);
+	if (result == 0)
+		result = run(sample, "decode+correct+stretch",
+			PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,
+			pictures);
+
+	palmpix_sample_free(sample);
+	return result < 0 ? 1 : 0;
+}
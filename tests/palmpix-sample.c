@@ -0,0 +1,128 @@
+/*
+ * palmpix-sample.c:  Synthetic PalmPix pictures for tests and benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "palmpix-sample.h"
+
+#define HEADER_RECORD	0
+#define NAME_RECORD	1
+#define CHANNEL_RECORD	4
+
+/* Channel records hold at most 64k: the header has 16 bit sizes */
+#define CHANNEL_MAX	65535
+
+static int
+sample_getrecord(struct PalmPixState *state, int recno, void **buffer,
+	size_t *bufsize)
+{
+	struct palmpix_sample *sample = (struct palmpix_sample *)state;
+
+	if (recno < 0 || recno >= sample->records
+	    || sample->record[recno] == NULL)
+		return -1;
+	*buffer = sample->record[recno];
+	*bufsize = sample->size[recno];
+	return 0;
+}
+
+static void
+set_le_short(unsigned char *p, int value)
+{
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+}
+
+struct palmpix_sample *
+palmpix_sample_new(int w, int h, unsigned long seed)
+{
+	struct palmpix_sample *sample;
+	unsigned char *p;
+	size_t	i;
+	int	k;
+
+	sample = (struct palmpix_sample *)calloc(1, sizeof(*sample));
+	if (sample == NULL)
+		return NULL;
+	sample->records = CHANNEL_RECORD + 4;
+
+	/* channels: the first row is stored as is, then random codes take
+	   three bits and a quarter a pixel on average, which leaves room
+	   for 800x600 */
+	for (k = 0; k < 4; k++) {
+		sample->size[CHANNEL_RECORD + k] = CHANNEL_MAX;
+		p = sample->record[CHANNEL_RECORD + k] =
+			(unsigned char *)malloc(CHANNEL_MAX);
+		if (p == NULL) {
+			palmpix_sample_free(sample);
+			return NULL;
+		}
+		for (i = 0; i < CHANNEL_MAX; i++) {
+			seed = seed * 1103515245UL + 12345UL;
+			p[i] = (seed >> 16) & 0xff;
+		}
+	}
+
+	p = sample->record[NAME_RECORD] = (unsigned char *)calloc(1, 32);
+	if (p == NULL) {
+		palmpix_sample_free(sample);
+		return NULL;
+	}
+	strcpy((char *)p, "Sample");
+	sample->size[NAME_RECORD] = 32;
+
+	p = sample->record[HEADER_RECORD] = (unsigned char *)calloc(1, 196);
+	if (p == NULL) {
+		palmpix_sample_free(sample);
+		return NULL;
+	}
+	sample->size[HEADER_RECORD] = 196;
+	p[0] = 4;			/* numRec */
+	p[2] = 10;			/* month */
+	p[3] = 18;			/* day */
+	p[4] = 20;
+	p[5] = 1;
+	p[9] = 1;			/* resolution */
+	set_le_short(p + 10, w);
+	set_le_short(p + 12, h);
+	set_le_short(p + 16, CHANNEL_MAX);
+	set_le_short(p + 19, CHANNEL_MAX);
+	set_le_short(p + 22, CHANNEL_MAX);
+	set_le_short(p + 25, CHANNEL_MAX);
+	unpack_PalmPixHeader(&sample->header, p, 196);
+
+	sample->state.getrecord	= sample_getrecord;
+	sample->state.offset_r	= 0;
+	sample->state.offset_g	= 1;
+	sample->state.offset_b	= 2;
+	sample->state.output_type = PALMPIX_OUT_PPM;
+	sample->state.bias	= 50;
+
+	return sample;
+}
+
+void
+palmpix_sample_free(struct palmpix_sample *sample)
+{
+	int	i;
+
+	for (i = 0; i < sample->records; i++)
+		free(sample->record[i]);
+	free(sample);
+}
@@ -0,0 +1,41 @@
+/*
+ * palmpix-sample.h:  Synthetic PalmPix pictures for tests and benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _PALMPIX_SAMPLE_H_
+#define _PALMPIX_SAMPLE_H_
+
+#include "pi-palmpix.h"
+
+/* The records of one picture in an ArchImage database: the header, its
+   name, two unused records, then one record per channel */
+struct palmpix_sample {
+	struct PalmPixState state;	/* must come first */
+	struct PalmPixHeader header;
+	unsigned char *record[8];
+	size_t	size[8];
+	int	records;
+};
+
+/* Build a w x h picture whose channels are pseudo-random bit streams
+   from seed; every stream decodes, so this exercises all of the
+   decoder's codes and its clamping */
+extern struct palmpix_sample *palmpix_sample_new(int w, int h,
+	unsigned long seed);
+extern void palmpix_sample_free(struct palmpix_sample *sample);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * palmpix-test.c:  Check PalmPix decoding against known pictures
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Decodes synthetic pictures with every combination of colour correction,
+ * histogram stretch and brightness, and compares a hash of each pixmap
+ * with the one the original, pixel-at-a-time code produced. Only the
+ * pixels Interpolate() computes are hashed; the one pixel border around
+ * them must be black.
+ *
+ * Usage: palmpix-test [-g]   (-g prints the table of hashes)
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pi-palmpix.h"
+#include "palmpix-sample.h"
+
+struct golden {
+	int	w,
+		h,
+		flags,
+		bias;
+	unsigned long hash;
+};
+
+static struct golden golden[] = {
+	{ 640, 480, 0, 50, 0x99634f03UL },
+	{ 640, 480, PALMPIX_COLOUR_CORRECTION, 50, 0x97fcd0beUL },
+	{ 640, 480, PALMPIX_HISTOGRAM_STRETCH, 50, 0xa016cc09UL },
+	{ 640, 480, PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,
+		50, 0x786bea29UL },
+	{ 640, 480, PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,
+		70, 0xe7c3fc1cUL },
+	{ 320, 240, PALMPIX_COLOUR_CORRECTION, 30, 0xc08bf99eUL },
+	{ 100, 76, PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,
+		50, 0x5c341b5bUL },
+	{ 800, 600, 0, 50, 0x6e8cdb40UL }
+};
+
+/* FNV-1a over the interpolated pixels */
+static unsigned long
+pixmap_hash(const unsigned char *pixmap, int w, int h)
+{
+	unsigned long hash = 2166136261UL;
+	int	x,
+		y,
+		c;
+
+	for (y = 1; y < h - 1; y++)
+		for (x = 2; x < w - 2; x++)
+			for (c = 0; c < 3; c++) {
+				hash ^= pixmap[3 * (y * w + x) + c];
+				hash = (hash * 16777619UL) & 0xffffffffUL;
+			}
+	return hash;
+}
+
+static int
+border_black(const unsigned char *pixmap, int w, int h)
+{
+	int	x,
+		y;
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			if (y > 0 && y < h - 1 && x > 1 && x < w - 2)
+				continue;
+			if (pixmap[3 * (y * w + x)] != 0
+			    || pixmap[3 * (y * w + x) + 1] != 0
+			    || pixmap[3 * (y * w + x) + 2] != 0)
+				return 0;
+		}
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct palmpix_sample *sample;
+	unsigned long hash;
+	int	generate = argc > 1 && strcmp(argv[1], "-g") == 0,
+		failures = 0,
+		i;
+
+	for (i = 0; i < (int) (sizeof(golden) / sizeof(golden[0])); i++) {
+		sample = palmpix_sample_new(golden[i].w, golden[i].h,
+			(unsigned long) i + 1);
+		if (sample == NULL) {
+			printf("palmpix: out of memory\n");
+			return 1;
+		}
+		sample->state.flags = golden[i].flags;
+		sample->state.bias = golden[i].bias;
+
+		if (!unpack_PalmPix(&sample->state, &sample->header, 0,
+				pixPixmap)) {
+			printf("palmpix: %dx%d: unable to decode\n",
+				golden[i].w, golden[i].h);
+			failures++;
+			palmpix_sample_free(sample);
+			continue;
+		}
+
+		hash = pixmap_hash(sample->state.pixmap, golden[i].w,
+			golden[i].h);
+		if (generate)
+			printf("\t{ %d, %d, %d, %d, 0x%08lxUL },\n",
+				golden[i].w, golden[i].h, golden[i].flags,
+				golden[i].bias, hash);
+		else if (hash != golden[i].hash) {
+			printf("palmpix: %dx%d flags %d bias %d: hash "
+				"0x%08lx, expected 0x%08lx\n", golden[i].w,
+				golden[i].h, golden[i].flags, golden[i].bias,
+				hash, golden[i].hash);
+			failures++;
+		}
+		if (!generate && !border_black(sample->state.pixmap,
+				golden[i].w, golden[i].h)) {
+			printf("palmpix: %dx%d: border not black\n",
+				golden[i].w, golden[i].h);
+			failures++;
+		}
+
+		free_PalmPix_data(&sample->state);
+		palmpix_sample_free(sample);
+	}
+
+	if (failures)
+		printf("palmpix: %d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * pi-file-bench.c:  Time building and searching large pi_file_t
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Appends records and resources to buffered files (each append checks
+ * that the ID is free), looks every one of them up by ID, and compares
+ * the lookups with a scan of the entries. Then writes a record database,
+ * reopens it and looks its records up again. A file on disk holds at most
+ * 65535 entries, so that one is capped; the others aren't written.
+ *
+ * Usage: pi-file-bench [entries]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-file.h"
+#include "pi-util.h"
+
+/* Lookups timed with a scan of the entries, which is too slow to do
+   them all */
+#define SCANS	2000
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Record IDs are 24 bits, spread them like a handheld does */
+static recordid_t
+uid(int i)
+{
+	return (recordid_t)(0x400000 + (i * 7919L) % 0x3fffff);
+}
+
+static int
+scan_uid(const pi_file_t *pf, recordid_t id)
+{
+	int	i;
+
+	for (i = 0; i < pf->num_entries; i++)
+		if (pf->entries[i].uid == id)
+			return i;
+	return -1;
+}
+
+static int
+scan_type_id(const pi_file_t *pf, unsigned long type, int id)
+{
+	int	i;
+
+	for (i = 0; i < pf->num_entries; i++)
+		if (pf->entries[i].type == type
+		    && pf->entries[i].resource_id == id)
+			return i;
+	return -1;
+}
+
+static void
+report(const char *what, int count, double seconds)
+{
+	printf("   %-28s %8d in %8.3f s, %10.0f per second\n", what, count,
+		seconds, count / seconds);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct DBInfo info;
+	pi_file_t *pf;
+	char	path[] = "/tmp/pi-file-benchXXXXXX";
+	unsigned char data[32];
+	void	*buf;
+	size_t	size;
+	double	start;
+	int	entries,
+		ondisk,
+		fd,
+		i,
+		found	= 0;
+
+	entries = argc > 1 ? atoi(argv[1]) : 100000;
+	ondisk = entries < 65535 ? entries : 65535;
+	memset(data, 'x', sizeof(data));
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "BenchDB");
+	info.type = pi_mktag('D', 'A', 'T', 'A');
+	info.creator = pi_mktag('b', 'n', 'c', 'h');
+
+	/* records */
+	printf("%d records:\n", entries);
+	pf = pi_file_create_buffered("/nonexistent/records.pdb", &info);
+	if (pf == NULL)
+		return 1;
+	start = now();
+	for (i = 0; i < entries; i++)
+		if (pi_file_append_record(pf, data, sizeof(data), 0, i & 15,
+				uid(i)) < 0)
+			return 1;
+	report("append", entries, now() - start);
+
+	start = now();
+	for (i = 0; i < entries; i++)
+		found += pi_file_id_used(pf, uid(entries - 1 - i));
+	report("pi_file_id_used", entries, now() - start);
+
+	start = now();
+	for (i = 0; i < SCANS; i++)
+		found += scan_uid(pf, uid(entries - 1 - i)) >= 0;
+	report("scan", SCANS, now() - start);
+	pi_file_close(pf);	/* too many entries, nothing is written */
+
+	/* resources */
+	printf("%d resources:\n", entries);
+	info.flags = dlpDBFlagResource;
+	pf = pi_file_create_buffered("/nonexistent/resources.prc", &info);
+	if (pf == NULL)
+		return 1;
+	start = now();
+	for (i = 0; i < entries; i++)
+		if (pi_file_append_resource(pf, data, sizeof(data),
+				pi_mktag('r', 's', 'c', 'A' + i / 10000),
+				i % 10000) < 0)
+			return 1;
+	report("append", entries, now() - start);
+
+	start = now();
+	for (i = 0; i < entries; i++)
+		found += pi_file_type_id_used(pf,
+			pi_mktag('r', 's', 'c', 'A' + i / 10000), i % 10000);
+	report("pi_file_type_id_used", entries, now() - start);
+
+	start = now();
+	for (i = 0; i < SCANS; i++)
+		found += scan_type_id(pf,
+			pi_mktag('r', 's', 'c', 'A' + (entries - 1 - i) / 10000),
+			(entries - 1 - i) % 10000) >= 0;
+	report("scan", SCANS, now() - start);
+	pi_file_close(pf);
+
+	/* a record database on disk */
+	printf("%d records on disk:\n", ondisk);
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	info.flags = 0;
+	if ((pf = pi_file_create(path, &info)) == NULL)
+		return 1;
+	for (i = 0; i < ondisk; i++)
+		pi_file_append_record(pf, data, sizeof(data), 0, 0, uid(i));
+	if (pi_file_close(pf) != 0 || (pf = pi_file_open(path)) == NULL) {
+		unlink(path);
+		return 1;
+	}
+	start = now();
+	for (i = 0; i < ondisk; i++)
+		found += pi_file_read_record_by_id(pf, uid(i), &buf, &size,
+			NULL, NULL, NULL) >= 0;
+	report("pi_file_read_record_by_id", ondisk, now() - start);
+	pi_file_close(pf);
+	unlink(path);
+
+	if (found != 2 * entries + 2 * SCANS + ondisk) {
+		fprintf(stderr, "pi-file-bench: %d lookups missed\n",
+			2 * entries + 2 * SCANS + ondisk - found);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * protocol-bench.c:  Protocol stack round trip benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Times DLP round trips through the serial protocol stack (DLP, PADP,
+ * SLP and the device) without any hardware: the two ends of the
+ * connection are sockets of the loopback device. The desktop end reads
+ * records with dlp_ReadRecordByIndex(); a thread plays the handheld and
+ * answers every request with a canned response.
+ *
+ * Usage: protocol-bench [round trips [record size]]
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+#define PORT	"loop:protocol-bench"
+
+/* libpisock only implements the side of PADP that sends requests: keep
+   one transaction id for both directions, so that either end accepts the
+   packets of the other */
+static void
+freeze_txid(int sd)
+{
+	int	freeze = 1;
+	size_t	size = sizeof(freeze);
+
+	pi_setsockopt(sd, PI_LEVEL_PADP, PI_PADP_FREEZE_TXID, &freeze, &size);
+}
+
+/* Handheld side: answer requests until the desktop hangs up */
+static void *
+handheld(void *userdata)
+{
+	int	sd,
+		size = *(int *)userdata,
+		arglen = 10 + size,
+		state = PI_SOCK_CONN_END,
+		len;
+	size_t	optlen;
+	pi_buffer_t *request;
+	unsigned char *response;
+
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_PADP);
+	if (sd < 0 || pi_connect(sd, PORT) < 0) {
+		fprintf(stderr, "unable to connect the handheld\n");
+		return NULL;
+	}
+	freeze_txid(sd);
+
+	request		= pi_buffer_new(256);
+	response	= malloc(size + 32);
+
+	response[0] = dlpFuncReadRecord | 0x80;
+	response[1] = 1;		/* argc */
+	response[2] = 0;		/* error */
+	response[3] = 0;
+	len = 4;
+	if (arglen < 256) {
+		response[len++] = 0x20;
+		response[len++] = arglen;
+	} else {
+		response[len++] = 0xa0;
+		response[len++] = 0;
+		response[len++] = arglen >> 8;
+		response[len++] = arglen & 0xff;
+	}
+	memset(response + len, 0, 10);	/* id, index, size, attr, cat */
+	memset(response + len + 10, 0x5a, size);
+	len += arglen;
+
+	for (;;) {
+		request->used = 0;
+		if (pi_read(sd, request, 0xffff) < 2)
+			break;
+		if (pi_write(sd, response, len) < len)
+			break;
+	}
+
+	pi_buffer_free(request);
+	free(response);
+
+	optlen = sizeof(state);
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_STATE, &state, &optlen);
+	pi_close(sd);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timeval start,
+		end;
+	pthread_t thread;
+	pi_buffer_t *record;
+	double	elapsed;
+	int	trips,
+		size,
+		listener,
+		desktop,
+		state = PI_SOCK_CONN_END,
+		i;
+	size_t	optlen;
+
+	trips	= argc > 1 ? atoi(argv[1]) : 20000;
+	size	= argc > 2 ? atoi(argv[2]) : 64;
+
+	if (size > 0xfff0) {
+		fprintf(stderr, "record size too large\n");
+		return 1;
+	}
+
+	listener = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_DLP);
+	if (listener < 0 || pi_bind(listener, PORT) < 0
+	    || pi_listen(listener, 1) < 0) {
+		fprintf(stderr, "unable to listen on %s\n", PORT);
+		return 1;
+	}
+	pthread_create(&thread, NULL, handheld, &size);
+	if ((desktop = pi_accept(listener, NULL, NULL)) < 0) {
+		fprintf(stderr, "unable to accept the handheld\n");
+		return 1;
+	}
+	freeze_txid(desktop);
+
+	record = pi_buffer_new(size);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < trips; i++) {
+		if (dlp_ReadRecordByIndex(desktop, 0, i, record, NULL, NULL,
+			NULL) < 0)
+			break;
+	}
+	gettimeofday(&end, NULL);
+	pi_buffer_free(record);
+
+	/* no EndOfSync on the way out: the handheld does not expect one */
+	optlen = sizeof(state);
+	pi_setsockopt(desktop, PI_LEVEL_SOCK, PI_SOCK_STATE, &state, &optlen);
+	pi_close(desktop);
+	pthread_join(thread, NULL);
+	pi_close(listener);
+
+	elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%d round trips of %d bytes in %.3f s\n", i, size, elapsed);
+	printf("%.0f round trips/s, %.2f us each\n", i / elapsed,
+		elapsed * 1000000.0 / i);
+
+	return i == trips ? 0 : 1;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+	fprintf(stderr, "protocol-bench: libpisock was built without threads\n");
+	return 77;
+}
+
+#endif
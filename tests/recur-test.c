@@ -0,0 +1,454 @@
+/*
+ * recur-test.c:  Check the recurrence engine against a brute-force one
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Checks a few rules whose occurrences are known, then makes up a
+ * datebook of every kind of repeat, with end dates, repeatForever and
+ * exceptions, and compares what pi_recur_index_query() finds in many
+ * ranges with what testing every day of the range against every
+ * appointment finds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+#include "pi-recur.h"
+
+#define APPOINTMENTS	2000
+#define QUERIES		400
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* The test must make up the same datebook each time */
+static unsigned long seed = 1;
+
+static int
+random_int(int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (int) ((seed >> 16) % n);
+}
+
+static long
+floor_div(long a, long b)
+{
+	return (a >= 0 ? a : a - b + 1) / b;
+}
+
+static long
+day_of(const struct tm *t)
+{
+	return pi_days_from_civil(t->tm_year + 1900L, t->tm_mon + 1,
+		t->tm_mday);
+}
+
+static void
+set_date(struct tm *t, int year, int mon, int mday)
+{
+	memset(t, 0, sizeof(*t));
+	t->tm_year = year - 1900;
+	t->tm_mon = mon - 1;
+	t->tm_mday = mday;
+	t->tm_isdst = -1;
+}
+
+/* Days of a rule from a given day, with pi_recur_next() */
+static int
+next_days(const Appointment_t *appt, long from, long *days, int count)
+{
+	pi_recur_t rule;
+	int	i;
+
+	CHECK(pi_recur_from_appointment(&rule, appt) == 0);
+	for (i = 0; i < count && pi_recur_next(&rule, from, &days[i]); i++)
+		from = days[i] + 1;
+	pi_recur_free(&rule);
+	return i;
+}
+
+static void
+check_known(void)
+{
+	Appointment_t appt;
+	struct tm exception;
+	long	days[4];
+	int	n;
+
+	/* the last Friday of each month, from 2008-01-01 */
+	memset(&appt, 0, sizeof(appt));
+	set_date(&appt.begin, 2008, 1, 1);
+	appt.end = appt.begin;
+	appt.event = 1;
+	appt.repeatType = repeatMonthlyByDay;
+	appt.repeatFrequency = 1;
+	appt.repeatForever = 1;
+	appt.repeatDay = domLastFri;
+	n = next_days(&appt, 0, days, 3);
+	CHECK(n == 3);
+	CHECK(days[0] == pi_days_from_civil(2008, 1, 25));
+	CHECK(days[1] == pi_days_from_civil(2008, 2, 29));
+	CHECK(days[2] == pi_days_from_civil(2008, 3, 28));
+
+	/* the second Monday, every other month */
+	appt.repeatDay = dom2ndMon;
+	appt.repeatFrequency = 2;
+	n = next_days(&appt, 0, days, 2);
+	CHECK(n == 2);
+	CHECK(days[0] == pi_days_from_civil(2008, 1, 14));
+	CHECK(days[1] == pi_days_from_civil(2008, 3, 10));
+
+	/* the 31st, which not every month has */
+	set_date(&appt.begin, 2008, 1, 31);
+	appt.repeatType = repeatMonthlyByDate;
+	appt.repeatFrequency = 1;
+	n = next_days(&appt, 0, days, 3);
+	CHECK(n == 3);
+	CHECK(days[1] == pi_days_from_civil(2008, 3, 31));
+	CHECK(days[2] == pi_days_from_civil(2008, 5, 31));
+
+	/* February 29th */
+	set_date(&appt.begin, 2008, 2, 29);
+	appt.repeatType = repeatYearly;
+	n = next_days(&appt, 0, days, 2);
+	CHECK(n == 2);
+	CHECK(days[1] == pi_days_from_civil(2012, 2, 29));
+
+	/* Tuesdays and Thursdays of every other week starting on Monday,
+	   until the 17th, without the 15th */
+	set_date(&appt.begin, 2008, 1, 3);
+	appt.repeatType = repeatWeekly;
+	appt.repeatFrequency = 2;
+	appt.repeatDays[2] = appt.repeatDays[4] = 1;
+	appt.repeatWeekstart = 1;
+	appt.repeatForever = 0;
+	set_date(&appt.repeatEnd, 2008, 1, 17);
+	set_date(&exception, 2008, 1, 15);
+	appt.exceptions = 1;
+	appt.exception = &exception;
+	n = next_days(&appt, 0, days, 4);
+	CHECK(n == 2);
+	CHECK(days[0] == pi_days_from_civil(2008, 1, 3));
+	CHECK(days[1] == pi_days_from_civil(2008, 1, 17));
+}
+
+static void
+make_up(Appointment_t *appt)
+{
+	int	n,
+		i;
+
+	memset(appt, 0, sizeof(*appt));
+	set_date(&appt->begin, 2000 + random_int(8), 1 + random_int(12),
+		1 + random_int(28));
+	if (random_int(6) == 0)
+		appt->begin.tm_mday = 29 + random_int(3);
+	appt->end = appt->begin;
+	appt->event = random_int(5) == 0;
+	if (!appt->event) {
+		appt->begin.tm_hour = random_int(24);
+		appt->begin.tm_min = random_int(4) * 15;
+		appt->end.tm_hour = appt->begin.tm_hour + random_int(24
+			- appt->begin.tm_hour);
+		appt->end.tm_min = appt->end.tm_hour > appt->begin.tm_hour
+			? random_int(60) : appt->begin.tm_min;
+	}
+	pi_normalize_tm(&appt->begin, 0);
+	pi_normalize_tm(&appt->end, 0);
+
+	appt->repeatType = random_int(6);
+	appt->repeatFrequency = appt->repeatType == repeatNone ? 0
+		: 1 + random_int(4);
+	appt->repeatForever = random_int(3) == 0;
+	appt->repeatEnd = appt->begin;
+	appt->repeatEnd.tm_mday += random_int(1500);
+	appt->repeatEnd.tm_hour = appt->repeatEnd.tm_min = 0;
+	pi_normalize_tm(&appt->repeatEnd, 0);
+	appt->repeatDay = random_int(35);
+	for (i = 0; i < 7; i++)
+		appt->repeatDays[i] = random_int(4) == 0;
+	appt->repeatWeekstart = random_int(2);
+
+	n = random_int(4) ? 0 : 1 + random_int(8);
+	appt->exceptions = n;
+	appt->exception = n ? calloc(n, sizeof(struct tm)) : NULL;
+	for (i = 0; i < n; i++) {
+		/* mostly near the start, where they hit occurrences */
+		appt->exception[i] = appt->begin;
+		appt->exception[i].tm_mday += random_int(i < 4 ? 30 : 700);
+		appt->exception[i].tm_hour = appt->exception[i].tm_min = 0;
+		pi_normalize_tm(&appt->exception[i], 0);
+	}
+}
+
+/* Whether an appointment occurs on a day, worked out for that day alone */
+static int
+occurs(const Appointment_t *appt, long day)
+{
+	long	first = day_of(&appt->begin),
+		year,
+		months,
+		wk;
+	int	mon,
+		mday,
+		dim,
+		wday,
+		mask,
+		i;
+
+	if (day < first)
+		return 0;
+	if (appt->repeatType == repeatNone || appt->repeatFrequency == 0)
+		return day == first;
+	if (!appt->repeatForever && day > day_of(&appt->repeatEnd))
+		return 0;
+	for (i = 0; i < appt->exceptions; i++)
+		if (day == day_of(&appt->exception[i]))
+			return 0;
+
+	pi_civil_from_days(day, &year, &mon, &mday);
+	dim = (int) (pi_days_from_civil(year, mon + 1, 1)
+		- pi_days_from_civil(year, mon, 1));
+	if (mon == 12)
+		dim = 31;
+	wday = (int) (day + 4 - floor_div(day + 4, 7) * 7);
+	months = (year - appt->begin.tm_year - 1900) * 12 + mon - 1
+		- appt->begin.tm_mon;
+
+	switch (appt->repeatType) {
+	case repeatDaily:
+		return (day - first) % appt->repeatFrequency == 0;
+	case repeatWeekly:
+		for (mask = i = 0; i < 7; i++)
+			if (appt->repeatDays[i])
+				mask |= 1 << i;
+		if (mask == 0)
+			mask = 1 << appt->begin.tm_wday;
+		/* week numbers change on the first day of the week */
+		wk = floor_div(day + 4 - appt->repeatWeekstart, 7)
+			- floor_div(first + 4 - appt->repeatWeekstart, 7);
+		return (mask & (1 << wday)) && wk % appt->repeatFrequency == 0;
+	case repeatMonthlyByDay:
+		if (months % appt->repeatFrequency || wday != appt->repeatDay % 7)
+			return 0;
+		if (appt->repeatDay / 7 == 4)
+			return mday + 7 > dim;
+		return (mday - 1) / 7 == appt->repeatDay / 7;
+	case repeatMonthlyByDate:
+		return months % appt->repeatFrequency == 0
+			&& mday == appt->begin.tm_mday;
+	case repeatYearly:
+		return months % (12 * appt->repeatFrequency) == 0
+			&& mday == appt->begin.tm_mday;
+	default:
+		return 0;
+	}
+}
+
+static int
+compare_occurrences(const void *a, const void *b)
+{
+	const pi_occurrence_t
+		*x = (const pi_occurrence_t *) a,
+		*y = (const pi_occurrence_t *) b;
+
+	if (x->begin != y->begin)
+		return x->begin < y->begin ? -1 : 1;
+	return x->index - y->index;
+}
+
+/* The occurrences in [from, to), trying every day of every appointment */
+static int
+brute_force(const Appointment_t *appts, long from, long to,
+	pi_occurrence_t **found)
+{
+	pi_occurrence_t *occurrences = NULL;
+	long	day,
+		begin,
+		end,
+		length;
+	int	count = 0,
+		i;
+
+	for (i = 0; i < APPOINTMENTS; i++) {
+		/* appointments don't last past their day */
+		for (day = floor_div(from, 1440) - 1;
+		     day <= floor_div(to, 1440); day++) {
+			if (!occurs(&appts[i], day))
+				continue;
+			if (appts[i].event) {
+				begin = day * 1440;
+				end = begin + 1440;
+			} else {
+				begin = day * 1440 + appts[i].begin.tm_hour * 60
+					+ appts[i].begin.tm_min;
+				end = day * 1440 + appts[i].end.tm_hour * 60
+					+ appts[i].end.tm_min;
+			}
+			length = end > begin ? end - begin : 1;
+			if (begin >= to || begin + length <= from)
+				continue;
+			occurrences = realloc(occurrences,
+				(count + 1) * sizeof(*occurrences));
+			occurrences[count].begin = begin;
+			occurrences[count].end = end;
+			occurrences[count].index = i;
+			count++;
+		}
+	}
+	qsort(occurrences, count, sizeof(*occurrences), compare_occurrences);
+	*found = occurrences;
+	return count;
+}
+
+static void
+check_queries(void)
+{
+	Appointment_t *appts = calloc(APPOINTMENTS, sizeof(*appts));
+	pi_recur_index_t *index = pi_recur_index_new();
+	pi_recur_t rule;
+	pi_occurrence_t *expected,
+		*found;
+	pi_buffer_t *buf = pi_buffer_new(1024);
+	long	from,
+		to,
+		total = 0;
+	int	count,
+		n,
+		q,
+		i;
+
+	for (i = 0; i < APPOINTMENTS; i++) {
+		make_up(&appts[i]);
+		CHECK(pi_recur_from_appointment(&rule, &appts[i]) == 0);
+		CHECK(pi_recur_index_add(index, &rule, &appts[i]) == i);
+
+		/* the index is rebuilt after more rules are added */
+		if (i == APPOINTMENTS / 2)
+			CHECK(pi_recur_index_query(index, 0, 1, buf) >= 0);
+	}
+
+	for (q = 0; q < QUERIES; q++) {
+		from = pi_days_from_civil(1999 + random_int(14),
+			1 + random_int(12), 1 + random_int(28)) * 1440
+			+ random_int(1440);
+		switch (q % 4) {
+		case 0:		/* less than a day */
+			to = from + 1 + random_int(1440);
+			break;
+		case 1:		/* a week */
+			to = from + 7 * 1440;
+			break;
+		case 2:		/* up to two months */
+			to = from + 1 + random_int(60 * 1440);
+			break;
+		default:	/* around an occurrence */
+			if (buf->used >= sizeof(pi_occurrence_t)) {
+				found = (pi_occurrence_t *) buf->data;
+				from = found[random_int(buf->used
+					/ sizeof(*found))].begin
+					- random_int(2);
+			}
+			to = from + 1 + random_int(3);
+			break;
+		}
+
+		count = pi_recur_index_query(index, from, to, buf);
+		n = brute_force(appts, from, to, &expected);
+		CHECK(count == n);
+		found = (pi_occurrence_t *) buf->data;
+		for (i = 0; i < count && i < n; i++) {
+			if (found[i].begin != expected[i].begin
+			    || found[i].end != expected[i].end
+			    || found[i].index != expected[i].index
+			    || found[i].data != &appts[found[i].index]) {
+				printf("query %d: occurrence %d differs\n", q, i);
+				failures++;
+				break;
+			}
+		}
+		total += n;
+		free(expected);
+	}
+	/* the ranges have to hit something for this to mean much */
+	CHECK(total > QUERIES);
+	CHECK(pi_recur_index_query(index, from, from, buf) == 0);
+
+	pi_buffer_free(buf);
+	pi_recur_index_free(index);
+	for (i = 0; i < APPOINTMENTS; i++)
+		free(appts[i].exception);
+	free(appts);
+}
+
+static void
+check_iter(void)
+{
+	CalendarEvent_t event;
+	pi_recur_t rule;
+	pi_recur_iter_t iter;
+	struct tm t;
+	long	begin,
+		end,
+		from;
+	int	n = 0;
+
+	/* 9:30-10:00 every third day, as a calendar event */
+	new_CalendarEvent(&event);
+	set_date(&event.begin, 2008, 6, 1);
+	event.begin.tm_hour = 9;
+	event.begin.tm_min = 30;
+	event.end = event.begin;
+	event.end.tm_hour = 10;
+	event.end.tm_min = 0;
+	event.repeatType = calendarRepeatDaily;
+	event.repeatFrequency = 3;
+	event.repeatForever = 1;
+	CHECK(pi_recur_from_calendar(&rule, &event) == 0);
+
+	/* from 9:45 on June 4th: that day's one is still on */
+	from = pi_days_from_civil(2008, 6, 4) * 1440 + 9 * 60 + 45;
+	pi_recur_iter_init(&iter, &rule, from, from + 7 * 1440);
+	while (pi_recur_iter_next(&iter, &begin, &end)) {
+		CHECK(end - begin == 30);
+		pi_recur_tm(begin, &t);
+		CHECK(t.tm_hour == 9 && t.tm_min == 30);
+		CHECK(t.tm_mday == 4 + 3 * n);
+		n++;
+	}
+	CHECK(n == 3);
+	pi_recur_free(&rule);
+}
+
+int
+main(int argc, char *argv[])
+{
+	check_known();
+	check_iter();
+	check_queries();
+
+	return failures ? 1 : 0;
+}
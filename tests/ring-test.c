@@ -0,0 +1,224 @@
+/*
+ * ring-test.c:  Check the read-ahead ring of the serial and USB devices
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Feeds the read and poll functions of the Unix serial device, and of the
+ * Linux USB device where it is built, from a socket pair instead of a
+ * port. Checks that one read() fills the ring and serves the small reads
+ * after it, that a read gives what the ring holds rather than wait for
+ * more, that a peek refills only when it wants more than the ring holds,
+ * that data wrapping around the end of the ring comes out in order, and
+ * what polling returns with and without data buffered.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-serial.h"
+#include "pi-usb.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s: %s\n", __FILE__, __LINE__, \
+				ring->name, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* A device, and the fields of its ring */
+struct ring {
+	const char *name;
+	pi_socket_t ps;
+	ssize_t (*read) PI_ARGS((pi_socket_t *ps, pi_buffer_t *buf,
+		size_t len, int flags));
+	int	(*poll) PI_ARGS((pi_socket_t *ps, int timeout));
+	int	(*flush) PI_ARGS((pi_socket_t *ps, int flags));
+	size_t	*size,
+		*start,
+		capacity;
+	int	*timeout,
+		*syscalls,
+		ready;			/* what poll() gives with data there */
+	int	writer;
+	unsigned long sent,		/* bytes of the stream written */
+		received;		/* and read */
+};
+
+/* Byte n of the stream */
+#define STREAM(n)	((unsigned char)((n) * 7 + (n) / 251))
+
+static void
+feed(struct ring *ring, size_t len)
+{
+	unsigned char data[8192];
+	size_t	i;
+
+	for (i = 0; i < len; i++)
+		data[i] = STREAM(ring->sent + i);
+	CHECK(write(ring->writer, data, len) == (ssize_t)len);
+	ring->sent += len;
+}
+
+/* Read up to len bytes, check they are the next ones of the stream,
+   and return how many came */
+static int
+receive(struct ring *ring, size_t len, int flags)
+{
+	pi_buffer_t *buf = pi_buffer_new(len);
+	ssize_t	bytes;
+	size_t	i;
+
+	bytes = ring->read(&ring->ps, buf, len, flags);
+	CHECK(bytes >= 0 && (size_t)bytes == buf->used);
+	for (i = 0; bytes > 0 && i < buf->used; i++)
+		if (buf->data[i] != STREAM(ring->received + i))
+			break;
+	CHECK(bytes <= 0 || i == buf->used);
+	if (bytes > 0 && flags != PI_MSG_PEEK)
+		ring->received += bytes;
+	pi_buffer_free(buf);
+	return bytes;
+}
+
+static void
+check_ring(struct ring *ring)
+{
+	pi_buffer_t *buf = pi_buffer_new(16);
+	int	fds[2],
+		calls;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		failures++;
+		return;
+	}
+	ring->ps.sd	= fds[0];
+	ring->writer	= fds[1];
+	*ring->timeout	= 100;
+
+	/* nothing there */
+	CHECK(ring->poll(&ring->ps, 100) == PI_ERR_SOCK_TIMEOUT);
+	CHECK(ring->read(&ring->ps, buf, 16, 0) == PI_ERR_SOCK_TIMEOUT);
+	CHECK(buf->used == 0);
+
+	/* one read() takes it all, and serves the reads after it */
+	feed(ring, 10);
+	CHECK(ring->poll(&ring->ps, 1000) == ring->ready);
+	calls = *ring->syscalls;
+	CHECK(receive(ring, 3, 0) == 3);
+	CHECK(*ring->size == 7);
+	CHECK(*ring->syscalls == calls + 2);
+
+	/* with data buffered, polling doesn't wait, and a read gives what
+	   is there */
+	calls = *ring->syscalls;
+	CHECK(ring->poll(&ring->ps, 1000) == ring->ready);
+	CHECK(receive(ring, 2, 0) == 2);
+	CHECK(receive(ring, 100, 0) == 5);
+	CHECK(*ring->syscalls == calls);
+	CHECK(*ring->size == 0 && *ring->start == 0);
+
+	/* leave a few bytes at the end of the ring, then peek past them:
+	   the ring is refilled, and the data wraps around */
+	feed(ring, ring->capacity - 5);
+	CHECK(receive(ring, ring->capacity - 10, 0)
+		== (int)(ring->capacity - 10));
+	CHECK(*ring->start == ring->capacity - 10 && *ring->size == 5);
+	feed(ring, 20);
+	CHECK(receive(ring, 3, PI_MSG_PEEK) == 3);
+	CHECK(*ring->size == 5);
+	calls = *ring->syscalls;
+	CHECK(receive(ring, 25, PI_MSG_PEEK) == 25);
+	CHECK(*ring->syscalls == calls + 2);
+	CHECK(*ring->size == 25);
+	CHECK(*ring->start + *ring->size > ring->capacity);
+	CHECK(receive(ring, 7, 0) == 7);
+	CHECK(receive(ring, 7, 0) == 7);
+	CHECK(*ring->start == 4);
+	CHECK(receive(ring, 100, 0) == 11);
+	CHECK(ring->received == ring->sent);
+
+	/* flushing input empties the ring */
+	feed(ring, 10);
+	CHECK(receive(ring, 2, 0) == 2);
+	CHECK(ring->flush(&ring->ps, PI_FLUSH_INPUT) == 0);
+	CHECK(*ring->size == 0);
+	CHECK(ring->poll(&ring->ps, 100) == PI_ERR_SOCK_TIMEOUT);
+
+	pi_buffer_free(buf);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ring ring;
+	pi_device_t *dev;
+	struct pi_serial_data *serial;
+#ifdef RING_TEST_LINUXUSB
+	pi_usb_data_t *usb;
+#endif
+
+	dev = pi_serial_device(PI_SERIAL_DEV);
+	serial = (struct pi_serial_data *)dev->data;
+	memset(&ring, 0, sizeof(ring));
+	ring.name	= "serial";
+	ring.ps.device	= dev;
+	ring.read	= serial->impl.read;
+	ring.poll	= serial->impl.poll;
+	ring.flush	= serial->impl.flush;
+	ring.size	= &serial->buf_size;
+	ring.start	= &serial->buf_start;
+	ring.capacity	= PI_SERIAL_RING_SIZE;
+	ring.timeout	= &serial->timeout;
+	ring.syscalls	= &serial->rx_syscalls;
+	ring.ready	= 0;
+	check_ring(&ring);
+	dev->free(dev);
+
+#ifdef RING_TEST_LINUXUSB
+	dev = pi_usb_device(PI_USB_DEV);
+	usb = (pi_usb_data_t *)dev->data;
+	memset(&ring, 0, sizeof(ring));
+	ring.name	= "usb";
+	ring.ps.device	= dev;
+	ring.read	= usb->impl.read;
+	ring.poll	= usb->impl.poll;
+	ring.flush	= usb->impl.flush;
+	ring.size	= &usb->buf_size;
+	ring.start	= &usb->buf_start;
+	ring.capacity	= PI_USB_RING_SIZE;
+	ring.timeout	= &usb->timeout;
+	ring.syscalls	= &usb->rx_syscalls;
+	ring.ready	= 1;
+	check_ring(&ring);
+	dev->free(dev);
+#endif
+
+	return failures ? 1 : 0;
+}
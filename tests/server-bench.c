@@ -0,0 +1,239 @@
+/*
+ * server-bench.c:  Multi-session server benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Serves a number of simulated devices at once. Each device is a thread
+ * that connects to the server over the loopback interface with NetSync
+ * and answers DLP requests with canned responses; each session opens a
+ * database on its device and reads every record of it.
+ *
+ * Usage: server-bench [devices [workers [records [record size]]]]
+ *
+ * The server listens on a TCP port the system chooses, so that several
+ * runs can share a host.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-server.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+struct bench {
+	int	devices,
+		workers,
+		records,
+		size;
+	long	bytes;		/* record data read by all the sessions */
+	char	port[64];	/* where the devices connect */
+	pthread_mutex_t lock;
+};
+
+/* Server side: read the whole database of the device */
+static int
+session(int sd, int id, void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+	pi_buffer_t *buffer;
+	int	db,
+		i,
+		result;
+	long	bytes = 0;
+
+	if (dlp_OpenDB(sd, 0, dlpOpenRead, "BenchDB", &db) < 0)
+		return -1;
+
+	buffer = pi_buffer_new(bench->size);
+	for (i = 0; i < bench->records; i++) {
+		result = dlp_ReadRecordByIndex(sd, db, i, buffer, NULL, NULL,
+			NULL);
+		if (result < 0)
+			break;
+		bytes += result;
+	}
+	pi_buffer_free(buffer);
+	dlp_CloseDB(sd, db);
+
+	pthread_mutex_lock(&bench->lock);
+	bench->bytes += bytes;
+	pthread_mutex_unlock(&bench->lock);
+
+	return i == bench->records ? 0 : -1;
+}
+
+/* Device side: answer requests until the end of the sync */
+static void *
+device(void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+	pi_buffer_t *request;
+	unsigned char *response;
+	int	sd,
+		cmd,
+		len,
+		split = 0,
+		state = PI_SOCK_CONN_END;
+	size_t	size;
+
+	response = malloc(bench->size + 32);
+	request = pi_buffer_new(256);
+
+	/* a device talks NetSync: no DLP layer on its side */
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_NET);
+	if (sd < 0 || pi_connect(sd, bench->port) < 0) {
+		fprintf(stderr, "device: unable to connect\n");
+		goto done;
+	}
+
+	/* like the server side, send each packet in one write */
+	size = sizeof(split);
+	pi_setsockopt(sd, PI_LEVEL_NET, PI_NET_SPLIT_WRITES, &split, &size);
+
+	for (;;) {
+		request->used = 0;
+		if (pi_read(sd, request, 0xffff) < 2)
+			break;
+		cmd = request->data[0];
+
+		response[0] = cmd | 0x80;
+		response[1] = 0;		/* argc */
+		response[2] = 0;		/* error */
+		response[3] = 0;
+		len = 4;
+
+		if (cmd == dlpFuncOpenDB) {
+			response[1] = 1;
+			response[len++] = 0x20;
+			response[len++] = 1;
+			response[len++] = 1;	/* handle */
+		} else if (cmd == dlpFuncReadRecord) {
+			int	arglen = 10 + bench->size;
+
+			response[1] = 1;
+			if (arglen < 256) {
+				response[len++] = 0x20;
+				response[len++] = arglen;
+			} else {
+				response[len++] = 0xa0;
+				response[len++] = 0;
+				response[len++] = arglen >> 8;
+				response[len++] = arglen & 0xff;
+			}
+			memset(response + len, 0, 10);	/* id, index, size, attr, cat */
+			memset(response + len + 10, 0x5a, bench->size);
+			len += arglen;
+		}
+
+		if (pi_write(sd, response, len) < len || cmd == dlpFuncEndOfSync)
+			break;
+	}
+
+	/* the server ended the sync: don't end it again */
+	size = sizeof(state);
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_STATE, &state, &size);
+
+done:
+	if (sd >= 0)
+		pi_close(sd);
+	pi_buffer_free(request);
+	free(response);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench bench;
+	struct pi_sockaddr addr;
+	struct timeval start,
+		end;
+	pthread_t *threads;
+	pi_server_t *server;
+	size_t	addrlen = sizeof(addr);
+	char	*port;
+	double	elapsed;
+	int	i,
+		completed,
+		failed;
+
+	bench.devices	= argc > 1 ? atoi(argv[1]) : 32;
+	bench.workers	= argc > 2 ? atoi(argv[2]) : 8;
+	bench.records	= argc > 3 ? atoi(argv[3]) : 500;
+	bench.size	= argc > 4 ? atoi(argv[4]) : 1024;
+	bench.bytes	= 0;
+	pthread_mutex_init(&bench.lock, NULL);
+
+	if (bench.size > 0xfff0) {
+		fprintf(stderr, "record size too large\n");
+		return 1;
+	}
+
+	server = pi_server_new(bench.workers, session, &bench);
+	if (server == NULL
+	    || pi_server_add_port(server, "net:127.0.0.1:0") < 0
+	    || pi_server_getsockname(server, (struct sockaddr *) &addr,
+			&addrlen) < 0
+	    || (port = strchr(addr.pi_device, ':')) == NULL) {
+		fprintf(stderr, "unable to start the server\n");
+		return 1;
+	}
+	snprintf(bench.port, sizeof(bench.port), "net:127.0.0.1%s", port);
+
+	threads = malloc(bench.devices * sizeof(pthread_t));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench.devices; i++)
+		pthread_create(&threads[i], NULL, device, &bench);
+	pi_server_wait(server, bench.devices);
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < bench.devices; i++)
+		pthread_join(threads[i], NULL);
+	pi_server_stats(server, &completed, &failed);
+	pi_server_free(server);
+	free(threads);
+
+	elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%d devices, %d workers, %d records of %d bytes each\n",
+		bench.devices, bench.workers, bench.records, bench.size);
+	printf("%d sessions completed, %d failed in %.3f s\n",
+		completed, failed, elapsed);
+	printf("%.1f sessions/s, %.2f MB/s\n", (completed + failed) / elapsed,
+		bench.bytes / elapsed / (1024 * 1024));
+
+	return failed ? 1 : 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+	fprintf(stderr, "server-bench: libpisock was built without threads\n");
+	return 77;
+}
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * store-test.c:  Check that the backup store keeps each record once and
+ *                gives back the databases put into it
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Puts two days' backups of a record database and a resource database
+ * into a store, then backs the first day up again from a virtual
+ * handheld, and checks what was written each time and that every
+ * snapshot comes back whole.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-store.h"
+#include "pi-util.h"
+#include "vhandheld.h"
+
+#define RECORDS	300
+#define RECSIZE	100
+
+/* Day 1 of each database, or day 2: records 5 and 6 changed, 7 gone
+   and one more at the end; resource 2 changed */
+static void
+make_db(const char *path, int resource, int day)
+{
+	struct DBInfo info;
+	pi_file_t *pf;
+	int	i;
+
+	pf = vh_make_db(path, resource ? "StoreTestRsrc" : "StoreTestDB",
+		pi_mktag('s', 't', 'o', 'r'), resource);
+	if (pf == NULL)
+		return;
+	pi_file_get_info(pf, &info);
+	info.modifyDate	+= day * 86400;
+	info.modnum	= day;
+	pi_file_set_info(pf, &info);
+
+	for (i = 0; i < (resource ? 8 : RECORDS); i++) {
+		if (resource) {
+			vh_add_resource(pf, 10000 + i
+				+ (day == 2 && i == 2 ? 500 : 0), RECSIZE, i);
+		} else {
+			if (day == 2 && i == 7)
+				continue;
+			vh_add_record(pf, i + (day == 2 && (i == 5 || i == 6)
+				? 1000 : 0), RECSIZE, i % 3, 0x2000 + i);
+		}
+	}
+	if (day == 2 && !resource)
+		vh_add_record(pf, 3000, RECSIZE, 1, 0x6000);
+	CHECK(pi_file_close(pf) == 0);
+}
+
+/* Check that two database files hold the same database, and unless
+   it went through the handheld, with the same header */
+static void
+check_same(const char *path, pi_file_t *copy, int header)
+{
+	struct DBInfo info,
+		info2;
+	pi_file_t *pf;
+	void	*data,
+		*data2;
+	size_t	size,
+		size2;
+	int	i,
+		count,
+		count2,
+		attr,
+		category,
+		attr2,
+		category2,
+		id,
+		id2;
+	unsigned long type,
+		type2;
+	recordid_t uid,
+		uid2;
+
+	CHECK(copy != NULL);
+	if (copy == NULL || (pf = pi_file_open(path)) == NULL)
+		return;
+
+	pi_file_get_info(pf, &info);
+	pi_file_get_info(copy, &info2);
+	CHECK(strcmp(info.name, info2.name) == 0);
+	CHECK(info.flags == info2.flags && info.type == info2.type
+		&& info.creator == info2.creator);
+	CHECK(!header || (info.modifyDate == info2.modifyDate
+		&& info.modnum == info2.modnum));
+
+	pi_file_get_app_info(pf, &data, &size);
+	pi_file_get_app_info(copy, &data2, &size2);
+	CHECK(size == size2 && memcmp(data, data2, size) == 0);
+
+	pi_file_get_entries(pf, &count);
+	pi_file_get_entries(copy, &count2);
+	CHECK(count == count2);
+	for (i = 0; i < count && i < count2; i++) {
+		if (info.flags & dlpDBFlagResource) {
+			pi_file_read_resource(pf, i, &data, &size, &type, &id);
+			pi_file_read_resource(copy, i, &data2, &size2, &type2,
+				&id2);
+			CHECK(type == type2 && id == id2);
+		} else {
+			pi_file_read_record(pf, i, &data, &size, &attr,
+				&category, &uid);
+			pi_file_read_record(copy, i, &data2, &size2, &attr2,
+				&category2, &uid2);
+			CHECK(uid == uid2 && category == category2);
+		}
+		CHECK(size == size2 && memcmp(data, data2, size) == 0);
+	}
+
+	pi_file_close(pf);
+	pi_file_close(copy);
+}
+
+static void
+add(pi_store_t *store, const char *path, const char *manifest)
+{
+	pi_file_t *pf;
+
+	pf = pi_file_open(path);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return;
+	CHECK(pi_store_add(store, pf, manifest) == 0);
+	pi_file_close(pf);
+}
+
+/* Put a database into the store and return the number of objects the
+   store didn't have yet */
+static unsigned long
+add_new(pi_store_t *store, const char *path, const char *manifest)
+{
+	struct pi_store_stats before,
+		after;
+
+	pi_store_get_stats(store, &before);
+	add(store, path, manifest);
+	pi_store_get_stats(store, &after);
+	return after.new_objects - before.new_objects;
+}
+
+static void
+remove_tree(const char *path)
+{
+	struct dirent *dirent;
+	struct stat sbuf;
+	char	name[1024];
+	DIR	*dir;
+
+	if (lstat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode)
+	    && (dir = opendir(path)) != NULL) {
+		while ((dirent = readdir(dir)) != NULL) {
+			if (strcmp(dirent->d_name, ".") == 0
+			    || strcmp(dirent->d_name, "..") == 0)
+				continue;
+			sprintf(name, "%s/%s", path, dirent->d_name);
+			remove_tree(name);
+		}
+		closedir(dir);
+		rmdir(path);
+	} else {
+		unlink(path);
+	}
+}
+
+#if HAVE_PTHREAD
+#define PORT	"loop:store-test"
+
+/* Install day 1 on a virtual handheld and back it up: the store
+   already has every record */
+static void
+check_retrieve(pi_store_t *store, const char *dir, const char *path)
+{
+	struct vh_device dev;
+	struct DBInfo info;
+	struct pi_store_stats before,
+		after;
+	vhandheld_t *vh;
+	pi_file_t *pf;
+	char	name[1024];
+	int	sd;
+
+	sprintf(name, "%s/device", dir);
+	mkdir(name, 0700);
+	vh = vh_new(name);
+	CHECK(vh != NULL);
+	if (vh == NULL)
+		return;
+	if ((sd = vh_start(&dev, vh, PORT)) < 0) {
+		vh_failures++;
+		vh_free(vh);
+		return;
+	}
+
+	pf = pi_file_open(path);
+	CHECK(pf != NULL && pi_file_install(pf, sd, 0, NULL) >= 0);
+	if (pf != NULL)
+		pi_file_close(pf);
+
+	CHECK(dlp_FindDBByName(sd, 0, "StoreTestDB", NULL, NULL, &info,
+		NULL) >= 0);
+	sprintf(name, "%s/retrieved.pdb", dir);
+	pi_store_get_stats(store, &before);
+	CHECK(pi_store_retrieve(store, sd, 0, &info, name, NULL) >= 0);
+	pi_store_get_stats(store, &after);
+	CHECK(after.objects - before.objects == RECORDS + 1);
+	CHECK(after.new_objects == before.new_objects);
+	check_same(path, pi_store_open_file(store, name), 0);
+
+	CHECK(vh_finish(&dev, sd) >= 0);
+	vh_free(vh);
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+	struct DBInfo info;
+	struct DBSizeInfo size;
+	struct stat sbuf;
+	pi_store_t *store;
+	char	dir[] = "/tmp/store-testXXXXXX",
+		path[4][sizeof(dir) + 16],
+		manifest[4][sizeof(dir) + 32],
+		copy[sizeof(dir) + 16],
+		object[1024];
+	struct dirent *dirent;
+	DIR	*objects;
+	FILE	*f;
+	int	i;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (i = 0; i < 4; i++) {
+		sprintf(path[i], "%s/%s%d", dir, i & 1 ? "rsrc" : "db",
+			i / 2 + 1);
+		sprintf(manifest[i], "%s/day%d/%s", dir, i / 2 + 1,
+			i & 1 ? "rsrc" : "db");
+		make_db(path[i], i & 1, i / 2 + 1);
+	}
+	sprintf(copy, "%s/day1", dir);
+	mkdir(copy, 0700);
+	sprintf(copy, "%s/day2", dir);
+	mkdir(copy, 0700);
+	sprintf(copy, "%s/copy", dir);
+
+	sprintf(object, "%s/store", dir);
+	store = pi_store_open(object);
+	CHECK(store != NULL);
+	if (store == NULL)
+		return 1;
+
+	/* day 1: everything is new, but the databases share the appInfo
+	   block */
+	CHECK(add_new(store, path[0], manifest[0]) == RECORDS + 1);
+	CHECK(add_new(store, path[1], manifest[1]) == 8);
+
+	/* day 2: only the changes are */
+	CHECK(add_new(store, path[2], manifest[2]) == 3);
+	CHECK(add_new(store, path[3], manifest[3]) == 1);
+
+	/* and again: nothing is */
+	CHECK(add_new(store, path[2], manifest[2]) == 0);
+
+	/* each snapshot comes back as it went in */
+	for (i = 0; i < 4; i++) {
+		CHECK(pi_store_get_info(manifest[i], &info, &size) == 0);
+		CHECK(info.modnum == (unsigned long)(i / 2 + 1));
+		CHECK(size.maxRecSize == RECSIZE);
+		CHECK(pi_store_materialize(store, manifest[i], copy) == 0);
+		CHECK(stat(copy, &sbuf) == 0
+			&& (unsigned long)sbuf.st_size == size.totalBytes);
+		check_same(path[i], pi_file_open(copy), 1);
+		check_same(path[i], pi_store_open_file(store, manifest[i]), 1);
+	}
+
+#if HAVE_PTHREAD
+	check_retrieve(store, dir, path[0]);
+#endif
+
+	/* a damaged object is noticed */
+	sprintf(object, "%s/store/objects", dir);
+	objects = opendir(object);
+	CHECK(objects != NULL);
+	while (objects != NULL && (dirent = readdir(objects)) != NULL) {
+		DIR	*sub;
+
+		if (dirent->d_name[0] == '.')
+			continue;
+		sprintf(object, "%s/store/objects/%s", dir, dirent->d_name);
+		if ((sub = opendir(object)) == NULL)
+			continue;
+		while ((dirent = readdir(sub)) != NULL)
+			if (dirent->d_name[0] != '.')
+				break;
+		if (dirent != NULL) {
+			strcat(object, "/");
+			strcat(object, dirent->d_name);
+		}
+		closedir(sub);
+		if (dirent != NULL)
+			break;
+	}
+	if (objects != NULL)
+		closedir(objects);
+	f = fopen(object, "ab");
+	CHECK(f != NULL);
+	if (f != NULL) {
+		fputc('!', f);
+		fclose(f);
+	}
+	for (i = 0; i < 4; i++)
+		if (pi_store_materialize(store, manifest[i], copy) < 0)
+			break;
+	CHECK(i < 4);
+	CHECK(access(copy, F_OK) != 0);
+
+	pi_store_close(store);
+	remove_tree(dir);
+
+	return vh_failures ? 1 : 0;
+}
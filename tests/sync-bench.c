@@ -0,0 +1,170 @@
+/*
+ * sync-bench.c:  Backup and restore benchmark against a virtual handheld
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Loads the databases of a directory into a virtual handheld, connects
+ * it to the desktop through the loopback device, then times a full
+ * backup with pi_file_retrieve() into a temporary directory and a full
+ * restore of that backup with pi_file_install(). Everything happens in
+ * memory, so the figures measure the protocol stack and the file code.
+ *
+ * Usage: sync-bench dir
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "vhandheld.h"
+
+#if HAVE_PTHREAD
+
+#define PORT	"loop:sync-bench"
+
+static double
+seconds(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec)
+		+ (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+report(const char *what, int dbs, long bytes, double elapsed)
+{
+	printf("%s: %d databases, %ld bytes in %.3f s\n", what, dbs, bytes,
+		elapsed);
+	printf("%s: %.2f MB/s, %.0f databases/s, %.3f ms per database\n",
+		what, bytes / elapsed / 1000000.0, dbs / elapsed,
+		elapsed * 1000.0 / dbs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vh_device dev;
+	struct PilotUser user;
+	struct DBInfo *dbs = NULL;
+	struct timeval start,
+		end;
+	vhandheld_t *vh;
+	pi_buffer_t *list;
+	pi_file_t *pf;
+	char	dir[] = "/tmp/sync-benchXXXXXX",
+		path[sizeof(dir) + 16];
+	long	bytes;
+	int	sd,
+		result,
+		count = 0,
+		backed_up,
+		restored = 0,
+		index = 0,
+		i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s dir\n", argv[0]);
+		return 1;
+	}
+	if ((vh = vh_new(argv[1])) == NULL) {
+		fprintf(stderr, "unable to read %s\n", argv[1]);
+		return 1;
+	}
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	bytes = vh_bytes(vh);
+
+	if ((sd = vh_start(&dev, vh, PORT)) < 0)
+		return 1;
+	if (dlp_ReadUserInfo(sd, &user) < 0) {
+		fprintf(stderr, "unable to read the user\n");
+		return 1;
+	}
+
+	/* backup: the database list, then every database */
+	gettimeofday(&start, NULL);
+	list = pi_buffer_new(sizeof(struct DBInfo));
+	while (dlp_ReadDBList(sd, 0, dlpDBListRAM | dlpDBListMultiple, index,
+			list) >= 0) {
+		dbs = realloc(dbs, count * sizeof(struct DBInfo) + list->used);
+		memcpy(dbs + count, list->data, list->used);
+		count += list->used / sizeof(struct DBInfo);
+		index = dbs[count - 1].index + 1;
+		if (!dbs[count - 1].more)
+			break;
+	}
+	pi_buffer_free(list);
+
+	for (backed_up = 0; backed_up < count; backed_up++) {
+		sprintf(path, "%s/%d.pdb", dir, backed_up);
+		if ((pf = pi_file_create(path, &dbs[backed_up])) == NULL)
+			break;
+		if (pi_file_retrieve(pf, sd, 0, NULL) < 0) {
+			fprintf(stderr, "unable to back up %s\n",
+				dbs[backed_up].name);
+			pi_file_close(pf);
+			break;
+		}
+		pi_file_close(pf);
+	}
+	gettimeofday(&end, NULL);
+	report("backup", backed_up, bytes, seconds(&start, &end));
+
+	/* restore: install the backup over the databases */
+	gettimeofday(&start, NULL);
+	for (restored = 0; restored < backed_up; restored++) {
+		sprintf(path, "%s/%d.pdb", dir, restored);
+		if ((pf = pi_file_open(path)) == NULL)
+			break;
+		if (pi_file_install(pf, sd, 0, NULL) < 0) {
+			fprintf(stderr, "unable to restore %s\n",
+				dbs[restored].name);
+			pi_file_close(pf);
+			break;
+		}
+		pi_file_close(pf);
+	}
+	gettimeofday(&end, NULL);
+	report("restore", restored, vh_bytes(vh), seconds(&start, &end));
+
+	result = vh_finish(&dev, sd);
+
+	for (i = 0; i < backed_up; i++) {
+		sprintf(path, "%s/%d.pdb", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	free(dbs);
+
+	if (result < 0)
+		fprintf(stderr, "device: error %d\n", result);
+	vh_free(vh);
+
+	return count > 0 && restored == count && result >= 0 ? 0 : 1;
+}
+
+#else
+VH_MAIN_WITHOUT_THREADS("sync-bench")
+#endif
@@ -0,0 +1,1378 @@
+/*
+ * vhandheld.c:  Virtual handheld for tests and benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
+#include "pi-util.h"
+#include "vhandheld.h"
+
+#define VH_MAX_OPEN	16		/* open databases */
+#define VH_MAX_ARGS	8		/* arguments of a request */
+#define VH_LIST_MAX	16		/* databases per dlpDBListMultiple reply */
+#define VH_MAX_REC_SIZE	0xffff
+#define VH_BUF_SIZE	0x20000		/* largest NetSync packet we take */
+
+/* A record, or a resource */
+struct vh_entry {
+	unsigned char *data;
+	size_t	size;
+	unsigned long type;		/* resources */
+	int	id,
+		attr,			/* records */
+		category;
+	recordid_t uid;
+};
+
+struct vh_db {
+	struct DBInfo info;
+	unsigned char *app_info,
+		*sort_info;
+	size_t	app_info_size,
+		sort_info_size;
+	struct vh_entry *entries;
+	int	count,
+		allocated;
+	recordid_t next_uid;
+};
+
+struct vh_open {
+	struct vh_db *db;
+	int	next_modified,		/* ReadNextModifiedRec position */
+		changed;		/* bump the modification number on close */
+};
+
+struct vhandheld {
+	struct vh_db **dbs;
+	int	count,
+		allocated;
+	struct vh_open open[VH_MAX_OPEN];	/* handle - 1 */
+	char	user[128];
+	unsigned long user_id,
+		viewer_id,
+		last_sync_pc;
+	time_t	last_sync;
+};
+
+struct vh_arg {
+	int	id;
+	size_t	len;
+	unsigned char *data;
+};
+
+struct vh_request {
+	int	cmd,
+		argc;
+	struct vh_arg argv[VH_MAX_ARGS];
+};
+
+
+/* Databases */
+
+static struct vh_entry *
+vh_db_add(struct vh_db *db, int index)
+{
+	struct vh_entry *entries;
+
+	if (db->count == db->allocated) {
+		entries = realloc(db->entries, (db->allocated * 2 + 16)
+			* sizeof(struct vh_entry));
+		if (entries == NULL)
+			return NULL;
+		db->entries = entries;
+		db->allocated = db->allocated * 2 + 16;
+	}
+	memmove(db->entries + index + 1, db->entries + index,
+		(db->count - index) * sizeof(struct vh_entry));
+	db->count++;
+	memset(&db->entries[index], 0, sizeof(struct vh_entry));
+	return &db->entries[index];
+}
+
+static void
+vh_db_remove(struct vh_db *db, int index)
+{
+	free(db->entries[index].data);
+	memmove(db->entries + index, db->entries + index + 1,
+		(db->count - index - 1) * sizeof(struct vh_entry));
+	db->count--;
+}
+
+static int
+vh_set_data(unsigned char **data, size_t *size, const void *src, size_t len)
+{
+	unsigned char *copy = NULL;
+
+	if (len > 0) {
+		if ((copy = malloc(len)) == NULL)
+			return -1;
+		memcpy(copy, src, len);
+	}
+	free(*data);
+	*data	= copy;
+	*size	= len;
+	return 0;
+}
+
+static void
+vh_db_free(struct vh_db *db)
+{
+	int	i;
+
+	for (i = 0; i < db->count; i++)
+		free(db->entries[i].data);
+	free(db->entries);
+	free(db->app_info);
+	free(db->sort_info);
+	free(db);
+}
+
+static struct vh_db *
+vh_db_new(void)
+{
+	struct vh_db *db = calloc(1, sizeof(struct vh_db));
+
+	if (db != NULL) {
+		db->info.miscFlags = dlpDBMiscFlagRamBased;
+		db->next_uid = 0x800001;
+	}
+	return db;
+}
+
+static struct vh_db *
+vh_db_load(const char *path)
+{
+	pi_file_t *pf;
+	struct vh_db *db;
+	struct vh_entry *e;
+	void	*data;
+	size_t	size;
+	int	i,
+		count,
+		resource,
+		result;
+
+	if ((pf = pi_file_open(path)) == NULL)
+		return NULL;
+	if ((db = vh_db_new()) == NULL) {
+		pi_file_close(pf);
+		return NULL;
+	}
+
+	pi_file_get_info(pf, &db->info);
+	db->info.flags &= ~dlpDBFlagOpen;
+	db->info.miscFlags = dlpDBMiscFlagRamBased;
+	resource = db->info.flags & dlpDBFlagResource;
+
+	pi_file_get_app_info(pf, &data, &size);
+	vh_set_data(&db->app_info, &db->app_info_size, data, size);
+	pi_file_get_sort_info(pf, &data, &size);
+	vh_set_data(&db->sort_info, &db->sort_info_size, data, size);
+
+	pi_file_get_entries(pf, &count);
+	for (i = 0; i < count; i++) {
+		if ((e = vh_db_add(db, db->count)) == NULL)
+			break;
+		if (resource)
+			result = pi_file_read_resource(pf, i, &data, &size,
+				&e->type, &e->id);
+		else
+			result = pi_file_read_record(pf, i, &data, &size,
+				&e->attr, &e->category, &e->uid);
+		if (result < 0
+		    || vh_set_data(&e->data, &e->size, data, size) < 0) {
+			db->count--;
+			break;
+		}
+		if (e->uid >= db->next_uid)
+			db->next_uid = e->uid + 1;
+	}
+	pi_file_close(pf);
+
+	if (i < count) {
+		vh_db_free(db);
+		return NULL;
+	}
+	return db;
+}
+
+static struct vh_db *
+vh_find_db(vhandheld_t *vh, const char *name)
+{
+	int	i;
+
+	for (i = 0; i < vh->count; i++)
+		if (strcmp(vh->dbs[i]->info.name, name) == 0)
+			return vh->dbs[i];
+	return NULL;
+}
+
+static int
+vh_add_db(vhandheld_t *vh, struct vh_db *db)
+{
+	struct vh_db **dbs;
+
+	if (vh->count == vh->allocated) {
+		dbs = realloc(vh->dbs, (vh->allocated * 2 + 16)
+			* sizeof(struct vh_db *));
+		if (dbs == NULL)
+			return -1;
+		vh->dbs = dbs;
+		vh->allocated = vh->allocated * 2 + 16;
+	}
+	db->info.index = vh->count;
+	vh->dbs[vh->count++] = db;
+	return 0;
+}
+
+static void
+vh_delete_db(vhandheld_t *vh, struct vh_db *db)
+{
+	int	i;
+
+	for (i = 0; i < VH_MAX_OPEN; i++)
+		if (vh->open[i].db == db)
+			vh->open[i].db = NULL;
+	for (i = db->info.index; i < vh->count - 1; i++) {
+		vh->dbs[i] = vh->dbs[i + 1];
+		vh->dbs[i]->info.index = i;
+	}
+	vh->count--;
+	vh_db_free(db);
+}
+
+static int
+vh_open_db(vhandheld_t *vh, struct vh_db *db)
+{
+	int	i;
+
+	for (i = 0; i < VH_MAX_OPEN; i++) {
+		if (vh->open[i].db == NULL) {
+			vh->open[i].db = db;
+			vh->open[i].next_modified = 0;
+			vh->open[i].changed = 0;
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+static struct vh_open *
+vh_handle(vhandheld_t *vh, int handle)
+{
+	if (handle < 1 || handle > VH_MAX_OPEN || vh->open[handle - 1].db == NULL)
+		return NULL;
+	return &vh->open[handle - 1];
+}
+
+static int
+vh_find_record(struct vh_db *db, recordid_t uid)
+{
+	int	i;
+
+	for (i = 0; i < db->count; i++)
+		if (db->entries[i].uid == uid)
+			return i;
+	return -1;
+}
+
+static int
+vh_find_resource(struct vh_db *db, unsigned long type, int id)
+{
+	int	i;
+
+	for (i = 0; i < db->count; i++)
+		if (db->entries[i].type == type && db->entries[i].id == id)
+			return i;
+	return -1;
+}
+
+
+/* Requests and responses */
+
+static int
+vh_parse(pi_buffer_t *buf, struct vh_request *req)
+{
+	unsigned char *p = buf->data + 2,
+		*end = buf->data + buf->used;
+	size_t	hdr,
+		len;
+	int	i;
+
+	if (buf->used < 2)
+		return -1;
+	req->cmd	= buf->data[0];
+	req->argc	= buf->data[1];
+	if (req->argc > VH_MAX_ARGS)
+		return -1;
+
+	for (i = 0; i < req->argc; i++) {
+		if (end - p < 2)
+			return -1;
+		if (p[0] & PI_DLP_ARG_FLAG_LONG) {
+			hdr = 6;
+			if (end - p < 6)
+				return -1;
+			len = get_long(p + 2);
+		} else if (p[0] & PI_DLP_ARG_FLAG_SHORT) {
+			hdr = 4;
+			if (end - p < 4)
+				return -1;
+			len = get_short(p + 2);
+		} else {
+			hdr = 2;
+			len = p[1];
+		}
+		if ((size_t)(end - p) - hdr < len)
+			return -1;
+		req->argv[i].id		= p[0] & 0x3f;
+		req->argv[i].len	= len;
+		req->argv[i].data	= p + hdr;
+		p += hdr + len;
+	}
+	return 0;
+}
+
+static void
+vh_begin(pi_buffer_t *res, int cmd)
+{
+	pi_buffer_clear(res);
+	pi_buffer_expect(res, 4);
+	res->data[0] = cmd | 0x80;
+	res->data[1] = 0;		/* argc */
+	set_short(res->data + 2, dlpErrNoError);
+	res->used = 4;
+}
+
+static void
+vh_error(pi_buffer_t *res, int err)
+{
+	res->data[1] = 0;
+	set_short(res->data + 2, err);
+	res->used = 4;
+}
+
+/* Append an argument of len bytes, returning where its data goes */
+static unsigned char *
+vh_arg(pi_buffer_t *res, size_t len)
+{
+	unsigned char *p;
+	int	id = PI_DLP_ARG_FIRST_ID + res->data[1];
+
+	if (pi_buffer_expect(res, len + 6) == NULL)
+		return NULL;
+	p = res->data + res->used;
+	if (len <= PI_DLP_ARG_TINY_LEN) {
+		p[0] = id;
+		p[1] = len;
+		p += 2;
+	} else if (len <= PI_DLP_ARG_SHORT_LEN) {
+		p[0] = id | PI_DLP_ARG_FLAG_SHORT;
+		p[1] = 0;
+		set_short(p + 2, len);
+		p += 4;
+	} else {
+		p[0] = id | PI_DLP_ARG_FLAG_LONG;
+		p[1] = 0;
+		set_long(p + 2, len);
+		p += 6;
+	}
+	res->used = p + len - res->data;
+	res->data[1]++;
+	return p;
+}
+
+/* Record and resource replies share most of their layout */
+static void
+vh_record_reply(pi_buffer_t *res, struct vh_db *db, int index,
+	size_t offset, size_t max)
+{
+	struct vh_entry *e = &db->entries[index];
+	size_t	len = offset < e->size ? e->size - offset : 0;
+	unsigned char *p;
+
+	if (len > max)
+		len = max;
+	if ((p = vh_arg(res, 10 + len)) == NULL) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	if (db->info.flags & dlpDBFlagResource) {
+		set_long(p, e->type);
+		set_short(p + 4, e->id);
+		set_short(p + 6, index);
+		set_short(p + 8, e->size);
+	} else {
+		set_long(p, e->uid);
+		set_short(p + 4, index);
+		set_short(p + 6, e->size);
+		set_byte(p + 8, e->attr);
+		set_byte(p + 9, e->category);
+	}
+	if (len > 0)
+		memcpy(p + 10, e->data + offset, len);
+}
+
+static void
+vh_db_info(unsigned char *p, struct vh_db *db)
+{
+	set_short(p, db->info.flags);
+	set_long(p + 2, db->info.type);
+	set_long(p + 6, db->info.creator);
+	set_short(p + 10, db->info.version);
+	set_long(p + 12, db->info.modnum);
+	dlp_htopdate(db->info.createDate, p + 16);
+	dlp_htopdate(db->info.modifyDate, p + 24);
+	dlp_htopdate(db->info.backupDate, p + 32);
+	set_short(p + 40, db->info.index);
+	strcpy((char *)p + 42, db->info.name);
+}
+
+static void
+vh_read_db_list(vhandheld_t *vh, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data,
+		*p;
+	int	flags = a[0],
+		start = get_short(a + 2),
+		count,
+		i;
+	size_t	len,
+		size;
+
+	/* there is nothing in ROM: answer as devices that send an empty
+	   list rather than an error do */
+	if (!(flags & dlpDBListRAM)) {
+		if ((p = vh_arg(res, 4)) == NULL)
+			vh_error(res, dlpErrMemory);
+		else
+			memset(p, 0, 4);
+		return;
+	}
+	if (start >= vh->count) {
+		vh_error(res, dlpErrNotFound);
+		return;
+	}
+
+	count = (flags & dlpDBListMultiple) ? VH_LIST_MAX : 1;
+	if (count > vh->count - start)
+		count = vh->count - start;
+
+	for (len = 4, i = start; i < start + count; i++)
+		len += (44 + strlen(vh->dbs[i]->info.name) + 2) & ~1;
+	if ((p = vh_arg(res, len)) == NULL) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	memset(p, 0, len);
+	set_short(p, start + count - 1);
+	set_byte(p + 2, start + count < vh->count);
+	set_byte(p + 3, count);
+	for (p += 4, i = start; i < start + count; i++, p += size) {
+		size = (44 + strlen(vh->dbs[i]->info.name) + 2) & ~1;
+		set_byte(p, size);
+		set_byte(p + 1, vh->dbs[i]->info.miscFlags);
+		vh_db_info(p + 2, vh->dbs[i]);
+	}
+}
+
+static void
+vh_find_db_reply(vhandheld_t *vh, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data,
+		*p;
+	struct vh_db *db = NULL;
+	struct vh_open *o;
+	int	flags = a[0],
+		i;
+	long	bytes;
+
+	switch (req->argv[0].id) {
+		case 0x20:		/* by name */
+			if (req->argv[0].len > 2)
+				db = vh_find_db(vh, (char *)a + 2);
+			break;
+		case 0x21:		/* by open handle */
+			if ((o = vh_handle(vh, a[1])) != NULL)
+				db = o->db;
+			break;
+		case 0x22:		/* by type and creator */
+			for (i = 0; i < vh->count && db == NULL; i++) {
+				if ((get_long(a + 2) == 0
+					|| vh->dbs[i]->info.type == get_long(a + 2))
+				    && (get_long(a + 6) == 0
+					|| vh->dbs[i]->info.creator == get_long(a + 6)))
+					db = vh->dbs[i];
+			}
+			break;
+	}
+	if (db == NULL) {
+		vh_error(res, dlpErrNotFound);
+		return;
+	}
+
+	if ((p = vh_arg(res, 54 + strlen(db->info.name) + 1)) == NULL) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	set_byte(p, 0);				/* card */
+	set_long(p + 2, db->info.index + 1);	/* local id */
+	set_long(p + 6, db->info.index + 1);	/* handle */
+	set_byte(p + 10, 0);
+	set_byte(p + 11, db->info.miscFlags);
+	vh_db_info(p + 12, db);
+
+	if (flags & dlpFindDBOptFlagGetSize) {
+		if ((p = vh_arg(res, 24)) == NULL) {
+			vh_error(res, dlpErrMemory);
+			return;
+		}
+		for (bytes = 0, i = 0; i < db->count; i++)
+			bytes += db->entries[i].size;
+		set_long(p, db->count);
+		set_long(p + 4, 78 + 10 * db->count + bytes
+			+ db->app_info_size + db->sort_info_size);
+		set_long(p + 8, bytes);
+		set_long(p + 12, db->app_info_size);
+		set_long(p + 16, db->sort_info_size);
+		set_long(p + 20, 0);
+	}
+}
+
+static void
+vh_create_db(vhandheld_t *vh, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data;
+	struct vh_db *db;
+	int	handle;
+
+	if (vh_find_db(vh, (char *)a + 14) != NULL) {
+		vh_error(res, dlpErrExists);
+		return;
+	}
+	if ((db = vh_db_new()) == NULL || vh_add_db(vh, db) < 0) {
+		free(db);
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	db->info.creator	= get_long(a);
+	db->info.type		= get_long(a + 4);
+	db->info.flags		= get_short(a + 10);
+	db->info.version	= get_short(a + 12);
+	strncpy(db->info.name, (char *)a + 14, sizeof(db->info.name) - 1);
+	db->info.createDate	= time(NULL);
+	db->info.modifyDate	= db->info.createDate;
+	db->info.backupDate	= 0;
+
+	if ((handle = vh_open_db(vh, db)) < 0)
+		vh_error(res, dlpErrLimit);
+	else
+		set_byte(vh_arg(res, 1), handle);
+}
+
+static void
+vh_write_block(unsigned char **block, size_t *size, struct vh_request *req,
+	pi_buffer_t *res)
+{
+	size_t	len = get_short(req->argv[0].data + 2);
+
+	if (len > req->argv[0].len - 4)
+		vh_error(res, dlpErrParam);
+	else if (vh_set_data(block, size, req->argv[0].data + 4, len) < 0)
+		vh_error(res, dlpErrMemory);
+}
+
+static void
+vh_read_block(unsigned char *block, size_t size, struct vh_request *req,
+	pi_buffer_t *res)
+{
+	size_t	offset = get_short(req->argv[0].data + 2),
+		len = get_short(req->argv[0].data + 4);
+	unsigned char *p;
+
+	if (size == 0) {
+		vh_error(res, dlpErrNotFound);
+		return;
+	}
+	if (offset > size)
+		offset = size;
+	if (len > size - offset)
+		len = size - offset;
+	if ((p = vh_arg(res, 2 + len)) == NULL) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	set_short(p, len);
+	memcpy(p + 2, block + offset, len);
+}
+
+static void
+vh_write_record(struct vh_db *db, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data;
+	recordid_t uid = get_long(a + 2);
+	struct vh_entry *e;
+	unsigned char *p;
+	int	index;
+
+	if (uid == 0 || (index = vh_find_record(db, uid)) < 0) {
+		if ((e = vh_db_add(db, db->count)) == NULL) {
+			vh_error(res, dlpErrMemory);
+			return;
+		}
+		if (uid == 0)
+			uid = db->next_uid++;
+		else if (uid >= db->next_uid)
+			db->next_uid = uid + 1;
+		e->uid = uid;
+	} else {
+		e = &db->entries[index];
+	}
+	e->attr		= get_byte(a + 6);
+	e->category	= get_byte(a + 7);
+	if (vh_set_data(&e->data, &e->size, a + 8, req->argv[0].len - 8) < 0) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	/* set_long() evaluates its pointer once per byte */
+	if ((p = vh_arg(res, 4)) != NULL)
+		set_long(p, uid);
+}
+
+static void
+vh_write_resource(struct vh_db *db, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data;
+	unsigned long type = get_long(a + 2);
+	int	id = get_short(a + 6),
+		index;
+	size_t	len = get_short(a + 8);
+	struct vh_entry *e;
+
+	if (len > req->argv[0].len - 10) {
+		vh_error(res, dlpErrParam);
+		return;
+	}
+	if ((index = vh_find_resource(db, type, id)) >= 0)
+		e = &db->entries[index];
+	else if ((e = vh_db_add(db, db->count)) == NULL) {
+		vh_error(res, dlpErrMemory);
+		return;
+	}
+	e->type	= type;
+	e->id	= id;
+	if (vh_set_data(&e->data, &e->size, a + 10, len) < 0)
+		vh_error(res, dlpErrMemory);
+}
+
+static void
+vh_delete_entries(struct vh_db *db, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data;
+	int	flags = a[1],
+		index,
+		i;
+
+	if (flags & 0x80) {			/* all of them */
+		while (db->count > 0)
+			vh_db_remove(db, db->count - 1);
+		return;
+	}
+	if (!(db->info.flags & dlpDBFlagResource) && (flags & 0x40)) {
+		for (i = db->count - 1; i >= 0; i--)	/* a category */
+			if (db->entries[i].category == (int)(get_long(a + 2) & 0xff))
+				vh_db_remove(db, i);
+		return;
+	}
+
+	index = (db->info.flags & dlpDBFlagResource)
+		? vh_find_resource(db, get_long(a + 2), get_short(a + 6))
+		: vh_find_record(db, get_long(a + 2));
+	if (index < 0)
+		vh_error(res, dlpErrNotFound);
+	else
+		vh_db_remove(db, index);
+}
+
+static void
+vh_next_modified(struct vh_open *o, struct vh_request *req,
+	pi_buffer_t *res)
+{
+	struct vh_db *db = o->db;
+	int	category = -1;
+
+	if (req->cmd == dlpFuncReadNextModifiedRecInCategory)
+		category = req->argv[0].data[1];
+	while (o->next_modified < db->count) {
+		struct vh_entry *e = &db->entries[o->next_modified++];
+
+		if ((e->attr & dlpRecAttrDirty)
+		    && (category < 0 || e->category == category)) {
+			vh_record_reply(res, db, o->next_modified - 1, 0,
+				VH_MAX_REC_SIZE);
+			return;
+		}
+	}
+	vh_error(res, dlpErrNotFound);
+}
+
+/* Requests about an open database: the first byte is the handle */
+static void
+vh_db_request(vhandheld_t *vh, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argv[0].data,
+		*p;
+	struct vh_open *o = vh_handle(vh, a[0]);
+	struct vh_db *db;
+	int	resource,
+		index,
+		max,
+		i;
+
+	if (o == NULL) {
+		vh_error(res, dlpErrNoneOpen);
+		return;
+	}
+	db = o->db;
+	resource = db->info.flags & dlpDBFlagResource;
+
+	switch (req->cmd) {
+		case dlpFuncWriteAppBlock:
+		case dlpFuncWriteSortBlock:
+		case dlpFuncWriteRecord:
+		case dlpFuncWriteResource:
+		case dlpFuncDeleteRecord:
+		case dlpFuncDeleteResource:
+		case dlpFuncResetSyncFlags:
+		case dlpFuncCleanUpDatabase:
+			o->changed = 1;
+			break;
+	}
+
+	switch (req->cmd) {
+		case dlpFuncReadOpenDBInfo:
+			if ((p = vh_arg(res, 2)) != NULL)
+				set_short(p, db->count);
+			break;
+
+		case dlpFuncReadAppBlock:
+			vh_read_block(db->app_info, db->app_info_size, req, res);
+			break;
+		case dlpFuncReadSortBlock:
+			vh_read_block(db->sort_info, db->sort_info_size, req, res);
+			break;
+		case dlpFuncWriteAppBlock:
+			vh_write_block(&db->app_info, &db->app_info_size, req, res);
+			break;
+		case dlpFuncWriteSortBlock:
+			vh_write_block(&db->sort_info, &db->sort_info_size, req, res);
+			break;
+
+		case dlpFuncReadRecord:
+			if (resource) {
+				vh_error(res, dlpErrNotSupp);
+				break;
+			}
+			if (req->argv[0].id == 0x21) {	/* by index */
+				index = get_short(a + 2);
+				if (index >= db->count) {
+					vh_error(res, dlpErrNotFound);
+					break;
+				}
+				vh_record_reply(res, db, index, get_short(a + 4),
+					get_short(a + 6));
+			} else {			/* by id */
+				if (req->argv[0].len < 10
+				    || (index = vh_find_record(db, get_long(a + 2))) < 0) {
+					vh_error(res, dlpErrNotFound);
+					break;
+				}
+				vh_record_reply(res, db, index, get_short(a + 6),
+					get_short(a + 8));
+			}
+			break;
+
+		case dlpFuncReadResource:
+			if (!resource) {
+				vh_error(res, dlpErrNotSupp);
+				break;
+			}
+			if (req->argv[0].id == 0x21) {	/* by type and id */
+				if (req->argv[0].len < 12
+				    || (index = vh_find_resource(db, get_long(a + 2),
+					get_short(a + 6))) < 0) {
+					vh_error(res, dlpErrNotFound);
+					break;
+				}
+				vh_record_reply(res, db, index, get_short(a + 8),
+					get_short(a + 10));
+			} else {			/* by index */
+				index = get_short(a + 2);
+				if (index >= db->count) {
+					vh_error(res, dlpErrNotFound);
+					break;
+				}
+				vh_record_reply(res, db, index, get_short(a + 4),
+					get_short(a + 6));
+			}
+			break;
+
+		case dlpFuncWriteRecord:
+			if (resource || req->argv[0].len < 8)
+				vh_error(res, dlpErrParam);
+			else
+				vh_write_record(db, req, res);
+			break;
+		case dlpFuncWriteResource:
+			if (!resource || req->argv[0].len < 10)
+				vh_error(res, dlpErrParam);
+			else
+				vh_write_resource(db, req, res);
+			break;
+		case dlpFuncDeleteRecord:
+		case dlpFuncDeleteResource:
+			vh_delete_entries(db, req, res);
+			break;
+
+		case dlpFuncReadRecordIDList:
+			if (resource) {
+				vh_error(res, dlpErrNotSupp);
+				break;
+			}
+			index	= get_short(a + 2);
+			max	= get_short(a + 4);
+			if (index > db->count)
+				index = db->count;
+			if (max > db->count - index)
+				max = db->count - index;
+			if (max > (VH_MAX_REC_SIZE - 2) / 4)
+				max = (VH_MAX_REC_SIZE - 2) / 4;
+			if ((p = vh_arg(res, 2 + 4 * max)) == NULL) {
+				vh_error(res, dlpErrMemory);
+				break;
+			}
+			set_short(p, max);
+			for (i = 0; i < max; i++)
+				set_long(p + 2 + 4 * i, db->entries[index + i].uid);
+			break;
+
+		case dlpFuncReadNextModifiedRec:
+		case dlpFuncReadNextModifiedRecInCategory:
+			vh_next_modified(o, req, res);
+			break;
+		case dlpFuncResetRecordIndex:
+			o->next_modified = 0;
+			break;
+		case dlpFuncResetSyncFlags:
+			for (i = 0; i < db->count; i++)
+				db->entries[i].attr &= ~dlpRecAttrDirty;
+			db->info.backupDate = time(NULL);
+			break;
+		case dlpFuncCleanUpDatabase:
+			for (i = db->count - 1; i >= 0; i--)
+				if (db->entries[i].attr
+				    & (dlpRecAttrDeleted | dlpRecAttrArchived))
+					vh_db_remove(db, i);
+			break;
+	}
+}
+
+static void
+vh_request(vhandheld_t *vh, struct vh_request *req, pi_buffer_t *res)
+{
+	unsigned char *a = req->argc > 0 ? req->argv[0].data : NULL,
+		*p;
+	struct vh_db *db;
+	struct vh_open *o;
+	int	handle,
+		i;
+	size_t	len;
+	long	used;
+
+	vh_begin(res, req->cmd);
+
+	switch (req->cmd) {
+		case dlpFuncReadSysInfo:
+			p = vh_arg(res, 14);
+			memset(p, 0, 14);
+			set_long(p, 0x04003000);	/* Palm OS 4.0 */
+			set_byte(p + 9, 4);
+			memcpy(p + 10, "vhhd", 4);
+			p = vh_arg(res, 12);
+			set_short(p, 1);		/* DLP 1.2 */
+			set_short(p + 2, 2);
+			set_short(p + 4, 1);
+			set_short(p + 6, 0);
+			set_long(p + 8, VH_MAX_REC_SIZE);
+			break;
+
+		case dlpFuncReadUserInfo:
+			len = strlen(vh->user) + 1;
+			p = vh_arg(res, 30 + len);
+			set_long(p, vh->user_id);
+			set_long(p + 4, vh->viewer_id);
+			set_long(p + 8, vh->last_sync_pc);
+			dlp_htopdate(vh->last_sync, p + 12);
+			dlp_htopdate(vh->last_sync, p + 20);
+			set_byte(p + 28, len);
+			set_byte(p + 29, 0);		/* no password */
+			memcpy(p + 30, vh->user, len);
+			break;
+
+		case dlpFuncWriteUserInfo:
+			if (req->argc < 1 || req->argv[0].len < 22) {
+				vh_error(res, dlpErrParam);
+				break;
+			}
+			vh->user_id	= get_long(a);
+			vh->viewer_id	= get_long(a + 4);
+			vh->last_sync_pc = get_long(a + 8);
+			vh->last_sync	= dlp_ptohdate(a + 12);
+			len = get_byte(a + 21);
+			if (len > 0 && len < sizeof(vh->user)
+			    && 22 + len <= req->argv[0].len) {
+				memcpy(vh->user, a + 22, len);
+				vh->user[len] = '\0';
+			}
+			break;
+
+		case dlpFuncGetSysDateTime:
+			dlp_htopdate(time(NULL), vh_arg(res, 8));
+			break;
+
+		case dlpFuncReadStorageInfo:
+			if (req->argc < 1 || a[0] != 0) {
+				vh_error(res, dlpErrNotFound);
+				break;
+			}
+			for (used = 0, i = 0; i < vh->count; i++) {
+				db = vh->dbs[i];
+				used += db->app_info_size + db->sort_info_size;
+				for (handle = 0; handle < db->count; handle++)
+					used += db->entries[handle].size;
+			}
+			p = vh_arg(res, 30 + 16);
+			memset(p, 0, 30 + 16);
+			set_byte(p + 3, 1);			/* cards */
+			set_byte(p + 4, 30 + 16);
+			set_byte(p + 6, 1);			/* version */
+			dlp_htopdate(time(NULL), p + 8);
+			set_long(p + 16, 0x400000);		/* ROM */
+			set_long(p + 20, 0x1000000);		/* RAM */
+			set_long(p + 24, 0x1000000 - used);	/* free */
+			set_byte(p + 28, 7);
+			set_byte(p + 29, 9);
+			memcpy(p + 30, "Virtual", 7);
+			memcpy(p + 37, "pilot-lnk", 9);
+			break;
+
+		case dlpFuncReadDBList:
+			if (req->argc < 1 || req->argv[0].len < 4)
+				vh_error(res, dlpErrParam);
+			else
+				vh_read_db_list(vh, req, res);
+			break;
+
+		case dlpFuncFindDB:
+			if (req->argc < 1 || req->argv[0].len < 2)
+				vh_error(res, dlpErrParam);
+			else
+				vh_find_db_reply(vh, req, res);
+			break;
+
+		case dlpFuncOpenDB:
+			if (req->argc < 1 || req->argv[0].len < 3) {
+				vh_error(res, dlpErrParam);
+				break;
+			}
+			if ((db = vh_find_db(vh, (char *)a + 2)) == NULL)
+				vh_error(res, dlpErrNotFound);
+			else if ((handle = vh_open_db(vh, db)) < 0)
+				vh_error(res, dlpErrLimit);
+			else
+				set_byte(vh_arg(res, 1), handle);
+			break;
+
+		case dlpFuncCreateDB:
+			if (req->argc < 1 || req->argv[0].len < 15)
+				vh_error(res, dlpErrParam);
+			else
+				vh_create_db(vh, req, res);
+			break;
+
+		case dlpFuncCloseDB:
+			if (req->argc > 0 && req->argv[0].id == 0x21) {
+				memset(vh->open, 0, sizeof(vh->open));
+				break;
+			}
+			if (req->argc < 1 || (o = vh_handle(vh, a[0])) == NULL) {
+				vh_error(res, dlpErrNoneOpen);
+				break;
+			}
+			if (o->changed)
+				o->db->info.modnum++;
+			o->db = NULL;
+			break;
+
+		case dlpFuncDeleteDB:
+			if (req->argc < 1 || req->argv[0].len < 3) {
+				vh_error(res, dlpErrParam);
+				break;
+			}
+			if ((db = vh_find_db(vh, (char *)a + 2)) == NULL)
+				vh_error(res, dlpErrNotFound);
+			else
+				vh_delete_db(vh, db);
+			break;
+
+		case dlpFuncReadOpenDBInfo:
+		case dlpFuncReadAppBlock:
+		case dlpFuncReadSortBlock:
+		case dlpFuncWriteAppBlock:
+		case dlpFuncWriteSortBlock:
+		case dlpFuncReadRecord:
+		case dlpFuncReadResource:
+		case dlpFuncWriteRecord:
+		case dlpFuncWriteResource:
+		case dlpFuncDeleteRecord:
+		case dlpFuncDeleteResource:
+		case dlpFuncReadRecordIDList:
+		case dlpFuncReadNextModifiedRec:
+		case dlpFuncReadNextModifiedRecInCategory:
+		case dlpFuncResetRecordIndex:
+		case dlpFuncResetSyncFlags:
+		case dlpFuncCleanUpDatabase:
+			if (req->argc < 1 || req->argv[0].len < 1
+			    || ((req->cmd == dlpFuncReadRecord
+				 || req->cmd == dlpFuncReadResource)
+				&& req->argv[0].len < 8)
+			    || ((req->cmd == dlpFuncReadAppBlock
+				 || req->cmd == dlpFuncReadSortBlock
+				 || req->cmd == dlpFuncReadRecordIDList
+				 || req->cmd == dlpFuncDeleteRecord)
+				&& req->argv[0].len < 6)
+			    || (req->cmd == dlpFuncDeleteResource
+				&& req->argv[0].len < 8)
+			    || ((req->cmd == dlpFuncWriteAppBlock
+				 || req->cmd == dlpFuncWriteSortBlock)
+				&& req->argv[0].len < 4))
+				vh_error(res, dlpErrParam);
+			else
+				vh_db_request(vh, req, res);
+			break;
+
+		case dlpFuncOpenConduit:
+		case dlpFuncEndOfSync:
+		case dlpFuncAddSyncLogEntry:
+		case dlpFuncResetSystem:
+		case dlpFuncSetSysDateTime:
+			break;
+
+		default:
+			vh_error(res, dlpErrNotSupp);
+			break;
+	}
+}
+
+
+/* Public functions */
+
+vhandheld_t *
+vh_new(const char *dir)
+{
+	vhandheld_t *vh;
+	DIR	*d;
+	struct dirent *entry;
+	struct vh_db *db;
+	char	*path;
+	size_t	len;
+
+	if ((d = opendir(dir)) == NULL)
+		return NULL;
+	if ((vh = calloc(1, sizeof(vhandheld_t))) == NULL) {
+		closedir(d);
+		return NULL;
+	}
+	strcpy(vh->user, "Virtual");
+	vh->user_id	= 1;
+
+	while ((entry = readdir(d)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len < 4 || (strcasecmp(entry->d_name + len - 4, ".pdb")
+				&& strcasecmp(entry->d_name + len - 4, ".prc")
+				&& strcasecmp(entry->d_name + len - 4, ".pqa")))
+			continue;
+
+		path = malloc(strlen(dir) + len + 2);
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		db = vh_db_load(path);
+		if (db == NULL)
+			fprintf(stderr, "vhandheld: unable to load %s\n", path);
+		else if (vh_find_db(vh, db->info.name) != NULL)
+			vh_db_free(db);		/* same database twice */
+		else if (vh_add_db(vh, db) < 0)
+			vh_db_free(db);
+		free(path);
+	}
+	closedir(d);
+
+	return vh;
+}
+
+void
+vh_free(vhandheld_t *vh)
+{
+	while (vh->count > 0)
+		vh_delete_db(vh, vh->dbs[vh->count - 1]);
+	free(vh->dbs);
+	free(vh);
+}
+
+void
+vh_set_user(vhandheld_t *vh, const char *name)
+{
+	strncpy(vh->user, name, sizeof(vh->user) - 1);
+}
+
+int
+vh_databases(vhandheld_t *vh)
+{
+	return vh->count;
+}
+
+long
+vh_bytes(vhandheld_t *vh)
+{
+	long	bytes = 0;
+	int	i,
+		j;
+
+	for (i = 0; i < vh->count; i++)
+		for (j = 0; j < vh->dbs[i]->count; j++)
+			bytes += vh->dbs[i]->entries[j].size;
+	return bytes;
+}
+
+int
+vh_connect(const char *port)
+{
+	int	sd,
+		result,
+		split = 0,
+		honor = 0;
+	size_t	size;
+
+	/* a device talks NetSync: no DLP layer on its side */
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_NET);
+	if (sd < 0)
+		return sd;
+	if ((result = pi_connect(sd, port)) < 0) {
+		pi_close(sd);
+		return result;
+	}
+
+	/* like the desktop side, send each packet in one write, and wait
+	   for the desktop as long as it takes */
+	size = sizeof(split);
+	pi_setsockopt(sd, PI_LEVEL_NET, PI_NET_SPLIT_WRITES, &split, &size);
+	size = sizeof(honor);
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_HONOR_RX_TIMEOUT, &honor,
+		&size);
+
+	return sd;
+}
+
+int
+vh_serve(vhandheld_t *vh, int sd)
+{
+	pi_buffer_t *request,
+		*response;
+	struct vh_request req;
+	int	count = 0,
+		result = 0,
+		state = PI_SOCK_CONN_END;
+	size_t	size;
+
+	request		= pi_buffer_new(VH_BUF_SIZE);
+	response	= pi_buffer_new(VH_BUF_SIZE);
+
+	for (;;) {
+		request->used = 0;
+		if ((result = pi_read(sd, request, VH_BUF_SIZE)) < 0)
+			break;
+		if (vh_parse(request, &req) < 0) {
+			if (request->used < 1)
+				continue;
+			req.cmd		= request->data[0];
+			req.argc	= 0;
+			vh_begin(response, req.cmd);
+			vh_error(response, dlpErrParam);
+		} else {
+			vh_request(vh, &req, response);
+		}
+
+		if ((result = pi_write(sd, response->data, response->used)) < 0)
+			break;
+		count++;
+		if (req.cmd == dlpFuncEndOfSync) {
+			result = 0;
+			break;
+		}
+	}
+
+	/* the desktop ended the sync: don't end it again */
+	size = sizeof(state);
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_STATE, &state, &size);
+	pi_close(sd);
+
+	pi_buffer_free(request);
+	pi_buffer_free(response);
+
+	/* hanging up without an EndOfSync is fine, errors are not */
+	if (result < 0 && result != PI_ERR_SOCK_DISCONNECTED)
+		return result;
+	return count;
+}
+
+
+/* What the tests share */
+
+int vh_failures = 0;
+
+void
+vh_fill(unsigned char *data, size_t size, int seed)
+{
+	size_t	i;
+
+	for (i = 0; i < size; i++)
+		data[i] = (unsigned char)(seed * 31 + i * 7);
+	if (size >= 4)
+		set_long(data, seed);
+}
+
+pi_file_t *
+vh_make_db(const char *path, const char *name, unsigned long creator,
+	int resource)
+{
+	struct DBInfo info;
+	pi_file_t *pf;
+	unsigned char app_info[64];
+
+	memset(&info, 0, sizeof(info));
+	strncpy(info.name, name, sizeof(info.name) - 1);
+	info.flags	= dlpDBFlagBackup | (resource ? dlpDBFlagResource : 0);
+	info.type	= resource ? pi_mktag('a', 'p', 'p', 'l')
+		: pi_mktag('D', 'A', 'T', 'A');
+	info.creator	= creator;
+	info.createDate	= info.modifyDate = 1000000000;
+
+	pf = pi_file_create(path, &info);
+	CHECK(pf != NULL);
+	if (pf == NULL)
+		return NULL;
+
+	memset(app_info, 'a', sizeof(app_info));
+	pi_file_set_app_info(pf, app_info, sizeof(app_info));
+	return pf;
+}
+
+void
+vh_add_record(pi_file_t *pf, int seed, size_t size, int category,
+	recordid_t uid)
+{
+	unsigned char *data = malloc(size);
+
+	vh_fill(data, size, seed);
+	CHECK(pi_file_append_record(pf, data, size, 0, category, uid) >= 0);
+	free(data);
+}
+
+void
+vh_add_resource(pi_file_t *pf, int seed, size_t size, int id)
+{
+	unsigned char *data = malloc(size);
+
+	vh_fill(data, size, seed);
+	CHECK(pi_file_append_resource(pf, data, size,
+		pi_mktag('c', 'o', 'd', 'e'), id) >= 0);
+	free(data);
+}
+
+#if HAVE_PTHREAD
+static void *
+vh_device_thread(void *userdata)
+{
+	struct vh_device *dev = (struct vh_device *)userdata;
+	int	sd;
+
+	if ((sd = vh_connect(dev->port)) < 0)
+		dev->result = sd;
+	else
+		dev->result = vh_serve(dev->vh, sd);
+	return NULL;
+}
+
+int
+vh_start(struct vh_device *dev, vhandheld_t *vh, const char *port)
+{
+	struct SysInfo sys;
+	int	sd;
+
+	dev->vh		= vh;
+	dev->port	= port;
+	dev->result	= 0;
+
+	dev->listener = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_DLP);
+	if (dev->listener < 0 || pi_bind(dev->listener, port) < 0
+	    || pi_listen(dev->listener, 1) < 0) {
+		fprintf(stderr, "unable to listen on %s\n", port);
+		if (dev->listener >= 0)
+			pi_close(dev->listener);
+		return PI_ERR_SOCK_LISTENER;
+	}
+	pthread_create(&dev->thread, NULL, vh_device_thread, dev);
+	if ((sd = pi_accept(dev->listener, NULL, NULL)) < 0
+	    || dlp_ReadSysInfo(sd, &sys) < 0) {
+		fprintf(stderr, "unable to start the sync\n");
+		if (sd >= 0)
+			pi_close(sd);
+		pi_close(dev->listener);
+		return PI_ERR_SOCK_DISCONNECTED;
+	}
+	return sd;
+}
+
+int
+vh_finish(struct vh_device *dev, int sd)
+{
+	dlp_EndOfSync(sd, dlpEndCodeNormal);
+	pi_close(sd);
+	pthread_join(dev->thread, NULL);
+	pi_close(dev->listener);
+	return dev->result;
+}
+#endif
@@ -0,0 +1,122 @@
+/*
+ * vhandheld.h:  Virtual handheld for tests and benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * A virtual handheld holds the databases of a directory of .pdb, .prc
+ * and .pqa files in memory and answers the DLP requests of a desktop
+ * about them: the database list, user and system information, and
+ * reading, writing, creating and deleting databases, records and
+ * resources. Changes only live in memory.
+ *
+ * It reports DLP 1.2 and speaks NetSync: libpisock only implements the
+ * desktop side of PADP.
+ */
+
+#ifndef _VHANDHELD_H_
+#define _VHANDHELD_H_
+
+#include <stdio.h>
+
+#include "pi-file.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+typedef struct vhandheld vhandheld_t;
+
+/* Load every database of a directory; NULL if it can't be read */
+extern vhandheld_t *vh_new(const char *dir);
+extern void vh_free(vhandheld_t *vh);
+
+/* Name of the user reported to the desktop (default "Virtual") */
+extern void vh_set_user(vhandheld_t *vh, const char *name);
+
+/* Connect a socket to a desktop listening on a port, as a device does */
+extern int vh_connect(const char *port);
+
+/* Answer requests on a connected socket until the desktop ends the
+   sync or hangs up, then close the socket. Returns the number of
+   requests answered, or a negative error code. */
+extern int vh_serve(vhandheld_t *vh, int sd);
+
+/* Number of databases, and bytes of record and resource data they hold */
+extern int vh_databases(vhandheld_t *vh);
+extern long vh_bytes(vhandheld_t *vh);
+
+
+/* What the tests share */
+
+/* Number of failed CHECK()s; a test returns 1 if there were any */
+extern int vh_failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			vh_failures++; \
+		} \
+	} while (0)
+
+/* Fill size bytes of record data, the first four being the seed, so
+   that entries made from different seeds differ */
+extern void vh_fill(unsigned char *data, size_t size, int seed);
+
+/* Create a database file to backup, resource or record database, with
+   64 bytes of appInfo block and dates of 1000000000; NULL if it can't */
+extern pi_file_t *vh_make_db(const char *path, const char *name,
+	unsigned long creator, int resource);
+
+/* Append a record or a resource of size bytes filled from a seed */
+extern void vh_add_record(pi_file_t *pf, int seed, size_t size,
+	int category, recordid_t uid);
+extern void vh_add_resource(pi_file_t *pf, int seed, size_t size, int id);
+
+#if HAVE_PTHREAD
+
+/* A virtual handheld syncing with the test from a thread of its own */
+struct vh_device {
+	vhandheld_t *vh;
+	const char *port;
+	int	listener,
+		result;			/* of vh_serve() */
+	pthread_t thread;
+};
+
+/* Listen on a port, connect the handheld to it and start the sync.
+   Returns the desktop's socket, or a negative error code */
+extern int vh_start(struct vh_device *dev, vhandheld_t *vh,
+	const char *port);
+
+/* End the sync, and wait for the handheld to hang up. Returns what
+   vh_serve() did */
+extern int vh_finish(struct vh_device *dev, int sd);
+
+#else
+
+/* main() of a test that needs threads, in a build without them */
+#define VH_MAIN_WITHOUT_THREADS(test) \
+	int main(int argc, char *argv[]) \
+	{ \
+		fprintf(stderr, "%s: libpisock was built without threads\n", \
+			test); \
+		return 77; \
+	}
+
+#endif
+
+#endif
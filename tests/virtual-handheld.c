@@ -0,0 +1,92 @@
+/*
+ * virtual-handheld.c:  Sync a directory of databases as a handheld would
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Loads the databases of a directory into a virtual handheld and syncs
+ * once with a desktop program waiting for NetSync connections, such as
+ * "pilot-xfer -p net:any". The port defaults to $PILOTPORT, or to
+ * net:127.0.0.1 if it is not set.
+ *
+ * Usage: virtual-handheld [-p port] [-u user] dir
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "vhandheld.h"
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-p port] [-u user] dir\n", progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	vhandheld_t *vh;
+	const char *port = getenv("PILOTPORT"),
+		*user = NULL,
+		*dir = NULL;
+	int	sd,
+		result,
+		i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-p") && i + 1 < argc)
+			port = argv[++i];
+		else if (!strcmp(argv[i], "-u") && i + 1 < argc)
+			user = argv[++i];
+		else if (argv[i][0] == '-' || dir != NULL)
+			usage(argv[0]);
+		else
+			dir = argv[i];
+	}
+	if (dir == NULL)
+		usage(argv[0]);
+	if (port == NULL)
+		port = "net:127.0.0.1";
+
+	if ((vh = vh_new(dir)) == NULL) {
+		fprintf(stderr, "unable to read %s\n", dir);
+		return 1;
+	}
+	if (user != NULL)
+		vh_set_user(vh, user);
+	printf("%d databases, %ld bytes of records and resources\n",
+		vh_databases(vh), vh_bytes(vh));
+
+	if ((sd = vh_connect(port)) < 0) {
+		fprintf(stderr, "unable to connect to %s\n", port);
+		vh_free(vh);
+		return 1;
+	}
+	result = vh_serve(vh, sd);
+	if (result < 0)
+		fprintf(stderr, "sync failed: error %d\n", result);
+	else
+		printf("%d requests answered\n", result);
+	vh_free(vh);
+
+	return result < 0 ? 1 : 0;
+}
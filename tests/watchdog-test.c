@@ -0,0 +1,268 @@
+/*
+ * watchdog-test.c:  Check the watchdog thread of pi_watchdog()
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ *
+ * Watches NetSync sockets over the loopback device. Their other ends are
+ * raw, so the test sees every byte, tickles included: it answers the
+ * NetSync handshake itself, then checks that an idle watched socket gets
+ * tickled, and that while a pi_recv() blocks on one socket and a
+ * pi_close() of that socket waits for it, the other sockets are still
+ * tickled and can be closed. Last, checks that a socket whose sync is
+ * over doesn't keep the watchdog busy. An alarm fails the test if
+ * anything hangs.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pi-source.h"
+#include "pi-socket.h"
+#include "pi-net.h"
+#include "pi-macros.h"
+#include "pi-util.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+
+#define PORT	"loop:watchdog-test"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* A watched NetSync socket and the raw socket at its other end */
+struct pair {
+	int	sd,
+		raw;
+};
+
+static void *
+connect_thread(void *arg)
+{
+	int	*sd = (int *)arg,
+		honor = 0;
+	size_t	size;
+
+	*sd = pi_socket(PI_AF_PILOT, PI_SOCK_STREAM, PI_PF_NET);
+	if (*sd >= 0 && pi_connect(*sd, PORT) < 0) {
+		pi_close(*sd);
+		*sd = -1;
+	}
+	if (*sd >= 0) {
+		/* a pi_recv() blocks until something comes */
+		size = sizeof(honor);
+		pi_setsockopt(*sd, PI_LEVEL_SOCK, PI_SOCK_HONOR_RX_TIMEOUT,
+			&honor, &size);
+	}
+	return NULL;
+}
+
+/* Reads exactly len bytes from a raw socket */
+static int
+read_raw(int sd, unsigned char *data, size_t len)
+{
+	pi_buffer_t *buf = pi_buffer_new(len);
+	int	result;
+
+	while (buf->used < len) {
+		result = pi_read(sd, buf, len - buf->used);
+		if (result <= 0)
+			break;
+	}
+	result = buf->used == len ? 0 : -1;
+	if (result == 0 && data != NULL)
+		memcpy(data, buf->data, len);
+	pi_buffer_free(buf);
+	return result;
+}
+
+/* Writes a NetSync data packet with len bytes of zeros */
+static int
+write_packet(int sd, size_t len)
+{
+	unsigned char packet[6 + 64];
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = PI_NET_TYPE_DATA;
+	packet[1] = 1;
+	set_long(&packet[2], len);
+	return pi_write(sd, packet, 6 + len) == (int)(6 + len) ? 0 : -1;
+}
+
+/* Reads a packet and checks that it is a tickle */
+static int
+read_tickle(int sd)
+{
+	unsigned char header[6];
+
+	if (read_raw(sd, header, 6) < 0)
+		return 0;
+	return header[0] == PI_NET_TYPE_TCKL && header[1] == 0xff
+		&& get_long(&header[2]) == 0;
+}
+
+/* Connects a pair, doing the device's side of the NetSync handshake
+   (see net_tx_handshake() and net_rx_handshake()) on the raw end */
+static int
+open_pair(int lsd, struct pair *p)
+{
+	pthread_t thread;
+
+	p->sd = -1;
+	pthread_create(&thread, NULL, connect_thread, &p->sd);
+	p->raw = pi_accept_session(lsd, NULL, NULL, 0);
+	if (p->raw < 0
+	    || read_raw(p->raw, NULL, 6 + 22) < 0
+	    || write_packet(p->raw, 50) < 0
+	    || read_raw(p->raw, NULL, 6 + 50) < 0
+	    || write_packet(p->raw, 46) < 0
+	    || read_raw(p->raw, NULL, 6 + 8) < 0)
+		return -1;
+	pthread_join(thread, NULL);
+
+	return p->sd >= 0 && pi_watchdog(p->sd, 1) == 0 ? 0 : -1;
+}
+
+/* What dlp_EndOfSync() leaves a socket in; there is no DLP on the
+   other end to end the sync with */
+static void
+end_sync(int sd)
+{
+	int	state = PI_SOCK_CONN_END;
+	size_t	size = sizeof(state);
+
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_STATE, &state, &size);
+}
+
+static int
+close_watched(int sd)
+{
+	end_sync(sd);
+	return pi_close(sd);
+}
+
+static void *
+recv_thread(void *arg)
+{
+	pi_buffer_t *buf = pi_buffer_new(64);
+	int	*sd = (int *)arg;
+
+	*sd = pi_recv(*sd, buf, 64, 0);
+	pi_buffer_free(buf);
+	return NULL;
+}
+
+static void *
+close_thread(void *arg)
+{
+	int	*sd = (int *)arg;
+
+	*sd = close_watched(*sd);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct pair a,
+		b,
+		c;
+	pthread_t receiver,
+		closer;
+	clock_t	cpu;
+	long	start;
+	int	lsd,
+		received,
+		closed;
+
+	/* whatever hangs kills the test */
+	alarm(30);
+
+	lsd = pi_socket(PI_AF_PILOT, PI_SOCK_RAW, PI_PF_DEV);
+	if (lsd < 0 || pi_bind(lsd, PORT) < 0 || pi_listen(lsd, 2) < 0) {
+		fprintf(stderr, "watchdog-test: unable to listen on %s\n", PORT);
+		return 1;
+	}
+	if (open_pair(lsd, &a) < 0 || open_pair(lsd, &b) < 0) {
+		fprintf(stderr, "watchdog-test: unable to connect\n");
+		return 1;
+	}
+
+	/* an idle socket is tickled once its interval is over */
+	start = pi_clock_ms();
+	CHECK(read_tickle(a.raw));
+	CHECK(pi_clock_ms() - start >= 500);
+	CHECK(read_tickle(b.raw));
+
+	/* a pi_recv() blocks on a, and a pi_close() of a waits for it */
+	received = a.sd;
+	pthread_create(&receiver, NULL, recv_thread, &received);
+	usleep(200000);
+	closed = a.sd;
+	pthread_create(&closer, NULL, close_thread, &closed);
+	usleep(200000);
+
+	/* meanwhile b is still tickled, and can be closed */
+	CHECK(read_tickle(b.raw));
+	CHECK(read_tickle(b.raw));
+	CHECK(close_watched(b.sd) == 0);
+
+	/* once something comes, the pi_recv() and the pi_close() return */
+	CHECK(write_packet(a.raw, 1) == 0);
+	pthread_join(receiver, NULL);
+	pthread_join(closer, NULL);
+	CHECK(received == 1);
+	CHECK(closed == 0);
+
+	/* a watched socket whose sync is over isn't tickled, and the
+	   watchdog doesn't spin until it is closed */
+	CHECK(open_pair(lsd, &c) == 0);
+	end_sync(c.sd);
+	cpu = clock();
+	sleep(3);
+	CHECK(clock() - cpu < CLOCKS_PER_SEC / 2);
+	CHECK(pi_close(c.sd) == 0);
+	CHECK(read_raw(c.raw, NULL, 6) < 0);
+
+	pi_close(a.raw);
+	pi_close(b.raw);
+	pi_close(c.raw);
+	pi_close(lsd);
+
+	return failures ? 1 : 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+	return 77;
+}
+
+#endif